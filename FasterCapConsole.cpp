@@ -92,10 +92,10 @@ int FasterCapConsole::main(int& argc, wxChar **argv, char bOption)
 			// print error
 			ErrMsg((const char*)errMsg);
 			LogMsg("Usage: %s <input file> [-a<relative error>] [-ap]\n", (const char*)argv[0]);
-			LogMsg("                 [-m<mesh>] [-mc<mesh curvature] [-t<tolerance>]\n");
-			LogMsg("                 [-d<interaction coeff>] [-f<outofcore>] [-g]\n");
-			LogMsg("                 [-pj] [-ps<dimension>] [-o] [-r] [-c] [-i] [-v]\n");
-			LogMsg("                 [-b|-b?|-bv]\n");
+			LogMsg("                 [-m<mesh>] [-mc<mesh curvature] [-t<tolerance>] [-tb<block size>] [-tc<solves>]\n");
+			LogMsg("                 [-d<interaction coeff>] [-f<outofcore>] [-fm] [-fz] [-fb<Mbytes>] [-g]\n");
+			LogMsg("                 [-pj] [-ps<dimension>] [-o] [-r] [-c] [-i] [-v] [-lf] [-lm] [-ls]\n");
+			LogMsg("                 [-tr<vectors>] [-tm<basis size>] [-ts] [-kl<cache dir>] [-b|-b?|-bv]\n");
 			LogMsg("DEFAULT VALUES:\n");
 			LogMsg("  -a:  Automatically calculate settings, stop when\n");
 			LogMsg("       relative error is lower than <relative error>, e.g. 0.01\n");
@@ -103,11 +103,25 @@ int FasterCapConsole::main(int& argc, wxChar **argv, char bOption)
 			LogMsg("  -m:  Mesh relative refinement value = %g\n", defGlobalVars.m_dMeshEps);
 			LogMsg("  -mc: Mesh curvature coefficient = %g\n", defGlobalVars.m_dMeshCurvCoeff);
 			LogMsg("  -t:  GMRES iteration tolerance = %g\n", defGlobalVars.m_dGmresTol);
+			LogMsg("  -tb: Number of conductors solved together by block GMRES = %d\n", defGlobalVars.m_uiGmresBlockSize);
+			LogMsg("  -tc: Number of conductors solved concurrently (in-core only) = %d\n", defGlobalVars.m_uiConcurrentSolves);
+			LogMsg("  -tr: Number of GMRES vectors recycled across conductors = %d\n", defGlobalVars.m_uiGmresRecycleNum);
+			LogMsg("  -tm: GMRES restart size, i.e. max Krylov vectors in memory (0 = no restart) = %d\n", defGlobalVars.m_uiGmresRestart);
 			LogMsg("  -d:  Direct potential interaction coefficient to mesh refinement ratio = %g\n", defGlobalVars.m_dEpsRatio);
 			LogMsg("  -f:  Out-Of-Core free memory to link memory condition = %g\n", defGlobalVars.m_dOutOfCoreRatio);
+			LogMsg("  -fm: Memory-map the Out-Of-Core link files (not available on Windows)\n");
+			LogMsg("  -fz: Compress the Out-Of-Core link files (less disk I/O)\n");
+			LogMsg("  -fb: Memory budget in Mbytes for panels, links and solver, instead of the free memory\n");
 			LogMsg("  -g:  Use Galerkin scheme\n");
 			LogMsg("  -pj: Use Jacobi Preconditioner\n");
 			LogMsg("  -ps: Use two-levels preconditioner with dimension = %d\n", defGlobalVars.m_uiSuperPreDim);
+			LogMsg("  -pa: Use sparse approximate inverse preconditioner with row dimension = %d\n", defGlobalVars.m_uiSpaiSize);
+			LogMsg("  -pm: Use multigrid preconditioner on the panel trees with max levels = %d\n", defGlobalVars.m_uiMgLevels);
+			LogMsg("       (block smoother dimension = %d, coarse level dimension = %d, set by -pb and -ps)\n", defGlobalVars.m_uiBlockPreSize, defGlobalVars.m_uiSuperPreDim);
+			LogMsg("  -ph: Use hierarchical preconditioner, solving a coarser mesh by inner GMRES\n");
+			LogMsg("  -phs: Hierarchical preconditioner mesh max discretization side = %g\n", defGlobalVars.m_dMaxHierPreDiscSide);
+			LogMsg("  -phe: Hierarchical preconditioner direct potential interaction coefficient (0 = ten times -d)\n");
+			LogMsg("  -pht: Hierarchical preconditioner inner GMRES tolerance = %g\n", defGlobalVars.m_dHierPreGmresTol);
 			LogMsg("OPTIONS:\n");
 			LogMsg("  -o:  Output refined geometry in FastCap2 format\n");
 			LogMsg("  -oi: Dump input geometry in FasterCap format and stop\n");
@@ -116,6 +130,11 @@ int FasterCapConsole::main(int& argc, wxChar **argv, char bOption)
 			LogMsg("  -c:  Dump charge densities in output file\n");
 			LogMsg("  -i:  Dump detailed time and memory information\n");
 			LogMsg("  -v:  Verbose output\n");
+			LogMsg("  -ts: Iterate on single precision coefficients, refining the solution in double precision (in-core only)\n");
+			LogMsg("  -lf: Store the interaction coefficients in single precision (less link memory)\n");
+			LogMsg("  -lm: Compute the far-field interaction coefficients on the fly (3D only, less link memory)\n");
+			LogMsg("  -ls: Store the symmetric interaction coefficients only once (3D Galerkin only, less link memory)\n");
+			LogMsg("  -kl: Keep the interaction coefficients in <cache dir> and reuse them in the next runs (in-core only)\n");
 			LogMsg("  -b:  Launch as console/shell application without GUI\n");
 			LogMsg("  -b?: Print console usage (this text)\n");
 			LogMsg("  -bv: Print only the version\n");
@@ -198,8 +217,23 @@ bool FasterCapConsole::ParseCmdLine(const char *commandStr, CAutoRefGlobalVars &
 			}
 
 			// '-f' is Out-Of-Core free memory to link memory condition (0 = don't go OOC)
+			// '-fm' is memory-map the out-of-core link files
+			// '-fz' is compress the out-of-core link files
+			// '-fb' is the memory budget, in Mbytes
 			else if(argStr[1] == 'f') {
-				if(sscanf(&(argStr[2]), "%lf", &(globalVars.m_dOutOfCoreRatio)) != 1) {
+				if(argStr[2] == 'm') {
+					globalVars.m_bMmapLinks = true;
+				}
+				else if(argStr[2] == 'z') {
+					globalVars.m_bCompressLinks = true;
+				}
+				else if(argStr[2] == 'b') {
+					if(sscanf(&(argStr[3]), "%lf", &(globalVars.m_dMemBudget)) != 1 || globalVars.m_dMemBudget <= 0.0) {
+						cmderr = true;
+						errMsg = wxString::Format(wxT("%s: bad memory budget '%s'\n"), commandStr, &argStr[3]);
+					}
+				}
+				else if(sscanf(&(argStr[2]), "%lf", &(globalVars.m_dOutOfCoreRatio)) != 1) {
 					cmderr = true;
 					errMsg = wxString::Format(wxT("%s: Out-Of-Core free memory to link memory condition '%s'\n"), commandStr, &argStr[2]);
 				}
@@ -227,6 +261,20 @@ bool FasterCapConsole::ParseCmdLine(const char *commandStr, CAutoRefGlobalVars &
 						errMsg = wxString::Format(wxT("%s: bad preconditioner dimension '%s'\n"), commandStr, &argStr[3]);
 					}
 				}
+				else if (argStr[2] == 'A' || argStr[2] == 'a') {
+					globalVars.m_ucPrecondType |= AUTOREFINE_PRECOND_SPAI;
+					if(sscanf(&(argStr[3]), "%u", &(globalVars.m_uiSpaiSize)) != 1) {
+						cmderr = true;
+						errMsg = wxString::Format(wxT("%s: bad preconditioner dimension '%s'\n"), commandStr, &argStr[3]);
+					}
+				}
+				else if (argStr[2] == 'M' || argStr[2] == 'm') {
+					globalVars.m_ucPrecondType |= AUTOREFINE_PRECOND_MG;
+					if(sscanf(&(argStr[3]), "%u", &(globalVars.m_uiMgLevels)) != 1) {
+						cmderr = true;
+						errMsg = wxString::Format(wxT("%s: bad preconditioner number of levels '%s'\n"), commandStr, &argStr[3]);
+					}
+				}
 				else if (argStr[2] == 'H' || argStr[2] == 'h') {
 					globalVars.m_ucPrecondType |= AUTOREFINE_PRECOND_HIER;
 					if (argStr[3] == 's') {
@@ -241,7 +289,7 @@ bool FasterCapConsole::ParseCmdLine(const char *commandStr, CAutoRefGlobalVars &
 							errMsg = wxString::Format(wxT("%s: bad preconditioner mutual potential epsilon value  '%s'\n"), commandStr, &argStr[4]);
 						}
 					}
-					else if(argStr[1] == 't') {
+					else if(argStr[3] == 't') {
 						if(sscanf(&(argStr[4]), "%lf", &(globalVars.m_dHierPreGmresTol)) != 1) {
 							cmderr = true;
 							errMsg = wxString::Format(wxT("%s: bad preconditioner GMRES tolerance value '%s'\n"), commandStr, &argStr[4]);
@@ -264,6 +312,11 @@ bool FasterCapConsole::ParseCmdLine(const char *commandStr, CAutoRefGlobalVars &
 				if(argStr[2] == 'c') {
 					globalVars.m_bKeepCharge = true;
 				}
+				// '-kl' is keep the links across runs, in the given cache directory
+				else if(argStr[2] == 'l') {
+					globalVars.m_bLinkCache = true;
+					globalVars.m_sLinkCacheDir = &(argStr[3]);
+				}
 			}
 
 			// '-s' is refine mesh using calculated charges
@@ -294,8 +347,40 @@ bool FasterCapConsole::ParseCmdLine(const char *commandStr, CAutoRefGlobalVars &
 			}
 
 			// '-t' is GMRES tolerance to stop iteration
+			// '-tb' is the number of conductor excitations solved together by block GMRES
+			// '-tc' is the number of conductor excitations solved concurrently
+			// '-tr' is the number of vectors recycled from one conductor solve to the next
+			// '-tm' is the GMRES restart size
+			// '-ts' is mixed precision solve
 			else if(argStr[1] == 't') {
-				if(sscanf(&(argStr[2]), "%lf", &(globalVars.m_dGmresTol)) != 1) {
+				if(argStr[2] == 'b') {
+					if(sscanf(&(argStr[3]), "%u", &(globalVars.m_uiGmresBlockSize)) != 1 || globalVars.m_uiGmresBlockSize < 1) {
+						cmderr = true;
+						errMsg = wxString::Format(wxT("%s: bad GMRES block size '%s'\n"), commandStr, &argStr[3]);
+					}
+				}
+				else if(argStr[2] == 'c') {
+					if(sscanf(&(argStr[3]), "%u", &(globalVars.m_uiConcurrentSolves)) != 1 || globalVars.m_uiConcurrentSolves < 1) {
+						cmderr = true;
+						errMsg = wxString::Format(wxT("%s: bad number of concurrent solves '%s'\n"), commandStr, &argStr[3]);
+					}
+				}
+				else if(argStr[2] == 'r') {
+					if(sscanf(&(argStr[3]), "%u", &(globalVars.m_uiGmresRecycleNum)) != 1) {
+						cmderr = true;
+						errMsg = wxString::Format(wxT("%s: bad number of GMRES recycled vectors '%s'\n"), commandStr, &argStr[3]);
+					}
+				}
+				else if(argStr[2] == 'm') {
+					if(sscanf(&(argStr[3]), "%u", &(globalVars.m_uiGmresRestart)) != 1) {
+						cmderr = true;
+						errMsg = wxString::Format(wxT("%s: bad GMRES restart size '%s'\n"), commandStr, &argStr[3]);
+					}
+				}
+				else if(argStr[2] == 's') {
+					globalVars.m_bMixedPrecision = true;
+				}
+				else if(sscanf(&(argStr[2]), "%lf", &(globalVars.m_dGmresTol)) != 1) {
 					cmderr = true;
 					errMsg = wxString::Format(wxT("%s: bad GMRES iteration tolerance '%s'\n"), commandStr, &argStr[2]);
 				}
@@ -313,6 +398,25 @@ bool FasterCapConsole::ParseCmdLine(const char *commandStr, CAutoRefGlobalVars &
 				}
 			}
 
+			// '-lf' is store the link coefficients of potential in single precision
+			// '-lm' is matrix-free far-field links (coefficients computed on the fly)
+			// '-ls' is symmetric links (Galerkin only, each conductor link is stored once)
+			else if(argStr[1] == 'l') {
+				if(argStr[2] == 'f') {
+					globalVars.m_bFloatLinks = true;
+				}
+				else if(argStr[2] == 'm') {
+					globalVars.m_bFarLinks = true;
+				}
+				else if(argStr[2] == 's') {
+					globalVars.m_bSymLinks = true;
+				}
+				else {
+					cmderr = true;
+					errMsg = wxString::Format(wxT("%s: bad link storage option '%s'\n"), commandStr, &argStr[1]);
+				}
+			}
+
 			// '-e' is output capacitance matrix to file
 			else if(argStr[1] == 'e') {
 				globalVars.m_bOutputCapMtx = true;
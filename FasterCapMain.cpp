@@ -549,6 +549,7 @@ void FasterCapFrame::OnMenuRun(wxCommandEvent& )
 
 #ifdef DEBUG_TEST_POT
 	test_pot2D();
+	test_hierPrecond();
 #else
 	// test if first launch, and if so
 	if((Globals::GetApp())->IsFirstUse() == true) {
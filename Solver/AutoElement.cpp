@@ -41,6 +41,9 @@ CAutoElement::CAutoElement()
 	for(i=0; i<AUTOPANEL_MAX_NUM_OF_HIERARCHIES; i++) {
 		m_ulLinkIndexStart[i] = 0;
 		m_ulLinkIndexEnd[i] = 0;
+		m_ulFarLinkIndexStart[i] = 0;
+		m_ulFarLinkIndexEnd[i] = 0;
+		m_ulNodeIndex[i] = AUTOPANEL_NO_NODE_INDEX;
 	}
 	m_pLeft = m_pRight = NULL;
 	m_dCharge = 1.0;
@@ -60,6 +63,8 @@ void CAutoElement::InitElementsTree()
 	for(i=0; i<AUTOPANEL_MAX_NUM_OF_HIERARCHIES; i++) {
 		m_ulLinkIndexStart[i] = 0;
 		m_ulLinkIndexEnd[i] = 0;
+		m_ulFarLinkIndexStart[i] = 0;
+		m_ulFarLinkIndexEnd[i] = 0;
 	}
 
 	if(IsLeaf() != true) {
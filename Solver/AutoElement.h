@@ -59,6 +59,9 @@ using namespace std;
 // EPS used to avoid divisions by zero, and other use
 #define AUTOPANEL_EPS 1E-12
 
+// value of 'm_ulNodeIndex' for elements not (yet) indexed at a given hierarchical level
+#define AUTOPANEL_NO_NODE_INDEX				((unsigned long)-1)
+
 // panel structure used by CAutoRefine
 class CAutoElement
 {
@@ -92,10 +95,15 @@ public:
 	unsigned char m_ucType;
 	unsigned long m_ulLinkIndexStart[AUTOPANEL_MAX_NUM_OF_HIERARCHIES];
 	unsigned long m_ulLinkIndexEnd[AUTOPANEL_MAX_NUM_OF_HIERARCHIES];
+	// far-field links, whose coefficients of potential are not stored (see CAutoRefine::m_bFarLinks)
+	unsigned long m_ulFarLinkIndexStart[AUTOPANEL_MAX_NUM_OF_HIERARCHIES];
+	unsigned long m_ulFarLinkIndexEnd[AUTOPANEL_MAX_NUM_OF_HIERARCHIES];
 	unsigned long m_lNumOfChildren;
 	CAutoElement *m_pLeft, *m_pRight;
 	double m_dCharge, m_dPotential;
 	long m_lIndex[AUTOPANEL_MAX_NUM_OF_HIERARCHIES];
+	// position of the element in the node array (post-order, conductor by conductor)
+	unsigned long m_ulNodeIndex[AUTOPANEL_MAX_NUM_OF_HIERARCHIES];
 	unsigned char m_ucDielIndex;
 	double m_dDimension;
 
@@ -35,11 +35,21 @@
 #include <time.h>
 // for _isnan() and _finite()
 #include <float.h>
+// for UINT_MAX
+#include <climits>
 // for _chdir()
 //#include <direct.h>
 // for openmp
 #include "omp.h"
 
+#ifndef __WXMSW__
+// for mmap(), used for memory-mapped out-of-core links
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 // for wxGetFreeMemory()
 #include <wx/utils.h> 
 
@@ -82,9 +92,19 @@
 #define AUTOREFINE_TRIANGULATE_CREATE_PANEL		1
 
 
-// extension for temporary files; l = links, p = potentials
+// extension for temporary files; l = links (one file per out-of-core block)
 #define FC_LINK_TMP_FILE_PREFIX _T("frcl")
-#define FC_POT_TMP_FILE_PREFIX _T("frcp")
+
+// size of the buffer holding a compressed out-of-core chunk
+// (a value encoded as variable-length integer takes up to 10 bytes, see PutVarint())
+#define AUTOREFINE_CODEC_BUFFER_SIZE	(AUTOREFINE_LINK_CHUNK_SIZE * 10)
+
+// link cache file format identification (see SaveLinkCache())
+#define AUTOREFINE_LINK_CACHE_MAGIC		"FCLC"
+#define AUTOREFINE_LINK_CACHE_VERSION	1
+// 64-bit FNV-1a hash parameters, for the link cache key
+#define AUTOREFINE_FNV_OFFSET			wxULL(0xcbf29ce484222325)
+#define AUTOREFINE_FNV_PRIME			wxULL(0x100000001b3)
 
 // cosinus of the minumum angle to declare a triangle 'thin'
 // (0.99619469809174553229501040247389 means 5 degrees)
@@ -115,12 +135,39 @@ CAutoRefine::CAutoRefine()
 		m_ulPanelNum[i] = 0;
 		m_ulNodeNum[i] = 0;
 		m_dPotCoeffLinks[i] = NULL;
-		m_pdPanelPtrLinks[i] = NULL;
+		m_fPotCoeffLinks[i] = NULL;
+		m_bFloatLinks[i] = false;
+		m_puiNodeIndexLinks[i] = NULL;
 		m_ulLinkChunkNum[i] = 0;
-	}
-
-	m_ulUniqueLinkChunkIDs = NULL;
-	m_ulUniquePotChunkIDs = NULL;
+		m_ulFarLinksNum[i] = 0;
+		m_puiFarNodeIndexLinks[i] = NULL;
+		m_ulFarLinkChunkNum[i] = 0;
+		m_bFarLinks[i] = false;
+		m_bSymLinks[i] = false;
+		m_ulSymLinksNum[i] = 0;
+	}
+	m_bRemapUpperLinks = false;
+	m_bPairLinks = false;
+
+	m_ulUniqueBlockIDs = NULL;
+	m_bMmapLinks = false;
+	m_pMappedBlock = NULL;
+	m_ulMappedBlockSize = 0;
+	m_ucMappedLevel = AUTOREFINE_HIER_PRE_0_LEVEL;
+	m_bAsyncLinksIO = false;
+	m_puiShadowNodeIndexLinks = NULL;
+	m_dShadowPotCoeffLinks = NULL;
+	m_fShadowPotCoeffLinks = NULL;
+	m_pLinksIOThread = NULL;
+	m_ulShadowBlock = AUTOREFINE_NO_BLOCK;
+	m_ulIOWriteBlock = AUTOREFINE_NO_BLOCK;
+	m_bIOReadAlsoPot = false;
+	m_bIOWriteAlsoPot = false;
+	m_iIORet = FC_NORMAL_END;
+	m_bCompressLinks = false;
+	m_pucCodecBuffer = NULL;
+	m_dLinksRawBytes = 0.0;
+	m_dLinksDiskBytes = 0.0;
 	m_fGlobalCharges = NULL;
 	m_pucDielIndex = NULL;
 	m_pNodes = NULL;
@@ -153,7 +200,7 @@ void CAutoRefine::CleanOnlyUpToSupHie()
 void CAutoRefine::Clean(int command, CAutoRefGlobalVars globalVars)
 {
 	unsigned int i;
-	unsigned long totChunksNum, k;
+	unsigned long k;
 	wxFileName tmpFileName;
     StlAutoCondDeque::iterator itc;
 
@@ -194,23 +241,17 @@ void CAutoRefine::Clean(int command, CAutoRefGlobalVars globalVars)
 	m_clsImgSelfPotCoeff.destroy();
 
 
-	// delete temporary chunks files and the chunk IDs array
+	// delete temporary block files and the block IDs array
 
-	if(m_ulBlocksNum > 1) {
-		// total number of chunks
-		totChunksNum = m_ulBlocksNum * m_ulLinkChunkNum[m_ucInteractionLevel];
-		// retrieve file name from chunk IDs
-		for(k=0; k< totChunksNum; k++) {
+	if(m_ulBlocksNum > 1 && m_ulUniqueBlockIDs != NULL) {
+		// the I/O thread may still be working on a block file
+		DeleteShadowLinks();
+		// release the mapped block, if any
+		UnmapLinks();
+		// retrieve file name from block IDs
+		for(k=0; k< m_ulBlocksNum; k++) {
 			// get the temp file path and name from the ID
-			PortableGetTempFileName(wxT(""), FC_LINK_TMP_FILE_PREFIX, m_ulUniqueLinkChunkIDs[k], tmpFileName);
-			// delete the file
-			if( remove((const char*)(tmpFileName.GetLongPath())) != 0 ) {
-				ErrMsg("Error: cannot delete the temporary file '%s'\n", (const char*)(tmpFileName.GetLongPath()));
-				ErrMsg("       Temporary files must be manually removed.\n");
-				ErrMsg("       Continuing with memory deallocation\n");
-			}
-			// get the temp file path and name from the ID
-			PortableGetTempFileName(wxT(""), FC_POT_TMP_FILE_PREFIX, m_ulUniquePotChunkIDs[k], tmpFileName);
+			PortableGetTempFileName(wxT(""), FC_LINK_TMP_FILE_PREFIX, m_ulUniqueBlockIDs[k], tmpFileName);
 			// delete the file
 			if( remove((const char*)(tmpFileName.GetLongPath())) != 0 ) {
 				ErrMsg("Error: cannot delete the temporary file '%s'\n", (const char*)(tmpFileName.GetLongPath()));
@@ -219,10 +260,8 @@ void CAutoRefine::Clean(int command, CAutoRefGlobalVars globalVars)
 			}
 		}
 		// deallocate the memory
-		delete m_ulUniqueLinkChunkIDs;
-		m_ulUniqueLinkChunkIDs = NULL;
-		delete m_ulUniquePotChunkIDs;
-		m_ulUniquePotChunkIDs = NULL;
+		delete m_ulUniqueBlockIDs;
+		m_ulUniqueBlockIDs = NULL;
 	}
 
 	// delete link arrays and reset other vars
@@ -239,6 +278,21 @@ void CAutoRefine::DeleteLinkArray(unsigned int level)
 {
 	unsigned long j;
 
+	// memory-mapped chunks are not allocated, so just release the mapping
+	if(m_pMappedBlock != NULL && m_ucMappedLevel == level) {
+		UnmapLinks();
+	}
+
+	// out-of-core (and so the shadow chunks and the codec buffer) is only at the bottom level
+	if(level == AUTOREFINE_HIER_PRE_0_LEVEL) {
+		DeleteShadowLinks();
+		if(m_pucCodecBuffer != NULL) {
+			delete m_pucCodecBuffer;
+			m_pucCodecBuffer = NULL;
+		}
+		m_bCompressLinks = false;
+	}
+
 	// delete interaction link arrays
 	if(m_dPotCoeffLinks[level] != NULL) {
 		for(j=0; j<m_ulLinkChunkNum[level]; j++) {
@@ -249,17 +303,79 @@ void CAutoRefine::DeleteLinkArray(unsigned int level)
 		delete m_dPotCoeffLinks[level];
 		m_dPotCoeffLinks[level] = NULL;
 	}
-	if(m_pdPanelPtrLinks[level] != NULL) {
+	if(m_fPotCoeffLinks[level] != NULL) {
+		for(j=0; j<m_ulLinkChunkNum[level]; j++) {
+			if(m_fPotCoeffLinks[level][j] != NULL) {
+				delete m_fPotCoeffLinks[level][j];
+			}
+		}
+		delete m_fPotCoeffLinks[level];
+		m_fPotCoeffLinks[level] = NULL;
+	}
+	if(m_puiNodeIndexLinks[level] != NULL) {
 		for(j=0; j<m_ulLinkChunkNum[level]; j++) {
-			if(m_pdPanelPtrLinks[level][j] != NULL) {
-				delete m_pdPanelPtrLinks[level][j];
+			if(m_puiNodeIndexLinks[level][j] != NULL) {
+				delete m_puiNodeIndexLinks[level][j];
+			}
+		}
+		delete m_puiNodeIndexLinks[level];
+		m_puiNodeIndexLinks[level] = NULL;
+	}
+	if(m_puiFarNodeIndexLinks[level] != NULL) {
+		for(j=0; j<m_ulFarLinkChunkNum[level]; j++) {
+			if(m_puiFarNodeIndexLinks[level][j] != NULL) {
+				delete m_puiFarNodeIndexLinks[level][j];
 			}
 		}
-		delete m_pdPanelPtrLinks[level];
-		m_pdPanelPtrLinks[level] = NULL;
+		delete m_puiFarNodeIndexLinks[level];
+		m_puiFarNodeIndexLinks[level] = NULL;
+	}
+	// nothing left to be remapped
+	if(level != AUTOREFINE_HIER_PRE_0_LEVEL) {
+		m_bRemapUpperLinks = false;
 	}
 }
 
+// Upper hierarchical levels (hierarchical preconditioner) are refined and linked before
+// the bottom level, so their links store the node indexes of the upper level tree.
+// Once the bottom level has been indexed, translate them into bottom level node indexes,
+// that are the ones used to access the node charges in the hierarchical multiplication
+// (the upper level tree is a sub-tree of the bottom level one)
+int CAutoRefine::RemapUpperLevelLinks(unsigned char level)
+{
+	unsigned long i, k, linkIndex, *nodeMap;
+
+	ASSERT(level != AUTOREFINE_HIER_PRE_0_LEVEL);
+
+	// SAFENEW_ARRAY_NOMEM_RET(TYPE, VAR, LEN)
+	SAFENEW_ARRAY_NOMEM_RET(unsigned long, nodeMap, m_ulNodeNum[level])
+
+	for(i=0; i<m_ulNodeNum[AUTOREFINE_HIER_PRE_0_LEVEL]; i++) {
+		if(m_pNodes[i]->m_ulNodeIndex[level] != AUTOPANEL_NO_NODE_INDEX) {
+			ASSERT(m_pNodes[i]->m_ulNodeIndex[level] < m_ulNodeNum[level]);
+			nodeMap[m_pNodes[i]->m_ulNodeIndex[level]] = m_pNodes[i]->m_ulNodeIndex[AUTOREFINE_HIER_PRE_0_LEVEL];
+		}
+	}
+
+	// upper levels are always in-core (see AutoRefineLinks())
+	for(linkIndex=0; linkIndex<m_ulLinksNum[level]; linkIndex++) {
+		k = linkIndex / AUTOREFINE_LINK_CHUNK_SIZE;
+		i = linkIndex % AUTOREFINE_LINK_CHUNK_SIZE;
+		m_puiNodeIndexLinks[level][k][i] = (unsigned int)nodeMap[m_puiNodeIndexLinks[level][k][i]];
+	}
+	for(linkIndex=0; linkIndex<m_ulFarLinksNum[level]; linkIndex++) {
+		k = linkIndex / AUTOREFINE_LINK_CHUNK_SIZE;
+		i = linkIndex % AUTOREFINE_LINK_CHUNK_SIZE;
+		m_puiFarNodeIndexLinks[level][k][i] = (unsigned int)nodeMap[m_puiFarNodeIndexLinks[level][k][i]];
+	}
+
+	delete nodeMap;
+
+	m_bRemapUpperLinks = false;
+
+	return FC_NORMAL_END;
+}
+
 // Automatic refinement (mesh generator), given an input file
 // describing a geometry in FastCap format
 //
@@ -315,6 +431,15 @@ int CAutoRefine::AutoRefinePanels(CAutoRefGlobalVars globalVars, unsigned char i
 	m_iLevel = 0;
 	m_iMaxLevel = 0;
 	m_ulLinksNum[m_ucInteractionLevel] = 0;
+	m_ulSymLinksNum[m_ucInteractionLevel] = 0;
+	m_ulFarLinksNum[m_ucInteractionLevel] = 0;
+	// matrix-free far-field links are supported only by the 3D solver
+	// (the 2D solver computes the coefficients while refining, see RefineMutual())
+	m_bFarLinks[m_ucInteractionLevel] = (m_clsGlobalVars.m_bFarLinks == true && g_ucSolverType == SOLVERGLOBAL_3DSOLVER);
+	// with the Galerkin scheme the conductor-conductor coefficients of potential are symmetric,
+	// so each of these links can be stored only once (the 2D solver has no Galerkin scheme)
+	m_bSymLinks[m_ucInteractionLevel] = (m_clsGlobalVars.m_bSymLinks == true && m_clsGlobalVars.m_cScheme == AUTOREFINE_GALERKIN
+	                                     && g_ucSolverType == SOLVERGLOBAL_3DSOLVER);
 
 	// init complexity computation vars (for algorithm analysis)
 	m_ulNumofpotest = 0;
@@ -449,7 +574,18 @@ int CAutoRefine::AutoRefinePanels(CAutoRefGlobalVars globalVars, unsigned char i
 	// if required, it should have already been used in Discretize() function)
 	Clean(AUTOREFINE_DEALLMEM_CLEAN_CHARGES, m_clsGlobalVars);
 
+	// links address the nodes through 32-bit indexes
+	if(m_ulNodeNum[m_ucInteractionLevel] > AUTOREFINE_MAX_NODE_NUM) {
+		ErrMsg("Error: the number of nodes (%lu) exceeds the maximum supported value (%lu)\n", m_ulNodeNum[m_ucInteractionLevel], AUTOREFINE_MAX_NODE_NUM);
+		return FC_GENERIC_ERROR;
+	}
+
 	// allocate nodes array (will be populated in RecurseIndex() called in AutoRefineLinks() )
+	// (in case it was already allocated for another hierarchical level, destroy and re-allocate)
+	if(m_pNodes != NULL) {
+		delete m_pNodes;
+		m_pNodes = NULL;
+	}
 	SAFENEW_ARRAY_RET(CAutoElement*, m_pNodes, m_ulNodeNum[m_ucInteractionLevel], g_clsMemUsage.m_ulPanelsMem)
 
 	// allocate array of global charges, used for refinement (if requested, and if on bottom level)
@@ -483,15 +619,18 @@ int CAutoRefine::AutoRefineLinks(CAutoRefGlobalVars globalVars)
 	int ret;
 	StlAutoCondDeque::iterator itc1, itc2;
 	double start, finish;
-	unsigned long j, k, totChunksNum;
+	unsigned long k;
 	// 'i' must have signed integral type due to MS OpenMP limitation (does not accept unsigned)
 	long i;
-	wxLongLong mem_Potest, mem_pCharge, mem_LinksTotal, mem_AvailVirtual, mem_MaxAllocVirtual, mem_AllocVirtual;
+	wxLongLong mem_Potest, mem_NodeIndex, mem_LinksTotal, mem_AvailVirtual, mem_MaxAllocVirtual, mem_AllocVirtual, mem_Link, mem_PotCoeff, mem_FarLinks;
 	wxLongLong freeDiskBytes;
 	wxFileName tmpFileName, tmpFNObj;
-	bool goOutOfCore, retBool;
+	wxLongLong mem_Committed;
+	double oocRatio;
+	bool goOutOfCore, retBool, useCache, cacheHit;
 	unsigned long uniqueFileID;
 	unsigned long linkIndex, chunk, block, nodeIndex, nodeBlockEnd, linksPerBlock;
+	wxUint64 cacheKey;
 
 
 	// start timer
@@ -500,6 +639,7 @@ int CAutoRefine::AutoRefineLinks(CAutoRefGlobalVars globalVars)
 	// index links and index panels
 	m_ulBasePanelNum = 0;
 	m_ulBaseLinksNum = 0;
+	m_ulBaseFarLinksNum = 0;
 	m_ulCountNodeNum = 0;
 	m_bPopulateNodeArray = true;
 	for(itc1 = m_stlConductors.begin(); itc1 != m_stlConductors.end(); itc1++) {
@@ -511,33 +651,92 @@ int CAutoRefine::AutoRefineLinks(CAutoRefGlobalVars globalVars)
 	}
 	ASSERT( m_ulBasePanelNum == m_ulPanelNum[m_ucInteractionLevel]);
 	ASSERT( m_ulBaseLinksNum == m_ulLinksNum[m_ucInteractionLevel]);
+	ASSERT( m_ulBaseFarLinksNum == m_ulFarLinksNum[m_ucInteractionLevel]);
 	ASSERT( m_ulCountNodeNum == m_ulNodeNum[m_ucInteractionLevel]);
 
+	// if the upper level links (hierarchical preconditioner) have already been computed,
+	// they must now refer to the bottom level node indexes
+	if(m_ucInteractionLevel == AUTOREFINE_HIER_PRE_0_LEVEL && m_bRemapUpperLinks == true) {
+		ret = RemapUpperLevelLinks(AUTOREFINE_HIER_PRE_1_LEVEL);
+		if(ret != FC_NORMAL_END) {
+			return ret;
+		}
+	}
 
+	// if requested, store the coefficients of potential in single precision; this is enough
+	// for the target accuracy, since the self potentials are kept separately in double precision,
+	// as well as the accumulation of the potentials in the multiplication
+	m_bFloatLinks[m_ucInteractionLevel] = globalVars.m_bFloatLinks;
+	if(m_bFloatLinks[m_ucInteractionLevel] == true) {
+		mem_PotCoeff = (wxLongLong)sizeof(float);
+	}
+	else {
+		mem_PotCoeff = (wxLongLong)sizeof(double);
+	}
+	// memory needed to store a single link: coefficient of potential and index of the interacting node
+	mem_Link = mem_PotCoeff + (wxLongLong)sizeof(unsigned int);
 	// calculate the memory needed for the potential estimates
-	mem_Potest = ((wxLongLong)m_ulLinksNum[m_ucInteractionLevel]) * ((wxLongLong)sizeof(double));
-	// calculate the memory needed for the pointer to interacting panel charge
-	mem_pCharge = ((wxLongLong)m_ulLinksNum[m_ucInteractionLevel]) * ((wxLongLong)sizeof(double*));
+	mem_Potest = ((wxLongLong)m_ulLinksNum[m_ucInteractionLevel]) * mem_PotCoeff;
+	// calculate the memory needed for the indexes of the interacting nodes
+	mem_NodeIndex = ((wxLongLong)m_ulLinksNum[m_ucInteractionLevel]) * ((wxLongLong)sizeof(unsigned int));
 	// total required memory
-	mem_LinksTotal = mem_Potest + mem_pCharge;
+	mem_LinksTotal = mem_Potest + mem_NodeIndex;
 
-	// get available memory
-	mem_AvailVirtual = (wxLongLong) wxGetFreeMemory();
+	// get available memory: either the free memory, or what is left of the memory budget once
+	// the panels are allocated and the memory the solver will need is set aside; in the latter
+	// case all of it can be used for the links, so the out-of-core ratio is one
+	oocRatio = globalVars.m_dOutOfCoreRatio;
+	if(globalVars.m_dMemBudget > 0.0) {
+		mem_Committed = (wxLongLong)(g_clsMemUsage.m_ulPanelsMem + g_clsMemUsage.m_ulCondMem + g_clsMemUsage.m_ulChargesMem);
+		if(globalVars.m_dMemBudget * G_MEGABYTE > mem_Committed.ToDouble() + globalVars.m_dSolveMemReserve) {
+			mem_AvailVirtual.Assign(globalVars.m_dMemBudget * G_MEGABYTE - mem_Committed.ToDouble() - globalVars.m_dSolveMemReserve);
+		}
+		else {
+			ErrMsg("Warning: the memory budget of %.0f Mbytes is not enough for the panels and the solver\n", globalVars.m_dMemBudget);
+			mem_AvailVirtual = 0;
+		}
+		// '-f0' still means never go out-of-core
+		if(oocRatio != 0.0) {
+			oocRatio = 1.0;
+		}
+	}
+	else {
+		mem_AvailVirtual = (wxLongLong) wxGetFreeMemory();
+	}
 // debug
 //mem_AvailVirtual = 50000000;
 
+	// matrix-free far-field links (node indexes only) are always kept in-core,
+	// so they are not part of the out-of-core decision but reduce the available memory
+	mem_FarLinks = ((wxLongLong)m_ulFarLinksNum[m_ucInteractionLevel]) * ((wxLongLong)sizeof(unsigned int));
+	if(mem_AvailVirtual.ToLong() != -1L) {
+		if(mem_AvailVirtual > mem_FarLinks) {
+			mem_AvailVirtual -= mem_FarLinks;
+		}
+		else {
+			mem_AvailVirtual = 0;
+		}
+	}
+
 	goOutOfCore = false;
-	if(mem_AvailVirtual.ToLong() == -1L) {
+	if(oocRatio == 0.0) {
+		// '-f0' means never go out-of-core
+	}
+	else if(mem_AvailVirtual.ToLong() == -1L) {
 		ErrMsg("Error: cannot retrieve the information about the free memory quantity\n");
 		ErrMsg("       Cannot go out-of-core, continuing in-core\n");
 	}
-	else if( mem_LinksTotal.ToDouble() * globalVars.m_dOutOfCoreRatio < mem_AvailVirtual.ToDouble() ) {
+	else if( mem_LinksTotal.ToDouble() * oocRatio < mem_AvailVirtual.ToDouble() ) {
 		// no need to go out of core
 	}
+	else if(m_ucInteractionLevel != AUTOREFINE_HIER_PRE_0_LEVEL) {
+		// upper levels are always kept in-core, since their links are remapped
+		// to the bottom level nodes once these are known (see RemapUpperLevelLinks())
+	}
 	else {
 		LogMsg("Estimated memory required for storing panel interaction links is: %lu Mbytes\n", (mem_LinksTotal/G_MEGABYTE).ToLong());
 		LogMsg("Available free memory left is: %lu Mbytes\n", (mem_AvailVirtual/G_MEGABYTE).ToLong());
-		LogMsg("Estimated links memory is more than %.0f%% of the available free memory. Going out-of-core.\n", 100.0f / globalVars.m_dOutOfCoreRatio);
+		LogMsg("Estimated links memory is more than %.0f%% of the available free memory. Going out-of-core.\n", 100.0f / oocRatio);
 
 		// try to create a temporary file, to understand if we can access the temp directory
 		// and if we have the write access rights to it
@@ -582,8 +781,13 @@ int CAutoRefine::AutoRefineLinks(CAutoRefGlobalVars globalVars)
 	}
 
 	if(goOutOfCore == true) {
-		// 'mem_AvailVirtual / globalVars.m_dOutOfCoreRatio' is the max ram memory block we decided to allocate for storing the chunks
-		mem_MaxAllocVirtual.Assign(mem_AvailVirtual.ToDouble() / globalVars.m_dOutOfCoreRatio);
+		// 'mem_AvailVirtual / oocRatio' is the max ram memory block we decided to allocate for storing the chunks
+		mem_MaxAllocVirtual.Assign(mem_AvailVirtual.ToDouble() / oocRatio);
+		// with asynchronous I/O two blocks are in memory at the same time (the current one and the shadow one,
+		// see SaveLinksBehind()), so each block gets half of the memory
+		if(globalVars.m_bMmapLinks == false) {
+			mem_MaxAllocVirtual = mem_MaxAllocVirtual / 2;
+		}
 		// let's calculate how many chunks fit in this block size
 		// We use the wxLongLong division, which is available either with native 64 bits integers or through wxWidgets
 		// implementation (remark: the class documentation does not report some operators, including '/', '<', etc.).
@@ -595,14 +799,19 @@ int CAutoRefine::AutoRefineLinks(CAutoRefGlobalVars globalVars)
 		// Remark: all values are casted to wxLongLong before operations happen, to avoid implicit conversions that may lead
 		// to errors, e.g. if 'AUTOREFINE_LINK_CHUNK_SIZE' is considered long, sizeof is considered long, but their product
 		// needs more than 32 bits to be stored; not likely, but to be avoided anyway
-		m_ulLinkChunkNum[m_ucInteractionLevel] = ( mem_MaxAllocVirtual / ( ((wxLongLong)AUTOREFINE_LINK_CHUNK_SIZE) * ((wxLongLong)(sizeof(double) + sizeof(double*))) ) ).ToLong();
+		m_ulLinkChunkNum[m_ucInteractionLevel] = ( mem_MaxAllocVirtual / ( ((wxLongLong)AUTOREFINE_LINK_CHUNK_SIZE) * mem_Link ) ).ToLong();
 		if(m_ulLinkChunkNum[m_ucInteractionLevel] == 0) {
-			ErrMsg("Error: available free memory is not enough to allocate any chunk\n");
+			if(globalVars.m_dMemBudget > 0.0) {
+				ErrMsg("Error: the memory budget of %.0f Mbytes is not enough to allocate any chunk\n", globalVars.m_dMemBudget);
+			}
+			else {
+				ErrMsg("Error: available free memory is not enough to allocate any chunk\n");
+			}
 			ErrMsg("       Cannot go out-of-core, terminating process\n");
 			return FC_CANNOT_GO_OOC;
 		}
 		// let's calculate the real size of the memory block (it has been rounded down to fit entire chunks)
-		mem_AllocVirtual = ((wxLongLong)AUTOREFINE_LINK_CHUNK_SIZE) * ((wxLongLong)(sizeof(double) + sizeof(double*))) * ((wxLongLong)m_ulLinkChunkNum[m_ucInteractionLevel]);
+		mem_AllocVirtual = ((wxLongLong)AUTOREFINE_LINK_CHUNK_SIZE) * mem_Link * ((wxLongLong)m_ulLinkChunkNum[m_ucInteractionLevel]);
 		// now let's calculate how many blocks we need
 		m_ulBlocksNum = (unsigned long) (mem_LinksTotal / mem_AllocVirtual).ToLong();
 		// result of the division is rounded towards zero (truncated). So if there is a remainder, need one block more
@@ -622,41 +831,70 @@ int CAutoRefine::AutoRefineLinks(CAutoRefGlobalVars globalVars)
 		m_ulBlocksNum = 1;
 	}
 
-	// allocate temporary file names for all chunks to be stored out-of-core
+	// allocate temporary file names for all blocks to be stored out-of-core
 	//
 
-	// allocate array of chunk file name IDs (only if we need to go out-of-core)
+	// allocate array of block file name IDs (only if we need to go out-of-core)
 	//
 	if(m_ulBlocksNum > 1) {
-		// total number of chunks
-		totChunksNum = m_ulBlocksNum * m_ulLinkChunkNum[m_ucInteractionLevel];
 		// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
-		SAFENEW_ARRAY_RET(unsigned long, m_ulUniqueLinkChunkIDs, totChunksNum, g_clsMemUsage.m_ulLinksMem)
-		SAFENEW_ARRAY_RET(unsigned long, m_ulUniquePotChunkIDs, totChunksNum, g_clsMemUsage.m_ulLinksMem)
+		SAFENEW_ARRAY_RET(unsigned long, m_ulUniqueBlockIDs, m_ulBlocksNum, g_clsMemUsage.m_ulLinksMem)
 		// create IDs
-		for(i=0, k=0; i< (long)m_ulBlocksNum; i++) {
-			for(j=0; j< m_ulLinkChunkNum[m_ucInteractionLevel]; j++) {
+		for(k=0; k< m_ulBlocksNum; k++) {
 
-				uniqueFileID = PortableGetTempFileName(wxT(""), FC_LINK_TMP_FILE_PREFIX, 0, tmpFileName);
-				if(uniqueFileID == 0) {
-					ErrMsg("Error: cannot create the temporary file '%s', to store out-of-core files\n", (const char*)tmpFileName.GetFullPath());
-					ErrMsg("       Cannot go out-of-core, stopping process\n");
+			uniqueFileID = PortableGetTempFileName(wxT(""), FC_LINK_TMP_FILE_PREFIX, 0, tmpFileName);
+			if(uniqueFileID == 0) {
+				ErrMsg("Error: cannot create the temporary file '%s', to store out-of-core files\n", (const char*)tmpFileName.GetFullPath());
+				ErrMsg("       Cannot go out-of-core, stopping process\n");
 
-					return FC_CANNOT_GO_OOC;
-				}
-				m_ulUniqueLinkChunkIDs[k] = uniqueFileID;
+				return FC_CANNOT_GO_OOC;
+			}
+			m_ulUniqueBlockIDs[k] = uniqueFileID;
+		}
+	}
 
-				uniqueFileID = PortableGetTempFileName(wxT(""), FC_POT_TMP_FILE_PREFIX, 0, tmpFileName);
-				if(uniqueFileID == 0) {
-					ErrMsg("Error: cannot create the temporary file '%s', to store out-of-core files\n", (const char*)tmpFileName.GetFullPath());
-					ErrMsg("       Cannot go out-of-core, stopping process\n");
+	// if requested, the out-of-core blocks are memory-mapped, so the link chunks are
+	// not allocated, and the OS takes care of paging the current block in and out
+	m_bMmapLinks = false;
+	if(m_ulBlocksNum > 1 && globalVars.m_bMmapLinks == true) {
+#ifndef __WXMSW__
+		m_bMmapLinks = true;
+		LogMsg("Out-of-core link blocks are memory-mapped\n");
+#else
+		ErrMsg("Warning: memory-mapped out-of-core links are not supported on this platform, using file I/O\n");
+#endif
+	}
+	// otherwise the blocks are read and written by a background I/O thread, overlapped with the computation
+	// (remark: if the mapping was requested but is not supported, the block size has not been halved, so use synchronous I/O)
+	m_bAsyncLinksIO = (m_ulBlocksNum > 1 && globalVars.m_bMmapLinks == false);
 
-					return FC_CANNOT_GO_OOC;
-				}
-				m_ulUniquePotChunkIDs[k] = uniqueFileID;
+	// if requested, the out-of-core files are compressed (see EncodeNodeIndexChunk()),
+	// but not if memory-mapped, since the mapping needs the chunks in their plain format
+	m_bCompressLinks = false;
+	if(m_ulBlocksNum > 1 && globalVars.m_bCompressLinks == true) {
+		if(m_bMmapLinks == true) {
+			ErrMsg("Warning: memory-mapped out-of-core links cannot be compressed, compression disabled\n");
+		}
+		else {
+			m_bCompressLinks = true;
+			// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+			SAFENEW_ARRAY_RET(unsigned char, m_pucCodecBuffer, AUTOREFINE_CODEC_BUFFER_SIZE, g_clsMemUsage.m_ulLinksMem)
+		}
+	}
 
-				k++;
-			}
+	// report the memory plan, if planning within a budget
+	if(globalVars.m_dMemBudget > 0.0 && m_ucInteractionLevel == AUTOREFINE_HIER_PRE_0_LEVEL) {
+		LogMsg("Memory plan for the budget of %.0f Mbytes:\n", globalVars.m_dMemBudget);
+		LogMsg("  panels and conductors: %lu Mbytes\n", (mem_Committed/G_MEGABYTE).ToLong());
+		LogMsg("  solver (GMRES, preconditioner, multiplication; estimated): %.0f Mbytes\n", globalVars.m_dSolveMemReserve / G_MEGABYTE);
+		LogMsg("  far-field links (in-core): %lu Mbytes\n", (mem_FarLinks/G_MEGABYTE).ToLong());
+		if(m_ulBlocksNum > 1) {
+			LogMsg("  links: out-of-core, %lu blocks of %lu chunks of %d links, %lu Mbytes in memory%s\n", m_ulBlocksNum, m_ulLinkChunkNum[m_ucInteractionLevel],
+			       AUTOREFINE_LINK_CHUNK_SIZE, (mem_AllocVirtual * (m_bAsyncLinksIO == true ? 2 : 1) / G_MEGABYTE).ToLong(),
+			       (m_bAsyncLinksIO == true) ? " (two blocks, asynchronous I/O)" : "");
+		}
+		else {
+			LogMsg("  links: in-core, %lu Mbytes\n", (mem_LinksTotal/G_MEGABYTE).ToLong());
 		}
 	}
 
@@ -664,25 +902,84 @@ int CAutoRefine::AutoRefineLinks(CAutoRefGlobalVars globalVars)
 	// allocate interaction link arrays
 	//
 
+	// far-field links, always in-core
+	if(m_ulFarLinksNum[m_ucInteractionLevel] > 0) {
+		m_ulFarLinkChunkNum[m_ucInteractionLevel] = m_ulFarLinksNum[m_ucInteractionLevel] / AUTOREFINE_LINK_CHUNK_SIZE;
+		if(m_ulFarLinksNum[m_ucInteractionLevel] % AUTOREFINE_LINK_CHUNK_SIZE != 0) {
+			m_ulFarLinkChunkNum[m_ucInteractionLevel]++;
+		}
+		// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+		SAFENEW_ARRAY_RET(unsigned int*, m_puiFarNodeIndexLinks[m_ucInteractionLevel], m_ulFarLinkChunkNum[m_ucInteractionLevel], g_clsMemUsage.m_ulLinksMem)
+		for(k = 0; k < m_ulFarLinkChunkNum[m_ucInteractionLevel]; k++) {
+			// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+			SAFENEW_ARRAY_RET(unsigned int, m_puiFarNodeIndexLinks[m_ucInteractionLevel][k], AUTOREFINE_LINK_CHUNK_SIZE, g_clsMemUsage.m_ulLinksMem)
+		}
+	}
+	else {
+		m_ulFarLinkChunkNum[m_ucInteractionLevel] = 0;
+	}
 
 	// allocate pointers to chunks
 	// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
-	SAFENEW_ARRAY_RET(double*, m_dPotCoeffLinks[m_ucInteractionLevel], m_ulLinkChunkNum[m_ucInteractionLevel], g_clsMemUsage.m_ulLinksMem)
-	SAFENEW_ARRAY_RET(CAutoElement**, m_pdPanelPtrLinks[m_ucInteractionLevel], m_ulLinkChunkNum[m_ucInteractionLevel], g_clsMemUsage.m_ulLinksMem)
+	if(m_bFloatLinks[m_ucInteractionLevel] == true) {
+		SAFENEW_ARRAY_RET(float*, m_fPotCoeffLinks[m_ucInteractionLevel], m_ulLinkChunkNum[m_ucInteractionLevel], g_clsMemUsage.m_ulLinksMem)
+	}
+	else {
+		SAFENEW_ARRAY_RET(double*, m_dPotCoeffLinks[m_ucInteractionLevel], m_ulLinkChunkNum[m_ucInteractionLevel], g_clsMemUsage.m_ulLinksMem)
+	}
+	SAFENEW_ARRAY_RET(unsigned int*, m_puiNodeIndexLinks[m_ucInteractionLevel], m_ulLinkChunkNum[m_ucInteractionLevel], g_clsMemUsage.m_ulLinksMem)
 
 //	LogMsg("Memory information before starting the allocation of link chunks\n");
 //	DumpMemoryInfo();
 
 	// and allocate chunks
 	for(k = 0; k < m_ulLinkChunkNum[m_ucInteractionLevel]; k++) {
+		// memory-mapped chunks point into the current block file, see MapLinks()
+		if(m_bMmapLinks == true) {
+			if(m_bFloatLinks[m_ucInteractionLevel] == true) {
+				m_fPotCoeffLinks[m_ucInteractionLevel][k] = NULL;
+			}
+			else {
+				m_dPotCoeffLinks[m_ucInteractionLevel][k] = NULL;
+			}
+			m_puiNodeIndexLinks[m_ucInteractionLevel][k] = NULL;
+			continue;
+		}
 		// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
-		SAFENEW_ARRAY_RET(double, m_dPotCoeffLinks[m_ucInteractionLevel][k], AUTOREFINE_LINK_CHUNK_SIZE, g_clsMemUsage.m_ulLinksMem)
-		SAFENEW_ARRAY_RET(CAutoElement*, m_pdPanelPtrLinks[m_ucInteractionLevel][k], AUTOREFINE_LINK_CHUNK_SIZE, g_clsMemUsage.m_ulLinksMem)
+		if(m_bFloatLinks[m_ucInteractionLevel] == true) {
+			SAFENEW_ARRAY_RET(float, m_fPotCoeffLinks[m_ucInteractionLevel][k], AUTOREFINE_LINK_CHUNK_SIZE, g_clsMemUsage.m_ulLinksMem)
+		}
+		else {
+			SAFENEW_ARRAY_RET(double, m_dPotCoeffLinks[m_ucInteractionLevel][k], AUTOREFINE_LINK_CHUNK_SIZE, g_clsMemUsage.m_ulLinksMem)
+		}
+		SAFENEW_ARRAY_RET(unsigned int, m_puiNodeIndexLinks[m_ucInteractionLevel][k], AUTOREFINE_LINK_CHUNK_SIZE, g_clsMemUsage.m_ulLinksMem)
 
 //		LogMsg("Memory information after allocation of link chunk #%d\n", k);
 //		DumpMemoryInfo();
 	}
 
+	// and the shadow chunks used by the I/O thread
+	if(m_bAsyncLinksIO == true) {
+		// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+		if(m_bFloatLinks[m_ucInteractionLevel] == true) {
+			SAFENEW_ARRAY_RET(float*, m_fShadowPotCoeffLinks, m_ulLinkChunkNum[m_ucInteractionLevel], g_clsMemUsage.m_ulLinksMem)
+		}
+		else {
+			SAFENEW_ARRAY_RET(double*, m_dShadowPotCoeffLinks, m_ulLinkChunkNum[m_ucInteractionLevel], g_clsMemUsage.m_ulLinksMem)
+		}
+		SAFENEW_ARRAY_RET(unsigned int*, m_puiShadowNodeIndexLinks, m_ulLinkChunkNum[m_ucInteractionLevel], g_clsMemUsage.m_ulLinksMem)
+		for(k = 0; k < m_ulLinkChunkNum[m_ucInteractionLevel]; k++) {
+			// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+			if(m_bFloatLinks[m_ucInteractionLevel] == true) {
+				SAFENEW_ARRAY_RET(float, m_fShadowPotCoeffLinks[k], AUTOREFINE_LINK_CHUNK_SIZE, g_clsMemUsage.m_ulLinksMem)
+			}
+			else {
+				SAFENEW_ARRAY_RET(double, m_dShadowPotCoeffLinks[k], AUTOREFINE_LINK_CHUNK_SIZE, g_clsMemUsage.m_ulLinksMem)
+			}
+			SAFENEW_ARRAY_RET(unsigned int, m_puiShadowNodeIndexLinks[k], AUTOREFINE_LINK_CHUNK_SIZE, g_clsMemUsage.m_ulLinksMem)
+		}
+	}
+
 
 	// allocate self-potential array (kept separate to be used also as Jacobi precond,
 	// in particular not to have it out-of-core in case we decided to go OOC)
@@ -714,8 +1011,22 @@ int CAutoRefine::AutoRefineLinks(CAutoRefGlobalVars globalVars)
 	// first pass in computing links. Just find and store the links, not their values
 	//
 
+	// if in-core, the second pass will evaluate the two coefficients of potential of each
+	// link pair at once (the geometry setup is the same); so here record, for each pair,
+	// the position of the opposite link (see SetLinkPair(); in single precision the position
+	// is stored in 32 bits)
+	m_bPairLinks = (m_ulBlocksNum == 1 && (m_bFloatLinks[m_ucInteractionLevel] == false || m_ulLinksNum[m_ucInteractionLevel] <= (unsigned long)UINT_MAX));
+
 	for(m_ulCurrBlock=0; m_ulCurrBlock < m_ulBlocksNum; m_ulCurrBlock++) {
 
+		// if memory-mapped, the block file must be mapped before storing the links into it
+		if(m_bMmapLinks == true) {
+			ret = MapLinks(m_ulCurrBlock);
+			if(ret != FC_NORMAL_END) {
+				return ret;
+			}
+		}
+
 		// actually scan all conductor groups and calculate interactions, stored in the links arrays
 		m_bComputeLinks = true;
 		ret = ComputeLinks();
@@ -743,6 +1054,7 @@ int CAutoRefine::AutoRefineLinks(CAutoRefGlobalVars globalVars)
 			// index links and index panels
 			m_ulBasePanelNum = 0;
 			m_ulBaseLinksNum = 0;
+			m_ulBaseFarLinksNum = 0;
 			m_bPopulateNodeArray = false;
 			for(itc1 = m_stlConductors.begin(); itc1 != m_stlConductors.end(); itc1++) {
 				m_ulCountPanelNum = 0;
@@ -757,6 +1069,19 @@ int CAutoRefine::AutoRefineLinks(CAutoRefGlobalVars globalVars)
 	// set current block to the latest actually in memory
 	m_ulCurrBlock--;
 
+	// if the same links have been computed by a previous run, load their coefficients of potential
+	// from the link cache, skipping the second pass (in-core only)
+	useCache = (globalVars.m_bLinkCache == true && m_ulBlocksNum == 1);
+	cacheHit = false;
+	cacheKey = 0;
+	if(useCache == true) {
+		cacheKey = GetLinkCacheKey();
+		ret = LoadLinkCache(globalVars.m_sLinkCacheDir, cacheKey, cacheHit);
+		if(ret != FC_NORMAL_END) {
+			return ret;
+		}
+	}
+
 	//
 	// second pass in computing links. Now use the links list to know which are the interacting panels,
 	// and calculate interactions (this is the long part, but in this way it can be done in parallel)
@@ -766,8 +1091,12 @@ int CAutoRefine::AutoRefineLinks(CAutoRefGlobalVars globalVars)
 	// 'm_ulLinkChunkNum' is the number of chunks per block
 	linksPerBlock = AUTOREFINE_LINK_CHUNK_SIZE * m_ulLinkChunkNum[m_ucInteractionLevel];
 
-	// scan all links, in blocks
-	for(linkIndex=0, nodeIndex=0; linkIndex<GetLinksNum(); linkIndex += linksPerBlock)  {
+	// bytes written to the compressed out-of-core files, to report the compression ratio
+	m_dLinksRawBytes = 0.0;
+	m_dLinksDiskBytes = 0.0;
+
+	// scan all links, in blocks (unless already loaded from the link cache)
+	for(linkIndex=0, nodeIndex=0; cacheHit == false && linkIndex<GetLinksNum(); linkIndex += linksPerBlock)  {
 
 		// load data from Mass Memory device (out of core)
 		//
@@ -781,6 +1110,13 @@ int CAutoRefine::AutoRefineLinks(CAutoRefGlobalVars globalVars)
 				return ret;
 			}
 		}
+		// with asynchronous I/O, read the next block while computing the current one
+		if(block + 1 < m_ulBlocksNum) {
+			ret = PrefetchLinks(block + 1, false);
+			if(ret != FC_NORMAL_END) {
+				return ret;
+			}
+		}
 
 		// scan the nodes whose links are in the current block (of course they must be ordered)
 		// but first we need to find where to stop (to avoid scanning all nodes every time)
@@ -794,194 +1130,1001 @@ int CAutoRefine::AutoRefineLinks(CAutoRefGlobalVars globalVars)
 			}
 		}
 
-		// now calculate coefficients of potential
+		// now calculate coefficients of potential
+		//
+		// if the links are evaluated in pairs, the link belonging to the lower node index
+		// computes both coefficients and stores also the opposite one (whose position
+		// has been recorded in the first pass); the opposite link is then skipped. Each
+		// coefficient is written by one thread only, so there is no conflict
+
+		#pragma omp parallel for
+		for(i=nodeIndex; i<(long)nodeBlockEnd; i++) {
+			unsigned long localLinkIndex, localChunk, localPosInChunk, pairPos;
+			unsigned int node2;
+			CAutoElement *element2;
+			double potestim1, potestim2;
+
+			// perform summation
+			for(localLinkIndex = m_pNodes[i]->m_ulLinkIndexStart[m_ucInteractionLevel]; localLinkIndex < m_pNodes[i]->m_ulLinkIndexEnd[m_ucInteractionLevel]; localLinkIndex++) {
+
+				// some of the links could be outside the boundary of the chunk, either on the left
+				// (but not for the first node) or on the right. In this case, skip
+				if(localLinkIndex >= linkIndex) {
+					localChunk = localLinkIndex / AUTOREFINE_LINK_CHUNK_SIZE;
+					localPosInChunk = localLinkIndex % AUTOREFINE_LINK_CHUNK_SIZE;
+					// adjust chunk to position within the current block
+					localChunk -= m_ulLinkChunkNum[m_ucInteractionLevel] * m_ulCurrBlock;
+					// if still within the boundary
+					if(localChunk < m_ulLinkChunkNum[m_ucInteractionLevel]) {
+						// interacting panels have already been identified
+						node2 = m_puiNodeIndexLinks[m_ucInteractionLevel][localChunk][localPosInChunk];
+						element2 = m_pNodes[node2];
+						if(m_bPairLinks == true && IsSymLink(m_pNodes[i], element2) == false) {
+							// only the link of the lower node index computes the pair
+							if(m_pNodes[i]->m_ulNodeIndex[m_ucInteractionLevel] < node2) {
+								pairPos = GetLinkPair(localChunk, localPosInChunk);
+								// calculate both coefficients of potential
+								PotEstimateOpt(m_pNodes[i], element2, potestim1, potestim2);
+								// and store them
+								SetPotCoeffLink(localChunk, localPosInChunk, potestim1);
+								SetPotCoeffLink(pairPos / AUTOREFINE_LINK_CHUNK_SIZE, pairPos % AUTOREFINE_LINK_CHUNK_SIZE, potestim2);
+							}
+						}
+						else {
+							// calculate coefficient of potential
+							PotEstimateOpt(m_pNodes[i], element2, potestim1);
+							// and store it
+							SetPotCoeffLink(localChunk, localPosInChunk, potestim1);
+						}
+					}
+				}
+			}
+		}
+		// and move to next nodeIndex position
+		nodeIndex = nodeBlockEnd - 1;
+
+		// save the links out-of-core, if requested
+		if(m_ulBlocksNum > 1) {
+
+			// with asynchronous I/O, the block is saved in the background while the next one
+			// (already prefetched) is computed; the last block is saved synchronously
+			if(m_bAsyncLinksIO == true && block + 1 < m_ulBlocksNum) {
+				ret = SaveLinksBehind(block + 1, (block + 2 < m_ulBlocksNum) ? block + 2 : AUTOREFINE_NO_BLOCK);
+			}
+			else {
+				ret = SaveLinks();
+			}
+
+			if(ret !=  FC_NORMAL_END) {
+				return ret;
+			}
+		}
+
+	}
+
+	if(m_bCompressLinks == true && m_dLinksRawBytes > 0.0) {
+		LogMsg("Out-of-core link files compressed to %.0f%% of their size\n", 100.0 * m_dLinksDiskBytes / m_dLinksRawBytes);
+	}
+
+	// store the newly computed coefficients of potential for the next runs
+	if(useCache == true && cacheHit == false) {
+		SaveLinkCache(globalVars.m_sLinkCacheDir, cacheKey);
+	}
+
+	// upper level links must be remapped once the bottom level nodes are indexed
+	if(m_ucInteractionLevel != AUTOREFINE_HIER_PRE_0_LEVEL) {
+		m_bRemapUpperLinks = true;
+	}
+
+	// check time
+	finish = omp_get_wtime();
+	m_fDurationRefine = (float)(finish - start);
+
+	return ret;
+}
+
+// Size in bytes of the out-of-core file of a block: all the node index chunks of the block,
+// followed (if 'withPot') by all the coefficient of potential chunks
+unsigned long CAutoRefine::GetBlockFileSize(bool withPot)
+{
+	unsigned long size;
+
+	size = m_ulLinkChunkNum[m_ucInteractionLevel] * AUTOREFINE_LINK_CHUNK_SIZE * sizeof(unsigned int);
+	if(withPot == true) {
+		if(m_bFloatLinks[m_ucInteractionLevel] == true) {
+			size += m_ulLinkChunkNum[m_ucInteractionLevel] * AUTOREFINE_LINK_CHUNK_SIZE * sizeof(float);
+		}
+		else {
+			size += m_ulLinkChunkNum[m_ucInteractionLevel] * AUTOREFINE_LINK_CHUNK_SIZE * sizeof(double);
+		}
+	}
+
+	return size;
+}
+
+// can save both links and coefficients of potential, or only links
+int CAutoRefine::SaveLinks(bool saveAlsoPot)
+{
+	int ret;
+
+	// memory-mapped blocks are written back by the OS
+	if(m_bMmapLinks == true) {
+		return FC_NORMAL_END;
+	}
+
+	// complete any pending background I/O first, so all the blocks are on disk on return
+	ret = WaitLinksIO();
+	if(ret != FC_NORMAL_END) {
+		return ret;
+	}
+
+	return WriteLinksBlock(m_ucInteractionLevel, m_ulCurrBlock, saveAlsoPot, m_puiNodeIndexLinks[m_ucInteractionLevel],
+	                       m_dPotCoeffLinks[m_ucInteractionLevel], m_fPotCoeffLinks[m_ucInteractionLevel]);
+}
+
+int CAutoRefine::LoadLinks(unsigned long block, bool loadAlsoPot)
+{
+	int ret;
+
+	// set the current memory block to the block actually being loaded from disk
+	m_ulCurrBlock = block;
+
+	// memory-mapped blocks are paged in by the OS when accessed
+	if(m_bMmapLinks == true) {
+		return MapLinks(block);
+	}
+
+	// if the I/O thread has been prefetching this block, just wait for it and swap the chunks
+	if(m_bAsyncLinksIO == true) {
+		ret = WaitLinksIO();
+		if(ret != FC_NORMAL_END) {
+			return ret;
+		}
+		if(m_ulShadowBlock == block && (loadAlsoPot == false || m_bIOReadAlsoPot == true)) {
+			SwapLinkBuffers();
+			return FC_NORMAL_END;
+		}
+	}
+
+	return ReadLinksBlock(m_ucInteractionLevel, block, loadAlsoPot, m_puiNodeIndexLinks[m_ucInteractionLevel],
+	                      m_dPotCoeffLinks[m_ucInteractionLevel], m_fPotCoeffLinks[m_ucInteractionLevel]);
+}
+
+// Write 'block' from the given chunks to its own file, one whole chunk per fwrite() call
+// (if compressed, one encoded chunk per call, preceded by its size)
+int CAutoRefine::WriteLinksBlock(unsigned char level, unsigned long block, bool saveAlsoPot, unsigned int **nodeIndexLinks, double **dPotCoeffLinks, float **fPotCoeffLinks)
+{
+	FILE *stream;
+	unsigned long j, numwritten, size;
+	wxFileName tmpFileName;
+	int ret;
+
+	ret = FC_NORMAL_END;
+
+	PortableGetTempFileName(wxT(""), FC_LINK_TMP_FILE_PREFIX, m_ulUniqueBlockIDs[block], tmpFileName);
+	// open the file
+	stream = fopen(tmpFileName.GetLongPath(), "wb");
+	if( stream == NULL ) {
+		ErrMsg("Error: cannot open the temporary file '%s' for writing\n", (const char*)tmpFileName.GetLongPath());
+		return FC_FILE_ERROR;
+	}
+
+	// and write the block to disk: first the node indexes, then the coefficients of potential
+	for(j=0; j< m_ulLinkChunkNum[level] && ret == FC_NORMAL_END; j++) {
+		if(m_bCompressLinks == true) {
+			size = EncodeNodeIndexChunk(nodeIndexLinks[j]);
+			ret = WriteCodecChunk(stream, size);
+			m_dLinksRawBytes += AUTOREFINE_LINK_CHUNK_SIZE * sizeof( unsigned int );
+		}
+		else {
+			numwritten = fwrite( nodeIndexLinks[j], sizeof( unsigned int ), AUTOREFINE_LINK_CHUNK_SIZE, stream );
+			if(numwritten != AUTOREFINE_LINK_CHUNK_SIZE) {
+				ret = FC_FILE_ERROR;
+			}
+		}
+	}
+
+	if(saveAlsoPot == true) {
+		for(j=0; j< m_ulLinkChunkNum[level] && ret == FC_NORMAL_END; j++) {
+			if(m_bCompressLinks == true) {
+				if(m_bFloatLinks[level] == true) {
+					size = EncodePotCoeffChunk(fPotCoeffLinks[j]);
+					m_dLinksRawBytes += AUTOREFINE_LINK_CHUNK_SIZE * sizeof( float );
+				}
+				else {
+					size = EncodePotCoeffChunk(dPotCoeffLinks[j]);
+					m_dLinksRawBytes += AUTOREFINE_LINK_CHUNK_SIZE * sizeof( double );
+				}
+				ret = WriteCodecChunk(stream, size);
+			}
+			else {
+				if(m_bFloatLinks[level] == true) {
+					numwritten = fwrite( fPotCoeffLinks[j], sizeof( float ), AUTOREFINE_LINK_CHUNK_SIZE, stream );
+				}
+				else {
+					numwritten = fwrite( dPotCoeffLinks[j], sizeof( double ), AUTOREFINE_LINK_CHUNK_SIZE, stream );
+				}
+				if(numwritten != AUTOREFINE_LINK_CHUNK_SIZE) {
+					ret = FC_FILE_ERROR;
+				}
+			}
+		}
+	}
+
+	if(ret != FC_NORMAL_END) {
+		ErrMsg("Error: cannot write to temporary out-of-core file, stopping the process\n");
+	}
+
+	fclose(stream);
+
+	return ret;
+}
+
+// Read 'block' from its own file into the given chunks, one whole chunk per fread() call
+// (if compressed, one encoded chunk per call, preceded by its size)
+int CAutoRefine::ReadLinksBlock(unsigned char level, unsigned long block, bool loadAlsoPot, unsigned int **nodeIndexLinks, double **dPotCoeffLinks, float **fPotCoeffLinks)
+{
+	FILE *stream;
+	unsigned long j, numread, size;
+	wxFileName tmpFileName;
+	bool retBool;
+	int ret;
+
+	ret = FC_NORMAL_END;
+
+	PortableGetTempFileName(wxT(""), FC_LINK_TMP_FILE_PREFIX, m_ulUniqueBlockIDs[block], tmpFileName);
+	// open the file
+	stream = fopen(tmpFileName.GetFullPath().c_str(), "rb");
+	if( stream == NULL ) {
+		ErrMsg("Error: cannot open the temporary file '%s' for reading\n", (const char*)tmpFileName.GetFullPath());
+		return FC_FILE_ERROR;
+	}
+
+	// and read the block from disk: first the node indexes, then the coefficients of potential
+	for(j=0; j< m_ulLinkChunkNum[level] && ret == FC_NORMAL_END; j++) {
+		if(m_bCompressLinks == true) {
+			ret = ReadCodecChunk(stream, size);
+			if(ret == FC_NORMAL_END && DecodeNodeIndexChunk(size, nodeIndexLinks[j]) == false) {
+				ret = FC_GENERIC_ERROR;
+			}
+		}
+		else {
+			numread = fread( nodeIndexLinks[j], sizeof( unsigned int ), AUTOREFINE_LINK_CHUNK_SIZE, stream );
+			if(numread != AUTOREFINE_LINK_CHUNK_SIZE) {
+				ret = FC_FILE_ERROR;
+			}
+		}
+	}
+
+	if(loadAlsoPot == true) {
+		for(j=0; j< m_ulLinkChunkNum[level] && ret == FC_NORMAL_END; j++) {
+			if(m_bCompressLinks == true) {
+				ret = ReadCodecChunk(stream, size);
+				if(ret == FC_NORMAL_END) {
+					if(m_bFloatLinks[level] == true) {
+						retBool = DecodePotCoeffChunk(size, fPotCoeffLinks[j]);
+					}
+					else {
+						retBool = DecodePotCoeffChunk(size, dPotCoeffLinks[j]);
+					}
+					if(retBool == false) {
+						ret = FC_GENERIC_ERROR;
+					}
+				}
+			}
+			else {
+				if(m_bFloatLinks[level] == true) {
+					numread = fread( fPotCoeffLinks[j], sizeof( float ), AUTOREFINE_LINK_CHUNK_SIZE, stream );
+				}
+				else {
+					numread = fread( dPotCoeffLinks[j], sizeof( double ), AUTOREFINE_LINK_CHUNK_SIZE, stream );
+				}
+				if(numread != AUTOREFINE_LINK_CHUNK_SIZE) {
+					ret = FC_FILE_ERROR;
+				}
+			}
+		}
+	}
+
+	if(ret == FC_GENERIC_ERROR) {
+		ErrMsg("Error: corrupted compressed out-of-core file, stopping the process\n");
+	}
+	else if(ret != FC_NORMAL_END) {
+		if(feof(stream)) {
+			ErrMsg("Error: unexpected end-of-file of temporary out-of-core file, stopping the process\n");
+		}
+		else {
+			ErrMsg("Error: cannot read from temporary out-of-core file, stopping the process\n");
+		}
+	}
+
+	fclose(stream);
+
+	return ret;
+}
+
+// Write the chunk encoded in 'm_pucCodecBuffer' ('size' bytes), preceded by its size
+int CAutoRefine::WriteCodecChunk(FILE *stream, unsigned long size)
+{
+	unsigned int fileSize;
+
+	fileSize = (unsigned int)size;
+	if(fwrite( &fileSize, sizeof( unsigned int ), 1, stream ) != 1) {
+		return FC_FILE_ERROR;
+	}
+	if(fwrite( m_pucCodecBuffer, sizeof( unsigned char ), size, stream ) != size) {
+		return FC_FILE_ERROR;
+	}
+	m_dLinksDiskBytes += sizeof( unsigned int ) + size;
+
+	return FC_NORMAL_END;
+}
+
+// Read an encoded chunk into 'm_pucCodecBuffer', returning its size
+int CAutoRefine::ReadCodecChunk(FILE *stream, unsigned long &size)
+{
+	unsigned int fileSize;
+
+	if(fread( &fileSize, sizeof( unsigned int ), 1, stream ) != 1) {
+		return FC_FILE_ERROR;
+	}
+	size = fileSize;
+	if(size > AUTOREFINE_CODEC_BUFFER_SIZE) {
+		return FC_GENERIC_ERROR;
+	}
+	if(fread( m_pucCodecBuffer, sizeof( unsigned char ), size, stream ) != size) {
+		return FC_FILE_ERROR;
+	}
+
+	return FC_NORMAL_END;
+}
+
+// Out-of-core chunk codec
+//
+// Each value is stored as a variable-length integer (7 bits per byte, the high bit
+// flagging that more bytes follow), so small values take few bytes:
+// - node indexes are stored as the difference from the previous index in the chunk
+//   (links of a node mostly point to nearby nodes, so differences are small), zig-zag
+//   mapped to be unsigned
+// - coefficients of potential are stored as the XOR of their bit pattern with the previous
+//   coefficient in the chunk: coefficients along the links of a node vary smoothly, so
+//   they share sign, exponent and the leading mantissa bits, that XOR to zero
+// The codec is lossless; lossy compression is obtained storing the coefficients
+// in single precision in the first place (see m_bFloatLinks)
+
+static inline unsigned char *PutVarint(unsigned char *buffer, wxUint64 value)
+{
+	while(value >= 0x80) {
+		*buffer++ = (unsigned char)(value | 0x80);
+		value >>= 7;
+	}
+	*buffer++ = (unsigned char)value;
+
+	return buffer;
+}
+
+// returns NULL if the value is truncated by 'end' or too long
+static inline unsigned char *GetVarint(unsigned char *buffer, unsigned char *end, wxUint64 &value)
+{
+	unsigned int shift;
+
+	value = 0;
+	for(shift = 0; shift < 64 && buffer < end; shift += 7) {
+		value |= ((wxUint64)(*buffer & 0x7F)) << shift;
+		if( (*buffer++ & 0x80) == 0) {
+			return buffer;
+		}
+	}
+
+	return NULL;
+}
+
+unsigned long CAutoRefine::EncodeNodeIndexChunk(unsigned int *nodeIndexLinks)
+{
+	unsigned long k;
+	unsigned char *buffer;
+	wxInt64 delta, prevIndex;
+
+	buffer = m_pucCodecBuffer;
+	prevIndex = 0;
+	for(k=0; k<AUTOREFINE_LINK_CHUNK_SIZE; k++) {
+		delta = (wxInt64)nodeIndexLinks[k] - prevIndex;
+		prevIndex = (wxInt64)nodeIndexLinks[k];
+		buffer = PutVarint(buffer, ((wxUint64)delta << 1) ^ (wxUint64)(delta >> 63));
+	}
+
+	return (unsigned long)(buffer - m_pucCodecBuffer);
+}
+
+unsigned long CAutoRefine::EncodePotCoeffChunk(double *potCoeffLinks)
+{
+	unsigned long k;
+	unsigned char *buffer;
+	wxUint64 bits, prevBits;
+
+	buffer = m_pucCodecBuffer;
+	prevBits = 0;
+	for(k=0; k<AUTOREFINE_LINK_CHUNK_SIZE; k++) {
+		memcpy(&bits, &potCoeffLinks[k], sizeof(wxUint64));
+		buffer = PutVarint(buffer, bits ^ prevBits);
+		prevBits = bits;
+	}
+
+	return (unsigned long)(buffer - m_pucCodecBuffer);
+}
+
+unsigned long CAutoRefine::EncodePotCoeffChunk(float *potCoeffLinks)
+{
+	unsigned long k;
+	unsigned char *buffer;
+	wxUint32 bits, prevBits;
+
+	buffer = m_pucCodecBuffer;
+	prevBits = 0;
+	for(k=0; k<AUTOREFINE_LINK_CHUNK_SIZE; k++) {
+		memcpy(&bits, &potCoeffLinks[k], sizeof(wxUint32));
+		buffer = PutVarint(buffer, bits ^ prevBits);
+		prevBits = bits;
+	}
+
+	return (unsigned long)(buffer - m_pucCodecBuffer);
+}
+
+bool CAutoRefine::DecodeNodeIndexChunk(unsigned long size, unsigned int *nodeIndexLinks)
+{
+	unsigned long k;
+	unsigned char *buffer, *end;
+	wxUint64 value;
+	wxInt64 prevIndex;
+
+	buffer = m_pucCodecBuffer;
+	end = m_pucCodecBuffer + size;
+	prevIndex = 0;
+	for(k=0; k<AUTOREFINE_LINK_CHUNK_SIZE; k++) {
+		buffer = GetVarint(buffer, end, value);
+		if(buffer == NULL) {
+			return false;
+		}
+		prevIndex += (wxInt64)(value >> 1) ^ -((wxInt64)(value & 1));
+		nodeIndexLinks[k] = (unsigned int)prevIndex;
+	}
+
+	return (buffer == end);
+}
+
+bool CAutoRefine::DecodePotCoeffChunk(unsigned long size, double *potCoeffLinks)
+{
+	unsigned long k;
+	unsigned char *buffer, *end;
+	wxUint64 value, bits;
+
+	buffer = m_pucCodecBuffer;
+	end = m_pucCodecBuffer + size;
+	bits = 0;
+	for(k=0; k<AUTOREFINE_LINK_CHUNK_SIZE; k++) {
+		buffer = GetVarint(buffer, end, value);
+		if(buffer == NULL) {
+			return false;
+		}
+		bits ^= value;
+		memcpy(&potCoeffLinks[k], &bits, sizeof(wxUint64));
+	}
+
+	return (buffer == end);
+}
+
+bool CAutoRefine::DecodePotCoeffChunk(unsigned long size, float *potCoeffLinks)
+{
+	unsigned long k;
+	unsigned char *buffer, *end;
+	wxUint64 value;
+	wxUint32 bits;
+
+	buffer = m_pucCodecBuffer;
+	end = m_pucCodecBuffer + size;
+	bits = 0;
+	for(k=0; k<AUTOREFINE_LINK_CHUNK_SIZE; k++) {
+		buffer = GetVarint(buffer, end, value);
+		if(buffer == NULL) {
+			return false;
+		}
+		bits ^= (wxUint32)value;
+		memcpy(&potCoeffLinks[k], &bits, sizeof(wxUint32));
+	}
+
+	return (buffer == end);
+}
+
+// Link cache: the coefficients of potential computed by the second link pass are stored
+// on disk, and loaded back by a following run with the same refined geometry and options,
+// instead of being computed again. The cache file name holds the key (see GetLinkCacheKey()),
+// and the key is stored also in the file header, together with the number of links
+
+// FNV-1a hash of 'size' bytes, continuing from 'hash'
+static wxUint64 HashBytes(wxUint64 hash, const void *data, unsigned long size)
+{
+	const unsigned char *bytes;
+	unsigned long k;
+
+	bytes = (const unsigned char*)data;
+	for(k=0; k<size; k++) {
+		hash ^= bytes[k];
+		hash *= AUTOREFINE_FNV_PRIME;
+	}
+
+	return hash;
+}
+
+// Key of the link cache: hash of the options affecting the coefficients of potential,
+// of the refined geometry (the nodes), and of the links found by the first link pass
+wxUint64 CAutoRefine::GetLinkCacheKey()
+{
+	wxUint64 hash;
+	unsigned long k, j, linksNum;
+	double selfPot;
+	unsigned int version;
+	CAutoElement *element;
+
+	hash = AUTOREFINE_FNV_OFFSET;
+
+	// options
+	version = AUTOREFINE_LINK_CACHE_VERSION;
+	hash = HashBytes(hash, &version, sizeof(unsigned int));
+	hash = HashBytes(hash, &m_ucInteractionLevel, sizeof(unsigned char));
+	hash = HashBytes(hash, &m_clsGlobalVars.m_cScheme, sizeof(char));
+	hash = HashBytes(hash, &m_clsGlobalVars.m_dEps, sizeof(double));
+	hash = HashBytes(hash, &m_clsGlobalVars.m_dEpsRatio, sizeof(double));
+	hash = HashBytes(hash, &m_clsGlobalVars.m_ucHasCmplxPerm, sizeof(unsigned char));
+	hash = HashBytes(hash, &m_bFloatLinks[m_ucInteractionLevel], sizeof(bool));
+	hash = HashBytes(hash, &m_bFarLinks[m_ucInteractionLevel], sizeof(bool));
+	hash = HashBytes(hash, &m_bSymLinks[m_ucInteractionLevel], sizeof(bool));
+
+	// nodes, in the same order used by the second link pass
+	for(k=0; k<m_ulNodeNum[AUTOREFINE_HIER_PRE_0_LEVEL]; k++) {
+		element = m_pNodes[k];
+		hash = HashBytes(hash, &element->m_ucType, sizeof(unsigned char));
+		hash = HashBytes(hash, &element->m_ucDielIndex, sizeof(unsigned char));
+		hash = HashBytes(hash, &element->m_dDimension, sizeof(double));
+		hash = HashBytes(hash, &element->m_ulLinkIndexStart[m_ucInteractionLevel], sizeof(unsigned long));
+		hash = HashBytes(hash, &element->m_ulLinkIndexEnd[m_ucInteractionLevel], sizeof(unsigned long));
+		if(element->GetClass() == AUTOELEMENT_SEGMENT) {
+			hash = HashBytes(hash, ((CAutoSegment*)element)->m_clsVertex, sizeof(((CAutoSegment*)element)->m_clsVertex));
+		}
+		else {
+			hash = HashBytes(hash, ((CAutoPanel*)element)->m_clsVertex, sizeof(((CAutoPanel*)element)->m_clsVertex));
+		}
+	}
+
+	// self-potentials (they depend also on the permittivities, for dielectric panels)
+	for(k=0; k<m_ulPanelNum[AUTOREFINE_HIER_PRE_0_LEVEL]; k++) {
+		selfPot = m_clsSelfPotCoeff[k];
+		hash = HashBytes(hash, &selfPot, sizeof(double));
+		if( m_clsGlobalVars.m_ucHasCmplxPerm != AUTOREFINE_REAL_PERM) {
+			selfPot = m_clsImgSelfPotCoeff[k];
+			hash = HashBytes(hash, &selfPot, sizeof(double));
+		}
+	}
+
+	// links
+	linksNum = m_ulLinksNum[m_ucInteractionLevel];
+	for(j=0; j<m_ulLinkChunkNum[m_ucInteractionLevel] && linksNum > 0; j++) {
+		k = (linksNum < AUTOREFINE_LINK_CHUNK_SIZE) ? linksNum : AUTOREFINE_LINK_CHUNK_SIZE;
+		hash = HashBytes(hash, m_puiNodeIndexLinks[m_ucInteractionLevel][j], k * sizeof(unsigned int));
+		linksNum -= k;
+	}
+
+	return hash;
+}
+
+void CAutoRefine::GetLinkCacheFileName(const std::string &cacheDir, wxUint64 key, wxFileName &cacheFileName)
+{
+	wxString name;
+
+	name = wxString::Format(wxT("fastercap_links_%d_%08lx%08lx.fcl"), (int)m_ucInteractionLevel,
+	                        (unsigned long)(key >> 32), (unsigned long)(key & 0xFFFFFFFF));
+	cacheFileName.Assign(wxString(cacheDir.c_str()), name);
+}
+
+// Load the coefficients of potential from the link cache, if there is a matching cache file
+// ('loaded' is then true). Returns an error only if a matching file cannot be read
+int CAutoRefine::LoadLinkCache(const std::string &cacheDir, wxUint64 key, bool &loaded)
+{
+	FILE *stream;
+	wxFileName cacheFileName;
+	char magic[4];
+	unsigned int version;
+	wxUint64 fileKey, linksNum;
+	unsigned char floatLinks;
+	unsigned long j, numread;
+	int ret;
+
+	loaded = false;
+
+	GetLinkCacheFileName(cacheDir, key, cacheFileName);
+	stream = fopen(cacheFileName.GetFullPath().c_str(), "rb");
+	if( stream == NULL ) {
+		// no cache file yet
+		return FC_NORMAL_END;
+	}
+
+	// check the header
+	if( fread(magic, sizeof(char), 4, stream) != 4 || memcmp(magic, AUTOREFINE_LINK_CACHE_MAGIC, 4) != 0 ||
+	        fread(&version, sizeof(unsigned int), 1, stream) != 1 || version != AUTOREFINE_LINK_CACHE_VERSION ||
+	        fread(&fileKey, sizeof(wxUint64), 1, stream) != 1 || fileKey != key ||
+	        fread(&linksNum, sizeof(wxUint64), 1, stream) != 1 || linksNum != (wxUint64)m_ulLinksNum[m_ucInteractionLevel] ||
+	        fread(&floatLinks, sizeof(unsigned char), 1, stream) != 1 || (floatLinks != 0) != m_bFloatLinks[m_ucInteractionLevel] ) {
+		ErrMsg("Warning: link cache file '%s' does not match, computing the links again\n", (const char*)cacheFileName.GetFullPath());
+		fclose(stream);
+		return FC_NORMAL_END;
+	}
+
+	// and read the coefficients of potential, one whole chunk per fread() call
+	ret = FC_NORMAL_END;
+	for(j=0; j< m_ulLinkChunkNum[m_ucInteractionLevel] && ret == FC_NORMAL_END; j++) {
+		if(m_bFloatLinks[m_ucInteractionLevel] == true) {
+			numread = fread( m_fPotCoeffLinks[m_ucInteractionLevel][j], sizeof( float ), AUTOREFINE_LINK_CHUNK_SIZE, stream );
+		}
+		else {
+			numread = fread( m_dPotCoeffLinks[m_ucInteractionLevel][j], sizeof( double ), AUTOREFINE_LINK_CHUNK_SIZE, stream );
+		}
+		if(numread != AUTOREFINE_LINK_CHUNK_SIZE) {
+			ErrMsg("Error: cannot read from link cache file '%s', stopping the process\n", (const char*)cacheFileName.GetFullPath());
+			ErrMsg("       Remove the file to compute the links again\n");
+			ret = FC_FILE_ERROR;
+		}
+	}
+
+	fclose(stream);
+
+	if(ret == FC_NORMAL_END) {
+		LogMsg("Interaction coefficients loaded from link cache file '%s'\n", (const char*)cacheFileName.GetFullPath());
+		loaded = true;
+	}
+
+	return ret;
+}
+
+// Store the coefficients of potential in the link cache. The file is written under a temporary
+// name and then renamed, so a partially written cache file is never loaded.
+// Failures are not fatal, the links are just not cached
+void CAutoRefine::SaveLinkCache(const std::string &cacheDir, wxUint64 key)
+{
+	FILE *stream;
+	wxFileName cacheFileName;
+	wxString tmpFileName;
+	unsigned int version;
+	wxUint64 linksNum;
+	unsigned char floatLinks;
+	unsigned long j, numwritten;
+	bool retBool;
+
+	GetLinkCacheFileName(cacheDir, key, cacheFileName);
+	tmpFileName = cacheFileName.GetFullPath() + wxT(".tmp");
+
+	stream = fopen(tmpFileName.c_str(), "wb");
+	if( stream == NULL ) {
+		ErrMsg("Warning: cannot open the link cache file '%s' for writing, links not cached\n", (const char*)tmpFileName);
+		return;
+	}
+
+	// header
+	version = AUTOREFINE_LINK_CACHE_VERSION;
+	linksNum = m_ulLinksNum[m_ucInteractionLevel];
+	floatLinks = (m_bFloatLinks[m_ucInteractionLevel] == true) ? 1 : 0;
+	retBool = ( fwrite(AUTOREFINE_LINK_CACHE_MAGIC, sizeof(char), 4, stream) == 4 &&
+	            fwrite(&version, sizeof(unsigned int), 1, stream) == 1 &&
+	            fwrite(&key, sizeof(wxUint64), 1, stream) == 1 &&
+	            fwrite(&linksNum, sizeof(wxUint64), 1, stream) == 1 &&
+	            fwrite(&floatLinks, sizeof(unsigned char), 1, stream) == 1 );
+
+	// coefficients of potential, one whole chunk per fwrite() call
+	for(j=0; j< m_ulLinkChunkNum[m_ucInteractionLevel] && retBool == true; j++) {
+		if(m_bFloatLinks[m_ucInteractionLevel] == true) {
+			numwritten = fwrite( m_fPotCoeffLinks[m_ucInteractionLevel][j], sizeof( float ), AUTOREFINE_LINK_CHUNK_SIZE, stream );
+		}
+		else {
+			numwritten = fwrite( m_dPotCoeffLinks[m_ucInteractionLevel][j], sizeof( double ), AUTOREFINE_LINK_CHUNK_SIZE, stream );
+		}
+		retBool = (numwritten == AUTOREFINE_LINK_CHUNK_SIZE);
+	}
+
+	if(fclose(stream) != 0) {
+		retBool = false;
+	}
+
+	if(retBool == true) {
+		retBool = wxRenameFile(tmpFileName, cacheFileName.GetFullPath(), true);
+	}
+
+	if(retBool == false) {
+		ErrMsg("Warning: cannot write the link cache file '%s', links not cached\n", (const char*)cacheFileName.GetFullPath());
+		remove((const char*)tmpFileName);
+	}
+}
+
+// Out-of-core with asynchronous I/O, start reading 'block' into the shadow chunks in the background,
+// so that the following LoadLinks() of the same block only needs to swap the chunks.
+// Does nothing if the I/O is synchronous, or if the I/O thread is still busy
+int CAutoRefine::PrefetchLinks(unsigned long block, bool loadAlsoPot)
+{
+	if(m_bAsyncLinksIO == false || m_pLinksIOThread != NULL || block == m_ulCurrBlock) {
+		return FC_NORMAL_END;
+	}
+
+	return StartLinksIO(AUTOREFINE_NO_BLOCK, false, block, loadAlsoPot);
+}
+
+// Out-of-core with asynchronous I/O, hand the current block over to the I/O thread to be saved
+// (coefficients of potential included), and make current 'nextBlock', that should have been
+// prefetched by PrefetchLinks(). The I/O thread then goes on reading the node indexes of 'prefetchBlock'
+int CAutoRefine::SaveLinksBehind(unsigned long nextBlock, unsigned long prefetchBlock)
+{
+	unsigned long savedBlock;
+	int ret;
+
+	ret = WaitLinksIO();
+	if(ret != FC_NORMAL_END) {
+		return ret;
+	}
+
+	// if 'nextBlock' has not been prefetched, fall back to synchronous I/O
+	if(m_ulShadowBlock != nextBlock) {
+		ret = SaveLinks();
+		if(ret != FC_NORMAL_END) {
+			return ret;
+		}
+		ret = LoadLinks(nextBlock, false);
+		if(ret != FC_NORMAL_END || prefetchBlock == AUTOREFINE_NO_BLOCK) {
+			return ret;
+		}
+		return PrefetchLinks(prefetchBlock, false);
+	}
+
+	savedBlock = m_ulCurrBlock;
+	// after the swap, the shadow chunks hold the block to be saved
+	SwapLinkBuffers();
 
-		#pragma omp parallel for
-		for(i=nodeIndex; i<(long)nodeBlockEnd; i++) {
-			unsigned long localLinkIndex, localChunk, localPosInChunk;
-			CAutoElement *element2;
-			double potestim1;
+	return StartLinksIO(savedBlock, true, prefetchBlock, false);
+}
 
-			// perform summation
-			for(localLinkIndex = m_pNodes[i]->m_ulLinkIndexStart[m_ucInteractionLevel]; localLinkIndex < m_pNodes[i]->m_ulLinkIndexEnd[m_ucInteractionLevel]; localLinkIndex++) {
+// Start the I/O thread on the shadow chunks: first write them as 'writeBlock', then read 'readBlock'
+// into them (either can be AUTOREFINE_NO_BLOCK). If the thread cannot be started, the I/O is
+// performed synchronously. In both cases, the result is returned by WaitLinksIO()
+int CAutoRefine::StartLinksIO(unsigned long writeBlock, bool writeAlsoPot, unsigned long readBlock, bool readAlsoPot)
+{
+	int ret;
 
-				// some of the links could be outside the boundary of the chunk, either on the left
-				// (but not for the first node) or on the right. In this case, skip
-				if(localLinkIndex >= linkIndex) {
-					localChunk = localLinkIndex / AUTOREFINE_LINK_CHUNK_SIZE;
-					localPosInChunk = localLinkIndex % AUTOREFINE_LINK_CHUNK_SIZE;
-					// adjust chunk to position within the current block
-					localChunk -= m_ulLinkChunkNum[m_ucInteractionLevel] * m_ulCurrBlock;
-					// if still within the boundary
-					if(localChunk < m_ulLinkChunkNum[m_ucInteractionLevel]) {
-						// interacting panels have already been identified
-						element2 = m_pdPanelPtrLinks[m_ucInteractionLevel][localChunk][localPosInChunk];
-						// calculate coefficient of potential
-						PotEstimateOpt(m_pNodes[i], element2, potestim1);
-						// and store it
-						m_dPotCoeffLinks[m_ucInteractionLevel][localChunk][localPosInChunk] = potestim1;
-					}
-				}
-			}
-		}
-		// and move to next nodeIndex position
-		nodeIndex = nodeBlockEnd - 1;
+	// only one I/O operation at a time can work on the shadow chunks
+	ret = WaitLinksIO();
+	if(ret != FC_NORMAL_END) {
+		return ret;
+	}
 
-		// save the links out-of-core, if requested
-		if(m_ulBlocksNum > 1) {
+	m_ulIOWriteBlock = writeBlock;
+	m_bIOWriteAlsoPot = writeAlsoPot;
+	m_ulShadowBlock = readBlock;
+	m_bIOReadAlsoPot = readAlsoPot;
+	m_iIORet = FC_NORMAL_END;
 
-			ret = SaveLinks();
+	m_pLinksIOThread = new CLinksIOThread(this);
+	if(m_pLinksIOThread->Create() != wxTHREAD_NO_ERROR || m_pLinksIOThread->Run() != wxTHREAD_NO_ERROR) {
+		delete m_pLinksIOThread;
+		m_pLinksIOThread = NULL;
+		m_iIORet = RunLinksIO();
+	}
 
-			if(ret !=  FC_NORMAL_END) {
-				return ret;
-			}
-		}
+	return FC_NORMAL_END;
+}
+
+// Wait for the I/O thread to complete, and return the result of the I/O
+int CAutoRefine::WaitLinksIO()
+{
+	int ret;
 
+	if(m_pLinksIOThread != NULL) {
+		m_pLinksIOThread->Wait();
+		delete m_pLinksIOThread;
+		m_pLinksIOThread = NULL;
 	}
 
-	// check time
-	finish = omp_get_wtime();
-	m_fDurationRefine = (float)(finish - start);
+	// report errors only once
+	ret = m_iIORet;
+	m_iIORet = FC_NORMAL_END;
+
+	// in case of error, the content of the shadow chunks is unknown
+	if(ret != FC_NORMAL_END) {
+		m_ulShadowBlock = AUTOREFINE_NO_BLOCK;
+	}
 
 	return ret;
 }
 
-// can save both links and coefficients of potential, or only links
-int CAutoRefine::SaveLinks(bool saveAlsoPot)
+// Body of the I/O thread (see StartLinksIO()). Out-of-core is only at the bottom level
+int CAutoRefine::RunLinksIO()
 {
-	FILE *stream;
-	unsigned long j, k, start;
-	wxFileName tmpFileName;
-	int numwritten, ret;
+	int ret;
 
 	ret = FC_NORMAL_END;
 
-	for(j=0; j< m_ulLinkChunkNum[m_ucInteractionLevel]; j++) {
-		// current start of chunks block
-		start  = m_ulCurrBlock * m_ulLinkChunkNum[m_ucInteractionLevel];
-
-		PortableGetTempFileName(wxT(""), FC_LINK_TMP_FILE_PREFIX, m_ulUniqueLinkChunkIDs[start + j], tmpFileName);
-		// open the file
-		stream = fopen(tmpFileName.GetLongPath(), "wb");
-		if( stream == NULL ) {
-			ErrMsg("Error: cannot open the temporary file '%s' for writing\n", (const char*)tmpFileName.GetLongPath());
-			return FC_FILE_ERROR;
-		}
+	if(m_ulIOWriteBlock != AUTOREFINE_NO_BLOCK) {
+		ret = WriteLinksBlock(AUTOREFINE_HIER_PRE_0_LEVEL, m_ulIOWriteBlock, m_bIOWriteAlsoPot, m_puiShadowNodeIndexLinks,
+		                      m_dShadowPotCoeffLinks, m_fShadowPotCoeffLinks);
+	}
+	if(ret == FC_NORMAL_END && m_ulShadowBlock != AUTOREFINE_NO_BLOCK) {
+		ret = ReadLinksBlock(AUTOREFINE_HIER_PRE_0_LEVEL, m_ulShadowBlock, m_bIOReadAlsoPot, m_puiShadowNodeIndexLinks,
+		                     m_dShadowPotCoeffLinks, m_fShadowPotCoeffLinks);
+	}
 
-		// and write current chunk to disk
-		for(k = 0; k < AUTOREFINE_LINK_CHUNK_SIZE; k++) {
-			numwritten = fwrite( &m_pdPanelPtrLinks[m_ucInteractionLevel][j][k], sizeof( CAutoPanel* ), 1, stream );
-			if(numwritten != 1) {
-				ErrMsg("Error: cannot write to temporary out-of-core file, stopping the process\n");
-				j = m_ulLinkChunkNum[m_ucInteractionLevel];
-				ret = FC_FILE_ERROR;
-				break;
-			}
-		}
+	return ret;
+}
 
-		fclose(stream);
+// Swap the current chunks with the shadow ones, making current the block held by the latter
+void CAutoRefine::SwapLinkBuffers()
+{
+	unsigned int **nodeIndexLinks;
+	double **dPotCoeffLinks;
+	float **fPotCoeffLinks;
 
-		if(saveAlsoPot == true && j < m_ulLinkChunkNum[m_ucInteractionLevel]) {
-			PortableGetTempFileName(wxT(""), FC_POT_TMP_FILE_PREFIX, m_ulUniquePotChunkIDs[start + j], tmpFileName);
-			// open the file
-			stream = fopen(tmpFileName.GetLongPath(), "wb");
-			if( stream == NULL ) {
-				ErrMsg("Error: cannot open the temporary file '%s' for writing\n", (const char*)tmpFileName.GetLongPath());
-				return FC_FILE_ERROR;
-			}
-
-			// and write current chunk to disk
-			for(k = 0; k < AUTOREFINE_LINK_CHUNK_SIZE; k++) {
-				numwritten = fwrite( &m_dPotCoeffLinks[m_ucInteractionLevel][j][k], sizeof( double ), 1, stream );
-				if(numwritten != 1) {
-					ErrMsg("Error: cannot write to temporary out-of-core file, stopping the process\n");
-					j = m_ulLinkChunkNum[m_ucInteractionLevel];
-					ret = FC_FILE_ERROR;
-					break;
-				}
-			}
+	nodeIndexLinks = m_puiNodeIndexLinks[AUTOREFINE_HIER_PRE_0_LEVEL];
+	m_puiNodeIndexLinks[AUTOREFINE_HIER_PRE_0_LEVEL] = m_puiShadowNodeIndexLinks;
+	m_puiShadowNodeIndexLinks = nodeIndexLinks;
+
+	dPotCoeffLinks = m_dPotCoeffLinks[AUTOREFINE_HIER_PRE_0_LEVEL];
+	m_dPotCoeffLinks[AUTOREFINE_HIER_PRE_0_LEVEL] = m_dShadowPotCoeffLinks;
+	m_dShadowPotCoeffLinks = dPotCoeffLinks;
+
+	fPotCoeffLinks = m_fPotCoeffLinks[AUTOREFINE_HIER_PRE_0_LEVEL];
+	m_fPotCoeffLinks[AUTOREFINE_HIER_PRE_0_LEVEL] = m_fShadowPotCoeffLinks;
+	m_fShadowPotCoeffLinks = fPotCoeffLinks;
+
+	m_ulCurrBlock = m_ulShadowBlock;
+	// the shadow chunks now hold the previous current block, not tracked any more
+	m_ulShadowBlock = AUTOREFINE_NO_BLOCK;
+}
+
+// Wait for the I/O thread, and delete the shadow chunks
+void CAutoRefine::DeleteShadowLinks()
+{
+	unsigned long j;
+
+	WaitLinksIO();
 
-			fclose(stream);
+	if(m_dShadowPotCoeffLinks != NULL) {
+		for(j=0; j<m_ulLinkChunkNum[AUTOREFINE_HIER_PRE_0_LEVEL]; j++) {
+			if(m_dShadowPotCoeffLinks[j] != NULL) {
+				delete m_dShadowPotCoeffLinks[j];
+			}
+		}
+		delete m_dShadowPotCoeffLinks;
+		m_dShadowPotCoeffLinks = NULL;
+	}
+	if(m_fShadowPotCoeffLinks != NULL) {
+		for(j=0; j<m_ulLinkChunkNum[AUTOREFINE_HIER_PRE_0_LEVEL]; j++) {
+			if(m_fShadowPotCoeffLinks[j] != NULL) {
+				delete m_fShadowPotCoeffLinks[j];
+			}
 		}
+		delete m_fShadowPotCoeffLinks;
+		m_fShadowPotCoeffLinks = NULL;
+	}
+	if(m_puiShadowNodeIndexLinks != NULL) {
+		for(j=0; j<m_ulLinkChunkNum[AUTOREFINE_HIER_PRE_0_LEVEL]; j++) {
+			if(m_puiShadowNodeIndexLinks[j] != NULL) {
+				delete m_puiShadowNodeIndexLinks[j];
+			}
+		}
+		delete m_puiShadowNodeIndexLinks;
+		m_puiShadowNodeIndexLinks = NULL;
 	}
 
-	return ret;
+	m_bAsyncLinksIO = false;
+	m_ulShadowBlock = AUTOREFINE_NO_BLOCK;
 }
 
-int CAutoRefine::LoadLinks(unsigned long block, bool loadAlsoPot)
+CLinksIOThread::CLinksIOThread(CAutoRefine *autoRefine)
+	: wxThread(wxTHREAD_JOINABLE)
 {
-	FILE *stream;
-	unsigned long j, k, start;
+	m_pAutoRefine = autoRefine;
+}
+
+void *CLinksIOThread::Entry()
+{
+	m_pAutoRefine->m_iIORet = m_pAutoRefine->RunLinksIO();
+
+	return NULL;
+}
+
+// Map the file of 'block' into memory, and point the link chunks into it
+// (see GetBlockFileSize() for the file layout). The file is sized for both node indexes
+// and coefficients of potential, so the first link pass can map it before writing
+int CAutoRefine::MapLinks(unsigned long block)
+{
+#ifndef __WXMSW__
+	int fd;
+	unsigned long j, indexSize;
+	unsigned char *base;
 	wxFileName tmpFileName;
-	int numwritten, ret;
 
-	ret = FC_NORMAL_END;
+	// release the block currently mapped, if any; being a shared mapping,
+	// any modification is written back to the file
+	UnmapLinks();
 
-	// set the current memory block to the block actually being loaded from disk
 	m_ulCurrBlock = block;
 
+	PortableGetTempFileName(wxT(""), FC_LINK_TMP_FILE_PREFIX, m_ulUniqueBlockIDs[block], tmpFileName);
+	fd = open(tmpFileName.GetFullPath().c_str(), O_RDWR);
+	if( fd == -1 ) {
+		ErrMsg("Error: cannot open the temporary file '%s' for mapping\n", (const char*)tmpFileName.GetFullPath());
+		return FC_FILE_ERROR;
+	}
+
+	m_ulMappedBlockSize = GetBlockFileSize(true);
+	// the file is created empty (see PortableGetTempFileName())
+	if( ftruncate(fd, (off_t)m_ulMappedBlockSize) != 0 ) {
+		ErrMsg("Error: cannot resize the temporary file '%s' for mapping\n", (const char*)tmpFileName.GetFullPath());
+		close(fd);
+		return FC_FILE_ERROR;
+	}
+
+	m_pMappedBlock = mmap(NULL, m_ulMappedBlockSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	// the mapping is kept even after closing the file descriptor
+	close(fd);
+	if( m_pMappedBlock == MAP_FAILED ) {
+		ErrMsg("Error: cannot map the temporary file '%s' into memory\n", (const char*)tmpFileName.GetFullPath());
+		m_pMappedBlock = NULL;
+		m_ulMappedBlockSize = 0;
+		return FC_FILE_ERROR;
+	}
+	m_ucMappedLevel = m_ucInteractionLevel;
+
+	// links are streamed by the multiplication
+	madvise(m_pMappedBlock, m_ulMappedBlockSize, MADV_SEQUENTIAL);
+
+	base = (unsigned char*)m_pMappedBlock;
+	indexSize = GetBlockFileSize(false);
 	for(j=0; j< m_ulLinkChunkNum[m_ucInteractionLevel]; j++) {
-		// current start of chunks block
-		start  = m_ulCurrBlock * m_ulLinkChunkNum[m_ucInteractionLevel];
-
-		PortableGetTempFileName(wxT(""), FC_LINK_TMP_FILE_PREFIX, m_ulUniqueLinkChunkIDs[start + j], tmpFileName);
-		// open the file
-		stream = fopen(tmpFileName.GetFullPath().c_str(), "rb");
-		if( stream == NULL ) {
-			ErrMsg("Error: cannot open the temporary file '%s' for reading\n", (const char*)tmpFileName.GetFullPath());
-			return FC_FILE_ERROR;
+		m_puiNodeIndexLinks[m_ucInteractionLevel][j] = (unsigned int*)(base + j * AUTOREFINE_LINK_CHUNK_SIZE * sizeof(unsigned int));
+		if(m_bFloatLinks[m_ucInteractionLevel] == true) {
+			m_fPotCoeffLinks[m_ucInteractionLevel][j] = (float*)(base + indexSize + j * AUTOREFINE_LINK_CHUNK_SIZE * sizeof(float));
 		}
-
-		// and read the current chunk from disk
-		for(k = 0; k < AUTOREFINE_LINK_CHUNK_SIZE; k++) {
-			numwritten = fread( &m_pdPanelPtrLinks[m_ucInteractionLevel][j][k], sizeof( CAutoPanel* ), 1, stream );
-			if(numwritten != 1) {
-				if(feof(stream)) {
-					ErrMsg("Error: unexpected end-of-file of temporary out-of-core file, stopping the process\n");
-				}
-				else {
-					ErrMsg("Error: cannot read from temporary out-of-core file, stopping the process\n");
-				}
-				ErrMsg("Error: cannot read from temporary out-of-core file, stopping the process\n");
-				j = m_ulLinkChunkNum[m_ucInteractionLevel];
-				ret = FC_FILE_ERROR;
-				break;
-			}
+		else {
+			m_dPotCoeffLinks[m_ucInteractionLevel][j] = (double*)(base + indexSize + j * AUTOREFINE_LINK_CHUNK_SIZE * sizeof(double));
 		}
+	}
 
-		fclose(stream);
+	return FC_NORMAL_END;
+#else
+	// not supported, see AutoRefineLinks()
+	return FC_GENERIC_ERROR;
+#endif
+}
 
-		if(loadAlsoPot == true && j < m_ulLinkChunkNum[m_ucInteractionLevel]) {
-			PortableGetTempFileName(wxT(""), FC_POT_TMP_FILE_PREFIX, m_ulUniquePotChunkIDs[start + j], tmpFileName);
-			// open the file
-			stream = fopen(tmpFileName.GetFullPath().c_str(), "rb");
-			if( stream == NULL ) {
-				ErrMsg("Error: cannot open the temporary file '%s' for reading\n", (const char*)tmpFileName.GetFullPath());
-				return FC_FILE_ERROR;
-			}
-
-			// and read the current chunk from disk
-			for(k = 0; k < AUTOREFINE_LINK_CHUNK_SIZE; k++) {
-				numwritten = fread( &m_dPotCoeffLinks[m_ucInteractionLevel][j][k], sizeof( double ), 1, stream );
-				if(numwritten != 1) {
-					if(feof(stream)) {
-						ErrMsg("Error: unexpected end-of-file of temporary out-of-core file, stopping the process\n");
-					}
-					else {
-						ErrMsg("Error: cannot read from temporary out-of-core file, stopping the process\n");
-					}
-					ErrMsg("Error: cannot read from temporary out-of-core file, stopping the process\n");
-					j = m_ulLinkChunkNum[m_ucInteractionLevel];
-					ret = FC_FILE_ERROR;
-					break;
-				}
-			}
+// Release the mapped block, and reset the link chunk pointers that were pointing into it
+void CAutoRefine::UnmapLinks()
+{
+	unsigned long j;
 
-			fclose(stream);
-		}
+	if(m_pMappedBlock == NULL) {
+		return;
 	}
 
-	return ret;
+#ifndef __WXMSW__
+	munmap(m_pMappedBlock, m_ulMappedBlockSize);
+#endif
+	m_pMappedBlock = NULL;
+	m_ulMappedBlockSize = 0;
+
+	for(j=0; j< m_ulLinkChunkNum[m_ucMappedLevel]; j++) {
+		if(m_puiNodeIndexLinks[m_ucMappedLevel] != NULL) {
+			m_puiNodeIndexLinks[m_ucMappedLevel][j] = NULL;
+		}
+		if(m_fPotCoeffLinks[m_ucMappedLevel] != NULL) {
+			m_fPotCoeffLinks[m_ucMappedLevel][j] = NULL;
+		}
+		if(m_dPotCoeffLinks[m_ucMappedLevel] != NULL) {
+			m_dPotCoeffLinks[m_ucMappedLevel][j] = NULL;
+		}
+	}
 }
 
 // This function mimics GetTempFileName() by MS but in a portable way using wxWidgets functions.
@@ -1197,6 +2340,8 @@ void CAutoRefine::RecurseIndex(CAutoElement *panel)
 
 	if(m_bPopulateNodeArray == true ) {
 		m_pNodes[m_ulCountNodeNum] = panel;
+		// links refer to the nodes through this index
+		panel->m_ulNodeIndex[m_ucInteractionLevel] = m_ulCountNodeNum;
 		m_ulCountNodeNum++;
 	}
 
@@ -1217,6 +2362,12 @@ void CAutoRefine::RecurseIndex(CAutoElement *panel)
 	panel->m_ulLinkIndexStart[m_ucInteractionLevel] = m_ulBaseLinksNum;
 	// increase link number
 	m_ulBaseLinksNum += numLinks;
+
+	// same for the far-field links
+	numLinks = panel->m_ulFarLinkIndexEnd[m_ucInteractionLevel] - panel->m_ulFarLinkIndexStart[m_ucInteractionLevel];
+	panel->m_ulFarLinkIndexEnd[m_ucInteractionLevel] = m_ulBaseFarLinksNum;
+	panel->m_ulFarLinkIndexStart[m_ucInteractionLevel] = m_ulBaseFarLinksNum;
+	m_ulBaseFarLinksNum += numLinks;
 }
 
 // setting of the pointer to the conductor currently processed,
@@ -1227,6 +2378,22 @@ void CAutoRefine::SetCurrentConductor(CAutoConductor *m_pCurrCond)
 	m_pCurrentConductor = m_pCurrCond;
 }
 
+// thread-safe setting of one of the 'm_bWarnGiven...' flags, as the potential
+// calculations may run in parallel; returns true only to the first caller,
+// which is the one that must warn the user
+bool CAutoRefine::SetWarnGiven(bool &warnGiven)
+{
+	bool first;
+
+	#pragma omp critical(warngiven)
+	{
+		first = !warnGiven;
+		warnGiven = true;
+	}
+
+	return first;
+}
+
 void CAutoRefine::OutputFastCapFile(std::string fileinname, std::string suffix, CLin_Vector *condCharges)
 {
 	FILE *foutlst;
@@ -2051,7 +3218,7 @@ void CAutoRefine::DebugDumpInteractions()
 		chunk -= m_ulLinkChunkNum[m_ucInteractionLevel] * m_ulCurrBlock;
 
 		// actually dump to file in scilab matrix format
-		fprintf(fp, "%f %p\n", m_dPotCoeffLinks[m_ucInteractionLevel][chunk][posInChunk], m_pdPanelPtrLinks[m_ucInteractionLevel][chunk][posInChunk]);
+		fprintf(fp, "%f %u\n", GetPotCoeffLink(chunk, posInChunk), m_puiNodeIndexLinks[m_ucInteractionLevel][chunk][posInChunk]);
 	}
 
 	fclose(fp);
@@ -2157,9 +3324,7 @@ int CAutoRefine::RefineSelf(CAutoPanel *panel)
 					_ASSERT(!isnan(potestRe));
 					_ASSERT(isfinite(potestRe));
 					if(isnan(potestRe) || !isfinite(potestRe)) {
-						if(m_clsGlobalVars.m_bWarnGivenNaN == false) {
-							// signal we already warned the user
-							m_clsGlobalVars.m_bWarnGivenNaN = true;
+						if(SetWarnGiven(m_clsGlobalVars.m_bWarnGivenNaN) == true) {
 							ErrMsg("Error: self-potential calculation failed.\n");
 							ErrMsg("       Remark: the precision of the result is affected.\n");
 						}
@@ -2183,9 +3348,7 @@ int CAutoRefine::RefineSelf(CAutoPanel *panel)
 							_ASSERT(!isnan(potestIm));
 							_ASSERT(isfinite(potestIm));
 							if(isnan(potestIm) || !isfinite(potestIm)) {
-								if(m_clsGlobalVars.m_bWarnGivenNaN == false) {
-									// signal we already warned the user
-									m_clsGlobalVars.m_bWarnGivenNaN = true;
+								if(SetWarnGiven(m_clsGlobalVars.m_bWarnGivenNaN) == true) {
 									ErrMsg("Error: electric field discontinuity calculation failed on a dielectric panel.\n");
 									ErrMsg("       Remark: the precision of the result is affected.\n");
 								}
@@ -2279,9 +3442,7 @@ int CAutoRefine::RefineSelf(CAutoSegment *panel)
 					_ASSERT(!isnan(potestRe));
 					_ASSERT(isfinite(potestRe));
 					if(isnan(potestRe) || !isfinite(potestRe)) {
-						if(m_clsGlobalVars.m_bWarnGivenNaN == false) {
-							// signal we already warned the user
-							m_clsGlobalVars.m_bWarnGivenNaN = true;
+						if(SetWarnGiven(m_clsGlobalVars.m_bWarnGivenNaN) == true) {
 							ErrMsg("Error: self-potential calculation failed.\n");
 							ErrMsg("       Remark: the precision of the result is affected.\n");
 						}
@@ -2305,9 +3466,7 @@ int CAutoRefine::RefineSelf(CAutoSegment *panel)
 							_ASSERT(!isnan(potestIm));
 							_ASSERT(isfinite(potestIm));
 							if(isnan(potestIm) || !isfinite(potestIm)) {
-								if(m_clsGlobalVars.m_bWarnGivenNaN == false) {
-									// signal we already warned the user
-									m_clsGlobalVars.m_bWarnGivenNaN = true;
+								if(SetWarnGiven(m_clsGlobalVars.m_bWarnGivenNaN) == true) {
 									ErrMsg("Error: electric field discontinuity calculation failed on a dielectric panel.\n");
 									ErrMsg("       Remark: the precision of the result is affected.\n");
 								}
@@ -2404,9 +3563,7 @@ void CAutoRefine::SelfPotential(CAutoPanel *panel, double *potestRe, double *pot
 			// collocation (using m_clsPotential.Auto() mixed with collocation for mutual potential gives instabilities)
 			*potestRe = m_clsPotential.PotentialOpt(panel->GetCentroid(), panel->m_clsVertex) / FOUR_PI_TIMES_E0;
 			if( *potestRe == 0.0) {
-				if(m_clsGlobalVars.m_bWarnGivenSelfPot == false) {
-					// signal we already warned the user
-					m_clsGlobalVars.m_bWarnGivenSelfPot = true;
+				if(SetWarnGiven(m_clsGlobalVars.m_bWarnGivenSelfPot) == true) {
 					ErrMsg("Warning: self-potential calculation equal to zero found during potential calculation\n");
 					ErrMsg("         This may be caused by the presence of very small panels.\n");
 					ErrMsg("         Remark: the precision of the result is affected.\n");
@@ -2483,9 +3640,7 @@ void CAutoRefine::SelfPotential(CAutoSegment *panel, double *potestRe, double *p
 		// collocation (using m_clsPotential.Auto() mixed with collocation for mutual potential gives instabilities)
 		*potestRe = m_clsPotential.PotentialOpt(panel->GetCentroid(), panel->m_clsVertex);
 		if( *potestRe == 0.0) {
-			if(m_clsGlobalVars.m_bWarnGivenSelfPot == false) {
-				// signal we already warned the user
-				m_clsGlobalVars.m_bWarnGivenSelfPot = true;
+			if(SetWarnGiven(m_clsGlobalVars.m_bWarnGivenSelfPot) == true) {
 				ErrMsg("Warning: self-potential calculation equal to zero found during potential calculation\n");
 				ErrMsg("         This may be caused by the presence of very small panels.\n");
 				ErrMsg("         Remark: the precision of the result is affected.\n");
@@ -2561,6 +3716,8 @@ int CAutoRefine::Discretize(CAutoPanel *panel)
 	// reset link counter
 	panel->m_ulLinkIndexStart[m_ucInteractionLevel] = 0;
 	panel->m_ulLinkIndexEnd[m_ucInteractionLevel] = 0;
+	panel->m_ulFarLinkIndexStart[m_ucInteractionLevel] = 0;
+	panel->m_ulFarLinkIndexEnd[m_ucInteractionLevel] = 0;
 
 	// get max lenght of panel side
 	rmax = panel->GetMaxSideLen();
@@ -2651,6 +3808,8 @@ int CAutoRefine::DiscretizeSelf(CAutoPanel *panel)
 	// reset link counter
 	panel->m_ulLinkIndexStart[m_ucInteractionLevel] = 0;
 	panel->m_ulLinkIndexEnd[m_ucInteractionLevel] = 0;
+	panel->m_ulFarLinkIndexStart[m_ucInteractionLevel] = 0;
+	panel->m_ulFarLinkIndexEnd[m_ucInteractionLevel] = 0;
 
 	// if leaf panel at top level, must start discretization
 	if(panel->IsLeaf() == true && m_iLevel == 1) {
@@ -2698,6 +3857,8 @@ int CAutoRefine::DiscretizeSelf(CAutoSegment *panel)
 	// reset link counter
 	panel->m_ulLinkIndexStart[m_ucInteractionLevel] = 0;
 	panel->m_ulLinkIndexEnd[m_ucInteractionLevel] = 0;
+	panel->m_ulFarLinkIndexStart[m_ucInteractionLevel] = 0;
+	panel->m_ulFarLinkIndexEnd[m_ucInteractionLevel] = 0;
 
 	// if leaf panel at top level, must start discretization
 	if(panel->IsLeaf() == true && m_iLevel == 1) {
@@ -3172,6 +4333,64 @@ int CAutoRefine::RefineMutual(CAutoPanel *panel1, CAutoPanel *panel2)
 			RefineMutual(panel1, (CAutoPanel*)(panel2->m_pRight));
 		}
 	}
+	// if the panels are far enough for PotEstimateOpt() to use the simple 1/r or dipole formula,
+	// and matrix-free far-field links are enabled, store only the interacting node index
+	// (in both directions, the criterion is symmetric); the coefficients will be computed
+	// on the fly in the multiplication
+	else if(m_bFarLinks[m_ucInteractionLevel] == true && rdist / rmax >= AUTOREFINE_FAR_FIELD_RATIO) {
+
+		// if just counting
+		if(m_bComputeLinks == false) {
+			m_ulFarLinksNum[m_ucInteractionLevel] += 2;
+		}
+		else {
+			// far-field links are always in-core
+			chunk1 = panel1->m_ulFarLinkIndexEnd[m_ucInteractionLevel] / AUTOREFINE_LINK_CHUNK_SIZE;
+			posInChunk1 = panel1->m_ulFarLinkIndexEnd[m_ucInteractionLevel] % AUTOREFINE_LINK_CHUNK_SIZE;
+			m_puiFarNodeIndexLinks[m_ucInteractionLevel][chunk1][posInChunk1] = (unsigned int)panel2->m_ulNodeIndex[m_ucInteractionLevel];
+
+			chunk2 = panel2->m_ulFarLinkIndexEnd[m_ucInteractionLevel] / AUTOREFINE_LINK_CHUNK_SIZE;
+			posInChunk2 = panel2->m_ulFarLinkIndexEnd[m_ucInteractionLevel] % AUTOREFINE_LINK_CHUNK_SIZE;
+			m_puiFarNodeIndexLinks[m_ucInteractionLevel][chunk2][posInChunk2] = (unsigned int)panel1->m_ulNodeIndex[m_ucInteractionLevel];
+		}
+
+		// in any case, increment position pointer
+		panel1->m_ulFarLinkIndexEnd[m_ucInteractionLevel]++;
+		panel2->m_ulFarLinkIndexEnd[m_ucInteractionLevel]++;
+	}
+	// if symmetric links are enabled and both panels are conductors, the coefficient of potential
+	// is the same in both directions, so store the link only for 'panel1'; the multiplication
+	// will scatter the contribution to 'panel2' as well (see CMultHier::ComputePanelPotentials_2fast())
+	else if(IsSymLink(panel1, panel2) == true) {
+
+		// if just counting
+		if(m_bComputeLinks == false) {
+
+			// increase number of links
+			m_ulLinksNum[m_ucInteractionLevel]++;
+			m_ulSymLinksNum[m_ucInteractionLevel]++;
+
+#ifdef DEBUG_DUMP_BASIC
+			m_iaLinksBtwLevels[panel1->m_iLevel][panel2->m_iLevel]++;
+#endif
+		}
+		else {
+			chunk1 = panel1->m_ulLinkIndexEnd[m_ucInteractionLevel] / AUTOREFINE_LINK_CHUNK_SIZE;
+			posInChunk1 = panel1->m_ulLinkIndexEnd[m_ucInteractionLevel] % AUTOREFINE_LINK_CHUNK_SIZE;
+			// determine in which block the current chunk is ('m_ulLinkChunkNum' is the number of chunks per block)
+			block1 = chunk1 / m_ulLinkChunkNum[m_ucInteractionLevel];
+
+			// only if in current block
+			if(block1 == m_ulCurrBlock) {
+				// adjust chunk to position within the current block
+				chunk1 -= m_ulLinkChunkNum[m_ucInteractionLevel] * m_ulCurrBlock;
+				m_puiNodeIndexLinks[m_ucInteractionLevel][chunk1][posInChunk1] = (unsigned int)panel2->m_ulNodeIndex[m_ucInteractionLevel];
+			}
+		}
+
+		// in any case, increment position pointer
+		panel1->m_ulLinkIndexEnd[m_ucInteractionLevel]++;
+	}
 	// this terminates recursion and stores 'potestim'
 	else {
 
@@ -3211,14 +4430,18 @@ int CAutoRefine::RefineMutual(CAutoPanel *panel1, CAutoPanel *panel2)
 			if(block1 == m_ulCurrBlock) {
 				// adjust chunk to position within the current block
 				chunk1 -= m_ulLinkChunkNum[m_ucInteractionLevel] * m_ulCurrBlock;
-				m_pdPanelPtrLinks[m_ucInteractionLevel][chunk1][posInChunk1] = panel2;
+				m_puiNodeIndexLinks[m_ucInteractionLevel][chunk1][posInChunk1] = (unsigned int)panel2->m_ulNodeIndex[m_ucInteractionLevel];
 			}
 
 			// only if in current block
 			if(block2 == m_ulCurrBlock) {
 				// adjust chunk to position within the current block
 				chunk2 -= m_ulLinkChunkNum[m_ucInteractionLevel] * m_ulCurrBlock;
-				m_pdPanelPtrLinks[m_ucInteractionLevel][chunk2][posInChunk2] = panel1;
+				m_puiNodeIndexLinks[m_ucInteractionLevel][chunk2][posInChunk2] = (unsigned int)panel1->m_ulNodeIndex[m_ucInteractionLevel];
+			}
+
+			if(m_bPairLinks == true) {
+				SetLinkPair(panel1, panel2);
 			}
 		}
 
@@ -3241,10 +4464,8 @@ int CAutoRefine::RefineMutual(CAutoSegment *panel1, CAutoSegment *panel2)
 	bool forcerefinement;
 	char refinePanel;
 	C2DVector dist;
-	double potestim1, potestim2;
 	double rdist, r1, r2, rmax;
 	double panel1crit, panel2crit;
-	int potstatus;
 	unsigned long chunk1, posInChunk1, block1;
 	unsigned long chunk2, posInChunk2, block2;
 
@@ -3358,84 +4579,30 @@ int CAutoRefine::RefineMutual(CAutoSegment *panel1, CAutoSegment *panel2)
 			// determine in which block the current chunk is ('m_ulLinkChunkNum' is the number of chunks per block)
 			block2 = chunk2 / m_ulLinkChunkNum[m_ucInteractionLevel];
 
-			// if at least one of the two estimates falls into a block, actually calculate the potential estimate
-			if(block1 == m_ulCurrBlock || block2 == m_ulCurrBlock) {
-				// TBC warning: should change PotEstimateOpt to return always valid potential
-				if(m_ucInteractionLevel == AUTOREFINE_HIER_PRE_0_LEVEL) {
-					potstatus = PotEstimateOpt(panel1, panel2, potestim1, potestim2);
-				}
-				else {
-					// in this case, we are computing the preconditioner, so don't be too picky about approximation
-					potstatus = PotEstimateOpt(panel1, panel2, potestim1, potestim2, AUTOREFINE_PRECOND_HIER);
-				}
-
-				_ASSERT(potstatus == 0);
-
-				_ASSERT(!isnan(potestim1));
-				_ASSERT(!isnan(potestim2));
-				_ASSERT(isfinite(potestim1));
-				_ASSERT(isfinite(potestim2));
-
-				if(isnan(potestim1) || !isfinite(potestim1) || isnan(potestim2) || !isfinite(potestim2)) {
-					if(m_clsGlobalVars.m_bWarnGivenNaN == false) {
-						// signal we already warned the user
-						m_clsGlobalVars.m_bWarnGivenNaN = true;
-						ErrMsg("Error: mutual-potential calculation failed.\n");
-						ErrMsg("       Remark: the precision of the result is affected.\n");
-// debug
-//						potstatus = PotEstimateOpt(panel1, panel2, potestim1, potestim2, AUTOREFINE_PRECOND_HIER);
-					}
-					if(m_clsGlobalVars.m_bVerboseOutput == true) {
-						if(!isfinite(potestim1) || !isfinite(potestim2)) {
-							ErrMsg("Error: mutual-potential calculation gave infinite value\n");
-						}
-						else {
-							ErrMsg("Error: mutual-potential calculation gave 'not a number' value (NaN)\n");
-						}
-						ErrMsg("       segment 1 data\n");
-						panel1->ErrorPrintCoords();
-						if(panel1->IsLeaf() == true) {
-							ErrMsg("       segment is leaf\n");
-						}
-						else {
-							ErrMsg("       segment is not leaf\n");
-						}
-						ErrMsg("       segment 2 data\n");
-						panel2->ErrorPrintCoords();
-						if(panel2->IsLeaf() == true) {
-							ErrMsg("       segment is leaf\n");
-						}
-						else {
-							ErrMsg("       segment is not leaf\n");
-						}
-					}
-				}
-
-				_ASSERT(panel1 != NULL);
-				_ASSERT(panel2 != NULL);
-			}
-
 			// store interaction
+			// (the coefficients of potential are computed later on, in the second pass of AutoRefineLinks())
 			//
 
 			// only if in current block
 			if(block1 == m_ulCurrBlock) {
 				// adjust chunk to position within the current block
 				chunk1 -= m_ulLinkChunkNum[m_ucInteractionLevel] * m_ulCurrBlock;
-				m_dPotCoeffLinks[m_ucInteractionLevel][chunk1][posInChunk1] = potestim1;
-				m_pdPanelPtrLinks[m_ucInteractionLevel][chunk1][posInChunk1] = panel2;
+				m_puiNodeIndexLinks[m_ucInteractionLevel][chunk1][posInChunk1] = (unsigned int)panel2->m_ulNodeIndex[m_ucInteractionLevel];
 			}
-			// anyway increment position pointer
-			panel1->m_ulLinkIndexEnd[m_ucInteractionLevel]++;
 
 			// only if in current block
 			if(block2 == m_ulCurrBlock) {
 				// adjust chunk to position within the current block
 				chunk2 -= m_ulLinkChunkNum[m_ucInteractionLevel] * m_ulCurrBlock;
-				m_dPotCoeffLinks[m_ucInteractionLevel][chunk2][posInChunk2] = potestim2;
-				m_pdPanelPtrLinks[m_ucInteractionLevel][chunk2][posInChunk2] = panel1;
+				m_puiNodeIndexLinks[m_ucInteractionLevel][chunk2][posInChunk2] = (unsigned int)panel1->m_ulNodeIndex[m_ucInteractionLevel];
+			}
+
+			if(m_bPairLinks == true) {
+				SetLinkPair(panel1, panel2);
 			}
-			// anyway increment position pointer
+
+			// anyway increment position pointers
+			panel1->m_ulLinkIndexEnd[m_ucInteractionLevel]++;
 			panel2->m_ulLinkIndexEnd[m_ucInteractionLevel]++;
 		}
 	}
@@ -3468,6 +4635,52 @@ int CAutoRefine::PotEstimateOpt(CAutoElement *element1, CAutoElement *element2,
 	return ret;
 }
 
+// Potential estimate of element2 on element1 ('potestim1') and of element1 on element2 ('potestim2'),
+// sharing the geometry setup
+int CAutoRefine::PotEstimateOpt(CAutoElement *element1, CAutoElement *element2, double &potestim1, double &potestim2)
+{
+	int ret;
+
+	if(g_ucSolverType == SOLVERGLOBAL_3DSOLVER) {
+		ret = PotEstimateOpt((CAutoPanel*)element1, (CAutoPanel*)element2, potestim1, potestim2);
+	}
+	else if(g_ucSolverType == SOLVERGLOBAL_2DSOLVER) {
+		ret = PotEstimateOpt((CAutoSegment*)element1, (CAutoSegment*)element2, potestim1, potestim2);
+	}
+	else {
+		ASSERT(false);
+		ret = FC_GENERIC_ERROR;
+	}
+
+	_ASSERT(!isnan(potestim1));
+	_ASSERT(!isnan(potestim2));
+	_ASSERT(isfinite(potestim1));
+	_ASSERT(isfinite(potestim2));
+
+	// the two-outputs routines do not check the results, so do it here
+	if(isnan(potestim1) || !isfinite(potestim1) || isnan(potestim2) || !isfinite(potestim2)) {
+		if(SetWarnGiven(m_clsGlobalVars.m_bWarnGivenNaN) == true) {
+			ErrMsg("Error: mutual-potential calculation failed.\n");
+			ErrMsg("       Remark: the precision of the result is affected.\n");
+		}
+		if(m_clsGlobalVars.m_bVerboseOutput == true) {
+			if(!isfinite(potestim1) || !isfinite(potestim2)) {
+				ErrMsg("Error: mutual-potential calculation gave infinite value\n");
+			}
+			else {
+				ErrMsg("Error: mutual-potential calculation gave 'not a number' value (NaN)\n");
+			}
+			ErrMsg("       element 1 data\n");
+			element1->ErrorPrintCoords();
+			ErrMsg("       element 2 data\n");
+			element2->ErrorPrintCoords();
+		}
+		ret = AUTOREFINE_ERROR_NAN_OR_INF;
+	}
+
+	return ret;
+}
+
 
 // Potential estimate between two triangular panels
 // 'computePrecond' == true will accept also near super-panels
@@ -3482,6 +4695,9 @@ int CAutoRefine::PotEstimateOpt(CAutoPanel *panel1, CAutoPanel *panel2, double &
 	double h, potestim_p, potestim_n;
 	unsigned char isdiel1;
 	bool nearpanels;
+	int ret;
+
+	ret = AUTOREFINE_NO_ERROR;
 
 	// if auto potential, this is an error
 	if(panel1 == panel2) {
@@ -3510,9 +4726,9 @@ int CAutoRefine::PotEstimateOpt(CAutoPanel *panel1, CAutoPanel *panel2, double &
 	//   a certain level)
 	if(rdist < AUTOPANEL_EPS) {
 		if(computePrecond == AUTOREFINE_PRECOND_SUPER) {
-			if(m_clsGlobalVars.m_bWarnGivenPre == false) {
-				// signal we already warned the user
-				m_clsGlobalVars.m_bWarnGivenPre = true;
+			// signal to the caller, as the global warning flag is shared among the threads
+			ret = AUTOREFINE_WARN_PRECOND_DIST;
+			if(SetWarnGiven(m_clsGlobalVars.m_bWarnGivenPre) == true) {
 				ErrMsg("Warning: panel distance too small found during potential calculation when forming the preconditioner\n");
 				ErrMsg("         In this case, convergence rate may be negatively impacted. If so, do not use the preconditioner.\n");
 				ErrMsg("         Remark: the precision of the result is not affected.\n");
@@ -3696,9 +4912,7 @@ int CAutoRefine::PotEstimateOpt(CAutoPanel *panel1, CAutoPanel *panel2, double &
 	_ASSERT(isfinite(potestim1));
 
 	if(isnan(potestim1) || !isfinite(potestim1) ) {
-		if(m_clsGlobalVars.m_bWarnGivenNaN == false) {
-			// signal we already warned the user
-			m_clsGlobalVars.m_bWarnGivenNaN = true;
+		if(SetWarnGiven(m_clsGlobalVars.m_bWarnGivenNaN) == true) {
 			ErrMsg("Error: mutual-potential calculation failed.\n");
 			ErrMsg("       Remark: the precision of the result is affected.\n");
 		}
@@ -3729,7 +4943,7 @@ int CAutoRefine::PotEstimateOpt(CAutoPanel *panel1, CAutoPanel *panel2, double &
 		return AUTOREFINE_ERROR_NAN_OR_INF;
 	}
 
-	return AUTOREFINE_NO_ERROR;
+	return ret;
 }
 
 // Potential estimate between two triangular panels
@@ -3745,6 +4959,9 @@ int CAutoRefine::PotEstimateOpt(CAutoPanel *panel1, CAutoPanel *panel2, double &
 	double h, potestim_p, potestim_n;
 	unsigned char isdiel1, isdiel2;
 	bool nearpanels;
+	int ret;
+
+	ret = AUTOREFINE_NO_ERROR;
 
 	// if auto potential, this is an error
 	if(panel1 == panel2) {
@@ -3774,9 +4991,9 @@ int CAutoRefine::PotEstimateOpt(CAutoPanel *panel1, CAutoPanel *panel2, double &
 	//   a certain level)
 	if(rdist < AUTOPANEL_EPS) {
 		if(computePrecond == AUTOREFINE_PRECOND_SUPER) {
-			if(m_clsGlobalVars.m_bWarnGivenPre == false) {
-				// signal we already warned the user
-				m_clsGlobalVars.m_bWarnGivenPre = true;
+			// signal to the caller, as the global warning flag is shared among the threads
+			ret = AUTOREFINE_WARN_PRECOND_DIST;
+			if(SetWarnGiven(m_clsGlobalVars.m_bWarnGivenPre) == true) {
 				ErrMsg("Warning: panel distance too small found during potential calculation when forming the preconditioner\n");
 				ErrMsg("         In this case, convergence rate may be negatively impacted. If so, do not use the preconditioner.\n");
 				ErrMsg("         Remark: the precision of the result is not affected.\n");
@@ -4147,7 +5364,7 @@ int CAutoRefine::PotEstimateOpt(CAutoPanel *panel1, CAutoPanel *panel2, double &
 	// keep track of number of potential estimations
 	m_ulNumofpotest += 1;
 
-	return AUTOREFINE_NO_ERROR;
+	return ret;
 }
 
 
@@ -4163,6 +5380,9 @@ int CAutoRefine::PotEstimateOpt(CAutoSegment *panel1, CAutoSegment *panel2, doub
 	double dotprod1;
 	unsigned char isdiel1;
 	bool nearpanels;
+	int ret;
+
+	ret = AUTOREFINE_NO_ERROR;
 
 	// if auto potential, this is an error
 	if(panel1 == panel2) {
@@ -4191,9 +5411,9 @@ int CAutoRefine::PotEstimateOpt(CAutoSegment *panel1, CAutoSegment *panel2, doub
 	//   a certain level)
 	if(rdist < AUTOPANEL_EPS) {
 		if(computePrecond == AUTOREFINE_PRECOND_SUPER) {
-			if(m_clsGlobalVars.m_bWarnGivenPre == false) {
-				// signal we already warned the user
-				m_clsGlobalVars.m_bWarnGivenPre = true;
+			// signal to the caller, as the global warning flag is shared among the threads
+			ret = AUTOREFINE_WARN_PRECOND_DIST;
+			if(SetWarnGiven(m_clsGlobalVars.m_bWarnGivenPre) == true) {
 				ErrMsg("Warning: panel distance too small found during potential calculation when forming the preconditioner\n");
 				ErrMsg("         In this case, convergence rate may be negatively impacted. If so, do not use the preconditioner.\n");
 				ErrMsg("         Remark: the precision of the result is not affected.\n");
@@ -4288,9 +5508,7 @@ int CAutoRefine::PotEstimateOpt(CAutoSegment *panel1, CAutoSegment *panel2, doub
 	_ASSERT(isfinite(potestim1));
 
 	if(isnan(potestim1) || !isfinite(potestim1) ) {
-		if(m_clsGlobalVars.m_bWarnGivenNaN == false) {
-			// signal we already warned the user
-			m_clsGlobalVars.m_bWarnGivenNaN = true;
+		if(SetWarnGiven(m_clsGlobalVars.m_bWarnGivenNaN) == true) {
 			ErrMsg("Error: mutual-potential calculation failed.\n");
 			ErrMsg("       Remark: the precision of the result is affected.\n");
 		}
@@ -4321,7 +5539,7 @@ int CAutoRefine::PotEstimateOpt(CAutoSegment *panel1, CAutoSegment *panel2, doub
 		return AUTOREFINE_ERROR_NAN_OR_INF;
 	}
 
-	return AUTOREFINE_NO_ERROR;
+	return ret;
 }
 
 // Potential estimate between two linear segments
@@ -4336,6 +5554,9 @@ int CAutoRefine::PotEstimateOpt(CAutoSegment *panel1, CAutoSegment *panel2, doub
 	double dotprod1, dotprod2;
 	unsigned char isdiel1, isdiel2;
 	bool nearpanels;
+	int ret;
+
+	ret = AUTOREFINE_NO_ERROR;
 
 	// if auto potential, this is an error
 	if(panel1 == panel2) {
@@ -4365,9 +5586,9 @@ int CAutoRefine::PotEstimateOpt(CAutoSegment *panel1, CAutoSegment *panel2, doub
 	//   a certain level)
 	if(rdist < AUTOPANEL_EPS) {
 		if(computePrecond == AUTOREFINE_PRECOND_SUPER) {
-			if(m_clsGlobalVars.m_bWarnGivenPre == false) {
-				// signal we already warned the user
-				m_clsGlobalVars.m_bWarnGivenPre = true;
+			// signal to the caller, as the global warning flag is shared among the threads
+			ret = AUTOREFINE_WARN_PRECOND_DIST;
+			if(SetWarnGiven(m_clsGlobalVars.m_bWarnGivenPre) == true) {
 				ErrMsg("Warning: panel distance too small found during potential calculation when forming the preconditioner\n");
 				ErrMsg("         In this case, convergence rate may be negatively impacted. If so, do not use the preconditioner.\n");
 				ErrMsg("         Remark: the precision of the result is not affected.\n");
@@ -4539,7 +5760,7 @@ int CAutoRefine::PotEstimateOpt(CAutoSegment *panel1, CAutoSegment *panel2, doub
 	// keep track of number of potential estimations
 	m_ulNumofpotest += 1;
 
-	return AUTOREFINE_NO_ERROR;
+	return ret;
 }
 
 // used only for quadrilateral panles (old version)
@@ -32,6 +32,8 @@
 
 #include <string>
 #include <map>
+// for memcpy
+#include <cstring>
 
 #ifdef MS_VS
 // for memory state and debug macros (e.g. _ASSERT), when using MS VisualC++
@@ -44,6 +46,8 @@
 
 // for wxFileName
 #include <wx/filename.h>
+// for wxThread
+#include <wx/thread.h>
 
 // link with FasterCap main frame
 #include "../FasterCapGlobal.h"
@@ -70,6 +74,14 @@ using namespace std;
 // actual value
 #define AUTOREFINE_LINK_CHUNK_SIZE		1048576
 
+// links store the interacting node as a 32-bit index in the nodes array 'm_pNodes'
+// (instead of a pointer to the node), so the number of nodes cannot exceed this value
+#define AUTOREFINE_MAX_NODE_NUM			4294967295UL
+
+// distance to max panel side ratio above which PotEstimateOpt() uses the simple
+// 1/r (conductor) or dipole (dielectric) formula for the coefficient of potential
+#define AUTOREFINE_FAR_FIELD_RATIO		10.0
+
 
 // PotEstimateOpt() return error codes
 #define AUTOREFINE_NO_ERROR				0
@@ -77,6 +89,9 @@ using namespace std;
 #define AUTOREFINE_ERROR_ZERO_DIST		-2
 #define AUTOREFINE_ERROR_SMALL_DIST		-4
 #define AUTOREFINE_ERROR_NAN_OR_INF		-8
+// PotEstimateOpt() return warning codes (the estimate is still usable)
+// panel distance too small when forming the two-levels preconditioner
+#define AUTOREFINE_WARN_PRECOND_DIST	1
 
 // constant used to define the min relative distance at which:
 // 1. two super panels can never interact directly
@@ -103,9 +118,29 @@ using namespace std;
 // i.e. no reference to the vector of the permittivities stored in the conductor
 #define AUTOREFINE_NO_DIEL_INDEX				-1
 
+// flag meaning that no out-of-core block is involved (see CAutoRefine::StartLinksIO())
+#define AUTOREFINE_NO_BLOCK						((unsigned long)-1)
+
+class CAutoRefine;
+
+// joinable thread reading or writing out-of-core link blocks in the background
+// (see CAutoRefine::StartLinksIO())
+class CLinksIOThread : public wxThread
+{
+public:
+	CLinksIOThread(CAutoRefine *autoRefine);
+
+	// thread execution starts here
+	virtual void *Entry();
+
+protected:
+	CAutoRefine *m_pAutoRefine;
+};
+
 class CAutoRefine
 {
-
+	friend class CLinksIOThread;
+
 public:
 	CAutoRefine();
 	~CAutoRefine();
@@ -119,11 +154,13 @@ public:
     void SelfPotential(CAutoSegment *panel, double *potestRe, double *potestIm);
 	int BuildSuperHierarchy();
 	int PotEstimateOpt(CAutoElement *element1, CAutoElement *element2, double &potestim1);
+	int PotEstimateOpt(CAutoElement *element1, CAutoElement *element2, double &potestim1, double &potestim2);
 	int PotEstimateOpt(CAutoPanel *panel1, CAutoPanel *panel2, double &potestim1, unsigned char computePrecond = AUTOREFINE_PRECOND_NONE);
 	int PotEstimateOpt(CAutoPanel *panel1, CAutoPanel *panel2, double &potestim1, double &potestim2, unsigned char computePrecond = AUTOREFINE_PRECOND_NONE);
     int PotEstimateOpt(CAutoSegment *panel1, CAutoSegment *panel2, double &potestim1, unsigned char computePrecond = AUTOREFINE_PRECOND_NONE);
     int PotEstimateOpt(CAutoSegment *panel1, CAutoSegment *panel2, double &potestim1, double &potestim2, unsigned char computePrecond = AUTOREFINE_PRECOND_NONE);
     void SetCurrentConductor(CAutoConductor *m_pCurrCond);
+	bool SetWarnGiven(bool &warnGiven);
 	inline void SetInteractionLevel(unsigned char interactionLevel)
 	{
 		m_ucInteractionLevel = interactionLevel;
@@ -156,10 +193,90 @@ public:
 	{
 		return m_ulLinksNum[interactLevel];
 	}
+	// number of links including the far-field links computed on the fly
+	inline unsigned long GetAllLinksNum(unsigned char interactLevel)
+	{
+		return (m_ulLinksNum[interactLevel] + m_ulFarLinksNum[interactLevel]);
+	}
+	inline unsigned long GetFarLinksNum(unsigned char interactLevel)
+	{
+		return m_ulFarLinksNum[interactLevel];
+	}
+	// true if the links are split in more blocks, loaded in turn from disk
+	inline bool IsOutOfCore()
+	{
+		return (m_ulBlocksNum > 1);
+	}
+	// access to the coefficients of potential of the links at the current level,
+	// stored in single or double precision (see AutoRefineLinks())
+	// ('chunk' is relative to the current block)
+	inline void SetPotCoeffLink(unsigned long chunk, unsigned long posInChunk, double potCoeff)
+	{
+		if(m_bFloatLinks[m_ucInteractionLevel] == true) {
+			m_fPotCoeffLinks[m_ucInteractionLevel][chunk][posInChunk] = (float)potCoeff;
+		}
+		else {
+			m_dPotCoeffLinks[m_ucInteractionLevel][chunk][posInChunk] = potCoeff;
+		}
+	}
+	inline double GetPotCoeffLink(unsigned long chunk, unsigned long posInChunk)
+	{
+		if(m_bFloatLinks[m_ucInteractionLevel] == true) {
+			return (double)m_fPotCoeffLinks[m_ucInteractionLevel][chunk][posInChunk];
+		}
+		else {
+			return m_dPotCoeffLinks[m_ucInteractionLevel][chunk][posInChunk];
+		}
+	}
+	// symmetric links (see 'm_bSymLinks') are the links between two conductor elements,
+	// stored only once; all other links come in pairs, one for each direction
+	inline bool IsSymLink(CAutoElement *element1, CAutoElement *element2)
+	{
+		return (m_bSymLinks[m_ucInteractionLevel] == true && (element1->m_ucType & AUTOPANEL_IS_DIEL) != AUTOPANEL_IS_DIEL
+		        && (element2->m_ucType & AUTOPANEL_IS_DIEL) != AUTOPANEL_IS_DIEL);
+	}
+	// when the links are evaluated in pairs (see 'm_bPairLinks'), the first link pass stores,
+	// in the coefficient slot of the link belonging to the lower node index, the position
+	// of the opposite link of the pair; both links are at the current end of the link
+	// ranges of 'element1' and 'element2' (in-core only, so there is a single block)
+	inline void SetLinkPair(CAutoElement *element1, CAutoElement *element2)
+	{
+		unsigned long linkPos, pairPos;
+		unsigned int pairPos32;
+
+		if(element1->m_ulNodeIndex[m_ucInteractionLevel] < element2->m_ulNodeIndex[m_ucInteractionLevel]) {
+			linkPos = element1->m_ulLinkIndexEnd[m_ucInteractionLevel];
+			pairPos = element2->m_ulLinkIndexEnd[m_ucInteractionLevel];
+		}
+		else {
+			linkPos = element2->m_ulLinkIndexEnd[m_ucInteractionLevel];
+			pairPos = element1->m_ulLinkIndexEnd[m_ucInteractionLevel];
+		}
+		if(m_bFloatLinks[m_ucInteractionLevel] == true) {
+			// a float cannot represent exactly all the positions, so store the bit pattern
+			pairPos32 = (unsigned int)pairPos;
+			memcpy(&m_fPotCoeffLinks[m_ucInteractionLevel][linkPos / AUTOREFINE_LINK_CHUNK_SIZE][linkPos % AUTOREFINE_LINK_CHUNK_SIZE], &pairPos32, sizeof(float));
+		}
+		else {
+			m_dPotCoeffLinks[m_ucInteractionLevel][linkPos / AUTOREFINE_LINK_CHUNK_SIZE][linkPos % AUTOREFINE_LINK_CHUNK_SIZE] = (double)pairPos;
+		}
+	}
+	inline unsigned long GetLinkPair(unsigned long chunk, unsigned long posInChunk)
+	{
+		unsigned int pairPos32;
+
+		if(m_bFloatLinks[m_ucInteractionLevel] == true) {
+			memcpy(&pairPos32, &m_fPotCoeffLinks[m_ucInteractionLevel][chunk][posInChunk], sizeof(float));
+			return (unsigned long)pairPos32;
+		}
+		else {
+			return (unsigned long)m_dPotCoeffLinks[m_ucInteractionLevel][chunk][posInChunk];
+		}
+	}
 	// number of links + number of autolinks (self potentials, one for each panel)
 	inline unsigned long GetTotalLinksNum(unsigned char interactLevel)
 	{
-		return (m_ulLinksNum[interactLevel] + m_ulPanelNum[interactLevel]);
+		return (m_ulLinksNum[interactLevel] + m_ulFarLinksNum[interactLevel] + m_ulPanelNum[interactLevel]);
 	}
 	inline double GetTotalArea()
 	{
@@ -190,6 +307,7 @@ public:
 	unsigned long m_ulPanelNum[AUTOPANEL_MAX_NUM_OF_HIERARCHIES], m_ulInputPanelNum;
 	unsigned long m_ulNodeNum[AUTOPANEL_MAX_NUM_OF_HIERARCHIES];
 	unsigned long m_ulLinksNum[AUTOPANEL_MAX_NUM_OF_HIERARCHIES];
+	unsigned long m_ulFarLinksNum[AUTOPANEL_MAX_NUM_OF_HIERARCHIES];
 	float m_fDurationDiscretize, m_fDurationRefine, m_fDurationSuperH, m_fDurationReadFile;
 	StlAutoCondDeque m_stlConductors;
 	long m_lCondNum, m_lDielNum, m_lGroupDielNum;
@@ -210,11 +328,36 @@ protected:
 	int ComputeLinks();
 	int SaveLinks(bool saveAlsoPot = true);
 	int LoadLinks(unsigned long block, bool loadAlsoPot = true);
+	int MapLinks(unsigned long block);
+	void UnmapLinks();
+	unsigned long GetBlockFileSize(bool withPot);
+	int WriteLinksBlock(unsigned char level, unsigned long block, bool saveAlsoPot, unsigned int **nodeIndexLinks, double **dPotCoeffLinks, float **fPotCoeffLinks);
+	int ReadLinksBlock(unsigned char level, unsigned long block, bool loadAlsoPot, unsigned int **nodeIndexLinks, double **dPotCoeffLinks, float **fPotCoeffLinks);
+	int PrefetchLinks(unsigned long block, bool loadAlsoPot = true);
+	int SaveLinksBehind(unsigned long nextBlock, unsigned long prefetchBlock);
+	int StartLinksIO(unsigned long writeBlock, bool writeAlsoPot, unsigned long readBlock, bool readAlsoPot);
+	int WaitLinksIO();
+	int RunLinksIO();
+	void SwapLinkBuffers();
+	void DeleteShadowLinks();
+	int WriteCodecChunk(FILE *stream, unsigned long size);
+	int ReadCodecChunk(FILE *stream, unsigned long &size);
+	unsigned long EncodeNodeIndexChunk(unsigned int *nodeIndexLinks);
+	unsigned long EncodePotCoeffChunk(double *potCoeffLinks);
+	unsigned long EncodePotCoeffChunk(float *potCoeffLinks);
+	bool DecodeNodeIndexChunk(unsigned long size, unsigned int *nodeIndexLinks);
+	bool DecodePotCoeffChunk(unsigned long size, double *potCoeffLinks);
+	bool DecodePotCoeffChunk(unsigned long size, float *potCoeffLinks);
+	wxUint64 GetLinkCacheKey();
+	void GetLinkCacheFileName(const std::string &cacheDir, wxUint64 key, wxFileName &cacheFileName);
+	int LoadLinkCache(const std::string &cacheDir, wxUint64 key, bool &loaded);
+	void SaveLinkCache(const std::string &cacheDir, wxUint64 key);
 	void DumpMemoryInfo();
 	void CopyCharges(CAutoElement *panel);
 	void RecurseIndex(CAutoElement *panel);
 	void DeletePanelsAndConductors();
 	void DeleteLinkArray(unsigned int level);
+	int RemapUpperLevelLinks(unsigned char level);
 	CAutoPanel *RecurBuild3DSuperHier(unsigned long firstPanel, unsigned long panelNum, C3DBBox *bbox);
 	CAutoSegment *RecurBuild2DSuperHier(unsigned long firstPanel, unsigned long panelNum, C3DBBox *bbox);
     int CreateFileMap(char *fileinname, FILE *fid, StlFilePosMap *filePosMap);
@@ -268,13 +411,57 @@ protected:
 	CAutoSegment **m_pSegmentArray1, **m_pSegmentArray2;
 	C3DVector *m_pCentroid;
 	bool m_bComputeLinks;
+	// evaluate the two coefficients of potential of each link pair together (see AutoRefineLinks())
+	bool m_bPairLinks;
 	double **m_dPotCoeffLinks[AUTOPANEL_MAX_NUM_OF_HIERARCHIES];
-	CAutoElement ***m_pdPanelPtrLinks[AUTOPANEL_MAX_NUM_OF_HIERARCHIES];
+	// single precision coefficients of potential, used instead of 'm_dPotCoeffLinks'
+	// when 'm_bFloatLinks' is set for the level
+	float **m_fPotCoeffLinks[AUTOPANEL_MAX_NUM_OF_HIERARCHIES];
+	bool m_bFloatLinks[AUTOPANEL_MAX_NUM_OF_HIERARCHIES];
+	// matrix-free far-field links: only the index of the interacting node is stored
+	// (always in-core), the coefficient of potential is re-computed in the multiplication
+	// from the node centroids and normals
+	unsigned int **m_puiFarNodeIndexLinks[AUTOPANEL_MAX_NUM_OF_HIERARCHIES];
+	unsigned long m_ulFarLinkChunkNum[AUTOPANEL_MAX_NUM_OF_HIERARCHIES];
+	bool m_bFarLinks[AUTOPANEL_MAX_NUM_OF_HIERARCHIES];
+	unsigned long m_ulBaseFarLinksNum;
+	// symmetric links (Galerkin, 3D only): a link between two conductor nodes is stored
+	// only once, in the range of one of the two nodes, and the multiplication
+	// scatters its contribution also to the other node
+	bool m_bSymLinks[AUTOPANEL_MAX_NUM_OF_HIERARCHIES];
+	// number of symmetric links, i.e. of links whose opposite is not stored
+	unsigned long m_ulSymLinksNum[AUTOPANEL_MAX_NUM_OF_HIERARCHIES];
+	unsigned int **m_puiNodeIndexLinks[AUTOPANEL_MAX_NUM_OF_HIERARCHIES];
 	unsigned long m_ulLinkChunkNum[AUTOPANEL_MAX_NUM_OF_HIERARCHIES];
-	unsigned long *m_ulUniqueLinkChunkIDs, *m_ulUniquePotChunkIDs;
+	// out-of-core: one temporary file per block, holding all the node index chunks
+	// of the block followed by all the coefficient of potential chunks
+	unsigned long *m_ulUniqueBlockIDs;
+	// memory-mapped out-of-core links: the chunk pointers of the current block point
+	// into the mapped block file, instead of to allocated chunks
+	bool m_bMmapLinks;
+	void *m_pMappedBlock;
+	unsigned long m_ulMappedBlockSize;
+	unsigned char m_ucMappedLevel;
+	// asynchronous out-of-core I/O: while the current block is processed, the I/O thread
+	// writes and / or reads a second (shadow) set of chunks, that is then swapped
+	// with the current one (see SaveLinksBehind() and PrefetchLinks())
+	bool m_bAsyncLinksIO;
+	unsigned int **m_puiShadowNodeIndexLinks;
+	double **m_dShadowPotCoeffLinks;
+	float **m_fShadowPotCoeffLinks;
+	CLinksIOThread *m_pLinksIOThread;
+	// block held in (or being read into) the shadow chunks, and block being written from them
+	unsigned long m_ulShadowBlock, m_ulIOWriteBlock;
+	bool m_bIOReadAlsoPot, m_bIOWriteAlsoPot;
+	int m_iIORet;
+	// compressed out-of-core files: buffer holding the encoded chunk being read or written
+	// (only one block I/O at a time), and raw vs. compressed bytes written
+	bool m_bCompressLinks;
+	unsigned char *m_pucCodecBuffer;
+	double m_dLinksRawBytes, m_dLinksDiskBytes;
 	CAutoConductor *m_pCurrentConductor;
 	double m_dMaxSigma, m_dMidSigma, m_dMinSigma;
-	bool m_bInitCharges, m_bPopulateNodeArray;
+	bool m_bInitCharges, m_bPopulateNodeArray, m_bRemapUpperLinks;
 	int m_iParseLevel;
 	int m_iGroupNum[AUTOREFINE_MAX_PARSE_LEVEL];
 	CLin_Vector *m_pLocalCondCharge;
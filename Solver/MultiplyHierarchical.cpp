@@ -44,9 +44,74 @@
 // This value has been empirically found
 #define MULTIPLYHIER_SCALE_FACTOR   1.0
 
-CMultHier::CMultHier()
+CMultHierWorkspace::CMultHierWorkspace()
 {
+	m_pdNodeCharges = NULL;
+	m_pdNodePotentials = NULL;
+	m_ulNodeArraySize = 0;
+	m_pdSymNodePotentials = NULL;
+	m_ulSymArraySize = 0;
+	m_iSymThreadsNum = 0;
+	m_bParallel = true;
+}
 
+CMultHierWorkspace::~CMultHierWorkspace()
+{
+	Deallocate();
+}
+
+void CMultHierWorkspace::Deallocate()
+{
+	if(m_pdNodeCharges != NULL) {
+		delete [] m_pdNodeCharges;
+		m_pdNodeCharges = NULL;
+		g_clsMemUsage.m_ulHierMem -= m_ulNodeArraySize * sizeof(double);
+	}
+	if(m_pdNodePotentials != NULL) {
+		delete [] m_pdNodePotentials;
+		m_pdNodePotentials = NULL;
+		g_clsMemUsage.m_ulHierMem -= m_ulNodeArraySize * sizeof(double);
+	}
+	if(m_pdSymNodePotentials != NULL) {
+		delete [] m_pdSymNodePotentials;
+		m_pdSymNodePotentials = NULL;
+		g_clsMemUsage.m_ulHierMem -= m_ulSymArraySize * sizeof(double);
+	}
+	m_ulNodeArraySize = 0;
+	m_ulSymArraySize = 0;
+	m_iSymThreadsNum = 0;
+}
+
+CMultHier::CMultHier()
+{
+	m_ulNodeArraySize = 0;
+	m_pulNodeLeft = NULL;
+	m_pulNodeRight = NULL;
+	m_plNodeLeafIndex = NULL;
+	m_pulLevelNodes = NULL;
+	m_pulLevelStart = NULL;
+	m_ulLevelsNum = 0;
+	m_pfNodeCentroidX = NULL;
+	m_pfNodeCentroidY = NULL;
+	m_pfNodeCentroidZ = NULL;
+	m_pfNodeNormalX = NULL;
+	m_pfNodeNormalY = NULL;
+	m_pfNodeNormalZ = NULL;
+	m_pucNodeIsDiel = NULL;
+	m_pdBlockNodeCharges = NULL;
+	m_pdBlockNodePotentials = NULL;
+	m_ulBlockArraySize = 0;
+	m_pclsBlockChargeVect = NULL;
+	m_pclsBlockPotVect = NULL;
+	m_uiBlockColsNum = 0;
+	m_uiBlockColsPerVec = 1;
+	m_ulBlockSubVecSize = 0;
+	m_fSinglePotCoeffLinks = NULL;
+	m_ulSingleChunkNum = 0;
+	m_bSinglePrecMult = false;
+	m_pulNearRowStart = NULL;
+	m_pulNearLeaf = NULL;
+	m_pdNearPotCoeff = NULL;
 }
 
 CMultHier::~CMultHier()
@@ -60,69 +125,381 @@ int CMultHier::AllocateMemory()
 	return FC_NORMAL_END;
 }
 
+// Allocate the dense node charge and potential arrays and the flattened tree;
+// must be called once the bottom level nodes are known (i.e. after AutoRefineLinks())
+int CMultHier::AllocateNodeArrays()
+{
+	int ret;
+
+	// if not already allocated with the right dimension
+	if(m_pulNodeLeft == NULL || m_ulNodeArraySize != m_ulNodeNum[AUTOREFINE_HIER_PRE_0_LEVEL]) {
+
+		DeallocateMemory();
+
+		m_ulNodeArraySize = m_ulNodeNum[AUTOREFINE_HIER_PRE_0_LEVEL];
+
+		ret = AllocateWorkspace(&m_clsWorkspace);
+		if(ret != FC_NORMAL_END) {
+			return ret;
+		}
+		// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+		SAFENEW_ARRAY_RET(unsigned long, m_pulNodeLeft, m_ulNodeArraySize, g_clsMemUsage.m_ulHierMem)
+		SAFENEW_ARRAY_RET(unsigned long, m_pulNodeRight, m_ulNodeArraySize, g_clsMemUsage.m_ulHierMem)
+		SAFENEW_ARRAY_RET(long, m_plNodeLeafIndex, m_ulNodeArraySize, g_clsMemUsage.m_ulHierMem)
+		SAFENEW_ARRAY_RET(unsigned long, m_pulLevelNodes, m_ulNodeArraySize, g_clsMemUsage.m_ulHierMem)
+		SAFENEW_ARRAY_RET(unsigned char, m_pucNodeIsDiel, m_ulNodeArraySize, g_clsMemUsage.m_ulHierMem)
+	}
+
+	// the mesh may have changed even if the number of nodes did not, so always rebuild the tree
+	return BuildNodeTree();
+}
+
+// Flatten the element trees of all conductors into arrays of node indexes,
+// ordering the nodes by tree level, for the parallel upward / downward sweeps
+// in ComputePanelCharges_fast() and ComputeLeafPotentials_fast()
+int CMultHier::BuildNodeTree()
+{
+	unsigned long i, level, *nodeLevel;
+	long leafIndex;
+
+	// SAFENEW_ARRAY_NOMEM_RET(TYPE, VAR, LEN)
+	SAFENEW_ARRAY_NOMEM_RET(unsigned long, nodeLevel, m_ulNodeArraySize)
+
+	// 'm_pNodes' is in post-order, conductor by conductor, so scanning it forward
+	// the leaves are met in the same order as in the charge / potential vectors
+	leafIndex = 0;
+	for(i=0; i<m_ulNodeArraySize; i++) {
+		ASSERT(m_pNodes[i]->m_ulNodeIndex[AUTOREFINE_HIER_PRE_0_LEVEL] == i);
+		if(m_pNodes[i]->IsLeaf()) {
+			m_plNodeLeafIndex[i] = leafIndex;
+			leafIndex++;
+			m_pulNodeLeft[i] = AUTOPANEL_NO_NODE_INDEX;
+			m_pulNodeRight[i] = AUTOPANEL_NO_NODE_INDEX;
+		}
+		else {
+			m_plNodeLeafIndex[i] = MULTHIER_NOT_A_LEAF;
+			m_pulNodeLeft[i] = m_pNodes[i]->m_pLeft->m_ulNodeIndex[AUTOREFINE_HIER_PRE_0_LEVEL];
+			m_pulNodeRight[i] = m_pNodes[i]->m_pRight->m_ulNodeIndex[AUTOREFINE_HIER_PRE_0_LEVEL];
+		}
+		if(m_pNodes[i]->m_ucType & AUTOPANEL_IS_DIEL) {
+			m_pucNodeIsDiel[i] = 1;
+		}
+		else {
+			m_pucNodeIsDiel[i] = 0;
+		}
+		// top panels are never children, so they stay at level zero
+		nodeLevel[i] = 0;
+	}
+
+	// in reverse post-order parents always come before their children
+	m_ulLevelsNum = 0;
+	for(i=m_ulNodeArraySize; i>0; i--) {
+		level = nodeLevel[i-1];
+		if(level + 1 > m_ulLevelsNum) {
+			m_ulLevelsNum = level + 1;
+		}
+		if(m_plNodeLeafIndex[i-1] == MULTHIER_NOT_A_LEAF) {
+			nodeLevel[m_pulNodeLeft[i-1]] = level + 1;
+			nodeLevel[m_pulNodeRight[i-1]] = level + 1;
+		}
+	}
+
+	// bucket the nodes by level (counting sort, keeping the post-order within each level)
+	if(m_pulLevelStart != NULL) {
+		delete m_pulLevelStart;
+		m_pulLevelStart = NULL;
+	}
+	// SAFENEW_ARRAY_NOMEM_RET(TYPE, VAR, LEN)
+	SAFENEW_ARRAY_NOMEM_RET(unsigned long, m_pulLevelStart, m_ulLevelsNum+1)
+
+	for(level=0; level<=m_ulLevelsNum; level++) {
+		m_pulLevelStart[level] = 0;
+	}
+	for(i=0; i<m_ulNodeArraySize; i++) {
+		m_pulLevelStart[nodeLevel[i]+1]++;
+	}
+	for(level=0; level<m_ulLevelsNum; level++) {
+		m_pulLevelStart[level+1] += m_pulLevelStart[level];
+	}
+	for(i=0; i<m_ulNodeArraySize; i++) {
+		// 'm_pulLevelStart' is used as insertion position
+		m_pulLevelNodes[m_pulLevelStart[nodeLevel[i]]] = i;
+		m_pulLevelStart[nodeLevel[i]]++;
+	}
+	// insertion moved every start to the start of the next level, shift back
+	for(level=m_ulLevelsNum; level>0; level--) {
+		m_pulLevelStart[level] = m_pulLevelStart[level-1];
+	}
+	m_pulLevelStart[0] = 0;
+
+	delete nodeLevel;
+
+	// if there are matrix-free far-field links, store the node geometry needed to compute them
+	// (only in 3D, see CAutoRefine::AutoRefinePanels())
+	if(m_bFarLinks[AUTOREFINE_HIER_PRE_0_LEVEL] == true || m_bFarLinks[AUTOREFINE_HIER_PRE_1_LEVEL] == true) {
+		if(m_pfNodeCentroidX == NULL) {
+			// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+			SAFENEW_ARRAY_RET(float, m_pfNodeCentroidX, m_ulNodeArraySize, g_clsMemUsage.m_ulHierMem)
+			SAFENEW_ARRAY_RET(float, m_pfNodeCentroidY, m_ulNodeArraySize, g_clsMemUsage.m_ulHierMem)
+			SAFENEW_ARRAY_RET(float, m_pfNodeCentroidZ, m_ulNodeArraySize, g_clsMemUsage.m_ulHierMem)
+			SAFENEW_ARRAY_RET(float, m_pfNodeNormalX, m_ulNodeArraySize, g_clsMemUsage.m_ulHierMem)
+			SAFENEW_ARRAY_RET(float, m_pfNodeNormalY, m_ulNodeArraySize, g_clsMemUsage.m_ulHierMem)
+			SAFENEW_ARRAY_RET(float, m_pfNodeNormalZ, m_ulNodeArraySize, g_clsMemUsage.m_ulHierMem)
+		}
+		for(i=0; i<m_ulNodeArraySize; i++) {
+			CAutoPanel *panel;
+			C3DVector normal;
+
+			panel = (CAutoPanel*)m_pNodes[i];
+			m_pfNodeCentroidX[i] = panel->GetCentroid().x;
+			m_pfNodeCentroidY[i] = panel->GetCentroid().y;
+			m_pfNodeCentroidZ[i] = panel->GetCentroid().z;
+			if(m_pucNodeIsDiel[i] != 0) {
+				// normal pointing to outperm side, as in PotEstimateOpt()
+				normal = panel->GetDielNormal();
+				m_pfNodeNormalX[i] = (float)normal.x;
+				m_pfNodeNormalY[i] = (float)normal.y;
+				m_pfNodeNormalZ[i] = (float)normal.z;
+			}
+			else {
+				m_pfNodeNormalX[i] = 0.0f;
+				m_pfNodeNormalY[i] = 0.0f;
+				m_pfNodeNormalZ[i] = 0.0f;
+			}
+		}
+	}
+
+	return FC_NORMAL_END;
+}
+
+// Allocate the node charge and potential arrays of 'workspace', sized on the
+// current node tree (see AllocateNodeArrays()); the symmetric links arrays
+// are allocated at the first multiplication
+int CMultHier::AllocateWorkspace(CMultHierWorkspace *workspace)
+{
+	// if already allocated with the right dimension, nothing to do
+	if(workspace->m_pdNodeCharges != NULL && workspace->m_ulNodeArraySize == m_ulNodeArraySize) {
+		return FC_NORMAL_END;
+	}
+
+	workspace->Deallocate();
+
+	workspace->m_ulNodeArraySize = m_ulNodeArraySize;
+
+	// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+	SAFENEW_ARRAY_RET(double, workspace->m_pdNodeCharges, m_ulNodeArraySize, g_clsMemUsage.m_ulHierMem)
+	SAFENEW_ARRAY_RET(double, workspace->m_pdNodePotentials, m_ulNodeArraySize, g_clsMemUsage.m_ulHierMem)
+
+	return FC_NORMAL_END;
+}
+
 void CMultHier::DeallocateMemory()
 {
+	m_clsWorkspace.Deallocate();
+	if(m_pulNodeLeft != NULL) {
+		delete m_pulNodeLeft;
+		m_pulNodeLeft = NULL;
+	}
+	if(m_pulNodeRight != NULL) {
+		delete m_pulNodeRight;
+		m_pulNodeRight = NULL;
+	}
+	if(m_plNodeLeafIndex != NULL) {
+		delete m_plNodeLeafIndex;
+		m_plNodeLeafIndex = NULL;
+	}
+	if(m_pulLevelNodes != NULL) {
+		delete m_pulLevelNodes;
+		m_pulLevelNodes = NULL;
+	}
+	if(m_pulLevelStart != NULL) {
+		delete m_pulLevelStart;
+		m_pulLevelStart = NULL;
+	}
+	if(m_pfNodeCentroidX != NULL) {
+		delete m_pfNodeCentroidX;
+		delete m_pfNodeCentroidY;
+		delete m_pfNodeCentroidZ;
+		delete m_pfNodeNormalX;
+		delete m_pfNodeNormalY;
+		delete m_pfNodeNormalZ;
+		m_pfNodeCentroidX = NULL;
+		m_pfNodeCentroidY = NULL;
+		m_pfNodeCentroidZ = NULL;
+		m_pfNodeNormalX = NULL;
+		m_pfNodeNormalY = NULL;
+		m_pfNodeNormalZ = NULL;
+	}
+	if(m_pucNodeIsDiel != NULL) {
+		delete m_pucNodeIsDiel;
+		m_pucNodeIsDiel = NULL;
+	}
+	m_ulNodeArraySize = 0;
+	m_ulLevelsNum = 0;
+	DeallocateBlockArrays();
+	DeallocateSinglePrecLinks();
+	DeallocateNearFieldMatrix();
+
 	// garbage collection not strictly needed (setting to NULL and zeroing memory counter)
 	// but in case this is moved out of destructor, it saves time and errors
 	g_clsMemUsage.m_ulHierMem = 0;
 }
 
 // Compute the charge of all nodes
-// Unrolling the recursion, for speed
-void CMultHier::ComputePanelCharges_fast()
+//
+// Bottom-up sweep of the flattened tree, one level at a time starting from
+// the deepest one, so the children charges are always available when the
+// parent is visited; the nodes within a level (of all conductors) are
+// independent and are processed in parallel
+void CMultHier::ComputePanelCharges_fast(CMultHierWorkspace *workspace)
 {
-	int i;
-	StlAutoCondDeque::iterator itc1;
+	unsigned long level;
+	// 'i' must have signed integral type due to MS OpenMP limitation (does not accept unsigned)
+	long i;
+	double *nodeCharges, *nodePotentials;
 
-	// init leaf panel counter
-	m_dIndex = 0;
+	nodeCharges = workspace->m_pdNodeCharges;
+	nodePotentials = workspace->m_pdNodePotentials;
 
-	// zeroes recursion vector
-	for(i=0; i<MULTHIER_MAX_RECURS_DEPTH; i++) {
-		m_clsRecursVec[i] = NULL;
-	}
+	for(level=m_ulLevelsNum; level>0; level--) {
 
-	// scan every conductor
-	for(itc1 = m_stlConductors.begin(); itc1 != m_stlConductors.end(); itc1++) {
-		// and compute the charge of its panels
-		i = 0;
-		m_clsRecursVec[i] = (*itc1)->m_uTopElement.m_pTopPanel;
+#pragma omp parallel for if(workspace->m_bParallel && m_pulLevelStart[level] - m_pulLevelStart[level-1] > MULTHIER_MIN_PARALLEL_NODES)
+		for(i=(long)m_pulLevelStart[level-1]; i<(long)m_pulLevelStart[level]; i++) {
+			unsigned long node;
+			long leaf;
 
-		do {
-			if(m_clsRecursVec[i]->IsLeaf()) {
+			node = m_pulLevelNodes[i];
+			leaf = m_plNodeLeafIndex[node];
+			if(leaf != MULTHIER_NOT_A_LEAF) {
 				// if leaf panel, simply copy charge value from input array
-				m_clsRecursVec[i]->m_dCharge = m_clsChargeVect[m_dIndex];
+				nodeCharges[node] = workspace->m_clsChargeVect[leaf];
 				// pre-calculate leaf panel potential based on self-coefficient of potential
 				// (for next ComputePanelPotentials() routine), instead of zeroing it and calculating it later,
 				// since the array of self-potential is separated from the mutual coefficients array
-				m_clsRecursVec[i]->m_dPotential = m_clsSelfPotCoeff[m_dIndex] * m_clsRecursVec[i]->m_dCharge;
-				m_dIndex++;
-				// and go up in the stack
-				i--;
+				nodePotentials[node] = m_clsSelfPotCoeff[leaf] * nodeCharges[node];
 			}
 			else {
-				// if already visited right branch, we have finished here
-				// and charge is the sum of left and right sub-tree charges
-				if(m_clsRecursVec[i+1] == m_clsRecursVec[i]->m_pRight) {
-					m_clsRecursVec[i]->m_dCharge = m_clsRecursVec[i]->m_pLeft->m_dCharge + m_clsRecursVec[i]->m_pRight->m_dCharge;
-					ASSERT(fabs(m_clsRecursVec[i]->m_dCharge) < 1E20);
-					// clear potentials (for next ComputePanelPotentials() routine)
-					m_clsRecursVec[i]->m_dPotential = 0.0;
-					i--;
+				// charge is the sum of left and right sub-tree charges
+				nodeCharges[node] = nodeCharges[m_pulNodeLeft[node]] + nodeCharges[m_pulNodeRight[node]];
+				ASSERT(fabs(nodeCharges[node]) < 1E20);
+				// clear potentials (for next ComputePanelPotentials() routine)
+				nodePotentials[node] = 0.0;
+			}
+		}
+	}
+}
+
+// Accumulate into 'potential' the contributions of 'linksNum' consecutive links, starting
+// at position 'posInChunk' of chunk 'chunk' (relative to the current block) and possibly
+// crossing into the next chunks. The coefficients of potential can be stored in single
+// or double precision, while the accumulation is always performed in double precision
+template<class T> void CMultHier::SumLinksPotential(T **potCoeffLinks, unsigned int **nodeIndexLinks, unsigned long chunk, unsigned long posInChunk,
+                                                    unsigned long linksNum, double *nodeCharges, double *potential, unsigned int vecNum)
+{
+	unsigned long j;
+	unsigned int k;
+	T *potCoeff;
+	unsigned int *nodeIndex;
+	double *charge, localPot;
+
+	potCoeff = &potCoeffLinks[chunk][posInChunk];
+	nodeIndex = &nodeIndexLinks[chunk][posInChunk];
+	localPot = 0.0;
+
+	for(j=0; j<linksNum; j++) {
+		if(vecNum == 1) {
+			localPot += nodeCharges[*nodeIndex] * (double)(*potCoeff);
+		}
+		else {
+			charge = &nodeCharges[(*nodeIndex) * vecNum];
+			for(k=0; k<vecNum; k++) {
+				potential[k] += charge[k] * (double)(*potCoeff);
+			}
+		}
+		potCoeff++;
+		nodeIndex++;
+		// if crossing the chunk boundary, move to the beginning of the next chunk
+		posInChunk++;
+		if(posInChunk == AUTOREFINE_LINK_CHUNK_SIZE && j+1 < linksNum) {
+			chunk++;
+			posInChunk = 0;
+			potCoeff = potCoeffLinks[chunk];
+			nodeIndex = nodeIndexLinks[chunk];
+		}
+	}
+
+	if(vecNum == 1) {
+		potential[0] += localPot;
+	}
+}
+
+// Same as SumLinksPotential(), for the links of a conductor node when symmetric links are enabled:
+// a link towards another conductor node is stored only once (see CAutoRefine::RefineMutual()),
+// so its contribution due to the node own 'charge' is also scattered into 'symPotentials'
+// (the per-thread potential array, to avoid conflicts with the other threads, or an array
+// shared by all the threads if 'atomicScatter' is true)
+template<class T> void CMultHier::SumSymLinksPotential(T **potCoeffLinks, unsigned int **nodeIndexLinks, unsigned long chunk, unsigned long posInChunk,
+                                                       unsigned long linksNum, double *nodeCharges, double *potential, double *charge,
+                                                       double *symPotentials, unsigned int vecNum, bool atomicScatter)
+{
+	unsigned long j;
+	unsigned int k;
+	T *potCoeff;
+	unsigned int *nodeIndex;
+	double *sourceCharge, *symPot, coeff, localPot;
+
+	potCoeff = &potCoeffLinks[chunk][posInChunk];
+	nodeIndex = &nodeIndexLinks[chunk][posInChunk];
+	localPot = 0.0;
+
+	for(j=0; j<linksNum; j++) {
+		coeff = (double)(*potCoeff);
+		if(vecNum == 1) {
+			localPot += nodeCharges[*nodeIndex] * coeff;
+			if(m_pucNodeIsDiel[*nodeIndex] == 0) {
+				if(atomicScatter == true) {
+#pragma omp atomic
+					symPotentials[*nodeIndex] += charge[0] * coeff;
 				}
-				else if(m_clsRecursVec[i+1] == m_clsRecursVec[i]->m_pLeft) {
-					// finished with left branch, must go visit the right one
-					m_clsRecursVec[i+1] = m_clsRecursVec[i]->m_pRight;
-					i++;
+				else {
+					symPotentials[*nodeIndex] += charge[0] * coeff;
+				}
+			}
+		}
+		else {
+			sourceCharge = &nodeCharges[(*nodeIndex) * vecNum];
+			for(k=0; k<vecNum; k++) {
+				potential[k] += sourceCharge[k] * coeff;
+			}
+			if(m_pucNodeIsDiel[*nodeIndex] == 0) {
+				symPot = &symPotentials[(*nodeIndex) * vecNum];
+				if(atomicScatter == true) {
+					for(k=0; k<vecNum; k++) {
+#pragma omp atomic
+						symPot[k] += charge[k] * coeff;
+					}
 				}
 				else {
-					// if none of the two, must go visit the left branch
-					m_clsRecursVec[i+1] = m_clsRecursVec[i]->m_pLeft;
-					i++;
+					for(k=0; k<vecNum; k++) {
+						symPot[k] += charge[k] * coeff;
+					}
 				}
 			}
 		}
-		while (i>=0);
+		potCoeff++;
+		nodeIndex++;
+		// if crossing the chunk boundary, move to the beginning of the next chunk
+		posInChunk++;
+		if(posInChunk == AUTOREFINE_LINK_CHUNK_SIZE && j+1 < linksNum) {
+			chunk++;
+			posInChunk = 0;
+			potCoeff = potCoeffLinks[chunk];
+			nodeIndex = nodeIndexLinks[chunk];
+		}
+	}
+
+	if(vecNum == 1) {
+		potential[0] += localPot;
 	}
 }
 
@@ -138,25 +515,54 @@ void CMultHier::ComputePanelCharges_fast()
 // Further accelerate, using links stored in array instead
 // of linked list, mimicking what is done by direct inversion of the
 // matrix, that in spite of n^3 complexity, is very fast for small n
-int CMultHier::ComputePanelPotentials_2fast()
+//
+// Links are stored CSR-like: the links of each node are contiguous in the
+// link arrays (from 'm_ulLinkIndexStart' to 'm_ulLinkIndexEnd'), and each link
+// holds the coefficient of potential and the index of the interacting node,
+// so the inner loop streams the link arrays and reads the node charges
+// from the dense 'nodeCharges' array
+//
+// 'nodeCharges' and 'nodePotentials' hold 'vecNum' interleaved values per node
+// (see MultiplyMatByBlock()), so every link is fetched only once for all the vectors
+//
+// With symmetric links, each conductor-conductor link is used for both nodes: the owner
+// node gathers as usual, while the contributions to the other node are accumulated
+// in per-thread arrays (or in a shared one, see AllocateSymArrays()), summed up at the end
+//
+// 'workspace' provides the symmetric links arrays and tells if the multiplication
+// can use all the threads; the links must be in-core if more multiplications run at the same time
+int CMultHier::ComputePanelPotentials_2fast(double *nodeCharges, double *nodePotentials, unsigned int vecNum, CMultHierWorkspace *workspace)
 {
 	int ret;
 	unsigned long linkIndex, chunk, block, nodeIndex, nodeBlockEnd, linksPerBlock;
 	// 'i' must have signed integral type due to MS OpenMP limitation (does not accept unsigned)
 	long i;
-	double **localPotCoeffLinks, **localBottomPotCoeffLinks;
-	CAutoElement ***localPanelPtrLinks, ***localBottomPnPtrLinks;
+	unsigned int **localNodeIndexLinks;
+	float **localFPotCoeffLinks;
+	bool symLinks, outOfCore, floatLinks;
+
+	symLinks = m_bSymLinks[m_ucInteractionLevel];
+	// single precision coefficients, either as stored or as a copy (see AllocateSinglePrecLinks())
+	floatLinks = m_bFloatLinks[m_ucInteractionLevel];
+	if(m_bSinglePrecMult == true && m_fSinglePotCoeffLinks != NULL && m_ucInteractionLevel == AUTOREFINE_HIER_PRE_0_LEVEL) {
+		floatLinks = true;
+	}
+	if(symLinks == true) {
+		ret = AllocateSymArrays(vecNum, workspace);
+		if(ret != FC_NORMAL_END) {
+			return ret;
+		}
+	}
 
-	// init pointers to link arrays
-	localPotCoeffLinks = m_dPotCoeffLinks[m_ucInteractionLevel];
-	localPanelPtrLinks = m_pdPanelPtrLinks[m_ucInteractionLevel];
-	// needed only for hierarchical precond upper level
-	localBottomPotCoeffLinks = m_dPotCoeffLinks[AUTOREFINE_HIER_PRE_0_LEVEL];
-	localBottomPnPtrLinks = m_pdPanelPtrLinks[AUTOREFINE_HIER_PRE_0_LEVEL];
+	// only the bottom level can be out-of-core
+	outOfCore = (m_ulBlocksNum > 1 && m_ucInteractionLevel == AUTOREFINE_HIER_PRE_0_LEVEL);
 
-	m_ulCurrBlock = 0;
 	// only if we went out-of-core, pre-load first set of chunks
-	if(m_ulBlocksNum > 1) {
+	// (with asynchronous I/O, block 0 has been prefetched at the end of the previous multiplication);
+	// in-core, the links are in a single block, and 'm_ulCurrBlock' must not be touched,
+	// as concurrent multiplications may run
+	if(outOfCore == true) {
+		m_ulCurrBlock = 0;
 		ret = LoadLinks(m_ulCurrBlock);
 		if(ret != FC_NORMAL_END) {
 			return ret;
@@ -175,12 +581,29 @@ int CMultHier::ComputePanelPotentials_2fast()
         chunk = linkIndex / AUTOREFINE_LINK_CHUNK_SIZE;
 		block = chunk / m_ulLinkChunkNum[m_ucInteractionLevel];
         // if not in current block
-		if(block != m_ulCurrBlock) {
+		if(outOfCore == true && block != m_ulCurrBlock) {
 			ret = LoadLinks(block);
 			if(ret != FC_NORMAL_END) {
 				return ret;
 			}
 		}
+		// with asynchronous I/O, read the next block while multiplying the current one
+		// (after the last block, read block 0 for the next multiplication)
+		if(outOfCore == true) {
+			ret = PrefetchLinks((block + 1) % m_ulBlocksNum);
+			if(ret != FC_NORMAL_END) {
+				return ret;
+			}
+		}
+
+		// init pointer to the node index links (the chunks are swapped by LoadLinks(), when asynchronous)
+		localNodeIndexLinks = m_puiNodeIndexLinks[m_ucInteractionLevel];
+		if(floatLinks == true && m_bFloatLinks[m_ucInteractionLevel] == false) {
+			localFPotCoeffLinks = m_fSinglePotCoeffLinks;
+		}
+		else {
+			localFPotCoeffLinks = m_fPotCoeffLinks[m_ucInteractionLevel];
+		}
 
         // scan the nodes whose links are in the current block (of course they must be ordered)
         // but first we need to find where to stop (to avoid scanning all nodes every time)
@@ -196,111 +619,215 @@ int CMultHier::ComputePanelPotentials_2fast()
 
         // now calculate potentials based on charges, performing multiplication and accumulation
 
-#pragma omp parallel for
+#pragma omp parallel for if(workspace->m_bParallel)
         for(i=nodeIndex; i<(long)nodeBlockEnd; i++) {
-            unsigned long localLinkIndex, localChunk, localPosInChunk;
-            // perform summation
-            for(localLinkIndex = m_pNodes[i]->m_ulLinkIndexStart[m_ucInteractionLevel]; localLinkIndex < m_pNodes[i]->m_ulLinkIndexEnd[m_ucInteractionLevel]; localLinkIndex++) {
-
-                // some of the links could be outside the boundary of the chunk, either on the left
-                // (but not for the first node) or on the right. In this case, skip
-                if(localLinkIndex >= linkIndex) {
-                    localChunk = localLinkIndex / AUTOREFINE_LINK_CHUNK_SIZE;
-                    localPosInChunk = localLinkIndex % AUTOREFINE_LINK_CHUNK_SIZE;
-                    // adjust chunk to position within the current block
-                    localChunk -= m_ulLinkChunkNum[m_ucInteractionLevel] * m_ulCurrBlock;
-                    // if still within the boundary
-                    if(localChunk < m_ulLinkChunkNum[m_ucInteractionLevel]) {
-                        // node potentials have already been zeroed in ComputePanelCharges_fast()
-                        m_pNodes[i]->m_dPotential += (localPanelPtrLinks[localChunk][localPosInChunk])->m_dCharge * localPotCoeffLinks[localChunk][localPosInChunk];
-                        ASSERT(fabs(m_pNodes[i]->m_dPotential) < 1E20);
-                    }
+            unsigned long localLinkIndex, localLinkEnd, localChunk, localPosInChunk;
+
+            localLinkIndex = m_pNodes[i]->m_ulLinkIndexStart[m_ucInteractionLevel];
+            localLinkEnd = m_pNodes[i]->m_ulLinkIndexEnd[m_ucInteractionLevel];
+            // some of the links could be outside the boundary of the block, either on the left
+            // (but not for the first node) or on the right. In this case, skip
+            if(localLinkIndex < linkIndex) {
+                localLinkIndex = linkIndex;
+            }
+            if(localLinkEnd > linkIndex + linksPerBlock) {
+                localLinkEnd = linkIndex + linksPerBlock;
+            }
+            if(localLinkIndex >= localLinkEnd) {
+                continue;
+            }
+
+            // position within the current block ('linkIndex' is the first link of the block)
+            localChunk = (localLinkIndex - linkIndex) / AUTOREFINE_LINK_CHUNK_SIZE;
+            localPosInChunk = (localLinkIndex - linkIndex) % AUTOREFINE_LINK_CHUNK_SIZE;
+
+            // node potentials have already been initialized in ComputePanelCharges_fast()
+            // (remark: the position of the node in 'm_pNodes' is its node index)
+            if(symLinks == true && m_pucNodeIsDiel[i] == 0) {
+                double *symPotentials;
+                bool atomicScatter;
+
+                // a single array, shared by all the threads (see AllocateSymArrays())
+                atomicScatter = (workspace->m_iSymThreadsNum == 1 && workspace->m_bParallel == true);
+                if(atomicScatter == true) {
+                    symPotentials = workspace->m_pdSymNodePotentials;
+                }
+                else {
+                    symPotentials = &workspace->m_pdSymNodePotentials[(unsigned long)omp_get_thread_num() * m_ulNodeArraySize * vecNum];
+                }
+                if(floatLinks == true) {
+                    SumSymLinksPotential(localFPotCoeffLinks, localNodeIndexLinks, localChunk, localPosInChunk,
+                                         localLinkEnd - localLinkIndex, nodeCharges, &nodePotentials[i * vecNum], &nodeCharges[i * vecNum],
+                                         symPotentials, vecNum, atomicScatter);
                 }
+                else {
+                    SumSymLinksPotential(m_dPotCoeffLinks[m_ucInteractionLevel], localNodeIndexLinks, localChunk, localPosInChunk,
+                                         localLinkEnd - localLinkIndex, nodeCharges, &nodePotentials[i * vecNum], &nodeCharges[i * vecNum],
+                                         symPotentials, vecNum, atomicScatter);
+                }
+            }
+            else if(floatLinks == true) {
+                SumLinksPotential(localFPotCoeffLinks, localNodeIndexLinks, localChunk, localPosInChunk,
+                                  localLinkEnd - localLinkIndex, nodeCharges, &nodePotentials[i * vecNum], vecNum);
+            }
+            else {
+                SumLinksPotential(m_dPotCoeffLinks[m_ucInteractionLevel], localNodeIndexLinks, localChunk, localPosInChunk,
+                                  localLinkEnd - localLinkIndex, nodeCharges, &nodePotentials[i * vecNum], vecNum);
             }
+            ASSERT(fabs(nodePotentials[i * vecNum]) < 1E20);
         }
         // and move to next nodeIndex position
         nodeIndex = nodeBlockEnd - 1;
     }
 
+	// add the contributions scattered by the symmetric links
+	if(symLinks == true) {
+		ReduceSymPotentials(nodePotentials, vecNum, workspace);
+	}
+
+	// matrix-free far-field links, always in-core
+	if(m_ulFarLinksNum[m_ucInteractionLevel] > 0) {
+
+#pragma omp parallel for if(workspace->m_bParallel)
+		for(i=0; i<(long)m_ulNodeNum[AUTOREFINE_HIER_PRE_0_LEVEL]; i++) {
+			if(m_pNodes[i]->m_ulFarLinkIndexEnd[m_ucInteractionLevel] > m_pNodes[i]->m_ulFarLinkIndexStart[m_ucInteractionLevel]) {
+				SumFarLinksPotential(i, nodeCharges, &nodePotentials[i * vecNum], vecNum);
+			}
+		}
+	}
+
 	return FC_NORMAL_END;
 }
 
+// Accumulate into 'potential' the contributions of the far-field links of 'node',
+// computing the coefficients of potential from the node centroids and normals
+// with the same simple formulas used by PotEstimateOpt() for far panels:
+// 1/r for conductor evaluation nodes, and the normal component of the field
+// (dipole-like formula) for dielectric evaluation nodes
+void CMultHier::SumFarLinksPotential(unsigned long node, double *nodeCharges, double *potential, unsigned int vecNum)
+{
+	unsigned long linkIndex, linkEnd, chunk, posInChunk, source;
+	unsigned int k, *nodeIndex;
+	float dx, dy, dz;
+	double rdist2, rdist, coeff, localPot, *charge;
+	bool isDiel;
+
+	linkIndex = m_pNodes[node]->m_ulFarLinkIndexStart[m_ucInteractionLevel];
+	linkEnd = m_pNodes[node]->m_ulFarLinkIndexEnd[m_ucInteractionLevel];
+	chunk = linkIndex / AUTOREFINE_LINK_CHUNK_SIZE;
+	posInChunk = linkIndex % AUTOREFINE_LINK_CHUNK_SIZE;
+	nodeIndex = &m_puiFarNodeIndexLinks[m_ucInteractionLevel][chunk][posInChunk];
+	isDiel = (m_pucNodeIsDiel[node] != 0);
+	localPot = 0.0;
+
+	for(; linkIndex < linkEnd; linkIndex++) {
+		source = *nodeIndex;
+
+		dx = m_pfNodeCentroidX[node] - m_pfNodeCentroidX[source];
+		dy = m_pfNodeCentroidY[node] - m_pfNodeCentroidY[source];
+		dz = m_pfNodeCentroidZ[node] - m_pfNodeCentroidZ[source];
+		rdist2 = (double)dx*dx + (double)dy*dy + (double)dz*dz;
+		rdist = sqrt(rdist2);
+		if(isDiel == false) {
+			coeff = 1.0 / (FOUR_PI_TIMES_E0 * rdist);
+		}
+		else {
+			coeff = ((double)dx*m_pfNodeNormalX[node] + (double)dy*m_pfNodeNormalY[node] + (double)dz*m_pfNodeNormalZ[node]) / (FOUR_PI_TIMES_E0 * rdist2 * rdist);
+		}
+
+		if(vecNum == 1) {
+			localPot += nodeCharges[source] * coeff;
+		}
+		else {
+			charge = &nodeCharges[source * vecNum];
+			for(k=0; k<vecNum; k++) {
+				potential[k] += charge[k] * coeff;
+			}
+		}
+
+		nodeIndex++;
+		// if crossing the chunk boundary, move to the beginning of the next chunk
+		posInChunk++;
+		if(posInChunk == AUTOREFINE_LINK_CHUNK_SIZE && linkIndex+1 < linkEnd) {
+			chunk++;
+			posInChunk = 0;
+			nodeIndex = m_puiFarNodeIndexLinks[m_ucInteractionLevel][chunk];
+		}
+	}
+
+	if(vecNum == 1) {
+		potential[0] += localPot;
+	}
+}
+
 // Compute the potential of each leaf panels from potential
 // on all panels, summing it down
-// Unrolling the recursion, for speed
-void CMultHier::ComputeLeafPotentials_fast()
+//
+// Top-down sweep of the flattened tree, one level at a time: all the parents
+// at a given level have completed their potential before their children
+// are visited, and each node writes only its own children, so the nodes
+// within a level (of all conductors) can be processed in parallel
+void CMultHier::ComputeLeafPotentials_fast(CMultHierWorkspace *workspace)
 {
-	int i;
-	StlAutoCondDeque::iterator itc1;
+	unsigned long level;
+	// 'i' must have signed integral type due to MS OpenMP limitation (does not accept unsigned)
+	long i;
+	double *nodePotentials;
 
-	// init leaf panel counter
-	m_dIndex = 0;
+	nodePotentials = workspace->m_pdNodePotentials;
 
-	// zeroes recursion vector
-	for(i=0; i<MULTHIER_MAX_RECURS_DEPTH; i++) {
-		m_clsRecursVec[i] = NULL;
-	}
+	for(level=0; level<m_ulLevelsNum; level++) {
 
-	// scan every conductor
-	for(itc1 = m_stlConductors.begin(); itc1 != m_stlConductors.end(); itc1++) {
-		// and compute the charge of its panels
-		i = 0;
-		m_clsRecursVec[i] = (*itc1)->m_uTopElement.m_pTopPanel;
+#pragma omp parallel for if(workspace->m_bParallel && m_pulLevelStart[level+1] - m_pulLevelStart[level] > MULTHIER_MIN_PARALLEL_NODES)
+		for(i=(long)m_pulLevelStart[level]; i<(long)m_pulLevelStart[level+1]; i++) {
+			unsigned long node;
 
-		do {
-			if(m_clsRecursVec[i]->IsLeaf()) {
+			node = m_pulLevelNodes[i];
+			if(m_plNodeLeafIndex[node] != MULTHIER_NOT_A_LEAF) {
 				// if leaf, store resulting potential in the array
 				// to be returned to the caller as mult result
-				m_clsPotVect[m_dIndex] = m_clsRecursVec[i]->m_dPotential;
-				m_dIndex++;
-				// and go up in the stack
-				i--;
+				workspace->m_clsPotVect[m_plNodeLeafIndex[node]] = nodePotentials[node];
 			}
 			else {
-				// if already visited right branch, we have finished here
-				// and charge is the sum of left and right sub-tree charges
-				if(m_clsRecursVec[i+1] == m_clsRecursVec[i]->m_pRight) {
-					i--;
-				}
-				else if(m_clsRecursVec[i+1] == m_clsRecursVec[i]->m_pLeft) {
-					// finished with left branch, must go visit the right one
-					m_clsRecursVec[i+1] = m_clsRecursVec[i]->m_pRight;
-					i++;
-				}
-				else {
-					// if none of the two
-					// add panel potential to children potentials
-					m_clsRecursVec[i]->m_pLeft->m_dPotential += m_clsRecursVec[i]->m_dPotential;
-					m_clsRecursVec[i]->m_pRight->m_dPotential += m_clsRecursVec[i]->m_dPotential;
-					// and go visit the left branch
-					m_clsRecursVec[i+1] = m_clsRecursVec[i]->m_pLeft;
-					i++;
-				}
+				// add panel potential to children potentials
+				nodePotentials[m_pulNodeLeft[node]] += nodePotentials[node];
+				nodePotentials[m_pulNodeRight[node]] += nodePotentials[node];
 			}
 		}
-		while (i>=0);
 	}
 }
 
 int CMultHier::MultiplyMatByVec_fast(CLin_Vector *v, CLin_Vector *q)
+{
+	return MultiplyMatByVec_fast(v, q, &m_clsWorkspace);
+}
+
+// Multiply the matrix by a vector: v = P * q
+//
+// All the intermediate values are kept in 'workspace', so this function is re-entrant:
+// more multiplications can run at the same time, each one with its own workspace
+// (allocated with AllocateWorkspace()), provided that the links are in-core
+int CMultHier::MultiplyMatByVec_fast(CLin_Vector *v, CLin_Vector *q, CMultHierWorkspace *workspace)
 {
 	int ret;
 	unsigned long size, halfsize, i, j;
 	double lastrow;
 
+	ASSERT(workspace == &m_clsWorkspace || IsOutOfCore() == false);
+
 	// allocate vectors
 	if( m_clsGlobalVars.m_ucHasCmplxPerm == AUTOREFINE_REAL_PERM ) {
 		// store locally the reference to
 		// the charge and the potential vectors
-		m_clsChargeVect = *q;
-		m_clsPotVect = *v;
+		workspace->m_clsChargeVect = *q;
+		workspace->m_clsPotVect = *v;
 
 		// gather charges, calculate potentials and
 		// sum contributions into the leaves
-		ComputePanelCharges_fast();
+		ComputePanelCharges_fast(workspace);
 		//	ComputePanelPotentials_fast();
-		ret = ComputePanelPotentials_2fast();
-		ComputeLeafPotentials_fast();
+		ret = ComputePanelPotentials_2fast(workspace->m_pdNodeCharges, workspace->m_pdNodePotentials, 1, workspace);
+		ComputeLeafPotentials_fast(workspace);
 
 		if(g_ucSolverType == SOLVERGLOBAL_2DSOLVER) {
 			// if 2D, must correct for the 'k' integration constant;
@@ -350,15 +877,15 @@ int CMultHier::MultiplyMatByVec_fast(CLin_Vector *v, CLin_Vector *q)
 
 		// store locally the reference to
 		// the charge and the potential vectors
-		m_clsChargeVect = CLin_Range(*q, 0, halfsize-1);
-		m_clsPotVect = CLin_Range(*v, 0, halfsize-1);
+		workspace->m_clsChargeVect = CLin_Range(*q, 0, halfsize-1);
+		workspace->m_clsPotVect = CLin_Range(*v, 0, halfsize-1);
 
 		// gather charges, calculate potentials and
 		// sum contributions into the leaves
-		ComputePanelCharges_fast();
+		ComputePanelCharges_fast(workspace);
 		//	ComputePanelPotentials_fast();
-		ret = ComputePanelPotentials_2fast();
-		ComputeLeafPotentials_fast();
+		ret = ComputePanelPotentials_2fast(workspace->m_pdNodeCharges, workspace->m_pdNodePotentials, 1, workspace);
+		ComputeLeafPotentials_fast(workspace);
 
 		// then add to the potential vector the contribution of the multiplication of the C block
 		// by the second half of the 'q' vector. This is easier since the C block is diagonal
@@ -405,15 +932,15 @@ int CMultHier::MultiplyMatByVec_fast(CLin_Vector *v, CLin_Vector *q)
 
 		// store locally the reference to
 		// the charge and the potential vectors
-		m_clsChargeVect = CLin_Range(*q, halfsize, size);
-		m_clsPotVect = CLin_Range(*v, halfsize, size);
+		workspace->m_clsChargeVect = CLin_Range(*q, halfsize, size);
+		workspace->m_clsPotVect = CLin_Range(*v, halfsize, size);
 
 		// gather charges, calculate potentials and
 		// sum contributions into the leaves
-		ComputePanelCharges_fast();
+		ComputePanelCharges_fast(workspace);
 		//	ComputePanelPotentials_fast();
-		ret = ComputePanelPotentials_2fast();
-		ComputeLeafPotentials_fast();
+		ret = ComputePanelPotentials_2fast(workspace->m_pdNodeCharges, workspace->m_pdNodePotentials, 1, workspace);
+		ComputeLeafPotentials_fast(workspace);
 
 		// then add to the potential vector the contribution of the multiplication of the C block
 		// by the first half of the 'q' vector. This is easier since the C block is diagonal
@@ -457,6 +984,464 @@ int CMultHier::MultiplyMatByVec_fast(CLin_Vector *v, CLin_Vector *q)
 	return ret;
 }
 
+// Multiply the matrix by a block of 'vecNum' vectors at once: v[k] = P * q[k]
+//
+// The charges and potentials of the nodes are stored interleaved ('vecNum' values per node,
+// or 2 * 'vecNum' in case of complex permittivity, where the real and imaginary halves of each
+// vector are multiplied by the R block as separate vectors), so every link is fetched
+// from memory (or from disk, if out-of-core) only once for all the vectors of the block
+int CMultHier::MultiplyMatByBlock(CLin_Vector *v, CLin_Vector *q, unsigned int vecNum)
+{
+	int ret;
+	unsigned long size, halfsize, i, j;
+	unsigned int k;
+
+	ASSERT(vecNum > 0);
+
+	// nothing to be gained
+	if(vecNum == 1) {
+		return MultiplyMatByVec_fast(v, q);
+	}
+
+	size = q[0].size();
+
+	m_pclsBlockChargeVect = q;
+	m_pclsBlockPotVect = v;
+	if( m_clsGlobalVars.m_ucHasCmplxPerm == AUTOREFINE_REAL_PERM ) {
+		m_uiBlockColsPerVec = 1;
+		m_ulBlockSubVecSize = size;
+	}
+	else {
+		halfsize = size / 2;
+		ASSERT(halfsize * 2 == size);
+		m_uiBlockColsPerVec = 2;
+		m_ulBlockSubVecSize = halfsize;
+	}
+	m_uiBlockColsNum = vecNum * m_uiBlockColsPerVec;
+
+	ret = AllocateBlockArrays(m_uiBlockColsNum);
+	if(ret != FC_NORMAL_END) {
+		return ret;
+	}
+
+	// gather charges, calculate potentials and
+	// sum contributions into the leaves
+	ComputePanelChargesBlock();
+	ret = ComputePanelPotentials_2fast(m_pdBlockNodeCharges, m_pdBlockNodePotentials, m_uiBlockColsNum, &m_clsWorkspace);
+	ComputeLeafPotentialsBlock();
+
+	// same corrections as in MultiplyMatByVec_fast(), vector by vector
+	for(k=0; k<vecNum; k++) {
+
+		ASSERT(q[k].size() == size && v[k].size() == size);
+
+		if( m_clsGlobalVars.m_ucHasCmplxPerm == AUTOREFINE_REAL_PERM ) {
+			if(g_ucSolverType == SOLVERGLOBAL_2DSOLVER) {
+				Correct2DLastRow(&v[k], &q[k], 0, size);
+			}
+		}
+		else {
+			// contribution of the diagonal C block of [R -C; C R]
+			for(i=0, j=halfsize; i<halfsize; i++, j++) {
+				v[k][i] -= m_clsImgSelfPotCoeff[i] * q[k][j];
+				v[k][j] += m_clsImgSelfPotCoeff[i] * q[k][i];
+			}
+			if(g_ucSolverType == SOLVERGLOBAL_2DSOLVER) {
+				Correct2DLastRow(&v[k], &q[k], 0, halfsize);
+				Correct2DLastRow(&v[k], &q[k], halfsize, size);
+			}
+		}
+	}
+
+	return ret;
+}
+
+// If 2D, must correct for the 'k' integration constant (see MultiplyMatByVec_fast()),
+// operating on the rows from 'start' to 'end'-1 of 'v'
+void CMultHier::Correct2DLastRow(CLin_Vector *v, CLin_Vector *q, unsigned long start, unsigned long end)
+{
+	unsigned long i;
+	double lastrow;
+
+	// subtract last row from all the previous conductor rows, except the last one
+	lastrow = (*v)[end-1];
+	for(i=m_ulFirstCondElemIndex + start; i<end-1; i++) {
+		(*v)[i] -= lastrow;
+	}
+	// and 'create' last row as sum of all charges
+	lastrow = 0.0;
+	for(i=start; i<end; i++) {
+		lastrow += (*q)[i];
+	}
+	(*v)[end-1] = MULTIPLYHIER_SCALE_FACTOR * lastrow;
+}
+
+// Allocate the interleaved node charge and potential arrays for block multiplication
+int CMultHier::AllocateBlockArrays(unsigned int colsNum)
+{
+	// if already allocated with enough room, nothing to do
+	// (a smaller block, e.g. when some GMRES columns have converged, reuses the arrays)
+	if(m_pdBlockNodeCharges != NULL && m_ulBlockArraySize >= m_ulNodeArraySize * colsNum) {
+		return FC_NORMAL_END;
+	}
+
+	DeallocateBlockArrays();
+
+	m_ulBlockArraySize = m_ulNodeArraySize * colsNum;
+
+	// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+	SAFENEW_ARRAY_RET(double, m_pdBlockNodeCharges, m_ulBlockArraySize, g_clsMemUsage.m_ulHierMem)
+	SAFENEW_ARRAY_RET(double, m_pdBlockNodePotentials, m_ulBlockArraySize, g_clsMemUsage.m_ulHierMem)
+
+	return FC_NORMAL_END;
+}
+
+void CMultHier::DeallocateBlockArrays()
+{
+	if(m_pdBlockNodeCharges != NULL) {
+		delete m_pdBlockNodeCharges;
+		m_pdBlockNodeCharges = NULL;
+		g_clsMemUsage.m_ulHierMem -= m_ulBlockArraySize * sizeof(double);
+	}
+	if(m_pdBlockNodePotentials != NULL) {
+		delete m_pdBlockNodePotentials;
+		m_pdBlockNodePotentials = NULL;
+		g_clsMemUsage.m_ulHierMem -= m_ulBlockArraySize * sizeof(double);
+	}
+	m_ulBlockArraySize = 0;
+}
+
+// Make a single precision copy of the coefficients of potential of the bottom level links,
+// used instead of the double precision ones by the multiplications issued while
+// 'm_bSinglePrecMult' is set (see SetSinglePrecMult()). Streaming half the bytes
+// per link, these multiplications are faster, at the price of single precision accuracy
+// (see CSolveCap::SolveMixedPrecision()).
+// Only for in-core, double precision links; returns FC_GENERIC_ERROR otherwise
+int CMultHier::AllocateSinglePrecLinks()
+{
+	unsigned long j, k, chunkLen;
+	double *dPotCoeff;
+	float *fPotCoeff;
+
+	DeallocateSinglePrecLinks();
+
+	if(IsOutOfCore() == true || m_bFloatLinks[AUTOREFINE_HIER_PRE_0_LEVEL] == true ||
+	        m_dPotCoeffLinks[AUTOREFINE_HIER_PRE_0_LEVEL] == NULL) {
+		return FC_GENERIC_ERROR;
+	}
+
+	m_ulSingleChunkNum = (GetLinksNum(AUTOREFINE_HIER_PRE_0_LEVEL) + AUTOREFINE_LINK_CHUNK_SIZE - 1) / AUTOREFINE_LINK_CHUNK_SIZE;
+
+	// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+	SAFENEW_ARRAY_RET(float*, m_fSinglePotCoeffLinks, m_ulSingleChunkNum, g_clsMemUsage.m_ulLinksMem)
+	for(k=0; k<m_ulSingleChunkNum; k++) {
+		m_fSinglePotCoeffLinks[k] = NULL;
+	}
+
+	for(k=0; k<m_ulSingleChunkNum; k++) {
+		// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+		SAFENEW_ARRAY_RET(float, m_fSinglePotCoeffLinks[k], AUTOREFINE_LINK_CHUNK_SIZE, g_clsMemUsage.m_ulLinksMem)
+
+		dPotCoeff = m_dPotCoeffLinks[AUTOREFINE_HIER_PRE_0_LEVEL][k];
+		fPotCoeff = m_fSinglePotCoeffLinks[k];
+		// the last chunk may be only partially filled
+		chunkLen = AUTOREFINE_LINK_CHUNK_SIZE;
+		if(k == m_ulSingleChunkNum-1 && GetLinksNum(AUTOREFINE_HIER_PRE_0_LEVEL) % AUTOREFINE_LINK_CHUNK_SIZE != 0) {
+			chunkLen = GetLinksNum(AUTOREFINE_HIER_PRE_0_LEVEL) % AUTOREFINE_LINK_CHUNK_SIZE;
+		}
+		for(j=0; j<chunkLen; j++) {
+			fPotCoeff[j] = (float)dPotCoeff[j];
+		}
+	}
+
+	return FC_NORMAL_END;
+}
+
+void CMultHier::DeallocateSinglePrecLinks()
+{
+	unsigned long k, mem;
+
+	if(m_fSinglePotCoeffLinks != NULL) {
+		mem = m_ulSingleChunkNum * sizeof(float*);
+		for(k=0; k<m_ulSingleChunkNum; k++) {
+			if(m_fSinglePotCoeffLinks[k] != NULL) {
+				delete [] m_fSinglePotCoeffLinks[k];
+				mem += AUTOREFINE_LINK_CHUNK_SIZE * sizeof(float);
+			}
+		}
+		delete [] m_fSinglePotCoeffLinks;
+		m_fSinglePotCoeffLinks = NULL;
+		// the links memory counter may have already been cleared together with the links
+		if(g_clsMemUsage.m_ulLinksMem >= mem) {
+			g_clsMemUsage.m_ulLinksMem -= mem;
+		}
+	}
+	m_ulSingleChunkNum = 0;
+	m_bSinglePrecMult = false;
+}
+
+// Extract from the bottom level links the near-field part of the potential matrix, that is
+// the coefficients of potential of the links between two leaves (the self potentials are not
+// included, see 'm_clsSelfPotCoeff'), in CSR format, row 'i' being the potential of leaf 'i'.
+// A symmetric link (see 'm_bSymLinks') is stored only once, so it goes in both rows.
+// The far-field links are never between leaves, so they are not needed.
+// Only for in-core links; returns FC_GENERIC_ERROR otherwise
+int CMultHier::BuildNearFieldMatrix()
+{
+	unsigned long i, linkIndex, chunk, posInChunk, node, leafNum, *rowPos;
+	long leaf1, leaf2;
+	bool symLink;
+	double potCoeff;
+
+	DeallocateNearFieldMatrix();
+
+	if(IsOutOfCore() == true || m_plNodeLeafIndex == NULL) {
+		return FC_GENERIC_ERROR;
+	}
+
+	leafNum = GetPanelNum(AUTOREFINE_HIER_PRE_0_LEVEL);
+
+	// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+	SAFENEW_ARRAY_RET(unsigned long, m_pulNearRowStart, leafNum+1, g_clsMemUsage.m_ulPrecondMem)
+
+	// first pass, count the links of each row
+	for(i=0; i<=leafNum; i++) {
+		m_pulNearRowStart[i] = 0;
+	}
+	for(i=0; i<m_ulNodeArraySize; i++) {
+		leaf1 = m_plNodeLeafIndex[i];
+		if(leaf1 == MULTHIER_NOT_A_LEAF) {
+			continue;
+		}
+		symLink = (m_bSymLinks[AUTOREFINE_HIER_PRE_0_LEVEL] == true && m_pucNodeIsDiel[i] == 0);
+		for(linkIndex = m_pNodes[i]->m_ulLinkIndexStart[AUTOREFINE_HIER_PRE_0_LEVEL]; linkIndex < m_pNodes[i]->m_ulLinkIndexEnd[AUTOREFINE_HIER_PRE_0_LEVEL]; linkIndex++) {
+			node = m_puiNodeIndexLinks[AUTOREFINE_HIER_PRE_0_LEVEL][linkIndex / AUTOREFINE_LINK_CHUNK_SIZE][linkIndex % AUTOREFINE_LINK_CHUNK_SIZE];
+			leaf2 = m_plNodeLeafIndex[node];
+			if(leaf2 == MULTHIER_NOT_A_LEAF) {
+				continue;
+			}
+			m_pulNearRowStart[leaf1+1]++;
+			if(symLink == true && m_pucNodeIsDiel[node] == 0) {
+				m_pulNearRowStart[leaf2+1]++;
+			}
+		}
+	}
+	for(i=0; i<leafNum; i++) {
+		m_pulNearRowStart[i+1] += m_pulNearRowStart[i];
+	}
+
+	// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+	SAFENEW_ARRAY_RET(unsigned long, m_pulNearLeaf, m_pulNearRowStart[leafNum], g_clsMemUsage.m_ulPrecondMem)
+	SAFENEW_ARRAY_RET(double, m_pdNearPotCoeff, m_pulNearRowStart[leafNum], g_clsMemUsage.m_ulPrecondMem)
+	// SAFENEW_ARRAY_NOMEM_RET(TYPE, VAR, LEN)
+	SAFENEW_ARRAY_NOMEM_RET(unsigned long, rowPos, leafNum)
+
+	// second pass, fill the rows ('rowPos' is the insertion position)
+	for(i=0; i<leafNum; i++) {
+		rowPos[i] = m_pulNearRowStart[i];
+	}
+	// GetPotCoeffLink() reads the links of the current level
+	ASSERT(m_ucInteractionLevel == AUTOREFINE_HIER_PRE_0_LEVEL);
+	for(i=0; i<m_ulNodeArraySize; i++) {
+		leaf1 = m_plNodeLeafIndex[i];
+		if(leaf1 == MULTHIER_NOT_A_LEAF) {
+			continue;
+		}
+		symLink = (m_bSymLinks[AUTOREFINE_HIER_PRE_0_LEVEL] == true && m_pucNodeIsDiel[i] == 0);
+		for(linkIndex = m_pNodes[i]->m_ulLinkIndexStart[AUTOREFINE_HIER_PRE_0_LEVEL]; linkIndex < m_pNodes[i]->m_ulLinkIndexEnd[AUTOREFINE_HIER_PRE_0_LEVEL]; linkIndex++) {
+			chunk = linkIndex / AUTOREFINE_LINK_CHUNK_SIZE;
+			posInChunk = linkIndex % AUTOREFINE_LINK_CHUNK_SIZE;
+			node = m_puiNodeIndexLinks[AUTOREFINE_HIER_PRE_0_LEVEL][chunk][posInChunk];
+			leaf2 = m_plNodeLeafIndex[node];
+			if(leaf2 == MULTHIER_NOT_A_LEAF) {
+				continue;
+			}
+			potCoeff = GetPotCoeffLink(chunk, posInChunk);
+			m_pulNearLeaf[rowPos[leaf1]] = (unsigned long)leaf2;
+			m_pdNearPotCoeff[rowPos[leaf1]] = potCoeff;
+			rowPos[leaf1]++;
+			if(symLink == true && m_pucNodeIsDiel[node] == 0) {
+				m_pulNearLeaf[rowPos[leaf2]] = (unsigned long)leaf1;
+				m_pdNearPotCoeff[rowPos[leaf2]] = potCoeff;
+				rowPos[leaf2]++;
+			}
+		}
+	}
+
+	delete [] rowPos;
+
+	return FC_NORMAL_END;
+}
+
+void CMultHier::DeallocateNearFieldMatrix()
+{
+	if(m_pulNearRowStart != NULL) {
+		delete [] m_pulNearRowStart;
+		m_pulNearRowStart = NULL;
+	}
+	if(m_pulNearLeaf != NULL) {
+		delete [] m_pulNearLeaf;
+		m_pulNearLeaf = NULL;
+	}
+	if(m_pdNearPotCoeff != NULL) {
+		delete [] m_pdNearPotCoeff;
+		m_pdNearPotCoeff = NULL;
+	}
+}
+
+// Allocate, if needed, and clear the per-thread node potential arrays for the symmetric links
+// (only one array if the multiplication runs on the calling thread only).
+// The per-thread arrays must not take more memory than the symmetric links save; if they would,
+// there is a single array, into which the threads scatter atomically (see SumSymLinksPotential())
+int CMultHier::AllocateSymArrays(unsigned int vecNum, CMultHierWorkspace *workspace)
+{
+	// 'i' must have signed integral type due to MS OpenMP limitation (does not accept unsigned)
+	long i;
+	int threadsNum;
+	double savedMem;
+
+	threadsNum = 1;
+	if(workspace->m_bParallel == true) {
+		if(m_bFloatLinks[m_ucInteractionLevel] == true) {
+			savedMem = (double)m_ulSymLinksNum[m_ucInteractionLevel] * (sizeof(float) + sizeof(unsigned int));
+		}
+		else {
+			savedMem = (double)m_ulSymLinksNum[m_ucInteractionLevel] * (sizeof(double) + sizeof(unsigned int));
+		}
+		if((double)m_ulNodeArraySize * vecNum * omp_get_max_threads() * sizeof(double) <= savedMem) {
+			threadsNum = omp_get_max_threads();
+		}
+	}
+
+	// if not already allocated with the right dimension
+	if(workspace->m_pdSymNodePotentials == NULL || workspace->m_iSymThreadsNum != threadsNum ||
+	        workspace->m_ulSymArraySize != m_ulNodeArraySize * vecNum * (unsigned long)threadsNum) {
+
+		// remark: the memory usage counter is updated atomically, as the workspaces
+		// of concurrent solves are allocated here at their first multiplication
+		if(workspace->m_pdSymNodePotentials != NULL) {
+			delete [] workspace->m_pdSymNodePotentials;
+			workspace->m_pdSymNodePotentials = NULL;
+			#pragma omp atomic
+			g_clsMemUsage.m_ulHierMem -= workspace->m_ulSymArraySize * sizeof(double);
+		}
+
+		workspace->m_iSymThreadsNum = threadsNum;
+		workspace->m_ulSymArraySize = m_ulNodeArraySize * vecNum * (unsigned long)threadsNum;
+
+		// SAFENEW_ARRAY_NOMEM_RET(TYPE, VAR, LEN)
+		SAFENEW_ARRAY_NOMEM_RET(double, workspace->m_pdSymNodePotentials, workspace->m_ulSymArraySize)
+		#pragma omp atomic
+		g_clsMemUsage.m_ulHierMem += workspace->m_ulSymArraySize * sizeof(double);
+	}
+
+#pragma omp parallel for if(workspace->m_bParallel)
+	for(i=0; i<(long)workspace->m_ulSymArraySize; i++) {
+		workspace->m_pdSymNodePotentials[i] = 0.0;
+	}
+
+	return FC_NORMAL_END;
+}
+
+// Sum the per-thread potentials scattered by the symmetric links into 'nodePotentials'
+void CMultHier::ReduceSymPotentials(double *nodePotentials, unsigned int vecNum, CMultHierWorkspace *workspace)
+{
+	unsigned long size;
+	// 'i' must have signed integral type due to MS OpenMP limitation (does not accept unsigned)
+	long i;
+
+	size = m_ulNodeArraySize * vecNum;
+
+#pragma omp parallel for if(workspace->m_bParallel)
+	for(i=0; i<(long)size; i++) {
+		int thread;
+		double sum;
+
+		sum = 0.0;
+		for(thread=0; thread<workspace->m_iSymThreadsNum; thread++) {
+			sum += workspace->m_pdSymNodePotentials[(unsigned long)thread * size + i];
+		}
+		nodePotentials[i] += sum;
+	}
+}
+
+// Block version of ComputePanelCharges_fast(), see MultiplyMatByBlock()
+void CMultHier::ComputePanelChargesBlock()
+{
+	unsigned long level;
+	// 'i' must have signed integral type due to MS OpenMP limitation (does not accept unsigned)
+	long i;
+
+	for(level=m_ulLevelsNum; level>0; level--) {
+
+#pragma omp parallel for if(m_pulLevelStart[level] - m_pulLevelStart[level-1] > MULTHIER_MIN_PARALLEL_NODES)
+		for(i=(long)m_pulLevelStart[level-1]; i<(long)m_pulLevelStart[level]; i++) {
+			unsigned long node, elem;
+			unsigned int col;
+			long leaf;
+			double *charge, *potential, *leftCharge, *rightCharge;
+
+			node = m_pulLevelNodes[i];
+			leaf = m_plNodeLeafIndex[node];
+			charge = &m_pdBlockNodeCharges[node * m_uiBlockColsNum];
+			potential = &m_pdBlockNodePotentials[node * m_uiBlockColsNum];
+			if(leaf != MULTHIER_NOT_A_LEAF) {
+				for(col=0; col<m_uiBlockColsNum; col++) {
+					// column 'col' is the real or imaginary half of vector 'col / m_uiBlockColsPerVec'
+					elem = (col % m_uiBlockColsPerVec) * m_ulBlockSubVecSize + leaf;
+					charge[col] = m_pclsBlockChargeVect[col / m_uiBlockColsPerVec][elem];
+					potential[col] = m_clsSelfPotCoeff[leaf] * charge[col];
+				}
+			}
+			else {
+				leftCharge = &m_pdBlockNodeCharges[m_pulNodeLeft[node] * m_uiBlockColsNum];
+				rightCharge = &m_pdBlockNodeCharges[m_pulNodeRight[node] * m_uiBlockColsNum];
+				for(col=0; col<m_uiBlockColsNum; col++) {
+					charge[col] = leftCharge[col] + rightCharge[col];
+					potential[col] = 0.0;
+				}
+			}
+		}
+	}
+}
+
+// Block version of ComputeLeafPotentials_fast(), see MultiplyMatByBlock()
+void CMultHier::ComputeLeafPotentialsBlock()
+{
+	unsigned long level;
+	// 'i' must have signed integral type due to MS OpenMP limitation (does not accept unsigned)
+	long i;
+
+	for(level=0; level<m_ulLevelsNum; level++) {
+
+#pragma omp parallel for if(m_pulLevelStart[level+1] - m_pulLevelStart[level] > MULTHIER_MIN_PARALLEL_NODES)
+		for(i=(long)m_pulLevelStart[level]; i<(long)m_pulLevelStart[level+1]; i++) {
+			unsigned long node, elem;
+			unsigned int col;
+			long leaf;
+			double *potential, *leftPotential, *rightPotential;
+
+			node = m_pulLevelNodes[i];
+			leaf = m_plNodeLeafIndex[node];
+			potential = &m_pdBlockNodePotentials[node * m_uiBlockColsNum];
+			if(leaf != MULTHIER_NOT_A_LEAF) {
+				for(col=0; col<m_uiBlockColsNum; col++) {
+					elem = (col % m_uiBlockColsPerVec) * m_ulBlockSubVecSize + leaf;
+					m_pclsBlockPotVect[col / m_uiBlockColsPerVec][elem] = potential[col];
+				}
+			}
+			else {
+				leftPotential = &m_pdBlockNodePotentials[m_pulNodeLeft[node] * m_uiBlockColsNum];
+				rightPotential = &m_pdBlockNodePotentials[m_pulNodeRight[node] * m_uiBlockColsNum];
+				for(col=0; col<m_uiBlockColsNum; col++) {
+					leftPotential[col] += potential[col];
+					rightPotential[col] += potential[col];
+				}
+			}
+		}
+	}
+}
+
 // Recursively copy the charges from panels to vector
 void CMultHier::CopyCharges(CAutoElement* panel)
 {
@@ -35,7 +35,38 @@
 // includes for LinALg
 #include "LinAlgebra/Vect.h"
 
-#define MULTHIER_MAX_RECURS_DEPTH	128
+// minimum number of nodes in a tree level for the level sweep to be run in parallel
+// (top levels contain only a few nodes, not worth the OpenMP overhead)
+#define MULTHIER_MIN_PARALLEL_NODES	256
+// value of 'm_plNodeLeafIndex' for non-leaf nodes
+#define MULTHIER_NOT_A_LEAF			-1
+
+// Buffers of a single hierarchical multiplication: node charges and potentials,
+// symmetric links scatter arrays and the charge / potential vectors being multiplied.
+// Multiplications using different workspaces can run at the same time
+// (see CMultHier::MultiplyMatByVec_fast())
+class CMultHierWorkspace
+{
+public:
+	CMultHierWorkspace();
+	~CMultHierWorkspace();
+	void Deallocate();
+
+	// node charges and potentials, indexed by the position of the node in 'm_pNodes'
+	// (i.e. by 'm_ulNodeIndex', the same index stored in the links)
+	double *m_pdNodeCharges, *m_pdNodePotentials;
+	unsigned long m_ulNodeArraySize;
+	// symmetric links: per-thread node potentials receiving the contributions scattered
+	// to the nodes not owning the link ('m_iSymThreadsNum' arrays of 'vecNum' values per node,
+	// see CMultHier::AllocateSymArrays())
+	double *m_pdSymNodePotentials;
+	unsigned long m_ulSymArraySize;
+	int m_iSymThreadsNum;
+	CLin_Range m_clsChargeVect, m_clsPotVect;
+	// if false, the multiplication runs only on the calling thread
+	// (e.g. when the caller is itself one of many parallel solves)
+	bool m_bParallel;
+};
 
 
 class CMultHier : public CAutoRefine
@@ -45,26 +76,93 @@ public:
 	CMultHier();
 	~CMultHier();
 	int AllocateMemory();
+	int AllocateNodeArrays();
 	void DeallocateMemory();
+	int AllocateWorkspace(CMultHierWorkspace *workspace);
 	int MultiplyMatByVec_fast(CLin_Vector *v, CLin_Vector *q);
+	int MultiplyMatByVec_fast(CLin_Vector *v, CLin_Vector *q, CMultHierWorkspace *workspace);
+	int MultiplyMatByBlock(CLin_Vector *v, CLin_Vector *q, unsigned int vecNum);
 	void CopyChargesToVec(CLin_Vector *q);
 	void CopyVecToCharges(CLin_Vector *q);
 	void InitFlatLinks();
+	int AllocateSinglePrecLinks();
+	void DeallocateSinglePrecLinks();
+	// select the single precision coefficients of potential for the next multiplications
+	// (only if AllocateSinglePrecLinks() succeeded)
+	void SetSinglePrecMult(bool singlePrec)
+	{
+		m_bSinglePrecMult = singlePrec;
+	}
+	bool HasSinglePrecLinks()
+	{
+		return (m_fSinglePotCoeffLinks != NULL);
+	}
+	int BuildNearFieldMatrix();
+	void DeallocateNearFieldMatrix();
 
 	unsigned long m_ulFirstCondElemIndex;
+	// near-field part of the bottom level potential matrix, i.e. the leaf to leaf links, in CSR format
+	// (see BuildNearFieldMatrix()): the coefficients of row 'i' are 'm_pdNearPotCoeff[m_pulNearRowStart[i]]'
+	// to 'm_pdNearPotCoeff[m_pulNearRowStart[i+1]-1]', and the leaf indexes of the columns are in 'm_pulNearLeaf'
+	unsigned long *m_pulNearRowStart, *m_pulNearLeaf;
+	double *m_pdNearPotCoeff;
 
 protected:
-	void ComputePanelCharges_fast();
-	int ComputePanelPotentials_2fast();
-	void ComputeLeafPotentials_fast();
+	void ComputePanelCharges_fast(CMultHierWorkspace *workspace);
+	int ComputePanelPotentials_2fast(double *nodeCharges, double *nodePotentials, unsigned int vecNum, CMultHierWorkspace *workspace);
+	void SumFarLinksPotential(unsigned long node, double *nodeCharges, double *potential, unsigned int vecNum);
+	template<class T> void SumLinksPotential(T **potCoeffLinks, unsigned int **nodeIndexLinks, unsigned long chunk, unsigned long posInChunk,
+	                                         unsigned long linksNum, double *nodeCharges, double *potential, unsigned int vecNum);
+	template<class T> void SumSymLinksPotential(T **potCoeffLinks, unsigned int **nodeIndexLinks, unsigned long chunk, unsigned long posInChunk,
+	                                            unsigned long linksNum, double *nodeCharges, double *potential, double *charge,
+	                                            double *symPotentials, unsigned int vecNum, bool atomicScatter);
+	int AllocateSymArrays(unsigned int vecNum, CMultHierWorkspace *workspace);
+	void ReduceSymPotentials(double *nodePotentials, unsigned int vecNum, CMultHierWorkspace *workspace);
+	void ComputeLeafPotentials_fast(CMultHierWorkspace *workspace);
+	int BuildNodeTree();
+	void ComputePanelChargesBlock();
+	void ComputeLeafPotentialsBlock();
+	int AllocateBlockArrays(unsigned int colsNum);
+	void DeallocateBlockArrays();
+	void Correct2DLastRow(CLin_Vector *v, CLin_Vector *q, unsigned long start, unsigned long end);
 	void CopyPanelCharges();
 	void CopyCharges(CAutoElement* panel);
 	void CopyVecCharges();
 	void CopyVec(CAutoElement* panel);
 
-	CLin_Range m_clsChargeVect, m_clsPotVect;
+	CLin_Range m_clsChargeVect;
 	long m_dIndex;
-	CAutoElement *m_clsRecursVec[MULTHIER_MAX_RECURS_DEPTH];
+	// buffers of the multiplications issued through MultiplyMatByVec_fast(v, q)
+	// and MultiplyMatByBlock()
+	CMultHierWorkspace m_clsWorkspace;
+	unsigned long m_ulNodeArraySize;
+	// flattened tree: for each node, the children node indexes and the index of the leaf
+	// in the charge / potential vectors (or MULTHIER_NOT_A_LEAF)
+	unsigned long *m_pulNodeLeft, *m_pulNodeRight;
+	long *m_plNodeLeafIndex;
+	// nodes ordered by tree level (depth), all conductors together; the nodes of level 'i'
+	// are from 'm_pulLevelNodes[m_pulLevelStart[i]]' to 'm_pulLevelNodes[m_pulLevelStart[i+1]-1]'
+	unsigned long *m_pulLevelNodes, *m_pulLevelStart;
+	unsigned long m_ulLevelsNum;
+	// for each node, non-zero if dielectric
+	unsigned char *m_pucNodeIsDiel;
+	// node centroids and dielectric normals (structure of arrays), used to compute
+	// on the fly the coefficients of potential of the matrix-free far-field links;
+	// the normals of the conductor nodes are zero ('m_pucNodeIsDiel' is false)
+	float *m_pfNodeCentroidX, *m_pfNodeCentroidY, *m_pfNodeCentroidZ;
+	float *m_pfNodeNormalX, *m_pfNodeNormalY, *m_pfNodeNormalZ;
+	// block multiplication: 'm_uiBlockColsNum' interleaved node charges and potentials per node;
+	// each vector of the block takes 'm_uiBlockColsPerVec' columns (2 if complex permittivity,
+	// i.e. real and imaginary halves of 'm_ulBlockSubVecSize' elements each)
+	double *m_pdBlockNodeCharges, *m_pdBlockNodePotentials;
+	unsigned long m_ulBlockArraySize, m_ulBlockSubVecSize;
+	CLin_Vector *m_pclsBlockChargeVect, *m_pclsBlockPotVect;
+	unsigned int m_uiBlockColsNum, m_uiBlockColsPerVec;
+	// single precision copy of the bottom level coefficients of potential, in chunks
+	// as 'm_dPotCoeffLinks' (see AllocateSinglePrecLinks())
+	float **m_fSinglePotCoeffLinks;
+	unsigned long m_ulSingleChunkNum;
+	bool m_bSinglePrecMult;
 
 };
 
@@ -49,15 +49,40 @@
 #define SOLVE_SIDE2_FROM_AREA	2.3094
 
 
+// constructor
+CSolveWorkspace::CSolveWorkspace()
+{
+	// arrays are allocated by CSolveCap::AllocateSolveWorkspaces()
+	m_pclsQ = NULL;
+	m_pclsH = NULL;
+	m_uiPrealloc = 0;
+	m_lIterations = 0;
+	m_dNormr = 0.0;
+	// the concurrent solves already use all the threads
+	m_clsMultWs.m_bParallel = false;
+}
+
+CSolveWorkspace::~CSolveWorkspace()
+{
+	if(m_pclsQ != NULL) {
+		delete []m_pclsQ;
+	}
+	if(m_pclsH != NULL) {
+		delete []m_pclsH;
+	}
+}
+
 // constructor
 CSolveCap::CSolveCap()
 {
 
 	// all structures pointed to with these pointers are deallocated
 	// by DeallocateMemory()
-	m_pclsSupPrecondMtx = NULL;
-	m_pclsSupPotMtx = NULL;
-	m_pclsTmpCapMtx = NULL;
+	m_pdSupPotMtx = NULL;
+	m_plSupPotPivot = NULL;
+	m_ulSupPotMtxDim = 0;
+	m_pdSupPrecondDiag = NULL;
+	m_pdSupPrecondVect = NULL;
 
 	m_pCondCharges = NULL;
 
@@ -66,6 +91,47 @@ CSolveCap::CSolveCap()
 	m_pclsGmres_zf = NULL;
 	m_pclsGmres1_q = NULL;
 	m_pclsGmres1_h = NULL;
+	m_lUpperIterations = 0;
+	m_iUpperGmresRet = FC_NORMAL_END;
+
+	m_pclsBGmres_q = NULL;
+	m_pclsBGmres_h = NULL;
+	m_pclsBGmres_g = NULL;
+	m_pclsBGmres_c = NULL;
+	m_pclsBGmres_s = NULL;
+	m_pclsBGmres_x0 = NULL;
+	m_pclsBGmres_b = NULL;
+	m_pclsBGmres_x = NULL;
+	m_pclsBGmres_Pq = NULL;
+	m_pclsBGmres_v = NULL;
+	m_plBGmresIter = NULL;
+	m_puiBGmresActive = NULL;
+	m_puiBGmresPrealloc = NULL;
+	m_uiBGmresVecNum = 0;
+
+	m_pclsSolveWs = NULL;
+	m_uiSolveWsNum = 0;
+
+	m_pclsRecycle_u = NULL;
+	m_pclsRecycle_c = NULL;
+	m_pclsRecycle_B = NULL;
+	m_uiRecycleNum = 0;
+	m_uiRecycleCur = 0;
+	m_uiRecycleNext = 0;
+
+	m_bPcgBreakdown = false;
+
+	m_pclsWarmCharges = NULL;
+	m_pucWarmIsLeaf = NULL;
+	m_pulWarmLeafIndex = NULL;
+	m_pdWarmLeafDim = NULL;
+	m_ulWarmNodeNum = 0;
+	m_ulWarmLeafNum = 0;
+	m_ulWarmCondNum = 0;
+	m_ulWarmNodePos = 0;
+	m_ulWarmLeafPos = 0;
+	m_bWarmStart = false;
+	m_bWarmValid = false;
 
 	m_clsSupPrecondElements = NULL;
 	m_puiSupPrecondIndex = NULL;
@@ -74,6 +140,27 @@ CSolveCap::CSolveCap()
 	m_clsBlockPrecondElements = NULL;
 	m_pdBlockPrecond = NULL;
 	m_pucBlockPrecondDim = NULL;
+	m_pulBlockPrecondBase = NULL;
+	m_pdBlockPotMtx = NULL;
+	m_plBlockPotPivot = NULL;
+
+	m_pdSpaiPrecond = NULL;
+	m_pulSpaiIndex = NULL;
+	m_pucSpaiDim = NULL;
+	m_pdSpaiPotMtx = NULL;
+	m_plSpaiPotPivot = NULL;
+
+	m_uiMgLevelsNum = 0;
+	m_pulMgParent = NULL;
+	m_pdMgWeight = NULL;
+	m_pdMgDiag = NULL;
+	m_pdMgRes = NULL;
+	m_pdMgCorr = NULL;
+	m_pdMgWork = NULL;
+	m_pdMgLevelMtx = NULL;
+	m_clsMgElements = NULL;
+	m_pdMgCoarseMtx = NULL;
+	m_plMgCoarsePivot = NULL;
 }
 
 CSolveCap::~CSolveCap()
@@ -119,10 +206,33 @@ int CSolveCap::Run(CAutoRefGlobalVars globalVars)
 		ErrMsg("Warning: Out-of-core free memory to link memory ratio %f is below the minimum value of 0.0, setting to 0.0\n", globalVars.m_dOutOfCoreRatio);
 		globalVars.m_dOutOfCoreRatio = 0.0;
 	}
+	// with the multigrid preconditioner, the block and two-levels preconditioner options only set
+	// the dimensions of its smoother and of its coarse level (and Jacobi is the default)
+	if( (globalVars.m_ucPrecondType & AUTOREFINE_PRECOND_MG) != 0 ) {
+		if( (globalVars.m_ucPrecondType & (AUTOREFINE_PRECOND_SPAI | AUTOREFINE_PRECOND_HIER)) != 0) {
+			ErrMsg("Warning: multigrid preconditioner specified together with sparse approximate inverse or hierarchical preconditioner, keeping only the multigrid preconditioner\n");
+		}
+		globalVars.m_ucPrecondType = AUTOREFINE_PRECOND_MG;
+	}
 	if( (globalVars.m_ucPrecondType & AUTOREFINE_PRECOND_SUPER) != 0 && (globalVars.m_ucPrecondType & AUTOREFINE_PRECOND_JACOBI) != 0) {
 		globalVars.m_ucPrecondType = AUTOREFINE_PRECOND_SUPER;
 		ErrMsg("Warning: both two-levels preconditioner and Jacobi preconditioner specified, keeping only the two-levels preconditioner\n");
 	}
+	if( (globalVars.m_ucPrecondType & AUTOREFINE_PRECOND_SPAI) != 0 && (globalVars.m_ucPrecondType & AUTOREFINE_PRECOND_SUPER) != 0) {
+		globalVars.m_ucPrecondType &= ~(AUTOREFINE_PRECOND_SUPER);
+		ErrMsg("Warning: both two-levels preconditioner and sparse approximate inverse preconditioner specified, keeping only the sparse approximate inverse preconditioner\n");
+	}
+	if( (globalVars.m_ucPrecondType & AUTOREFINE_PRECOND_SPAI) != 0 && (globalVars.m_ucPrecondType & AUTOREFINE_PRECOND_JACOBI) != 0) {
+		globalVars.m_ucPrecondType &= ~(AUTOREFINE_PRECOND_JACOBI);
+		ErrMsg("Warning: both sparse approximate inverse preconditioner and Jacobi preconditioner specified, keeping only the sparse approximate inverse preconditioner\n");
+	}
+	// the sparse approximate inverse is built from the links of the bottom level only,
+	// while the hierarchical preconditioner applies the lower level one on the upper level too
+	if( (globalVars.m_ucPrecondType & AUTOREFINE_PRECOND_SPAI) != 0 && (globalVars.m_ucPrecondType & AUTOREFINE_PRECOND_HIER) != 0) {
+		globalVars.m_ucPrecondType &= ~(AUTOREFINE_PRECOND_SPAI);
+		globalVars.m_ucPrecondType |= AUTOREFINE_PRECOND_JACOBI;
+		ErrMsg("Warning: sparse approximate inverse preconditioner not supported together with hierarchical preconditioner, moving to Jacobi preconditioner\n");
+	}
 	if( (globalVars.m_ucPrecondType & AUTOREFINE_PRECOND_HIER) != 0 && globalVars.m_dMaxHierPreDiscSide == 0.0) {
 		globalVars.m_dMaxHierPreDiscSide = globalVars.m_dMaxDiscSide;
 		ErrMsg("Warning: no preconditioner side discretization value specified, using %f\n", globalVars.m_dMaxHierPreDiscSide);
@@ -135,7 +245,9 @@ int CSolveCap::Run(CAutoRefGlobalVars globalVars)
 		globalVars.m_bRefineCharge = false;
 		ErrMsg("Warning: 'refine mesh using calculated charges (-s)' option is not compatible with hierarchical preconditioner, resetting option to false\n");
 	}
-	if( (globalVars.m_ucPrecondType & AUTOREFINE_PRECOND_SUPER) != 0 ) {
+	// the multigrid preconditioner uses the two-levels preconditioner dimension for its coarse level,
+	// and the block preconditioner dimension for its smoother
+	if( (globalVars.m_ucPrecondType & (AUTOREFINE_PRECOND_SUPER | AUTOREFINE_PRECOND_MG)) != 0 ) {
 		if(globalVars.m_uiSuperPreDim > SOLVE_MAX_SUPER_PRECOND_NUM) {
 			globalVars.m_uiSuperPreDim = SOLVE_MAX_SUPER_PRECOND_NUM;
 			ErrMsg("Warning: maximum two-levels preconditioner dimension is %d, using %d\n", SOLVE_MAX_SUPER_PRECOND_NUM, SOLVE_MAX_SUPER_PRECOND_NUM);
@@ -145,7 +257,7 @@ int CSolveCap::Run(CAutoRefGlobalVars globalVars)
 			ErrMsg("Warning: minimum two-levels preconditioner dimension is %d, using %d\n", SOLVE_MIN_SUPER_PRECOND_NUM, SOLVE_MIN_SUPER_PRECOND_NUM);
 		}
 	}
-	if( (globalVars.m_ucPrecondType & AUTOREFINE_PRECOND_BLOCK) != 0 ) {
+	if( (globalVars.m_ucPrecondType & (AUTOREFINE_PRECOND_BLOCK | AUTOREFINE_PRECOND_MG)) != 0 ) {
 		if(globalVars.m_uiBlockPreSize > SOLVE_MAX_BLOCK_PRECOND_NUM) {
 			globalVars.m_uiBlockPreSize = SOLVE_MAX_BLOCK_PRECOND_NUM;
 			ErrMsg("Warning: maximum block preconditioner dimension is %d, using %d\n", SOLVE_MAX_BLOCK_PRECOND_NUM, SOLVE_MAX_BLOCK_PRECOND_NUM);
@@ -155,6 +267,73 @@ int CSolveCap::Run(CAutoRefGlobalVars globalVars)
 			ErrMsg("Warning: minimum block preconditioner dimension is %d, using %d\n", SOLVE_MIN_BLOCK_PRECOND_NUM, SOLVE_MIN_BLOCK_PRECOND_NUM);
 		}
 	}
+	if( (globalVars.m_ucPrecondType & AUTOREFINE_PRECOND_SPAI) != 0 ) {
+		if(globalVars.m_uiSpaiSize > SOLVE_MAX_SPAI_NUM) {
+			globalVars.m_uiSpaiSize = SOLVE_MAX_SPAI_NUM;
+			ErrMsg("Warning: maximum sparse approximate inverse preconditioner row dimension is %d, using %d\n", SOLVE_MAX_SPAI_NUM, SOLVE_MAX_SPAI_NUM);
+		}
+		else if(globalVars.m_uiSpaiSize < SOLVE_MIN_SPAI_NUM) {
+			globalVars.m_uiSpaiSize = SOLVE_MIN_SPAI_NUM;
+			ErrMsg("Warning: minimum sparse approximate inverse preconditioner row dimension is %d, using %d\n", SOLVE_MIN_SPAI_NUM, SOLVE_MIN_SPAI_NUM);
+		}
+	}
+	if( (globalVars.m_ucPrecondType & AUTOREFINE_PRECOND_MG) != 0 ) {
+		if(globalVars.m_uiMgLevels > SOLVE_MAX_MG_LEVELS) {
+			globalVars.m_uiMgLevels = SOLVE_MAX_MG_LEVELS;
+			ErrMsg("Warning: maximum number of multigrid preconditioner levels is %d, using %d\n", SOLVE_MAX_MG_LEVELS, SOLVE_MAX_MG_LEVELS);
+		}
+		else if(globalVars.m_uiMgLevels < SOLVE_MIN_MG_LEVELS) {
+			globalVars.m_uiMgLevels = SOLVE_MIN_MG_LEVELS;
+			ErrMsg("Warning: minimum number of multigrid preconditioner levels is %d, using %d\n", SOLVE_MIN_MG_LEVELS, SOLVE_MIN_MG_LEVELS);
+		}
+	}
+	if(globalVars.m_uiGmresBlockSize < 1) {
+		globalVars.m_uiGmresBlockSize = 1;
+	}
+	if(globalVars.m_uiConcurrentSolves < 1) {
+		globalVars.m_uiConcurrentSolves = 1;
+	}
+	// a memory budget also implies restarting (see GetGmresRestart())
+	if( (globalVars.m_uiGmresRestart > 0 && globalVars.m_uiGmresRestart < SOLVE_GMRES_ITER_MAX) || globalVars.m_dMemBudget > 0.0) {
+		// see GetGmresBlockSize(); the flex gmres used with the hierarchical preconditioner does not restart either
+		if( (globalVars.m_ucPrecondType & AUTOREFINE_PRECOND_HIER) != 0 ) {
+			ErrMsg("Warning: GMRES restart (-tm, or implied by -fb) not supported together with hierarchical preconditioner, not restarting\n");
+		}
+		else if(globalVars.m_uiGmresBlockSize > 1) {
+			ErrMsg("Warning: block GMRES (-tb) not supported together with GMRES restart (-tm, or implied by -fb), solving one conductor at a time\n");
+		}
+	}
+	else if(globalVars.m_uiGmresBlockSize > 1) {
+		// see GetGmresBlockSize()
+		if(globalVars.m_uiGmresRecycleNum > 0) {
+			ErrMsg("Warning: block GMRES (-tb) not supported together with GMRES recycling (-tr), solving one conductor at a time\n");
+		}
+		else if(globalVars.m_bAuto == true) {
+			ErrMsg("Warning: block GMRES (-tb) does not start from the charges of the previous auto-refinement iteration\n");
+		}
+	}
+	if(globalVars.m_uiConcurrentSolves > 1) {
+		// see GetConcurrentSolves()
+		if( (globalVars.m_uiGmresRestart > 0 && globalVars.m_uiGmresRestart < SOLVE_GMRES_ITER_MAX) || globalVars.m_dMemBudget > 0.0) {
+			ErrMsg("Warning: concurrent solves (-tc) not supported together with GMRES restart (-tm, or implied by -fb), solving one conductor at a time\n");
+		}
+		else if(globalVars.m_bAuto == true) {
+			ErrMsg("Warning: concurrent solves (-tc) do not start from the charges of the previous auto-refinement iteration\n");
+		}
+	}
+	if(globalVars.m_bMixedPrecision == true) {
+		// see UseFlexGmres(); the flex gmres iterations are always in double precision
+		if( (globalVars.m_ucPrecondType & AUTOREFINE_PRECOND_HIER) != 0 ||
+		        ((globalVars.m_ucPrecondType & AUTOREFINE_PRECOND_BLOCK) != 0  &&
+		         (globalVars.m_ucPrecondType & ~(AUTOREFINE_PRECOND_BLOCK)) != 0) ) {
+			ErrMsg("Warning: mixed precision solve (-ts) not supported together with hierarchical preconditioner\n");
+			ErrMsg("         or with block preconditioner combined with other ones, using double precision only\n");
+		}
+	}
+	if(globalVars.m_uiGmresRecycleNum > SOLVE_GMRES_RECYCLE_MAX) {
+		globalVars.m_uiGmresRecycleNum = SOLVE_GMRES_RECYCLE_MAX;
+		ErrMsg("Warning: maximum number of GMRES recycled vectors is %d, using %d\n", SOLVE_GMRES_RECYCLE_MAX, SOLVE_GMRES_RECYCLE_MAX);
+	}
 	if(g_ucSolverType == SOLVERGLOBAL_2DSOLVER) {
 		if( globalVars.m_cScheme == AUTOREFINE_GALERKIN ) {
 			globalVars.m_cScheme = AUTOREFINE_COLLOCATION;
@@ -291,6 +470,9 @@ int CSolveCap::SolveMain(CAutoRefGlobalVars globalVars, CLin_Matrix &capRe, CLin
             return ret;
         }
 
+        // try the conjugate gradient again, if the system is symmetric (see UsePcg())
+        m_bPcgBreakdown = false;
+
         if(globalVars.m_bAuto == true) {
 
             LogMsg("Auto calculation with max error: %g\n", globalVars.m_dAutoMaxErr);
@@ -307,6 +489,10 @@ int CSolveCap::SolveMain(CAutoRefGlobalVars globalVars, CLin_Matrix &capRe, CLin
             // and are now not used for discretization)
             m_clsMulthier.Clean(AUTOREFINE_DEALLMEM_AT_START, globalVars);
 
+            // each iteration starts from the charges of the previous one
+            DeallocateWarmStart();
+            m_bWarmStart = true;
+
             // read input file and build super hierarchy;
             // will also modify 'globalVars' to report if there is complex permittivity
             ret = InputFile(&globalVars);
@@ -338,13 +524,24 @@ int CSolveCap::SolveMain(CAutoRefGlobalVars globalVars, CLin_Matrix &capRe, CLin
             LogMsg("Refinement completed\n");
             OutputMeshParams(globalVars);
 
+            // the preconditioner must be known before computing the links, to set aside its memory
+            AutoSetPrecondType(m_clsMulthier.GetAllLinksNum(AUTOREFINE_HIER_PRE_0_LEVEL), m_clsMulthier.m_lCondNum, false, globalVars);
+            m_clsGlobalVars.m_ucPrecondType = globalVars.m_ucPrecondType;
+            m_clsGlobalVars.m_uiSuperPreDim = globalVars.m_uiSuperPreDim;
+            OutputSolvePrecondType(globalVars);
+
             ret = SolveComputeLinks();
             if(ret !=  FC_NORMAL_END) {
                 return ret;
             }
-
-            AutoSetPrecondType(m_clsMulthier.GetLinksNum(AUTOREFINE_HIER_PRE_0_LEVEL), m_clsMulthier.m_lCondNum, globalVars);
-            OutputSolvePrecondType(globalVars);
+            // now the links may turn out to be out-of-core
+            if(globalVars.m_bAutoPrecond == true && m_clsMulthier.IsOutOfCore() == true) {
+                AutoSetPrecondType(m_clsMulthier.GetAllLinksNum(AUTOREFINE_HIER_PRE_0_LEVEL), m_clsMulthier.m_lCondNum, true, globalVars);
+                if(globalVars.m_ucPrecondType != m_clsGlobalVars.m_ucPrecondType) {
+                    m_clsGlobalVars.m_ucPrecondType = globalVars.m_ucPrecondType;
+                    OutputSolvePrecondType(globalVars);
+                }
+            }
 
             ret = SolveForCapacitance(&cRe[0], &cIm[0]);
             if(ret !=  FC_NORMAL_END) {
@@ -363,7 +560,12 @@ int CSolveCap::SolveMain(CAutoRefGlobalVars globalVars, CLin_Matrix &capRe, CLin
             LogMsg("Iteration allocated memory: %d kilobytes\n", g_clsMemUsage.GetTotalKB());
 
             oldpanelsnum = m_clsMulthier.GetPanelNum(AUTOREFINE_HIER_PRE_0_LEVEL);
-            oldlinksnum = m_clsMulthier.GetLinksNum(AUTOREFINE_HIER_PRE_0_LEVEL);
+            oldlinksnum = m_clsMulthier.GetAllLinksNum(AUTOREFINE_HIER_PRE_0_LEVEL);
+
+            // record the panel trees, to prolong the charges onto the next, refined ones
+            if(SaveWarmStartTree() != FC_NORMAL_END) {
+                ErrMsg("Warning: not enough memory to warm start the next iteration\n");
+            }
 
             // free memory, to be ready for next iteration
             DeallocateMemory(AUTOREFINE_DEALLMEM_AT_END, globalVars);
@@ -405,7 +607,7 @@ int CSolveCap::SolveMain(CAutoRefGlobalVars globalVars, CLin_Matrix &capRe, CLin
                     }
 
                     newpanelsnum = m_clsMulthier.GetPanelNum(AUTOREFINE_HIER_PRE_0_LEVEL);
-                    newlinksnum = m_clsMulthier.GetLinksNum(AUTOREFINE_HIER_PRE_0_LEVEL);
+                    newlinksnum = m_clsMulthier.GetAllLinksNum(AUTOREFINE_HIER_PRE_0_LEVEL);
 
                     // if links or panels number stayed the same, increasing the '-m' parameter had no or small effect, so go on
                     if(newlinksnum > oldlinksnum * SOLVE_AUTO_INCREMENT_FACTOR && newpanelsnum > oldpanelsnum * SOLVE_AUTO_INCREMENT_FACTOR) {
@@ -427,13 +629,24 @@ int CSolveCap::SolveMain(CAutoRefGlobalVars globalVars, CLin_Matrix &capRe, CLin
                 LogMsg("Refinement completed\n");
                 OutputMeshParams(globalVars);
 
+                // the preconditioner must be known before computing the links, to set aside its memory
+                AutoSetPrecondType(m_clsMulthier.GetAllLinksNum(AUTOREFINE_HIER_PRE_0_LEVEL), m_clsMulthier.m_lCondNum, false, globalVars);
+                m_clsGlobalVars.m_ucPrecondType = globalVars.m_ucPrecondType;
+                m_clsGlobalVars.m_uiSuperPreDim = globalVars.m_uiSuperPreDim;
+                OutputSolvePrecondType(globalVars);
+
                 ret = SolveComputeLinks();
                 if(ret !=  FC_NORMAL_END) {
                     return ret;
                 }
-
-                AutoSetPrecondType(m_clsMulthier.GetLinksNum(AUTOREFINE_HIER_PRE_0_LEVEL), m_clsMulthier.m_lCondNum, globalVars);
-                OutputSolvePrecondType(globalVars);
+                // now the links may turn out to be out-of-core
+                if(globalVars.m_bAutoPrecond == true && m_clsMulthier.IsOutOfCore() == true) {
+                    AutoSetPrecondType(m_clsMulthier.GetAllLinksNum(AUTOREFINE_HIER_PRE_0_LEVEL), m_clsMulthier.m_lCondNum, true, globalVars);
+                    if(globalVars.m_ucPrecondType != m_clsGlobalVars.m_ucPrecondType) {
+                        m_clsGlobalVars.m_ucPrecondType = globalVars.m_ucPrecondType;
+                        OutputSolvePrecondType(globalVars);
+                    }
+                }
 
                 ret = SolveForCapacitance(&cRe[i], &cIm[i]);
                 if(ret !=  FC_NORMAL_END) {
@@ -471,6 +684,10 @@ int CSolveCap::SolveMain(CAutoRefGlobalVars globalVars, CLin_Matrix &capRe, CLin
                 oldpanelsnum = newpanelsnum;
                 oldlinksnum = newlinksnum;
 
+                // record the panel trees, to prolong the charges onto the next, refined ones
+                if(SaveWarmStartTree() != FC_NORMAL_END) {
+                    ErrMsg("Warning: not enough memory to warm start the next iteration\n");
+                }
 
                 // free memory, to be ready for next iteration
                 DeallocateMemory(AUTOREFINE_DEALLMEM_AT_END, globalVars);
@@ -573,11 +790,14 @@ int CSolveCap::SolveMain(CAutoRefGlobalVars globalVars, CLin_Matrix &capRe, CLin
 	g_clsMemUsageCopy = g_clsMemUsage;
 	DeallocateMemory(AUTOREFINE_DEALLMEM_AT_END, globalVars);
 	m_clsMulthier.DeallocateMemory();
+	DeallocateWarmStart();
 
 	return ret;
 }
 
-void CSolveCap::AutoSetPrecondType(unsigned long numOfLinks, long condNum, CAutoRefGlobalVars &globalVars)
+// Choose the preconditioner according to the problem size; 'outOfCore' tells whether the links
+// are known to be out-of-core (so it is always false before the links are computed)
+void CSolveCap::AutoSetPrecondType(unsigned long numOfLinks, long condNum, bool outOfCore, CAutoRefGlobalVars &globalVars)
 {
 	long linksXcond;
 
@@ -605,6 +825,18 @@ void CSolveCap::AutoSetPrecondType(unsigned long numOfLinks, long condNum, CAuto
 		globalVars.m_ucPrecondType = AUTOREFINE_PRECOND_SUPER;
 		globalVars.m_uiSuperPreDim = 1024;
 	}
+
+	// if too many conductors and dielectric interfaces for the two-levels preconditioner
+	// (see MakePreconditioner()), use the sparse approximate inverse, that does not
+	// depend on the number of conductors
+	if( globalVars.m_ucPrecondType == AUTOREFINE_PRECOND_SUPER &&
+	        condNum + m_clsMulthier.m_lDielNum >= (long)globalVars.m_uiSuperPreDim ) {
+		globalVars.m_ucPrecondType = AUTOREFINE_PRECOND_SPAI;
+		// but the sparse approximate inverse needs the links in-core (see ComputeSpaiPrecond())
+		if(outOfCore == true) {
+			globalVars.m_ucPrecondType = AUTOREFINE_PRECOND_JACOBI;
+		}
+	}
 }
 
 void CSolveCap::OutputSolveParams(CAutoRefGlobalVars globalVars)
@@ -640,6 +872,21 @@ void CSolveCap::OutputSolveParams(CAutoRefGlobalVars globalVars)
 	}
 
 	LogMsg("GMRES tolerance (-t): %g\n", globalVars.m_dGmresTol);
+	if(globalVars.m_uiGmresBlockSize > 1) {
+		LogMsg("GMRES block size (-tb): %d\n", globalVars.m_uiGmresBlockSize);
+	}
+	if(globalVars.m_uiConcurrentSolves > 1) {
+		LogMsg("Concurrent solves (-tc): %d\n", globalVars.m_uiConcurrentSolves);
+	}
+	if(globalVars.m_uiGmresRecycleNum > 0) {
+		LogMsg("GMRES recycled vectors (-tr): %d\n", globalVars.m_uiGmresRecycleNum);
+	}
+	if(globalVars.m_uiGmresRestart > 0) {
+		LogMsg("GMRES restart (-tm): %d\n", globalVars.m_uiGmresRestart);
+	}
+	if(globalVars.m_bMixedPrecision == true) {
+		LogMsg("Mixed precision solve (-ts)\n");
+	}
 
 	if(globalVars.m_bRefineCharge == true) {
 		LogMsg("Refine mesh using charges (-s)\n");
@@ -678,6 +925,12 @@ void CSolveCap::OutputSolvePrecondType(CAutoRefGlobalVars globalVars)
 	if( (globalVars.m_ucPrecondType & AUTOREFINE_PRECOND_HIER) != 0 ) {
 		LogMsg("Hierarchical, Eps (-phe): %g, max discr side (-phs): %g, tol (-pht): %g ", globalVars.m_dHierPreEps, globalVars.m_dMaxHierPreDiscSide, globalVars.m_dHierPreGmresTol);
 	}
+	if( (globalVars.m_ucPrecondType & AUTOREFINE_PRECOND_SPAI) != 0 ) {
+		LogMsg("Sparse approximate inverse, row dimension (-pa): %d ", globalVars.m_uiSpaiSize);
+	}
+	if( (globalVars.m_ucPrecondType & AUTOREFINE_PRECOND_MG) != 0 ) {
+		LogMsg("Multigrid, max levels (-pm): %d, block smoother dimension (-pb): %d, coarse level dimension (-ps): %d ", globalVars.m_uiMgLevels, globalVars.m_uiBlockPreSize, globalVars.m_uiSuperPreDim);
+	}
 	LogMsg("\n");
 }
 
@@ -695,7 +948,7 @@ void CSolveCap::OutputSolveStats(CAutoRefGlobalVars globalVars)
 	LogMsg("Number of links: %lu (uncompressed %lu, compression ratio is %.1f%%)\n", g_lLinksNum, g_lPanelsNum * g_lPanelsNum, 100.0f - ((float)(g_lLinksNum)) / ((float)(g_lPanelsNum * g_lPanelsNum)) * 100.0);;
 	if( (globalVars.m_ucPrecondType & AUTOREFINE_PRECOND_HIER) != 0 ) {
 		LogMsg("Number of precond panels: %lu\n", m_clsMulthier.GetPanelNum(AUTOREFINE_HIER_PRE_1_LEVEL));
-		LogMsg("Number of precond links: %lu\n", m_clsMulthier.GetLinksNum(AUTOREFINE_HIER_PRE_1_LEVEL));
+		LogMsg("Number of precond links: %lu\n", m_clsMulthier.GetAllLinksNum(AUTOREFINE_HIER_PRE_1_LEVEL));
 	}
 	LogMsg("Max recursion level: %d\n", m_clsMulthier.m_iMaxLevel);
 	LogMsg("Max Mesh relative refinement value: %g\n", m_clsMulthier.m_dMaxMeshEps);
@@ -1001,6 +1254,11 @@ int CSolveCap::RefineGeoAndCountLinks()
 		globalVars.m_bOutputCapMtx = false;
 
 		ret = m_clsMulthier.AutoRefinePanels(globalVars, AUTOREFINE_HIER_PRE_1_LEVEL);
+
+		if(ret !=  FC_NORMAL_END) {
+			return ret;
+		}
+
 		ret = m_clsMulthier.AutoRefineLinks(globalVars);
 
 		if(ret !=  FC_NORMAL_END) {
@@ -1030,8 +1288,13 @@ int CSolveCap::SolveComputeLinks()
 	LogMsg("Computing the links.. \n");
 	LogMsg("Number of panels after refinement: %lu\n", m_clsMulthier.GetPanelNum(AUTOREFINE_HIER_PRE_0_LEVEL));
 	LogMsg("Number of links to be computed: %lu\n", m_clsMulthier.GetLinksNum(AUTOREFINE_HIER_PRE_0_LEVEL));
+	if(m_clsMulthier.GetFarLinksNum(AUTOREFINE_HIER_PRE_0_LEVEL) > 0) {
+		LogMsg("Number of far-field links computed on the fly: %lu\n", m_clsMulthier.GetFarLinksNum(AUTOREFINE_HIER_PRE_0_LEVEL));
+	}
 
 	m_clsMulthier.SetInteractionLevel(AUTOREFINE_HIER_PRE_0_LEVEL);
+	// memory to be left to the solver, if the links must fit in a memory budget
+	m_clsGlobalVars.m_dSolveMemReserve = EstimateSolveMemory();
 	ret = m_clsMulthier.AutoRefineLinks(m_clsGlobalVars);
 
 	LogMsg("Done computing links\n");
@@ -1040,6 +1303,114 @@ int CSolveCap::SolveComputeLinks()
 	return ret;
 }
 
+// Estimate of the memory (in bytes) that will be allocated after the links, for the GMRES vectors,
+// the preconditioner and the hierarchical multiplication. GMRES is accounted for
+// SOLVE_GMRES_PLAN_ITER iterations, since the actual number is not known in advance
+double CSolveCap::EstimateSolveMemory()
+{
+	double panelNum, nodeNum, mem, levelDim;
+	unsigned int blockSize, concurrentNum, planIter, l;
+
+	panelNum = (double)m_clsMulthier.GetPanelNum(AUTOREFINE_HIER_PRE_0_LEVEL);
+	nodeNum = (double)m_clsMulthier.GetNodeNum(AUTOREFINE_HIER_PRE_0_LEVEL);
+
+	// GMRES: Krylov vectors plus the work vectors preallocated in AllocateMemory();
+	// if restarting, the Krylov vectors are at most the restart size (but the flex gmres
+	// used with the hierarchical or block plus other preconditioners does not restart),
+	// and there are none with the conjugate gradient
+	planIter = SOLVE_GMRES_PLAN_ITER;
+	if(UseFlexGmres() == false && GetGmresRestart() < planIter) {
+		planIter = GetGmresRestart();
+	}
+	if(UsePcg() == true && GetGmresBlockSize() == 1 && GetConcurrentSolves() == 1) {
+		planIter = 0;
+	}
+	mem = (planIter + 16) * panelNum * sizeof(double);
+	// the hierarchical preconditioner runs a second GMRES on the upper level
+	if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_HIER) != 0) {
+		mem *= 2.0;
+	}
+
+	// preconditioner
+	if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_JACOBI) != 0) {
+		mem += panelNum * sizeof(double);
+	}
+	if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_BLOCK) != 0) {
+		mem += panelNum * m_clsGlobalVars.m_uiBlockPreSize * sizeof(double);
+	}
+	if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_SUPER) != 0) {
+		mem += (double)m_clsGlobalVars.m_uiSuperPreDim * m_clsGlobalVars.m_uiSuperPreDim * sizeof(double);
+	}
+	if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_SPAI) != 0) {
+		mem += panelNum * m_clsGlobalVars.m_uiSpaiSize * (sizeof(double) + sizeof(unsigned long));
+		// near-field matrix, while forming the preconditioner (at most one entry per link)
+		mem += (double)m_clsMulthier.GetLinksNum(AUTOREFINE_HIER_PRE_0_LEVEL) * (sizeof(double) + sizeof(unsigned long));
+	}
+	if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_MG) != 0) {
+		// block smoother, coarse matrix, leaf work vectors and per-element arrays
+		// (the aggregates of all the levels are less than the leaves)
+		mem += panelNum * m_clsGlobalVars.m_uiBlockPreSize * sizeof(double);
+		mem += (double)m_clsGlobalVars.m_uiSuperPreDim * m_clsGlobalVars.m_uiSuperPreDim * sizeof(double);
+		mem += 4.0 * panelNum * sizeof(double);
+		mem += 2.0 * panelNum * (sizeof(unsigned long) + 5.0 * sizeof(double));
+		// potential matrices of the intermediate levels (see ComputeMultigridPrecond())
+		levelDim = panelNum / m_clsGlobalVars.m_uiBlockPreSize;
+		for(l=2; l<m_clsGlobalVars.m_uiMgLevels && levelDim > m_clsGlobalVars.m_uiSuperPreDim; l++) {
+			if(levelDim <= SOLVE_MG_MAX_LEVEL_DIM) {
+				mem += levelDim * levelDim * sizeof(double);
+			}
+			levelDim /= SOLVE_MG_COARSENING;
+		}
+	}
+
+	// node charges and potentials of the hierarchical multiplication
+	mem += 3.0 * nodeNum * sizeof(double);
+
+	blockSize = GetGmresBlockSize();
+	concurrentNum = GetConcurrentSolves();
+
+	// symmetric links: per-thread node potentials of the multiplication, and one array
+	// for each concurrent solve, whose multiplications run on a single thread
+	// (see CMultHier::AllocateSymArrays())
+	if(m_clsGlobalVars.m_bSymLinks == true && m_clsGlobalVars.m_cScheme == AUTOREFINE_GALERKIN && g_ucSolverType == SOLVERGLOBAL_3DSOLVER) {
+		mem += nodeNum * blockSize * omp_get_max_threads() * sizeof(double);
+		if(concurrentNum > 1) {
+			mem += concurrentNum * nodeNum * sizeof(double);
+		}
+	}
+
+	// block gmres: Krylov and work vectors of every right-hand side in the block,
+	// and node charges and potentials of the multi-vector multiplication
+	if(blockSize > 1) {
+		mem += blockSize * (SOLVE_GMRES_PLAN_ITER + 7) * panelNum * sizeof(double);
+		mem += 2.0 * blockSize * nodeNum * sizeof(double);
+	}
+
+	// recycled space: 'u' and 'c' vectors
+	mem += 2.0 * GetRecycleNum() * panelNum * sizeof(double);
+
+	// warm start: charges of the previous auto-refinement iteration, initial
+	// vector and record of the panel trees
+	if(m_bWarmStart == true) {
+		mem += (m_clsMulthier.m_lCondNum + 3.0) * panelNum * sizeof(double);
+	}
+
+	// concurrent solves: Krylov and work vectors of every workspace,
+	// and node charges and potentials of its multiplications
+	if(concurrentNum > 1) {
+		mem += concurrentNum * ((SOLVE_GMRES_PLAN_ITER + 14) * panelNum + 2.0 * nodeNum) * sizeof(double);
+	}
+
+	// mixed precision solve: single precision copy of the links, residual and correction
+	if(m_clsGlobalVars.m_bMixedPrecision == true && m_clsGlobalVars.m_bFloatLinks == false && UseFlexGmres() == false &&
+	        blockSize == 1 && concurrentNum == 1) {
+		mem += (double)m_clsMulthier.GetLinksNum(AUTOREFINE_HIER_PRE_0_LEVEL) * sizeof(float);
+		mem += 2.0 * panelNum * sizeof(double);
+	}
+
+	return mem;
+}
+
 int CSolveCap::SolveForCapacitance(CLin_Matrix *cRe, CLin_Matrix *cIm)
 {
 	int ret;
@@ -1092,11 +1463,12 @@ void CSolveCap::MakePreconditioner()
 	if(m_clsGlobalVars.m_ucPrecondType != AUTOREFINE_PRECOND_NONE) {
 		m_ulPanelNum = 0;
 		m_ulBlockPreBaseNum = 0;
+		m_ulBlockPrecondNum = 0;
 		for(itc1 = m_clsMulthier.m_stlConductors.begin(); itc1 != m_clsMulthier.m_stlConductors.end(); itc1++) {
 
 			m_iLevel = -1;
-			// only if using Block precond
-			if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_BLOCK) != 0 ) {
+			// only if using Block precond (also the smoother of the multigrid precond)
+			if( (m_clsGlobalVars.m_ucPrecondType & (AUTOREFINE_PRECOND_BLOCK | AUTOREFINE_PRECOND_MG)) != 0 ) {
 				m_bIsComputingBlock = false;
 			}
 			m_pCurrCond = *itc1;
@@ -1104,10 +1476,25 @@ void CSolveCap::MakePreconditioner()
 		}
 	}
 
+	// only if using Block precond, compute the blocks recorded during the recursion
+	if( (m_clsGlobalVars.m_ucPrecondType & (AUTOREFINE_PRECOND_BLOCK | AUTOREFINE_PRECOND_MG)) != 0 ) {
+		ComputeBlockPrecond();
+	}
+
+	// only if using multigrid precond, build the levels on top of the blocks
+	if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_MG) != 0 ) {
+		ComputeMultigridPrecond();
+	}
+
+	// only if using sparse approximate inverse precond
+	if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_SPAI) != 0 ) {
+		ComputeSpaiPrecond();
+	}
+
 	// only if using Super precond or Hier precond and Super precond can be used to accelerate iterations
 	if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_SUPER) != 0) {
 
-		// and finally compute the super preconditioner (inverting the matrix)
+		// and finally compute the super preconditioner (factoring the matrix)
 		ComputeSuperPrecond();
 	}
 
@@ -1137,12 +1524,15 @@ void CSolveCap::MakePreconditioner()
 // solution matrix 'cRe' and 'cIm' beforehand
 int CSolveCap::Solve(CLin_Matrix *cRe, CLin_Matrix *cIm)
 {
-	StlAutoCondDeque::iterator itc1, itc2;
-	unsigned long i, j, potindex, chindex, caprow, capcol, panelnum, potVectorDim;
+	StlAutoCondDeque::iterator itc1;
+	unsigned long i, potindex, caprow, panelnum, potVectorDim, excNum;
+	unsigned long *excPotIndex, *excPanelNum;
 	long firstCondElemIndex, rowNum;
-	double capacitance[2], outpermRe, outpermIm, chargeRe, chargeIm;
+	unsigned int blockSize, blockCols, concurrentNum;
 	double start, finish;
 	int ret;
+	bool pcgBreakdown;
+	CLin_Vector *x0;
 
 	// init 'ret' status, in case anything fails
 	ret = FC_GENERIC_ERROR;
@@ -1185,6 +1575,15 @@ int CSolveCap::Solve(CLin_Matrix *cRe, CLin_Matrix *cIm)
 
 	// init variable to alternate precond schemes
 	m_ucAlternatePrecond = 0;
+	m_iUpperGmresRet = FC_NORMAL_END;
+
+	// start with an empty recycled space
+	m_uiRecycleCur = 0;
+	m_uiRecycleNext = 0;
+
+	if(UsePcg() == true && GetGmresBlockSize() == 1 && GetConcurrentSolves() == 1) {
+		LogMsg("Symmetric positive definite system, using the preconditioned conjugate gradient\n");
+	}
 
 	// init leaf panel counter for potential computations
 	potindex = 0;
@@ -1192,6 +1591,34 @@ int CSolveCap::Solve(CLin_Matrix *cRe, CLin_Matrix *cIm)
 	// init index of first conductor element
 	firstCondElemIndex = -1;
 
+	// number of conductor excitations solved together by the block gmres
+	// (pre-allocated in AllocateMemory()), and excitations currently in the block
+	blockSize = GetGmresBlockSize();
+	// if the multigrid preconditioner fell back to the block one after the
+	// allocation (see ComputeMultigridPrecond()), there are no block gmres vectors
+	if(blockSize > m_uiBGmresVecNum) {
+		blockSize = 1;
+	}
+	blockCols = 0;
+
+	// number of conductor excitations solved concurrently (workspaces pre-allocated
+	// in AllocateMemory()); in this case, the excitations are only collected here,
+	// and solved after the loop
+	concurrentNum = GetConcurrentSolves();
+	// as above, there may be no workspaces
+	if(concurrentNum > m_uiSolveWsNum) {
+		concurrentNum = 1;
+	}
+	excNum = 0;
+	excPotIndex = NULL;
+	excPanelNum = NULL;
+	if(concurrentNum > 1) {
+		// SAFENEW_ARRAY_NOMEM_RET(TYPE, VAR, LEN)
+		SAFENEW_ARRAY_NOMEM_RET(unsigned long, excPotIndex, m_clsMulthier.m_lCondNum)
+		// SAFENEW_ARRAY_NOMEM_RET(TYPE, VAR, LEN)
+		SAFENEW_ARRAY_NOMEM_RET(unsigned long, excPanelNum, m_clsMulthier.m_lCondNum)
+	}
+
 	// scan every conductor to find the charge when the current
 	// conductor is raised to unit potential while the others
 	// are kept at zero
@@ -1253,9 +1680,35 @@ int CSolveCap::Solve(CLin_Matrix *cRe, CLin_Matrix *cIm)
 
 			// solve for charge
 
+			// if concurrent solves, just record the excitation (first leaf panel and number
+			// of leaf panels raised to unit potential); the excitation of row 'caprow' of the
+			// capacitance matrix is recorded at position 'caprow'
+			if(concurrentNum > 1) {
+				ASSERT(excNum == caprow);
+				excPotIndex[excNum] = potindex;
+				excPanelNum[excNum] = (*itc1)->m_ulLeafPanelNum;
+				excNum++;
+			}
+			// if block gmres, collect the excitation into the block, and solve
+			// when the block is full (the last, partial block is solved after the loop)
+			else if(blockSize > 1) {
+				for(i=0; i < potVectorDim; i++) {
+					m_pclsBGmres_b[blockCols][i] = potential[i];
+				}
+				blockCols++;
+
+				if(blockCols == blockSize) {
+					ret = SolveCondBlock(blockCols, caprow + 1 - blockCols, cRe, cIm);
+
+					if(ret !=  FC_NORMAL_END) {
+						return ret;
+					}
+					blockCols = 0;
+				}
+			}
 			// if block precond and a second precond method, we use alternate preconditioning,
 			// so we need the flex gmres version
-			if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_BLOCK) != 0  &&
+			else if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_BLOCK) != 0  &&
 			        (m_clsGlobalVars.m_ucPrecondType & ~(AUTOREFINE_PRECOND_BLOCK)) != 0) {
 
 				// this is not supported at the moment, also considering complex capacitance
@@ -1271,9 +1724,6 @@ int CSolveCap::Solve(CLin_Matrix *cRe, CLin_Matrix *cIm)
 			// through a second gmres iteration, gives different results at each main gmres iteration)
 			else if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_HIER) != 0) {
 
-				// this is not supported at the moment, also considering complex capacitance
-				ErrMsg("Error: using unsupported preconditioner 'h'!");
-
 				ret = gmresFlexPrecondSFastAll(&potential, &charge, m_clsGlobalVars.m_dGmresTol);
 
 				if(ret !=  FC_NORMAL_END) {
@@ -1281,10 +1731,42 @@ int CSolveCap::Solve(CLin_Matrix *cRe, CLin_Matrix *cIm)
 				}
 			}
 			else {
-				ret = gmresPrecondSFastAll(&potential, &charge, m_clsGlobalVars.m_dGmresTol);
+				// if the charges of the previous auto-refinement iteration are available,
+				// use them as initial vector
+				if(m_bWarmStart == true && ProlongWarmCharge(caprow, &m_clsWarmX0) == true) {
+					x0 = &m_clsWarmX0;
+				}
+				else {
+					x0 = NULL;
+				}
 
-				if(ret !=  FC_NORMAL_END) {
-					return ret;
+				// single precision corrections, refined in double precision
+				pcgBreakdown = false;
+				if(m_clsMulthier.HasSinglePrecLinks() == true) {
+					ret = SolveMixedPrecision(&potential, &charge, x0);
+
+					if(ret !=  FC_NORMAL_END) {
+						return ret;
+					}
+				}
+				// symmetric positive definite system, no need of gmres
+				else if(UsePcg() == true) {
+					ret = pcgPrecondSFastAll(&potential, &charge, m_clsGlobalVars.m_dGmresTol, x0, &pcgBreakdown);
+
+					if(ret !=  FC_NORMAL_END) {
+						return ret;
+					}
+					if(pcgBreakdown == true) {
+						ErrMsg("Warning: conjugate gradient failed, moving to GMRES\n");
+						m_bPcgBreakdown = true;
+					}
+				}
+				if(m_clsMulthier.HasSinglePrecLinks() == false && UsePcg() == false) {
+					ret = gmresPrecondSFastAll(&potential, &charge, m_clsGlobalVars.m_dGmresTol, x0);
+
+					if(ret !=  FC_NORMAL_END) {
+						return ret;
+					}
 				}
 			}
 
@@ -1295,110 +1777,9 @@ int CSolveCap::Solve(CLin_Matrix *cRe, CLin_Matrix *cIm)
 //	LogMsg("Index %d, chargeRe %g, chargeIm %g\n", j, chargeRe, chargeIm);
 //}
 
-			//
 			// sum up charge to find conductor's capacitance
-			//
-
-			// init leaf panel counter for potential computations
-			chindex = 0;
-
-			for(itc2 = m_clsMulthier.m_stlConductors.begin(), capcol=0;
-			        itc2 != m_clsMulthier.m_stlConductors.end(); itc2++) {
-
-				// sum up only if current conductor is real conductor and not dielectric
-				if( (*itc2)->m_bIsDiel == false) {
-
-					capacitance[0] = 0.0;
-					capacitance[1] = 0.0;
-
-					// sum this conductor's charges
-					//
-					// note that charge for this conductor is multiplied by outperm;
-					// this is to consider the medium surrounding the conductor,
-					// for detailed explanation, see Keith Nabors's PhD Thesis,
-					// "Efficient three-dimensional capacitance calculation", p.76
-					// as well as "The electrostatic field of conductive bodies in
-					// multiple dielectric media", Rao & Sarkar; another good reference is
-					// C. Wei, R. F. Harrington, J. R. Mautz, T. K. Sarkar
-					// "Multiconductor transmission lines in multilayered dielectric media", IEEE Transactions on Microwave
-					// Theory and Techniques, Vol. 32, No. 4, Apr 1985
-					for(j=chindex; j < chindex + (*itc2)->m_ulLeafPanelNum; j++) {
-
-						if( m_clsGlobalVars.m_ucHasCmplxPerm == AUTOREFINE_REAL_PERM ) {
-							_ASSERT(!isnan(charge[j]));
-							_ASSERT(isfinite(charge[j]));
-							// get the outer permittivity for this panel
-							outpermRe = (*itc2)->m_dSurfOutperm[m_clsMulthier.m_pucDielIndex[j]][0];
-							// and adjust the charge
-							capacitance[0] += outpermRe*charge[j];
-						}
-						else {
-							// real part
-							_ASSERT(!isnan(charge[j]));
-							_ASSERT(isfinite(charge[j]));
-							// imaginary part
-							_ASSERT(!isnan(charge[j+panelnum]));
-							_ASSERT(isfinite(charge[j+panelnum]));
-							// get the complex outer permittivity for this panel
-							outpermRe = (*itc2)->m_dSurfOutperm[m_clsMulthier.m_pucDielIndex[j]][0];
-							outpermIm = (*itc2)->m_dSurfOutperm[m_clsMulthier.m_pucDielIndex[j]][1];
-
-							// and adjust the charge
-							// remark: a*b where a and b are complex is (aRe+j*aIm)*(bRe+j*bIm) = aRe*bRe-aIm*bIm +j*(aIm*bRe+aRe*bIm)
-							chargeRe = charge[j];
-							chargeIm = charge[j+panelnum];
-							capacitance[0] += outpermRe*chargeRe - outpermIm*chargeIm;
-							capacitance[1] += outpermIm*chargeRe + outpermRe*chargeIm;
-//debug
-//LogMsg("outpemRe %g, outpermIm %g, chargeRe %g, chargeIm %g; c[0] %g, c[1] %g\n", outpermRe, outpermIm, chargeRe, chargeIm, capacitance[0], capacitance[1]);
-						}
-
-					}
-					// store capacitance value in matrix
-					(*cRe)[caprow][capcol] = capacitance[0];
-					(*cIm)[caprow][capcol] = capacitance[1];
-					// increase capacitance matrix col index
-					capcol++;
-				}
-
-				// increment chindex
-				chindex += (*itc2)->m_ulLeafPanelNum;
-			}
-
-			// store charges for later use, if requested
-			// Remark: charges from the solve on each conductor are summed up;
-			// this is a simplification, in order not to have to save the charges
-			// for each conductor and use it to discretize differently the geometry
-			// for each solve pass (would not be good for speed improvement)
-			if(m_clsGlobalVars.m_bKeepCharge == true) {
-				// charges
-				// remark: you must modify also the functions CAutoRefine::CopyCharges()
-				// and CAutoRefine::OutputPanelTree(), dividing charge by the panel area,
-				// to work with charge densities
-				for(i=0; i < panelnum; i++) {
-//					m_clsMulthier.m_fGlobalCharges[i] += fabs(charge[i]);
-					m_clsMulthier.m_fGlobalCharges[i] += charge[i];
-				}
-			}
-
-			if(m_clsGlobalVars.m_bOutputCharge == true) {
-				// charges
-				// remark: the using functions (e.g. CAutoRefine::CopyCharges()
-				// and CAutoRefine::OutputPanelTree() ), will divide the charge by the panel area,
-				// to work with charge densities
-				//
-				// update vector dimension
-				m_pCondCharges[caprow].newsize(panelnum);
-				// and copy charges into the vector
-				// remark: this is only the real part, in case of complex charges
-				for(i=0; i < panelnum; i++) {
-					if(g_ucSolverType == SOLVERGLOBAL_3DSOLVER) {
-						m_pCondCharges[caprow][i] = charge[i];
-					}
-					else {
-						m_pCondCharges[caprow][i] = charge[i] * TWO_PI_TIMES_E0;
-					}
-				}
+			if(blockSize == 1 && concurrentNum == 1) {
+				StoreCondCharge(&charge, caprow, cRe, cIm);
 			}
 
 			// clean up
@@ -1418,23 +1799,290 @@ int CSolveCap::Solve(CLin_Matrix *cRe, CLin_Matrix *cIm)
 		potindex += (*itc1)->m_ulLeafPanelNum;
 	}
 
+	// solve the last, partial block
+	if(blockCols > 0) {
+		ret = SolveCondBlock(blockCols, caprow - blockCols, cRe, cIm);
+	}
+
+	// solve the collected excitations concurrently
+	if(concurrentNum > 1) {
+		ret = SolveConcurrent(excNum, excPotIndex, excPanelNum, cRe, cIm);
+
+		delete []excPotIndex;
+		delete []excPanelNum;
+	}
+
 	finish = omp_get_wtime();
 	m_fDurationSolve = (float)(finish - start);
 
 	return ret;
 }
 
+// Solve with the block gmres the 'vecNum' conductor excitations collected
+// in 'm_pclsBGmres_b', the first one being at row 'firstRow' of the capacitance matrix
+int CSolveCap::SolveCondBlock(unsigned int vecNum, unsigned long firstRow, CLin_Matrix *cRe, CLin_Matrix *cIm)
+{
+	unsigned int k;
+	int ret;
+
+	ret = gmresPrecondSFastBlock(m_pclsBGmres_b, m_pclsBGmres_x, vecNum, m_clsGlobalVars.m_dGmresTol);
+
+	if(ret !=  FC_NORMAL_END) {
+		return ret;
+	}
+
+	for(k=0; k<vecNum; k++) {
+		StoreCondCharge(&m_pclsBGmres_x[k], firstRow + k, cRe, cIm);
+	}
+
+	return FC_NORMAL_END;
+}
+
+// Solve concurrently the 'excNum' conductor excitations collected by Solve(), each
+// one with its own workspace. The k-th excitation raises to unit potential the
+// 'excPanelNum[k]' leaf panels starting at 'excPotIndex[k]', and its solution is stored
+// at row 'k' of the capacitance matrix
+int CSolveCap::SolveConcurrent(unsigned long excNum, unsigned long *excPotIndex, unsigned long *excPanelNum, CLin_Matrix *cRe, CLin_Matrix *cIm)
+{
+	long exc;
+	unsigned long i, k;
+	long *iterations;
+	double *normr;
+	CSolveWorkspace *ws;
+	int ret, retWs;
+
+	ASSERT(m_uiSolveWsNum > 1);
+
+	// SAFENEW_ARRAY_NOMEM_RET(TYPE, VAR, LEN)
+	SAFENEW_ARRAY_NOMEM_RET(long, iterations, excNum)
+	// SAFENEW_ARRAY_NOMEM_RET(TYPE, VAR, LEN)
+	SAFENEW_ARRAY_NOMEM_RET(double, normr, excNum)
+
+	for(k=0; k<excNum; k++) {
+		iterations[k] = -1;
+		normr[k] = 0.0;
+	}
+
+	ret = FC_NORMAL_END;
+
+	// remark: no logging from the worker threads (the log functions are not re-entrant),
+	// and the sum up of the charges is serialized, since it also updates shared variables
+	// (e.g. the conductor charges, if dumping charge densities)
+	// 'exc' must have signed integral type due to MS OpenMP limitation
+	#pragma omp parallel for schedule(dynamic, 1) num_threads((int)m_uiSolveWsNum) private(ws, i, retWs)
+	for(exc=0; exc<(long)excNum; exc++) {
+
+		// skip the remaining excitations, if any solve failed
+		#pragma omp critical(solveconcurrent)
+		{
+			retWs = ret;
+		}
+		if(retWs != FC_NORMAL_END) {
+			continue;
+		}
+
+		ws = &m_pclsSolveWs[omp_get_thread_num()];
+
+		// raise conductor's potential to one
+		for(i=0; i < ws->m_clsPotential.size(); i++) {
+			ws->m_clsPotential[i] = 0.0;
+		}
+		for(i=excPotIndex[exc]; i < excPotIndex[exc] + excPanelNum[exc]; i++) {
+			ws->m_clsPotential[i] = 1.0;
+		}
+
+		retWs = gmresPrecondSFastAllWs(&ws->m_clsPotential, &ws->m_clsCharge, m_clsGlobalVars.m_dGmresTol, ws);
+
+		iterations[exc] = ws->m_lIterations;
+		normr[exc] = ws->m_dNormr;
+
+		#pragma omp critical(solveconcurrent)
+		{
+			if(retWs != FC_NORMAL_END) {
+				if(ret == FC_NORMAL_END) {
+					ret = retWs;
+				}
+			}
+			else {
+				StoreCondCharge(&ws->m_clsCharge, (unsigned long)exc, cRe, cIm);
+			}
+		}
+	}
+
+	// log the iterations of the solved excitations
+	for(k=0; k<excNum; k++) {
+		if(iterations[k] < 0) {
+			continue;
+		}
+		if(iterations[k] >= SOLVE_GMRES_ITER_MAX) {
+			ErrMsg("\nError: conductor %d not converging after %d iterations, norm of the residual is %.3f, while targeting %.3f\n", k+1, iterations[k], normr[k], m_clsGlobalVars.m_dGmresTol);
+		}
+		else {
+			if(m_clsGlobalVars.m_bDumpResidual == true) {
+				LogMsg("GMRES Iterations (conductor %d): %d, norm of the residual %.3g\n", k+1, iterations[k], normr[k]);
+			}
+			else {
+				LogMsg("GMRES Iterations (conductor %d): %d\n", k+1, iterations[k]);
+			}
+		}
+	}
+
+	delete []iterations;
+	delete []normr;
+
+	return ret;
+}
+
+// Sum up the charges solving for the conductor at row 'caprow' of the capacitance matrix
+// to find the capacitances, and store them if requested
+void CSolveCap::StoreCondCharge(CLin_Vector *charge, unsigned long caprow, CLin_Matrix *cRe, CLin_Matrix *cIm)
+{
+	StlAutoCondDeque::iterator itc2;
+	unsigned long i, j, chindex, capcol, panelnum;
+	double capacitance[2], outpermRe, outpermIm, chargeRe, chargeIm;
+
+	panelnum = m_clsMulthier.GetPanelNum(AUTOREFINE_HIER_PRE_0_LEVEL);
+
+	//
+	// sum up charge to find conductor's capacitance
+	//
+
+	// init leaf panel counter for potential computations
+	chindex = 0;
+
+	for(itc2 = m_clsMulthier.m_stlConductors.begin(), capcol=0;
+	        itc2 != m_clsMulthier.m_stlConductors.end(); itc2++) {
+
+		// sum up only if current conductor is real conductor and not dielectric
+		if( (*itc2)->m_bIsDiel == false) {
+
+			capacitance[0] = 0.0;
+			capacitance[1] = 0.0;
+
+			// sum this conductor's charges
+			//
+			// note that charge for this conductor is multiplied by outperm;
+			// this is to consider the medium surrounding the conductor,
+			// for detailed explanation, see Keith Nabors's PhD Thesis,
+			// "Efficient three-dimensional capacitance calculation", p.76
+			// as well as "The electrostatic field of conductive bodies in
+			// multiple dielectric media", Rao & Sarkar; another good reference is
+			// C. Wei, R. F. Harrington, J. R. Mautz, T. K. Sarkar
+			// "Multiconductor transmission lines in multilayered dielectric media", IEEE Transactions on Microwave
+			// Theory and Techniques, Vol. 32, No. 4, Apr 1985
+			for(j=chindex; j < chindex + (*itc2)->m_ulLeafPanelNum; j++) {
+
+				if( m_clsGlobalVars.m_ucHasCmplxPerm == AUTOREFINE_REAL_PERM ) {
+					_ASSERT(!isnan((*charge)[j]));
+					_ASSERT(isfinite((*charge)[j]));
+					// get the outer permittivity for this panel
+					outpermRe = (*itc2)->m_dSurfOutperm[m_clsMulthier.m_pucDielIndex[j]][0];
+					// and adjust the charge
+					capacitance[0] += outpermRe*(*charge)[j];
+				}
+				else {
+					// real part
+					_ASSERT(!isnan((*charge)[j]));
+					_ASSERT(isfinite((*charge)[j]));
+					// imaginary part
+					_ASSERT(!isnan((*charge)[j+panelnum]));
+					_ASSERT(isfinite((*charge)[j+panelnum]));
+					// get the complex outer permittivity for this panel
+					outpermRe = (*itc2)->m_dSurfOutperm[m_clsMulthier.m_pucDielIndex[j]][0];
+					outpermIm = (*itc2)->m_dSurfOutperm[m_clsMulthier.m_pucDielIndex[j]][1];
+
+					// and adjust the charge
+					// remark: a*b where a and b are complex is (aRe+j*aIm)*(bRe+j*bIm) = aRe*bRe-aIm*bIm +j*(aIm*bRe+aRe*bIm)
+					chargeRe = (*charge)[j];
+					chargeIm = (*charge)[j+panelnum];
+					capacitance[0] += outpermRe*chargeRe - outpermIm*chargeIm;
+					capacitance[1] += outpermIm*chargeRe + outpermRe*chargeIm;
+//debug
+//LogMsg("outpemRe %g, outpermIm %g, chargeRe %g, chargeIm %g; c[0] %g, c[1] %g\n", outpermRe, outpermIm, chargeRe, chargeIm, capacitance[0], capacitance[1]);
+				}
+
+			}
+			// store capacitance value in matrix
+			(*cRe)[caprow][capcol] = capacitance[0];
+			(*cIm)[caprow][capcol] = capacitance[1];
+			// increase capacitance matrix col index
+			capcol++;
+		}
+
+		// increment chindex
+		chindex += (*itc2)->m_ulLeafPanelNum;
+	}
+
+	// store charges for later use, if requested
+	// Remark: charges from the solve on each conductor are summed up;
+	// this is a simplification, in order not to have to save the charges
+	// for each conductor and use it to discretize differently the geometry
+	// for each solve pass (would not be good for speed improvement)
+	if(m_clsGlobalVars.m_bKeepCharge == true) {
+		// charges
+		// remark: you must modify also the functions CAutoRefine::CopyCharges()
+		// and CAutoRefine::OutputPanelTree(), dividing charge by the panel area,
+		// to work with charge densities
+		for(i=0; i < panelnum; i++) {
+//					m_clsMulthier.m_fGlobalCharges[i] += fabs((*charge)[i]);
+			m_clsMulthier.m_fGlobalCharges[i] += (*charge)[i];
+		}
+	}
+
+	if(m_clsGlobalVars.m_bOutputCharge == true) {
+		// charges
+		// remark: the using functions (e.g. CAutoRefine::CopyCharges()
+		// and CAutoRefine::OutputPanelTree() ), will divide the charge by the panel area,
+		// to work with charge densities
+		//
+		// update vector dimension
+		m_pCondCharges[caprow].newsize(panelnum);
+		// and copy charges into the vector
+		// remark: this is only the real part, in case of complex charges
+		for(i=0; i < panelnum; i++) {
+			if(g_ucSolverType == SOLVERGLOBAL_3DSOLVER) {
+				m_pCondCharges[caprow][i] = (*charge)[i];
+			}
+			else {
+				m_pCondCharges[caprow][i] = (*charge)[i] * TWO_PI_TIMES_E0;
+			}
+		}
+	}
+
+	// keep the charges for warm starting the next auto-refinement iteration
+	if(m_bWarmStart == true && m_pclsWarmCharges != NULL) {
+		if(m_pclsWarmCharges[caprow].size() != charge->size()) {
+			if(m_pclsWarmCharges[caprow].newsize(charge->size()) == false) {
+				// not enough memory, simply give up warm starting
+				m_bWarmStart = false;
+				return;
+			}
+			g_clsMemUsage.m_ulGmresMem += charge->size() * sizeof(double);
+		}
+		for(i=0; i < (unsigned long)charge->size(); i++) {
+			m_pclsWarmCharges[caprow][i] = (*charge)[i];
+		}
+	}
+}
+
 // pre-allocate gmres vectors
 int CSolveCap::AllocateMemory()
 {
-	unsigned long numElems_0, numPanels_0;
+	unsigned long numElems_0, numPanels_0, supPotMtxDim;
+	unsigned int blockSize, wsNum, recycleNum;
 	bool ret;
+	int retInt;
 
 	//
 	// declare large arrays / matrices on the heap, not on the stack (otherwise will run out of stack
 	// at run time)
 	//
 
+	// node charges and potentials used by the hierarchical matrix-vector product
+	if(m_clsMulthier.AllocateNodeArrays() != FC_NORMAL_END) {
+		return FC_OUT_OF_MEMORY;
+	}
+
 	numPanels_0 = m_clsMulthier.GetPanelNum(AUTOREFINE_HIER_PRE_0_LEVEL);
 	if( m_clsGlobalVars.m_ucHasCmplxPerm == AUTOREFINE_REAL_PERM ) {
 		numElems_0 = numPanels_0;
@@ -1447,7 +2095,14 @@ int CSolveCap::AllocateMemory()
 	// SAFENEW_ARRAY_NOMEM_RET(TYPE, VAR, LEN)
 	SAFENEW_ARRAY_NOMEM_RET(CLin_Vector, m_pCondCharges, m_clsMulthier.m_lCondNum)
 
-	// preallocate vectors and matrices for gmres on bottom level
+	// charges kept for warm starting the next auto-refinement iteration
+	// (allocated once, the number of conductors does not change among iterations)
+	if(m_bWarmStart == true && m_pclsWarmCharges == NULL) {
+		// SAFENEW_ARRAY_NOMEM_RET(TYPE, VAR, LEN)
+		SAFENEW_ARRAY_NOMEM_RET(CLin_Vector, m_pclsWarmCharges, m_clsMulthier.m_lCondNum)
+	}
+
+	// preallocate vectors and matrices for gmres on bottom level
 
 	//
 	// allocate matrices
@@ -1570,6 +2225,57 @@ int CSolveCap::AllocateMemory()
 	// record up to which iteration the arrays have been pre-allocated
 	m_uiGmresPrealloc[AUTOREFINE_HIER_PRE_0_LEVEL] = 0;
 
+	// mixed precision solve: single precision copy of the links, and
+	// residual and correction vectors (see SolveMixedPrecision())
+	if(m_clsGlobalVars.m_bMixedPrecision == true && GetGmresBlockSize() == 1 && GetConcurrentSolves() == 1 && UseFlexGmres() == false) {
+		retInt = m_clsMulthier.AllocateSinglePrecLinks();
+		if(retInt == FC_OUT_OF_MEMORY) {
+			return FC_OUT_OF_MEMORY;
+		}
+		else if(retInt != FC_NORMAL_END) {
+			ErrMsg("Warning: mixed precision solve (-ts) needs in-core, double precision links, using double precision only\n");
+		}
+		else {
+			ret = m_clsMixed_r.newsize(numElems_0);
+			if(ret == false) {
+				return FC_OUT_OF_MEMORY;
+			}
+			g_clsMemUsage.m_ulGmresMem += numElems_0 * sizeof(double);
+			ret = m_clsMixed_d.newsize(numElems_0);
+			if(ret == false) {
+				return FC_OUT_OF_MEMORY;
+			}
+			g_clsMemUsage.m_ulGmresMem += numElems_0 * sizeof(double);
+		}
+	}
+	else if(m_clsGlobalVars.m_bMixedPrecision == true && UseFlexGmres() == false) {
+		ErrMsg("Warning: mixed precision solve (-ts) not supported together with block (-tb) or concurrent (-tc) solves, using double precision only\n");
+	}
+
+	// block gmres, if more than one conductor excitation is solved at once
+	blockSize = GetGmresBlockSize();
+	if(blockSize > 1) {
+		if(AllocateBlockGmres(blockSize, numElems_0) != FC_NORMAL_END) {
+			return FC_OUT_OF_MEMORY;
+		}
+	}
+
+	// recycled space, if recycling vectors across the conductor solves
+	recycleNum = GetRecycleNum();
+	if(recycleNum > 0) {
+		if(AllocateRecycledSpace(recycleNum, numElems_0) != FC_NORMAL_END) {
+			return FC_OUT_OF_MEMORY;
+		}
+	}
+
+	// workspaces, if more conductor excitations are solved concurrently
+	wsNum = GetConcurrentSolves();
+	if(wsNum > 1) {
+		if(AllocateSolveWorkspaces(wsNum, numElems_0) != FC_NORMAL_END) {
+			return FC_OUT_OF_MEMORY;
+		}
+	}
+
 	// only in case the user is requesting a hierarchical preconditioner,
 	// pre-allocate matrices for gmres on upper levels of hierarchy
 	if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_HIER) != 0) {
@@ -1685,32 +2391,59 @@ int CSolveCap::AllocateMemory()
 	}
 
 
+	// super potential matrix, sized on the actual two-levels preconditioner dimension
+	supPotMtxDim = 0;
 	if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_SUPER) != 0) {
-
-		// super preconditioner
-		//
-		// allocate only if not already allocated (in previous call)
-		if(m_pclsSupPrecondMtx == NULL) {
-			// SAFENEW_MATRIX_RET(TYPE, VAR, LEN, MEM)
-			SAFENEW_MATRIX_RET(double, m_pclsSupPrecondMtx, SOLVE_MAX_SUPER_PRECOND_NUM, g_clsMemUsage.m_ulPrecondMem)
+		supPotMtxDim = m_clsGlobalVars.m_uiSuperPreDim;
+	}
+	// allocate only if not already allocated (in previous call) with the same dimension
+	if(supPotMtxDim != 0 && supPotMtxDim != m_ulSupPotMtxDim) {
+		if(m_pdSupPotMtx != NULL) {
+			delete [] m_pdSupPotMtx;
+			m_pdSupPotMtx = NULL;
 		}
-		if(m_pclsSupPotMtx == NULL) {
-			// SAFENEW_MATRIX_RET(TYPE, VAR, LEN, MEM)
-			SAFENEW_MATRIX_RET(double, m_pclsSupPotMtx, SOLVE_MAX_SUPER_PRECOND_NUM, g_clsMemUsage.m_ulPrecondMem)
+		if(m_plSupPotPivot != NULL) {
+			delete [] m_plSupPotPivot;
+			m_plSupPotPivot = NULL;
 		}
+		m_ulSupPotMtxDim = 0;
+		// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+		SAFENEW_ARRAY_RET(double, m_pdSupPotMtx, supPotMtxDim * supPotMtxDim, g_clsMemUsage.m_ulPrecondMem)
+		// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+		SAFENEW_ARRAY_RET(long, m_plSupPotPivot, supPotMtxDim, g_clsMemUsage.m_ulPrecondMem)
+		m_ulSupPotMtxDim = supPotMtxDim;
+	}
+
+	if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_SUPER) != 0) {
 
-		// allocate arrays for super preconditioner
+		// allocate arrays for super preconditioner;
+		// in case they were already declared, destroy and re-declare (can change length)
 		//
 		// super preconditioner elements
-		if(m_clsSupPrecondElements == NULL) {
-			// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
-			SAFENEW_ARRAY_RET(CSuperPrecondElement, m_clsSupPrecondElements, SOLVE_MAX_SUPER_PRECOND_NUM, g_clsMemUsage.m_ulPrecondMem)
+		if(m_clsSupPrecondElements != NULL) {
+			delete [] m_clsSupPrecondElements;
+		}
+		// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+		SAFENEW_ARRAY_RET(CSuperPrecondElement, m_clsSupPrecondElements, m_clsGlobalVars.m_uiSuperPreDim, g_clsMemUsage.m_ulPrecondMem)
+
+		// diagonal of the inverse of the super potential matrix
+		if(m_pdSupPrecondDiag != NULL) {
+			delete [] m_pdSupPrecondDiag;
+		}
+		// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+		SAFENEW_ARRAY_RET(double, m_pdSupPrecondDiag, m_clsGlobalVars.m_uiSuperPreDim, g_clsMemUsage.m_ulPrecondMem)
+
+		// work vectors for the substitutions, one per thread (see ComputeSuperPrecond())
+		if(m_pdSupPrecondVect != NULL) {
+			delete [] m_pdSupPrecondVect;
 		}
+		// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+		SAFENEW_ARRAY_RET(double, m_pdSupPrecondVect, (unsigned long)m_clsGlobalVars.m_uiSuperPreDim * omp_get_max_threads(), g_clsMemUsage.m_ulPrecondMem)
 
 		// leaf pointers to super preconditioner high level leaves;
 		// in case it was already declared, destroy and re-declare (can change length)
 		if(m_puiSupPrecondIndex != NULL) {
-			delete m_puiSupPrecondIndex;
+			delete [] m_puiSupPrecondIndex;
 		}
 		// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
 		SAFENEW_ARRAY_RET(unsigned int, m_puiSupPrecondIndex, numPanels_0, g_clsMemUsage.m_ulPrecondMem)
@@ -1719,23 +2452,32 @@ int CSolveCap::AllocateMemory()
 		// the results of the super precond multiplication to the leaves (correct weighting,
 		// in case of non-uniform panel discretizations)
 		if(m_pfSupPrecondAreae != NULL) {
-			delete m_pfSupPrecondAreae;
+			delete [] m_pfSupPrecondAreae;
 		}
 		// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
 		SAFENEW_ARRAY_RET(float, m_pfSupPrecondAreae, numPanels_0, g_clsMemUsage.m_ulPrecondMem)
 	}
 
-	// if block preconditioner
-	if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_BLOCK) != 0) {
+	// if block preconditioner (also the smoother of the multigrid preconditioner)
+	if( (m_clsGlobalVars.m_ucPrecondType & (AUTOREFINE_PRECOND_BLOCK | AUTOREFINE_PRECOND_MG)) != 0) {
 
 		// allocate arrays for block preconditioner
 		//
 
-		// block preconditioner elements
-		if(m_clsBlockPrecondElements == NULL) {
-			// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
-			SAFENEW_ARRAY_RET(CAutoPanel*, m_clsBlockPrecondElements, SOLVE_MAX_BLOCK_PRECOND_NUM, g_clsMemUsage.m_ulPrecondMem)
+		// block preconditioner elements, in the leaves order (the blocks are computed all together
+		// after the recursion, see ComputeBlockPrecond()); in case it was already declared,
+		// destroy and re-declare (can change length)
+		if(m_clsBlockPrecondElements != NULL) {
+			delete [] m_clsBlockPrecondElements;
+		}
+		// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+		SAFENEW_ARRAY_RET(CAutoPanel*, m_clsBlockPrecondElements, numPanels_0, g_clsMemUsage.m_ulPrecondMem)
+		// position of the first element of each block
+		if(m_pulBlockPrecondBase != NULL) {
+			delete [] m_pulBlockPrecondBase;
 		}
+		// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+		SAFENEW_ARRAY_RET(unsigned long, m_pulBlockPrecondBase, numPanels_0, g_clsMemUsage.m_ulPrecondMem)
 		// block preconditioner
 		if(m_pdBlockPrecond != NULL) {
 			delete []m_pdBlockPrecond;
@@ -1745,1064 +2487,3139 @@ int CSolveCap::AllocateMemory()
 
 		// number of elements in each block (in case there are less than 'm_clsGlobalVars.m_uiBlockPreSize')
 		if(m_pucBlockPrecondDim != NULL) {
-			delete m_pucBlockPrecondDim;
+			delete [] m_pucBlockPrecondDim;
 		}
 		// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
 		SAFENEW_ARRAY_RET(unsigned char, m_pucBlockPrecondDim, numElems_0, g_clsMemUsage.m_ulPrecondMem);
 
-		// borrow also the super potential matrix
-		if(m_pclsSupPotMtx == NULL) {
-			// SAFENEW_MATRIX_RET(TYPE, VAR, LEN, MEM)
-			SAFENEW_MATRIX_RET(double, m_pclsSupPotMtx, SOLVE_MAX_SUPER_PRECOND_NUM, g_clsMemUsage.m_ulPrecondMem)
+		// scratch block potential matrices and pivot vectors, one per thread
+		if(m_pdBlockPotMtx != NULL) {
+			delete [] m_pdBlockPotMtx;
+		}
+		// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+		SAFENEW_ARRAY_RET(double, m_pdBlockPotMtx, (unsigned long)m_clsGlobalVars.m_uiBlockPreSize * m_clsGlobalVars.m_uiBlockPreSize * omp_get_max_threads(), g_clsMemUsage.m_ulPrecondMem)
+		if(m_plBlockPotPivot != NULL) {
+			delete [] m_plBlockPotPivot;
+		}
+		// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+		SAFENEW_ARRAY_RET(long, m_plBlockPotPivot, (unsigned long)m_clsGlobalVars.m_uiBlockPreSize * omp_get_max_threads(), g_clsMemUsage.m_ulPrecondMem)
+	}
+
+	// if sparse approximate inverse preconditioner
+	if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_SPAI) != 0) {
+
+		// allocate arrays for sparse approximate inverse preconditioner
+		//
+
+		// coefficients and column indexes, 'm_uiSpaiSize' for each leaf; in case they were
+		// already declared, destroy and re-declare (can change length)
+		if(m_pdSpaiPrecond != NULL) {
+			delete [] m_pdSpaiPrecond;
+		}
+		// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+		SAFENEW_ARRAY_RET(double, m_pdSpaiPrecond, numPanels_0 * m_clsGlobalVars.m_uiSpaiSize, g_clsMemUsage.m_ulPrecondMem)
+		if(m_pulSpaiIndex != NULL) {
+			delete [] m_pulSpaiIndex;
+		}
+		// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+		SAFENEW_ARRAY_RET(unsigned long, m_pulSpaiIndex, numPanels_0 * m_clsGlobalVars.m_uiSpaiSize, g_clsMemUsage.m_ulPrecondMem)
+		// number of elements of each row (in case there are less than 'm_clsGlobalVars.m_uiSpaiSize')
+		if(m_pucSpaiDim != NULL) {
+			delete [] m_pucSpaiDim;
+		}
+		// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+		SAFENEW_ARRAY_RET(unsigned char, m_pucSpaiDim, numPanels_0, g_clsMemUsage.m_ulPrecondMem)
+
+		// scratch local potential matrices and pivot vectors, one per thread
+		if(m_pdSpaiPotMtx != NULL) {
+			delete [] m_pdSpaiPotMtx;
 		}
-		// and allocate temporary block to store the inverted 'm_pclsSupPotMtx' when calculating the precond
-		if(m_pclsTmpCapMtx == NULL) {
-			// SAFENEW_MATRIX_RET(TYPE, VAR, LEN, MEM)
-			SAFENEW_MATRIX_RET(double, m_pclsTmpCapMtx, SOLVE_MAX_SUPER_PRECOND_NUM, g_clsMemUsage.m_ulPrecondMem)
+		// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+		SAFENEW_ARRAY_RET(double, m_pdSpaiPotMtx, (unsigned long)m_clsGlobalVars.m_uiSpaiSize * m_clsGlobalVars.m_uiSpaiSize * omp_get_max_threads(), g_clsMemUsage.m_ulPrecondMem)
+		if(m_plSpaiPotPivot != NULL) {
+			delete [] m_plSpaiPotPivot;
 		}
+		// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+		SAFENEW_ARRAY_RET(long, m_plSpaiPotPivot, (unsigned long)m_clsGlobalVars.m_uiSpaiSize * omp_get_max_threads(), g_clsMemUsage.m_ulPrecondMem)
 	}
 
 	return FC_NORMAL_END;
 }
 
-// delete structures
-void CSolveCap::DeallocateMemory(int command, CAutoRefGlobalVars globalVars)
+// pre-allocate the block gmres vectors for 'vecNum' right-hand sides of 'numElems' elements
+int CSolveCap::AllocateBlockGmres(unsigned int vecNum, unsigned long numElems)
 {
-	m_clsMulthier.Clean(command, globalVars);
+	unsigned int k;
+	unsigned long qbase;
+	bool ret;
 
-	if(m_pCondCharges != NULL) {
-		delete [] m_pCondCharges;
-		m_pCondCharges = NULL;
+	// dimensions may have changed since last run (e.g. in 'auto' mode)
+	DeallocateBlockGmres();
+
+	// SAFENEW_ARRAY_NOMEM_RET(TYPE, VAR, LEN)
+	SAFENEW_ARRAY_NOMEM_RET(CLin_Vector, m_pclsBGmres_q, vecNum * (SOLVE_GMRES_ITER_MAX+1))
+	SAFENEW_ARRAY_NOMEM_RET(CLin_Vector, m_pclsBGmres_h, vecNum * SOLVE_GMRES_ITER_MAX)
+	SAFENEW_ARRAY_NOMEM_RET(CLin_Vector, m_pclsBGmres_g, vecNum)
+	SAFENEW_ARRAY_NOMEM_RET(CLin_Vector, m_pclsBGmres_c, vecNum)
+	SAFENEW_ARRAY_NOMEM_RET(CLin_Vector, m_pclsBGmres_s, vecNum)
+	SAFENEW_ARRAY_NOMEM_RET(CLin_Vector, m_pclsBGmres_x0, vecNum)
+	SAFENEW_ARRAY_NOMEM_RET(CLin_Vector, m_pclsBGmres_b, vecNum)
+	SAFENEW_ARRAY_NOMEM_RET(CLin_Vector, m_pclsBGmres_x, vecNum)
+	SAFENEW_ARRAY_NOMEM_RET(CLin_Vector, m_pclsBGmres_Pq, vecNum)
+	SAFENEW_ARRAY_NOMEM_RET(CLin_Vector, m_pclsBGmres_v, vecNum)
+	SAFENEW_ARRAY_NOMEM_RET(long, m_plBGmresIter, vecNum)
+	SAFENEW_ARRAY_NOMEM_RET(unsigned int, m_puiBGmresActive, vecNum)
+	SAFENEW_ARRAY_NOMEM_RET(unsigned int, m_puiBGmresPrealloc, vecNum)
+	g_clsMemUsage.m_ulGmresMem += (vecNum * (2*SOLVE_GMRES_ITER_MAX+9)) * sizeof(CLin_Vector);
+
+	ret = m_clsBGmres_normr.newsize(vecNum);
+	ret = ret && m_clsBGmres_normb.newsize(vecNum);
+	if(ret == false) {
+		return FC_OUT_OF_MEMORY;
 	}
 
-	if(m_pclsTmpCapMtx != NULL) {
-		delete [] m_pclsTmpCapMtx;
-		m_pclsTmpCapMtx = NULL;
+	for(k=0; k<vecNum; k++) {
+		qbase = k * (SOLVE_GMRES_ITER_MAX+1);
+		// init first and second element of q, and first element of h
+		ret = m_pclsBGmres_q[qbase].newsize(numElems);
+		ret = ret && m_pclsBGmres_q[qbase+1].newsize(numElems);
+		ret = ret && m_pclsBGmres_h[k * SOLVE_GMRES_ITER_MAX].newsize(2);
+		// g, c, s vectors
+		ret = ret && m_pclsBGmres_g[k].newsize(SOLVE_GMRES_ITER_MAX+1);
+		ret = ret && m_pclsBGmres_c[k].newsize(SOLVE_GMRES_ITER_MAX+1);
+		ret = ret && m_pclsBGmres_s[k].newsize(SOLVE_GMRES_ITER_MAX+1);
+		// x0, right-hand side, solution and block mat-vec vectors
+		ret = ret && m_pclsBGmres_x0[k].newsize(numElems);
+		ret = ret && m_pclsBGmres_b[k].newsize(numElems);
+		ret = ret && m_pclsBGmres_x[k].newsize(numElems);
+		ret = ret && m_pclsBGmres_Pq[k].newsize(numElems);
+		ret = ret && m_pclsBGmres_v[k].newsize(numElems);
+		if(ret == false) {
+			return FC_OUT_OF_MEMORY;
+		}
+		g_clsMemUsage.m_ulGmresMem += (7 * numElems + 3 * (SOLVE_GMRES_ITER_MAX+1) + 2) * sizeof(double);
+
+		m_puiBGmresPrealloc[k] = 0;
 	}
 
-	if(m_pclsGmres_q != NULL) {
-		delete []m_pclsGmres_q;
-		m_pclsGmres_q = NULL;
+	m_uiBGmresVecNum = vecNum;
+
+	return FC_NORMAL_END;
+}
+
+// Number of conductor excitations solved together by gmresPrecondSFastBlock(),
+// or 1 if the excitations must be solved one by one
+unsigned int CSolveCap::GetGmresBlockSize()
+{
+	unsigned int blockSize;
+
+	// the preconditioners requiring the flex gmres version are not supported by the block gmres
+	if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_HIER) != 0 ||
+	        ((m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_BLOCK) != 0  &&
+	         (m_clsGlobalVars.m_ucPrecondType & ~(AUTOREFINE_PRECOND_BLOCK)) != 0) ) {
+		return 1;
 	}
-	if(m_pclsGmres_h != NULL) {
-		delete []m_pclsGmres_h;
-		m_pclsGmres_h = NULL;
+	// the multigrid preconditioner multiplies by the potential matrix
+	// through the shared hierarchical multiplication buffers
+	if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_MG) != 0) {
+		return 1;
 	}
-	if(m_pclsGmres_zf != NULL) {
-		delete []m_pclsGmres_zf;
-		m_pclsGmres_zf = NULL;
+	// the block gmres does not restart
+	if(GetGmresRestart() < SOLVE_GMRES_ITER_MAX) {
+		return 1;
 	}
-	if(m_pclsGmres1_q != NULL) {
-		delete []m_pclsGmres1_q;
-		m_pclsGmres1_q = NULL;
+	// the conjugate gradient is cheaper, and has no Krylov basis to share
+	if(UsePcg() == true) {
+		return 1;
 	}
-	if(m_pclsGmres1_h != NULL) {
-		delete []m_pclsGmres1_h;
-		m_pclsGmres1_h = NULL;
+	// recycling needs the solution of the previous conductor (remark: cannot call
+	// GetRecycleNum() here, as it depends on the block size)
+	if(m_clsGlobalVars.m_uiGmresRecycleNum > 0) {
+		return 1;
 	}
 
-	DeallocatePrecond();
+	blockSize = m_clsGlobalVars.m_uiGmresBlockSize;
+	// no need for more columns than conductors
+	if(blockSize > (unsigned int)m_clsMulthier.m_lCondNum) {
+		blockSize = (unsigned int)m_clsMulthier.m_lCondNum;
+	}
+	if(blockSize < 1) {
+		blockSize = 1;
+	}
 
-	m_clsGmres_g.destroy();
-	m_clsGmres_v.destroy();
-	m_clsGmres_w.destroy();
-	m_clsGmres_z.destroy();
-	m_clsGmres_y.destroy();
-	m_clsGmres_c.destroy();
-	m_clsGmres_s.destroy();
-	m_clsGmres_r.destroy();
-	m_clsGmres_Pq.destroy();
-	m_clsGmres_x0.destroy();
+	return blockSize;
+}
 
-	m_clsGmres1_g.destroy();
-	m_clsGmres1_v.destroy();
-	m_clsGmres1_w.destroy();
-	m_clsGmres1_z.destroy();
-	m_clsGmres1_y.destroy();
-	m_clsGmres1_c.destroy();
-	m_clsGmres1_s.destroy();
-	m_clsGmres1_r.destroy();
-	m_clsGmres1_Pq.destroy();
-	m_clsGmres1_x0.destroy();
+// pre-allocate the workspaces of 'wsNum' concurrent solves, for right-hand sides of 'numElems' elements
+int CSolveCap::AllocateSolveWorkspaces(unsigned int wsNum, unsigned long numElems)
+{
+	unsigned int k;
+	CSolveWorkspace *ws;
+	bool ret;
 
-	g_clsMemUsage.m_ulGmresMem = 0;
-	g_clsMemUsage.m_ulPrecondMem = 0;
+	// dimensions may have changed since last run (e.g. in 'auto' mode)
+	DeallocateSolveWorkspaces();
+
+	// SAFENEW_ARRAY_NOMEM_RET(TYPE, VAR, LEN)
+	SAFENEW_ARRAY_NOMEM_RET(CSolveWorkspace, m_pclsSolveWs, wsNum)
+	m_uiSolveWsNum = wsNum;
+
+	for(k=0; k<wsNum; k++) {
+		ws = &m_pclsSolveWs[k];
+
+		// SAFENEW_ARRAY_NOMEM_RET(TYPE, VAR, LEN)
+		SAFENEW_ARRAY_NOMEM_RET(CLin_Vector, ws->m_pclsQ, SOLVE_GMRES_ITER_MAX+1)
+		SAFENEW_ARRAY_NOMEM_RET(CLin_Vector, ws->m_pclsH, SOLVE_GMRES_ITER_MAX)
+		g_clsMemUsage.m_ulGmresMem += (2*SOLVE_GMRES_ITER_MAX+1) * sizeof(CLin_Vector);
+
+		// init first and second element of q, and first element of h
+		ret = ws->m_pclsQ[0].newsize(numElems);
+		ret = ret && ws->m_pclsQ[1].newsize(numElems);
+		ret = ret && ws->m_pclsH[0].newsize(2);
+		// g, z, c, s vectors
+		ret = ret && ws->m_clsG.newsize(numElems+1);
+		ret = ret && ws->m_clsZ.newsize(numElems+1);
+		ret = ret && ws->m_clsC.newsize(numElems);
+		ret = ret && ws->m_clsS.newsize(numElems);
+		// v, w, y, r, Pq, x0 vectors, excitation and solution
+		ret = ret && ws->m_clsV.newsize(numElems);
+		ret = ret && ws->m_clsW.newsize(numElems);
+		ret = ret && ws->m_clsY.newsize(numElems);
+		ret = ret && ws->m_clsR.newsize(numElems);
+		ret = ret && ws->m_clsPq.newsize(numElems);
+		ret = ret && ws->m_clsX0.newsize(numElems);
+		ret = ret && ws->m_clsPotential.newsize(numElems);
+		ret = ret && ws->m_clsCharge.newsize(numElems);
+		if(ret == false) {
+			return FC_OUT_OF_MEMORY;
+		}
+		g_clsMemUsage.m_ulGmresMem += (14 * numElems + 4) * sizeof(double);
+
+		ws->m_uiPrealloc = 0;
+
+		// node charges and potentials of the hierarchical multiplication
+		if(m_clsMulthier.AllocateWorkspace(&ws->m_clsMultWs) != FC_NORMAL_END) {
+			return FC_OUT_OF_MEMORY;
+		}
+	}
+
+	return FC_NORMAL_END;
 }
 
-void CSolveCap::DeallocatePrecond()
+void CSolveCap::DeallocateSolveWorkspaces()
 {
-	// used in super and hierarchical preconditioner
+	if(m_pclsSolveWs != NULL) {
+		delete []m_pclsSolveWs;
+		m_pclsSolveWs = NULL;
+	}
+	m_uiSolveWsNum = 0;
+}
+
+// Number of conductor excitations solved concurrently by SolveConcurrent(),
+// or 1 if the excitations must be solved one at a time
+unsigned int CSolveCap::GetConcurrentSolves()
+{
+	unsigned int solvesNum;
 
-	if(m_pclsSupPrecondMtx != NULL) {
-		delete [] m_pclsSupPrecondMtx;
-		m_pclsSupPrecondMtx = NULL;
+	// the flex gmres versions are not re-entrant (the hierarchical preconditioner
+	// also switches the interaction level of the links)
+	if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_HIER) != 0 ||
+	        ((m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_BLOCK) != 0  &&
+	         (m_clsGlobalVars.m_ucPrecondType & ~(AUTOREFINE_PRECOND_BLOCK)) != 0) ) {
+		return 1;
 	}
-	if(m_pclsSupPotMtx != NULL) {
-		delete [] m_pclsSupPotMtx;
-		m_pclsSupPotMtx = NULL;
+	// the multigrid preconditioner multiplies by the potential matrix
+	// through the shared hierarchical multiplication buffers
+	if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_MG) != 0) {
+		return 1;
 	}
-	if(m_clsSupPrecondElements != NULL) {
-		delete m_clsSupPrecondElements;
-		m_clsSupPrecondElements = NULL;
+	// the block gmres already shares the links among the excitations
+	if(GetGmresBlockSize() > 1) {
+		return 1;
 	}
-	if(m_puiSupPrecondIndex != NULL) {
-		delete m_puiSupPrecondIndex;
-		m_puiSupPrecondIndex = NULL;
+	// recycling needs the solution of the previous conductor
+	if(GetRecycleNum() > 0) {
+		return 1;
 	}
-	if(m_pfSupPrecondAreae != NULL) {
-		delete m_pfSupPrecondAreae;
-		m_pfSupPrecondAreae = NULL;
+	// the workspace gmres does not restart, so the memory would not be bounded
+	// by the restart size (remark: the warm start is not used either, see Run())
+	if(GetGmresRestart() < SOLVE_GMRES_ITER_MAX) {
+		return 1;
+	}
+	// out-of-core links are loaded in turn into the same arrays, so there can
+	// be only one multiplication at a time
+	if(m_clsMulthier.IsOutOfCore() == true) {
+		return 1;
 	}
 
+	solvesNum = m_clsGlobalVars.m_uiConcurrentSolves;
+	// no need for more solves than conductors, or than threads
+	if(solvesNum > (unsigned int)m_clsMulthier.m_lCondNum) {
+		solvesNum = (unsigned int)m_clsMulthier.m_lCondNum;
+	}
+	if(solvesNum > (unsigned int)omp_get_max_threads()) {
+		solvesNum = (unsigned int)omp_get_max_threads();
+	}
+	if(solvesNum < 1) {
+		solvesNum = 1;
+	}
 
-	// used in block preconditioner
+	return solvesNum;
+}
 
-	if(m_clsBlockPrecondElements != NULL) {
-		delete m_clsBlockPrecondElements;
-		m_clsBlockPrecondElements = NULL;
+// Number of vectors recycled from one conductor solve to the next by
+// gmresPrecondSFastAll(), or 0 if not recycling
+unsigned int CSolveCap::GetRecycleNum()
+{
+	unsigned int recycleNum;
+
+	// only the plain gmres version recycles (the flex version changes the
+	// preconditioner at every iteration, so A*P*u would not hold)
+	if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_HIER) != 0 ||
+	        ((m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_BLOCK) != 0  &&
+	         (m_clsGlobalVars.m_ucPrecondType & ~(AUTOREFINE_PRECOND_BLOCK)) != 0) ) {
+		return 0;
 	}
-	if(m_pdBlockPrecond != NULL) {
-		delete [] m_pdBlockPrecond;
-		m_pdBlockPrecond = NULL;
+	// the block gmres solves the excitations together
+	if(GetGmresBlockSize() > 1) {
+		return 0;
 	}
-	if(m_pucBlockPrecondDim != NULL) {
-		delete m_pucBlockPrecondDim;
-		m_pucBlockPrecondDim = NULL;
+	// the conjugate gradient has no Krylov basis
+	if(UsePcg() == true) {
+		return 0;
+	}
+
+	recycleNum = m_clsGlobalVars.m_uiGmresRecycleNum;
+	// the last conductor solve does not add any vector
+	if(m_clsMulthier.m_lCondNum < 2) {
+		recycleNum = 0;
+	}
+	else if(recycleNum > (unsigned int)m_clsMulthier.m_lCondNum - 1) {
+		recycleNum = (unsigned int)m_clsMulthier.m_lCondNum - 1;
 	}
 
+	return recycleNum;
 }
 
-// recursively count panels and build super preconditioner
-void CSolveCap::RecurseComputePrecond(CAutoElement* element)
+// Whether the conductor excitations are solved with the flex gmres version, needed by the
+// hierarchical preconditioner and by the block preconditioner applied in turn with other ones
+bool CSolveCap::UseFlexGmres()
 {
-	InteractionC3DList::iterator iti;
-	bool calculateBlock;
+	if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_HIER) != 0 ||
+	        ((m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_BLOCK) != 0  &&
+	         (m_clsGlobalVars.m_ucPrecondType & ~(AUTOREFINE_PRECOND_BLOCK)) != 0) ) {
+		return true;
+	}
 
-	m_iLevel++;
+	return false;
+}
 
-	// only if using Block precond
-	calculateBlock = false;
-	if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_BLOCK) != 0 ) {
+// Whether the conductor excitations are solved with the preconditioned conjugate gradient
+// instead of gmres. This needs a symmetric positive definite system, that is the Galerkin
+// scheme (symmetric coefficients of potential) with only conductors (the dielectric panels
+// have rows imposing the continuity of the normal field, which are not symmetric), and a
+// symmetric preconditioner (Jacobi or two-levels, the block and the hierarchical ones are
+// applied in turn with other preconditioners or through an inner gmres)
+bool CSolveCap::UsePcg()
+{
+	if(m_bPcgBreakdown == true) {
+		return false;
+	}
+	if(m_clsGlobalVars.m_cScheme != AUTOREFINE_GALERKIN || m_clsGlobalVars.m_ucHasCmplxPerm != AUTOREFINE_REAL_PERM) {
+		return false;
+	}
+	if(m_clsMulthier.m_lDielNum != 0) {
+		return false;
+	}
+	if(m_clsGlobalVars.m_ucPrecondType != AUTOREFINE_PRECOND_NONE && m_clsGlobalVars.m_ucPrecondType != AUTOREFINE_PRECOND_JACOBI &&
+	        m_clsGlobalVars.m_ucPrecondType != AUTOREFINE_PRECOND_SUPER) {
+		return false;
+	}
 
-		// if we have reached the right depth, or if from the start
-		// there is not enough depth, reset element pointer array
-		if(element->m_lNumOfChildren <= m_clsGlobalVars.m_uiBlockPreSize &&
-		        m_bIsComputingBlock == false) {
+	return true;
+}
 
-			m_uiBlockPreNum = 0;
-			m_bIsComputingBlock = true;
-			calculateBlock = true;
-		}
+// Number of Arnoldi steps after which gmresPrecondSFastAll() restarts,
+// i.e. max number of Krylov vectors kept in memory (but for the first one)
+unsigned int CSolveCap::GetGmresRestart()
+{
+	if(m_clsGlobalVars.m_uiGmresRestart > 0 && m_clsGlobalVars.m_uiGmresRestart < SOLVE_GMRES_ITER_MAX) {
+		return m_clsGlobalVars.m_uiGmresRestart;
+	}
+	// with a memory budget, the Krylov vectors must fit in the memory set aside for them (see EstimateSolveMemory())
+	else if(m_clsGlobalVars.m_dMemBudget > 0.0) {
+		return SOLVE_GMRES_PLAN_ITER;
 	}
+	else {
+		return SOLVE_GMRES_ITER_MAX;
+	}
+}
 
-	if(element->IsLeaf() == true) {
+// pre-allocate the recycled space, 'vecNum' vectors 'u' and 'c' of 'numElems' elements
+int CSolveCap::AllocateRecycledSpace(unsigned int vecNum, unsigned long numElems)
+{
+	unsigned int k;
+	bool ret;
 
-		// compute Jacobi preconditioner
-//		if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_JACOBI) != 0 ) {
-//
-// old, when Jacobi precond was not calculated on the spot, and there was no dedicated array for self-potential
-//			// self potential is always the first one, see RefineSelf()
-//			m_clsJacPrecond[m_ulPanelNum] = 1 / m_clsMulthier.GetAutoPotCoeff(element);
-//
-// older
-//			for(iti = element->m_stlInteractions[m_clsMulthier.GetInteractionLevel()].begin(); iti != element->m_stlInteractions[m_clsMulthier.GetInteractionLevel()].end(); iti++) {
-//				if( (*iti).m_clsPanel == element ) {
-//					m_clsJacPrecond[m_ulPanelNum] = 1 / (*iti).m_dPotCoeff;
-//					break;
-//				}
-//			}
-//		}
+	// dimensions may have changed since last run (e.g. in 'auto' mode)
+	DeallocateRecycledSpace();
 
-		// only if using Block precond, store current leaf element in the block precond elements array
-		if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_BLOCK) != 0 ) {
-			m_clsBlockPrecondElements[m_uiBlockPreNum] = (CAutoPanel*)element;
-			m_uiBlockPreNum++;
-		}
+	// SAFENEW_ARRAY_NOMEM_RET(TYPE, VAR, LEN)
+	SAFENEW_ARRAY_NOMEM_RET(CLin_Vector, m_pclsRecycle_u, vecNum)
+	// SAFENEW_ARRAY_NOMEM_RET(TYPE, VAR, LEN)
+	SAFENEW_ARRAY_NOMEM_RET(CLin_Vector, m_pclsRecycle_c, vecNum)
+	// SAFENEW_ARRAY_NOMEM_RET(TYPE, VAR, LEN)
+	SAFENEW_ARRAY_NOMEM_RET(CLin_Vector, m_pclsRecycle_B, vecNum)
+	g_clsMemUsage.m_ulGmresMem += 3 * vecNum * sizeof(CLin_Vector);
 
-		// only if using Super precond
-		if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_SUPER) != 0) {
+	for(k=0, ret=true; k<vecNum; k++) {
+		ret = ret && m_pclsRecycle_u[k].newsize(numElems);
+		ret = ret && m_pclsRecycle_c[k].newsize(numElems);
+		ret = ret && m_pclsRecycle_B[k].newsize(SOLVE_GMRES_ITER_MAX);
+	}
+	ret = ret && m_clsRecycle_a.newsize(vecNum);
+	if(ret == false) {
+		return FC_OUT_OF_MEMORY;
+	}
+	g_clsMemUsage.m_ulGmresMem += (vecNum * (2 * numElems + SOLVE_GMRES_ITER_MAX + 1)) * sizeof(double);
 
-			// if in this branch there is no depth enough, use leaf for preconditioner
-			if(m_iLevel <= (int)m_uiSupPreLevel) {
-				// hi level preconditioner elements array
-				m_clsSupPrecondElements[m_uiSupPreNum].m_pclsHiLevLeaf = element;
-//				m_clsSupPrecondElements[m_uiSupPreNum].m_lLoLevLeavesNum = 1;
-				m_clsSupPrecondElements[m_uiSupPreNum].m_pCond = m_pCurrCond;
-				// leaf pointer to hi level preconditioner element
-				m_puiSupPrecondIndex[m_ulPanelNum] = m_uiSupPreNum;
-				IncrementSupPreNum();
-			}
-			// otherwise, just record pointer from leaf to hi level preconditioner element
-			// and increment count of leaves under that hi level preconditioner element
-			else {
-				m_puiSupPrecondIndex[m_ulPanelNum] = m_ulTmpSupPreIndex;
-				m_ulSupPreNumOfLeaves++;
-			}
+	m_uiRecycleNum = vecNum;
+	m_uiRecycleCur = 0;
+	m_uiRecycleNext = 0;
 
-			// and copy the area
-			if(g_ucSolverType == SOLVERGLOBAL_3DSOLVER) {
-				m_pfSupPrecondAreae[m_ulPanelNum] = ((CAutoPanel*)element)->GetArea();
-			}
-			else {
-				m_pfSupPrecondAreae[m_ulPanelNum] = ((CAutoSegment*)element)->GetLength();
-			}
-		}
+	return FC_NORMAL_END;
+}
 
-		m_ulPanelNum++;
+void CSolveCap::DeallocateRecycledSpace()
+{
+	if(m_pclsRecycle_u != NULL) {
+		delete []m_pclsRecycle_u;
+		m_pclsRecycle_u = NULL;
+	}
+	if(m_pclsRecycle_c != NULL) {
+		delete []m_pclsRecycle_c;
+		m_pclsRecycle_c = NULL;
+	}
+	if(m_pclsRecycle_B != NULL) {
+		delete []m_pclsRecycle_B;
+		m_pclsRecycle_B = NULL;
+	}
+	m_clsRecycle_a.destroy();
+	m_uiRecycleNum = 0;
+	m_uiRecycleCur = 0;
+	m_uiRecycleNext = 0;
+}
+
+// Add to the recycled space the correction found by the last gmresPrecondSFastAll() call,
+// i.e. the vector 'y' such that x = x0 + P*y ('m_clsGmres_y' and 'm_clsGmres_x0'), and
+// 'x' is the solution. The vectors 'u' = y and 'c' = A*P*y are orthonormalized, as for 'c',
+// against the vectors already in the space, so all the 'c' vectors stay orthonormal and
+// A*P*u = c holds for each pair. When the space is full, the oldest pair is replaced.
+//
+// The corrections of the previous conductor solves span the components of the solution
+// that the preconditioned Krylov space is slow to build; projecting the initial residual
+// of the next solve on them, and keeping the new Krylov vectors orthogonal to them
+// (GCRO-like augmentation, see gmresPrecondSFastAll()), removes these components
+// from the iteration
+int CSolveCap::UpdateRecycledSpace(CLin_Vector *x)
+{
+	unsigned int j, slot;
+	long k, size;
+	double proj, normc, normc0;
+	int retInt;
+
+	size = x->size();
+
+	// P*y is already known, being x - x0 (x0 being the start of the last restart cycle)
+	for(k=0; k<size; k++) {
+		m_clsGmres_Pq[k] = (*x)[k] - m_clsGmres_x0[k];
 	}
-	// else, element is not a leaf
-	else {
-		// only if using Super precond
-		if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_SUPER) != 0 ) {
 
-			// if correct depth for super preconditioner
-			if(m_iLevel == (int)m_uiSupPreLevel) {
-				// initialize count of number of subtended leaves
-				m_ulSupPreNumOfLeaves = 0;
-				// and remember what is the hi level preconditioner element
-				m_ulTmpSupPreIndex = m_uiSupPreNum;
-				// hi level preconditioner elements array
-				m_clsSupPrecondElements[m_uiSupPreNum].m_pclsHiLevLeaf = element;
-				m_clsSupPrecondElements[m_uiSupPreNum].m_pCond = m_pCurrCond;
-			}
-		}
+	// c = A*P*y
+	retInt = m_clsMulthier.MultiplyMatByVec_fast(&m_clsGmres_v, &m_clsGmres_Pq);
+	if(retInt != FC_NORMAL_END) {
+		return retInt;
+	}
 
-		// if not a leaf element, go into left and right sub-trees
-		RecurseComputePrecond(element->m_pLeft);
-		RecurseComputePrecond(element->m_pRight);
+	normc0 = mod(m_clsGmres_v);
 
-		// only if using Block precond, store current leaf element in the block precond elements array
-		if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_BLOCK) != 0 && calculateBlock == true) {
-			m_bIsComputingBlock = false;
-			ComputeBlockPrecond();
+	// slot to be filled, i.e. the first free one or the oldest one
+	slot = m_uiRecycleNext;
+
+	// orthonormalize against the other vectors (modified Gram-Schmidt)
+	for(j=0; j<m_uiRecycleCur; j++) {
+		if(j == slot) {
+			continue;
 		}
+		proj = dot_prod(m_pclsRecycle_c[j], m_clsGmres_v);
+		for(k=0; k<size; k++) {
+			m_clsGmres_v[k] -= proj * m_pclsRecycle_c[j][k];
+			m_clsGmres_y[k] -= proj * m_pclsRecycle_u[j][k];
+		}
+	}
 
-		// only if using Super precond or Hier precond and Super precond can be used to accelerate iterations
-		if(m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_SUPER) {
+	normc = mod(m_clsGmres_v);
+	// if the new vector is (numerically) already in the space, nothing to add
+	if(normc <= SOLVE_GMRES_RECYCLE_EPS * normc0) {
+		return FC_NORMAL_END;
+	}
 
-			// if correct depth for super preconditioner
-			if(m_iLevel == (int)m_uiSupPreLevel) {
-				// store number of leaves
-//				m_clsSupPrecondElements[m_uiSupPreNum].m_lLoLevLeavesNum = m_ulSupPreNumOfLeaves;
-				IncrementSupPreNum();
-			}
-		}
+	for(k=0; k<size; k++) {
+		m_pclsRecycle_c[slot][k] = m_clsGmres_v[k] / normc;
+		m_pclsRecycle_u[slot][k] = m_clsGmres_y[k] / normc;
 	}
 
-	m_iLevel--;
+	if(m_uiRecycleCur < m_uiRecycleNum) {
+		m_uiRecycleCur++;
+	}
+	m_uiRecycleNext = (slot + 1) % m_uiRecycleNum;
+
+	return FC_NORMAL_END;
 }
 
-// safe function to increment m_uiSupPreNum
-void CSolveCap::IncrementSupPreNum()
+// Add to 'm_clsGmres_y' the component in the recycled space of the correction found by
+// gmresPrecondSFastAll(). Since A*P*Q = C*B + Q*H, where Q are the Krylov vectors and B the
+// projections on the 'c' vectors stored at each Arnoldi step, the correction
+// y = Q*z + U*(a - B*z) leaves the same residual as the Krylov space alone, with 'z'
+// the solution of the least squares problem after the 'iteration'-th step (-1 if none)
+void CSolveCap::ApplyRecycledCorrection(long iteration)
 {
-	if(m_uiSupPreNum < SOLVE_MAX_SUPER_PRECOND_NUM) {
-		m_uiSupPreNum++;
-	}
-	else {
-		ErrMsg("Internal error: number of two-levels preconditioner elements greater than %i\nReverting to Jacobi preconditioner\n", SOLVE_MAX_SUPER_PRECOND_NUM);
-		m_clsGlobalVars.m_ucPrecondType = AUTOREFINE_PRECOND_JACOBI;
+	long j, k, l, size;
+	double coeff;
+
+	size = m_pclsRecycle_u[0].size();
+
+	for(j=0; j<(long)m_uiRecycleCur; j++) {
+		coeff = m_clsRecycle_a[j];
+		for(l=0; l<=iteration; l++) {
+			coeff -= m_pclsRecycle_B[j][l] * m_clsGmres_z[l];
+		}
+		for(k=0; k<size; k++) {
+			m_clsGmres_y[k] += coeff * m_pclsRecycle_u[j][k];
+		}
 	}
 }
 
-void CSolveCap::ComputeSuperPrecond()
+void CSolveCap::DeallocateWarmStart()
 {
-	unsigned int i, j;
-	int isPotValid;
-	double potestim1, potestim2;
+	if(m_pclsWarmCharges != NULL) {
+		delete []m_pclsWarmCharges;
+		m_pclsWarmCharges = NULL;
+	}
+	if(m_pucWarmIsLeaf != NULL) {
+		delete []m_pucWarmIsLeaf;
+		m_pucWarmIsLeaf = NULL;
+	}
+	if(m_pulWarmLeafIndex != NULL) {
+		delete []m_pulWarmLeafIndex;
+		m_pulWarmLeafIndex = NULL;
+	}
+	if(m_pdWarmLeafDim != NULL) {
+		delete []m_pdWarmLeafDim;
+		m_pdWarmLeafDim = NULL;
+	}
+	m_clsWarmX0.destroy();
+	m_ulWarmNodeNum = 0;
+	m_ulWarmLeafNum = 0;
+	m_ulWarmCondNum = 0;
+	m_bWarmStart = false;
+	m_bWarmValid = false;
+}
 
-	// compute super potential matrix
-	for(i = 0; i < m_uiSupPreNum; i++) {
-		for(j = i; j < m_uiSupPreNum; j++) {
-			// if self potential
-			if( i == j ) {
-				m_clsMulthier.SetCurrentConductor(m_clsSupPrecondElements[i].m_pCond);
-				if(g_ucSolverType == SOLVERGLOBAL_3DSOLVER) {
-					m_clsMulthier.SelfPotential((CAutoPanel*)(m_clsSupPrecondElements[i].m_pclsHiLevLeaf), &potestim1, &potestim2);
-				}
-				else {
-					m_clsMulthier.SelfPotential((CAutoSegment*)(m_clsSupPrecondElements[i].m_pclsHiLevLeaf), &potestim1, &potestim2);
-				}
-				// store only the real part; the super preconditioner in case of complex capacitance matrix
-				// will be used to precondition only the real part of the potential matrix, since this is
-				// the one compressed with the hierarchical method
-				m_pclsSupPotMtx[i][i] = potestim1;
-			}
-			else {
-				if(g_ucSolverType == SOLVERGLOBAL_3DSOLVER) {
-					isPotValid = m_clsMulthier.PotEstimateOpt((CAutoPanel*)(m_clsSupPrecondElements[i].m_pclsHiLevLeaf), (CAutoPanel*)(m_clsSupPrecondElements[j].m_pclsHiLevLeaf), potestim1, potestim2, AUTOREFINE_PRECOND_SUPER);
-				}
-				else {
-					isPotValid = m_clsMulthier.PotEstimateOpt((CAutoSegment*)(m_clsSupPrecondElements[i].m_pclsHiLevLeaf), (CAutoSegment*)(m_clsSupPrecondElements[j].m_pclsHiLevLeaf), potestim1, potestim2, AUTOREFINE_PRECOND_SUPER);
-				}
+// Record the current panel trees, whose leaves hold the charges kept by StoreCondCharge(),
+// so that at the next auto-refinement iteration ProlongWarmCharge() can map these charges
+// onto the new, refined trees. Must be called before the trees are deleted.
+int CSolveCap::SaveWarmStartTree()
+{
+	StlAutoCondDeque::iterator itc;
+	unsigned long panelNum;
 
-				// if real error while calculating the precond
-				if(isPotValid != AUTOREFINE_NO_ERROR) {
-					ErrMsg("Error: invalid potential calculation during two-levels preconditioner calculation\n");
-					ErrMsg("       Removing the pre-conditioner and continuing\n");
-					m_clsGlobalVars.m_ucPrecondType &= (~AUTOREFINE_PRECOND_SUPER);
-					DeallocatePrecond();
-					return;
-				}
+	// until the record is complete, there is no valid warm start
+	m_bWarmValid = false;
 
-				// if problems calculating the precond, and in automatic mode, prevent usage of the preconditioner
-				if(	m_clsMulthier.m_clsGlobalVars.m_bWarnGivenPre == true && m_clsGlobalVars.m_bAutoPrecond == true) {
-					ErrMsg("Warning: problems found when forming the two-levels preconditioner in automatic preconditioner mode\n");
-					ErrMsg("         Moving to Jacobi pre-conditioner, to avoid possible worst convergence of GMRES, and continuing\n");
-					m_clsGlobalVars.m_ucPrecondType = AUTOREFINE_PRECOND_JACOBI;
-					DeallocatePrecond();
-					return;
-				}
+	if(m_bWarmStart == false || m_pclsWarmCharges == NULL) {
+		return FC_NORMAL_END;
+	}
 
-				m_pclsSupPotMtx[i][j] = potestim1;
-				m_pclsSupPotMtx[j][i] = potestim2;
-			}
-		}
+	if(m_pucWarmIsLeaf != NULL) {
+		delete []m_pucWarmIsLeaf;
+		m_pucWarmIsLeaf = NULL;
+	}
+	if(m_pulWarmLeafIndex != NULL) {
+		delete []m_pulWarmLeafIndex;
+		m_pulWarmLeafIndex = NULL;
+	}
+	if(m_pdWarmLeafDim != NULL) {
+		delete []m_pdWarmLeafDim;
+		m_pdWarmLeafDim = NULL;
 	}
 
-	// then invert it
-	//
+	panelNum = m_clsMulthier.GetPanelNum(AUTOREFINE_HIER_PRE_0_LEVEL);
 
-	InvertMatrix(m_pclsSupPotMtx, m_pclsSupPrecondMtx, m_uiSupPreNum);
-}
+	// the trees are binary, so there are less than two nodes for each leaf
+	// SAFENEW_ARRAY_NOMEM_RET(TYPE, VAR, LEN)
+	SAFENEW_ARRAY_NOMEM_RET(unsigned char, m_pucWarmIsLeaf, 2 * panelNum)
+	// SAFENEW_ARRAY_NOMEM_RET(TYPE, VAR, LEN)
+	SAFENEW_ARRAY_NOMEM_RET(unsigned long, m_pulWarmLeafIndex, panelNum)
+	// SAFENEW_ARRAY_NOMEM_RET(TYPE, VAR, LEN)
+	SAFENEW_ARRAY_NOMEM_RET(double, m_pdWarmLeafDim, panelNum)
 
-void CSolveCap::ComputeBlockPrecond()
-{
-	unsigned int i, j;
-	int isPotValid;
-	double potestim1, potestim2;
+	m_ulWarmNodeNum = 2 * panelNum;
+	m_ulWarmLeafNum = panelNum;
+	m_ulWarmNodePos = 0;
+	m_ulWarmLeafPos = 0;
+	for(itc = m_clsMulthier.m_stlConductors.begin(); itc != m_clsMulthier.m_stlConductors.end(); itc++) {
+		RecordWarmStartTree((*itc)->m_uTopElement.m_pTopElement);
+	}
 
-	ASSERT(m_uiBlockPreNum <= m_clsGlobalVars.m_uiBlockPreSize);
+	ASSERT(m_ulWarmLeafPos == panelNum);
 
-	for(i=0; i < m_uiBlockPreNum; i++) {
-		for(j = i; j < m_uiBlockPreNum; j++) {
-			// if self potential
-			if( i == j ) {
-				m_clsMulthier.SelfPotential(m_clsBlockPrecondElements[i], &potestim1, &potestim2);
-				// store only the real part; the super preconditioner in case of complex capacitance matrix
-				// will be used to precondition only the real part of the potential matrix, since this is
-				// the one compressed with the hierarchical method
-				m_pclsSupPotMtx[i][i] = potestim1;
-			}
-			else {
-				isPotValid = m_clsMulthier.PotEstimateOpt(m_clsBlockPrecondElements[i], m_clsBlockPrecondElements[j], potestim1, potestim2, AUTOREFINE_PRECOND_BLOCK);
+	m_ulWarmNodeNum = m_ulWarmNodePos;
+	m_ulWarmCondNum = m_clsMulthier.m_stlConductors.size();
+	m_bWarmValid = (m_ulWarmLeafPos == panelNum);
 
-				if(isPotValid != AUTOREFINE_NO_ERROR) {
-					ErrMsg("Error: invalid potential calculation during two-levels preconditioner calculation\n");
-					ErrMsg("       Efficiency of the preconditioner may be impacted\n");
-				}
+	return FC_NORMAL_END;
+}
 
-				m_pclsSupPotMtx[i][j] = potestim1;
-				m_pclsSupPotMtx[j][i] = potestim2;
-			}
-		}
+void CSolveCap::RecordWarmStartTree(CAutoElement *panel)
+{
+	// stop if the trees are not what expected
+	if(m_ulWarmNodePos >= m_ulWarmNodeNum) {
+		return;
 	}
 
-	InvertMatrix(m_pclsSupPotMtx, m_pclsTmpCapMtx, m_uiBlockPreNum);
+	if(panel->IsLeaf() == true) {
+		m_pucWarmIsLeaf[m_ulWarmNodePos++] = 1;
 
-	// store block dimension for preconditioner usage
-	m_pucBlockPrecondDim[m_ulBlockPreBaseNum] = (unsigned char) m_uiBlockPreNum;
-	// copy inverted matrix into preconditioner block
-	for(i=0; i < m_uiBlockPreNum; i++) {
-		for(j=0; j < m_uiBlockPreNum; j++) {
-			m_pdBlockPrecond[m_ulBlockPreBaseNum + i][j] = m_pclsTmpCapMtx[i][j];
+		if(m_ulWarmLeafPos < m_ulWarmLeafNum) {
+			m_pulWarmLeafIndex[m_ulWarmLeafPos] = (unsigned long)panel->m_lIndex[AUTOREFINE_HIER_PRE_0_LEVEL];
+			m_pdWarmLeafDim[m_ulWarmLeafPos] = panel->GetDimension();
+			m_ulWarmLeafPos++;
 		}
 	}
+	else {
+		m_pucWarmIsLeaf[m_ulWarmNodePos++] = 0;
 
-	// and position index to next block
-	m_ulBlockPreBaseNum += m_uiBlockPreNum;
+		RecordWarmStartTree(panel->m_pLeft);
+		RecordWarmStartTree(panel->m_pRight);
+	}
 }
 
-// REMARK: can invert matrices with up to 64k entries (max size is 'unsigned int')
-void CSolveCap::InvertMatrix(double (*matrix)[SOLVE_MAX_SUPER_PRECOND_NUM], double (*invMatrix)[SOLVE_MAX_SUPER_PRECOND_NUM], unsigned long size)
+// Build in 'x0' the initial vector for the conductor excitation at row 'caprow' of the
+// capacitance matrix, prolonging onto the current panel trees the charges of the same
+// excitation at the previous auto-refinement iteration.
+// The trees are rebuilt from the same input file at each iteration, and Subdivide() always
+// splits a panel in the same way, so walking the old and the new trees in the same order
+// visits corresponding elements. When an old leaf has been refined, its charge density
+// is spread over the new leaves; when a new leaf was refined further in the old tree
+// (not usual), it gets the sum of the old charges.
+// Returns false if there is no previous charge, or if the trees do not match
+bool CSolveCap::ProlongWarmCharge(unsigned long caprow, CLin_Vector *x0)
 {
-	unsigned int j, k, jp, ii, jj, ip;
-	int i, *indx;
-	double t, sum, recp, *b;
-	bool flag;
+	StlAutoCondDeque::iterator itc;
+	unsigned long i, size;
 
-	indx = new int[size];
-	b = new double[size];
-
-	// algorithm taken from LinAlg
-	// LU factorization with pivoting; if mtx is not singular,
-	// LU factorization is always possible
+	if(m_bWarmValid == false || m_pclsWarmCharges == NULL) {
+		return false;
+	}
+	if(m_ulWarmCondNum != m_clsMulthier.m_stlConductors.size()) {
+		return false;
+	}
+	// previous charges not available for this excitation
+	if(m_pclsWarmCharges[caprow].size() == 0) {
+		return false;
+	}
 
-	// right-looking LU factorization algorithm (unblocked)
-	//
-	//   Factors matrix A into lower and upper  triangular matrices
-	//   (L and U respectively)
-	//
-	//
-	// A        (input/output) Matrix(1:n, 1:n)  In input, matrix to be
-	//                  factored.  On output, overwritten with lower and
-	//                  upper triangular factors.
-	//
-	// indx     (output) Vector(1:n)    Pivot vector. Describes how
-	//                  the rows of A were reordered to increase
-	//                  numerical stability.
-	//
-	for (j=0; j < size; j++) {
-		// find pivot in column j and test for singularity.
+	size = m_clsMulthier.GetPanelNum(AUTOREFINE_HIER_PRE_0_LEVEL);
+	if( m_clsGlobalVars.m_ucHasCmplxPerm != AUTOREFINE_REAL_PERM ) {
+		size *= 2;
+	}
+	if((unsigned long)x0->size() != size) {
+		if(x0->newsize(size) == false) {
+			return false;
+		}
+	}
+	for(i=0; i<size; i++) {
+		(*x0)[i] = 0.0;
+	}
 
-		jp = j;
-		t = fabs(matrix[j][j]);
-		for (i=j+1; i<(long)size; i++) {
-			if ( fabs(matrix[i][j]) > t) {
-				jp = i;
-				t = fabs(matrix[i][j]);
-			}
+	m_ulWarmNodePos = 0;
+	m_ulWarmLeafPos = 0;
+	for(itc = m_clsMulthier.m_stlConductors.begin(); itc != m_clsMulthier.m_stlConductors.end(); itc++) {
+		if(ProlongCharges((*itc)->m_uTopElement.m_pTopElement, &m_pclsWarmCharges[caprow], x0) == false) {
+			return false;
 		}
+	}
 
-		indx[j] = jp;
+	// the whole old trees must have been consumed
+	return (m_ulWarmNodePos == m_ulWarmNodeNum && m_ulWarmLeafPos == m_ulWarmLeafNum);
+}
 
-		// jp now has the index of maximum element
-		// of column j, below the diagonal
+bool CSolveCap::ProlongCharges(CAutoElement *panel, CLin_Vector *oldCharge, CLin_Vector *x0)
+{
+	unsigned long leaf, index, panelNum;
+	double densityRe, densityIm, chargeRe, chargeIm;
 
-		// factorization failed because of zero pivot
-		// TBC warning: maybe should add a real warning?
-		ASSERT( matrix[jp][j] != 0 );
+	if(m_ulWarmNodePos >= m_ulWarmNodeNum) {
+		return false;
+	}
 
-		// if pivot not already on the diagonal
-		if (jp != j) {
-			// swap rows j and jp
-			for (k=0; k<size; k++) {
-				t = matrix[j][k];
-				matrix[j][k] = matrix[jp][k];
-				matrix[jp][k] = t;
-			}
+	if(m_pucWarmIsLeaf[m_ulWarmNodePos] != 0) {
+		m_ulWarmNodePos++;
+		if(m_ulWarmLeafPos >= m_ulWarmLeafNum) {
+			return false;
 		}
+		leaf = m_ulWarmLeafPos++;
 
-		// divide elements j+1:panelNum of jth column by pivot element
-		// (for the first panelNum-1 cols, last col's below-the-diagonal element
-		// is already the pivot)
-		if (j < size - 1) {
-			// note that potentialMtx(j,j) was previously potentialMtx(jp,p), which was
-			// guaranteed not to be zero
-			recp =  1.0 / matrix[j][j];
-
-			for (k=j+1; k<size; k++)
-				matrix[k][j] *= recp;
+		// spread the charge density of the old leaf on the new elements it was refined into
+		index = m_pulWarmLeafIndex[leaf];
+		densityRe = (*oldCharge)[index] / m_pdWarmLeafDim[leaf];
+		if( m_clsGlobalVars.m_ucHasCmplxPerm != AUTOREFINE_REAL_PERM ) {
+			densityIm = (*oldCharge)[index + m_ulWarmLeafNum] / m_pdWarmLeafDim[leaf];
 		}
-
-
-		if (j < size - 1) {
-			// rank-1 update to trailing submatrix:   E = E - x*y;
-			//
-			// E is the region potentialMtx(j+1:M, j+1:N)
-			// x is the column vector potentialMtx(j+1:M,j)
-			// y is row vector potentialMtx(j,j+1:N)
-
-			for (ii=j+1; ii<size; ii++)
-				for (jj=j+1; jj<size; jj++)
-					matrix[ii][jj] -= matrix[ii][j]*matrix[j][jj];
+		else {
+			densityIm = 0.0;
 		}
-	}
+		DistributeCharge(panel, densityRe, densityIm, x0);
 
-	// now we have the LU factors of 'potentialMtx', stored in-place in 'potentialMtx'.
-	// So we compute inv(potentialMtx) from the LU factors.
-	//
-	// Remark: to get results in the correct order, must remember pivot vector
-	// 'indx', which stores rows permutation
+		return true;
+	}
 
-	for(k=0; k<size; k++) {
+	m_ulWarmNodePos++;
 
-		// compute b vector
-		for (i=0; i<(long)size; i++) {
-			b[i] = 0.0;
+	if(panel->IsLeaf() == true) {
+		// the old element was refined further: collect the old charges
+		chargeRe = 0.0;
+		chargeIm = 0.0;
+		if(SumOldCharges(oldCharge, &chargeRe, &chargeIm) == false) {
+			return false;
+		}
+		if(SumOldCharges(oldCharge, &chargeRe, &chargeIm) == false) {
+			return false;
+		}
+		index = (unsigned long)panel->m_lIndex[AUTOREFINE_HIER_PRE_0_LEVEL];
+		(*x0)[index] = chargeRe;
+		if( m_clsGlobalVars.m_ucHasCmplxPerm != AUTOREFINE_REAL_PERM ) {
+			panelNum = m_clsMulthier.GetPanelNum(AUTOREFINE_HIER_PRE_0_LEVEL);
+			(*x0)[index + panelNum] = chargeIm;
 		}
-		b[k] = 1.0;
 
-		// forward substitution
-		flag = false;
-		sum = 0.0;
+		return true;
+	}
 
-		for (i=0; i<(long)size; i++) {
-			ip = indx[i];
-			sum = b[ip];
-			b[ip] = b[i];
+	if(ProlongCharges(panel->m_pLeft, oldCharge, x0) == false) {
+		return false;
+	}
+	return ProlongCharges(panel->m_pRight, oldCharge, x0);
+}
 
-			if (flag) {
-				for (j=ii; j<=(unsigned long)(i-1); j++) {
-					sum -= matrix[i][j]*b[j];
-				}
-			}
-			else if(sum != 0.0) {
-				ii = i;
-				flag = true;
-			}
+// Sum the charges of the leaves of the old subtree at the current record position
+bool CSolveCap::SumOldCharges(CLin_Vector *oldCharge, double *chargeRe, double *chargeIm)
+{
+	unsigned long index;
 
-			b[i] = sum;
-		}
+	if(m_ulWarmNodePos >= m_ulWarmNodeNum) {
+		return false;
+	}
 
-		// backward substitution
-		for (i=size-1; i>=0; i--) {
-			sum=b[i];
-			for (j=i+1; j<size; j++) {
-				sum -= matrix[i][j]*b[j];
-			}
-			b[i] = sum/matrix[i][i];
+	if(m_pucWarmIsLeaf[m_ulWarmNodePos++] != 0) {
+		if(m_ulWarmLeafPos >= m_ulWarmLeafNum) {
+			return false;
 		}
-
-		// copy the column 'x' resulting from solving A*x = b ('x' is stored in-place in 'b' vector)
-		// into the precond matrix
-		for(i=0; i < (long)size; i++) {
-			_ASSERT(!isnan(b[i]));
-			_ASSERT(isfinite(b[i]));
-
-			invMatrix[i][k] = b[i];
+		index = m_pulWarmLeafIndex[m_ulWarmLeafPos++];
+		*chargeRe += (*oldCharge)[index];
+		if( m_clsGlobalVars.m_ucHasCmplxPerm != AUTOREFINE_REAL_PERM ) {
+			*chargeIm += (*oldCharge)[index + m_ulWarmLeafNum];
 		}
+		return true;
 	}
 
-	delete [] indx;
-	delete [] b;
+	if(SumOldCharges(oldCharge, chargeRe, chargeIm) == false) {
+		return false;
+	}
+	return SumOldCharges(oldCharge, chargeRe, chargeIm);
 }
 
-//   Generalized Minimum Residual Method with preconditioner
-//
-//   x = gmresPrecond(A,b,P) attempt to solve the preconditioned
-//   system A*P*y = b & x = P*y
-//
-//   Enrico Di Lorenzo, 2004/07/06
-//
-//   'fast' refers to the direct vector multiplication loops used
-//   instead of CLin_Vector class operator*, which requires
-//   the creation of a temp object for every assignment operation
-//
-//   the 's' on the other hand refers to the scilab gmres correction,
-//   to make convergence faster, that basically uses as residual
-//   a weighted residual: normr = || b - Ax || / || b ||, that is
-//   normr = fabs(g[i+1]) / normb;
-//   and not
-//   normr = fabs(g[i+1]);
-//   see also the notes inline about this choice
-//
-//   the 'all' refers to the increase of speed not allocating memory
-//   locally every time
-//
-//   This version has been modified to work with a complex potential matrix;
-//   this is not a general-purpose gmres dealing with complex values, but an optimized
-//   version that considers that the only imaginary parts are on the diagonal, and only
-//   for the rows corresponding to the dielectric panels. In this case, b and x have
-//   a length 2x the number of panels n, where the first n elements are the real parts,
-//   while the remaining n elements are the imaginary parts
-int CSolveCap::gmresPrecondSFastAll(CLin_Vector *b, CLin_Vector *x, double gmresTol)
+// Assign to the leaves of the subtree of 'panel' the charges corresponding to the given density
+void CSolveCap::DistributeCharge(CAutoElement *panel, double densityRe, double densityIm, CLin_Vector *x0)
 {
-	double normr, normb, tmp1, tmp2, length;
-	long i, j, iteration, size, k, ii;
-	bool ret;
-	int retInt;
-	CLin_Range bre, xre;
-
-	// get system size
-	size = b->size();
-	// check consistency of size
-	ASSERT(size == (long)(*x).size());
-
-	// if there is a preconditioner
-	if(m_clsGlobalVars.m_ucPrecondType != AUTOREFINE_PRECOND_NONE) {
-
-		// initial vector: having the approx inverted matrix, it is cheap to calculate the initial vector.
-		//  Simply put, to solve the preconditioned system
-		//  A * P * y = b and x = P * y, the best choice for y0 initial vector is b,
-		//  since a good P should be as similar as possible to inv(A), so A * P ~= I
-		//  So x0 = P * y0 = P * b
-		ComputePrecondVectFast(&m_clsGmres_x0, b, m_clsGlobalVars.m_ucPrecondType);
+	unsigned long index, panelNum;
 
-		// r = b - A * x0;
-		// matrix - vector multiplication
-		retInt = m_clsMulthier.MultiplyMatByVec_fast(&m_clsGmres_v, &m_clsGmres_x0);
-		if(retInt != FC_NORMAL_END) {
-			return retInt;
-		}
-		// and get r
-		//m_clsGmres_r = *b - m_clsGmres_v;
-		for(k=0; k<size; k++) {
-			m_clsGmres_r[k] = (*b)[k] - m_clsGmres_v[k];
+	if(panel->IsLeaf() == true) {
+		index = (unsigned long)panel->m_lIndex[AUTOREFINE_HIER_PRE_0_LEVEL];
+		(*x0)[index] = densityRe * panel->GetDimension();
+		if( m_clsGlobalVars.m_ucHasCmplxPerm != AUTOREFINE_REAL_PERM ) {
+			panelNum = m_clsMulthier.GetPanelNum(AUTOREFINE_HIER_PRE_0_LEVEL);
+			(*x0)[index + panelNum] = densityIm * panel->GetDimension();
 		}
-		normr = mod(m_clsGmres_r);
-		normb = mod(*b);
 	}
 	else {
-		// no preconditioner; assumes that initial vector x0 is an all zeros vector
-		//
-		m_clsGmres_r = *b;
-		normr = mod(m_clsGmres_r);
-		normb = normr;
-	}
-
-	// allocate and init first column of Q matrix
-	//m_pclsGmres_q[0] = m_clsGmres_r / normr;
-	for(k=0; k<size; k++) {
-		m_pclsGmres_q[0][k] = m_clsGmres_r[k] / normr;
+		DistributeCharge(panel->m_pLeft, densityRe, densityIm, x0);
+		DistributeCharge(panel->m_pRight, densityRe, densityIm, x0);
 	}
+}
 
-	// init first element of first row of the
-	// Q matrix of the QR factors of H; this should be 1,
-	// using normr will produce the first row
-	// multiplied by normr, which is used to compute the solution
-	// Remark: this is not the Q matrix whose columns are q(i,j)
-	m_clsGmres_g[0] = normr;
+// delete structures
+void CSolveCap::DeallocateMemory(int command, CAutoRefGlobalVars globalVars)
+{
+	// before cleaning the multiplication, since the workspaces also hold
+	// node arrays accounted in the hierarchical memory usage
+	DeallocateSolveWorkspaces();
 
-	//
-	// if the norm of the residual is small enough,
-	// initial vector is a good enough solution
-	//
-	if(normr / normb < gmresTol) {
-		if(m_clsGlobalVars.m_ucPrecondType == AUTOREFINE_PRECOND_NONE) {
-			*x = CLin_Vector(size, 0.0);
-		}
-		else {
-			*x = m_clsGmres_x0;
-		}
-		return FC_NORMAL_END;
+	// the warm start data must survive the end of each auto-refinement iteration
+	if(command == AUTOREFINE_DEALLMEM_ALL) {
+		DeallocateWarmStart();
 	}
 
-	LogMsg("GMRES Iteration: ");
+	// the copy would not match the links of the next iteration
+	m_clsMulthier.DeallocateSinglePrecLinks();
 
-	// start iteration
-	for(i = 0; i < SOLVE_GMRES_ITER_MAX && i < (long)size; i++) {
+	m_clsMulthier.Clean(command, globalVars);
+
+	if(m_pCondCharges != NULL) {
+		delete [] m_pCondCharges;
+		m_pCondCharges = NULL;
+	}
+
+	if(m_pclsGmres_q != NULL) {
+		delete []m_pclsGmres_q;
+		m_pclsGmres_q = NULL;
+	}
+	if(m_pclsGmres_h != NULL) {
+		delete []m_pclsGmres_h;
+		m_pclsGmres_h = NULL;
+	}
+	if(m_pclsGmres_zf != NULL) {
+		delete []m_pclsGmres_zf;
+		m_pclsGmres_zf = NULL;
+	}
+	if(m_pclsGmres1_q != NULL) {
+		delete []m_pclsGmres1_q;
+		m_pclsGmres1_q = NULL;
+	}
+	if(m_pclsGmres1_h != NULL) {
+		delete []m_pclsGmres1_h;
+		m_pclsGmres1_h = NULL;
+	}
+
+	DeallocatePrecond();
+	DeallocateBlockGmres();
+	DeallocateRecycledSpace();
+
+	m_clsGmres_g.destroy();
+	m_clsGmres_v.destroy();
+	m_clsGmres_w.destroy();
+	m_clsGmres_z.destroy();
+	m_clsGmres_y.destroy();
+	m_clsGmres_c.destroy();
+	m_clsGmres_s.destroy();
+	m_clsGmres_r.destroy();
+	m_clsGmres_Pq.destroy();
+	m_clsGmres_x0.destroy();
+	m_clsMixed_r.destroy();
+	m_clsMixed_d.destroy();
+
+	m_clsGmres1_g.destroy();
+	m_clsGmres1_v.destroy();
+	m_clsGmres1_w.destroy();
+	m_clsGmres1_z.destroy();
+	m_clsGmres1_y.destroy();
+	m_clsGmres1_c.destroy();
+	m_clsGmres1_s.destroy();
+	m_clsGmres1_r.destroy();
+	m_clsGmres1_Pq.destroy();
+	m_clsGmres1_x0.destroy();
+
+	g_clsMemUsage.m_ulGmresMem = 0;
+	g_clsMemUsage.m_ulPrecondMem = 0;
+}
+
+// delete the block gmres structures
+void CSolveCap::DeallocateBlockGmres()
+{
+	if(m_pclsBGmres_q != NULL) {
+		delete []m_pclsBGmres_q;
+		m_pclsBGmres_q = NULL;
+	}
+	if(m_pclsBGmres_h != NULL) {
+		delete []m_pclsBGmres_h;
+		m_pclsBGmres_h = NULL;
+	}
+	if(m_pclsBGmres_g != NULL) {
+		delete []m_pclsBGmres_g;
+		m_pclsBGmres_g = NULL;
+	}
+	if(m_pclsBGmres_c != NULL) {
+		delete []m_pclsBGmres_c;
+		m_pclsBGmres_c = NULL;
+	}
+	if(m_pclsBGmres_s != NULL) {
+		delete []m_pclsBGmres_s;
+		m_pclsBGmres_s = NULL;
+	}
+	if(m_pclsBGmres_x0 != NULL) {
+		delete []m_pclsBGmres_x0;
+		m_pclsBGmres_x0 = NULL;
+	}
+	if(m_pclsBGmres_b != NULL) {
+		delete []m_pclsBGmres_b;
+		m_pclsBGmres_b = NULL;
+	}
+	if(m_pclsBGmres_x != NULL) {
+		delete []m_pclsBGmres_x;
+		m_pclsBGmres_x = NULL;
+	}
+	if(m_pclsBGmres_Pq != NULL) {
+		delete []m_pclsBGmres_Pq;
+		m_pclsBGmres_Pq = NULL;
+	}
+	if(m_pclsBGmres_v != NULL) {
+		delete []m_pclsBGmres_v;
+		m_pclsBGmres_v = NULL;
+	}
+	if(m_plBGmresIter != NULL) {
+		delete []m_plBGmresIter;
+		m_plBGmresIter = NULL;
+	}
+	if(m_puiBGmresActive != NULL) {
+		delete []m_puiBGmresActive;
+		m_puiBGmresActive = NULL;
+	}
+	if(m_puiBGmresPrealloc != NULL) {
+		delete []m_puiBGmresPrealloc;
+		m_puiBGmresPrealloc = NULL;
+	}
+	m_clsBGmres_normr.destroy();
+	m_clsBGmres_normb.destroy();
+
+	m_uiBGmresVecNum = 0;
+}
+
+void CSolveCap::DeallocatePrecond()
+{
+	// used in super and hierarchical preconditioner
+
+	DeallocateSuperPrecond();
+
+
+	// used in block preconditioner
+
+	if(m_clsBlockPrecondElements != NULL) {
+		delete [] m_clsBlockPrecondElements;
+		m_clsBlockPrecondElements = NULL;
+	}
+	if(m_pulBlockPrecondBase != NULL) {
+		delete [] m_pulBlockPrecondBase;
+		m_pulBlockPrecondBase = NULL;
+	}
+	if(m_pdBlockPotMtx != NULL) {
+		delete [] m_pdBlockPotMtx;
+		m_pdBlockPotMtx = NULL;
+	}
+	if(m_plBlockPotPivot != NULL) {
+		delete [] m_plBlockPotPivot;
+		m_plBlockPotPivot = NULL;
+	}
+	if(m_pdBlockPrecond != NULL) {
+		delete [] m_pdBlockPrecond;
+		m_pdBlockPrecond = NULL;
+	}
+	if(m_pucBlockPrecondDim != NULL) {
+		delete [] m_pucBlockPrecondDim;
+		m_pucBlockPrecondDim = NULL;
+	}
+
+
+	// used in sparse approximate inverse preconditioner
+
+	if(m_pdSpaiPrecond != NULL) {
+		delete [] m_pdSpaiPrecond;
+		m_pdSpaiPrecond = NULL;
+	}
+	if(m_pulSpaiIndex != NULL) {
+		delete [] m_pulSpaiIndex;
+		m_pulSpaiIndex = NULL;
+	}
+	if(m_pucSpaiDim != NULL) {
+		delete [] m_pucSpaiDim;
+		m_pucSpaiDim = NULL;
+	}
+	if(m_pdSpaiPotMtx != NULL) {
+		delete [] m_pdSpaiPotMtx;
+		m_pdSpaiPotMtx = NULL;
+	}
+	if(m_plSpaiPotPivot != NULL) {
+		delete [] m_plSpaiPotPivot;
+		m_plSpaiPotPivot = NULL;
+	}
+	m_clsMulthier.DeallocateNearFieldMatrix();
+
+
+	// used in multigrid preconditioner
+
+	DeallocateMultigridPrecond();
+}
+
+// release the two-levels preconditioner only (the other preconditioners may still be in use)
+void CSolveCap::DeallocateSuperPrecond()
+{
+	if(m_pdSupPotMtx != NULL) {
+		delete [] m_pdSupPotMtx;
+		m_pdSupPotMtx = NULL;
+	}
+	if(m_plSupPotPivot != NULL) {
+		delete [] m_plSupPotPivot;
+		m_plSupPotPivot = NULL;
+	}
+	m_ulSupPotMtxDim = 0;
+	if(m_pdSupPrecondDiag != NULL) {
+		delete [] m_pdSupPrecondDiag;
+		m_pdSupPrecondDiag = NULL;
+	}
+	if(m_pdSupPrecondVect != NULL) {
+		delete [] m_pdSupPrecondVect;
+		m_pdSupPrecondVect = NULL;
+	}
+	if(m_clsSupPrecondElements != NULL) {
+		delete [] m_clsSupPrecondElements;
+		m_clsSupPrecondElements = NULL;
+	}
+	if(m_puiSupPrecondIndex != NULL) {
+		delete [] m_puiSupPrecondIndex;
+		m_puiSupPrecondIndex = NULL;
+	}
+	if(m_pfSupPrecondAreae != NULL) {
+		delete [] m_pfSupPrecondAreae;
+		m_pfSupPrecondAreae = NULL;
+	}
+}
+
+// recursively count panels and build super preconditioner
+void CSolveCap::RecurseComputePrecond(CAutoElement* element)
+{
+	InteractionC3DList::iterator iti;
+	bool calculateBlock;
+
+	m_iLevel++;
+
+	// only if using Block precond (also the smoother of the multigrid precond)
+	calculateBlock = false;
+	if( (m_clsGlobalVars.m_ucPrecondType & (AUTOREFINE_PRECOND_BLOCK | AUTOREFINE_PRECOND_MG)) != 0 ) {
+
+		// if we have reached the right depth, or if from the start
+		// there is not enough depth, reset element pointer array
+		if(element->m_lNumOfChildren <= m_clsGlobalVars.m_uiBlockPreSize &&
+		        m_bIsComputingBlock == false) {
+
+			m_uiBlockPreNum = 0;
+			m_bIsComputingBlock = true;
+			calculateBlock = true;
+		}
+	}
+
+	if(element->IsLeaf() == true) {
+
+		// compute Jacobi preconditioner
+//		if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_JACOBI) != 0 ) {
+//
+// old, when Jacobi precond was not calculated on the spot, and there was no dedicated array for self-potential
+//			// self potential is always the first one, see RefineSelf()
+//			m_clsJacPrecond[m_ulPanelNum] = 1 / m_clsMulthier.GetAutoPotCoeff(element);
+//
+// older
+//			for(iti = element->m_stlInteractions[m_clsMulthier.GetInteractionLevel()].begin(); iti != element->m_stlInteractions[m_clsMulthier.GetInteractionLevel()].end(); iti++) {
+//				if( (*iti).m_clsPanel == element ) {
+//					m_clsJacPrecond[m_ulPanelNum] = 1 / (*iti).m_dPotCoeff;
+//					break;
+//				}
+//			}
+//		}
+
+		// only if using Block precond, store current leaf element in the block precond elements array
+		if( (m_clsGlobalVars.m_ucPrecondType & (AUTOREFINE_PRECOND_BLOCK | AUTOREFINE_PRECOND_MG)) != 0 ) {
+			m_clsBlockPrecondElements[m_ulBlockPreBaseNum + m_uiBlockPreNum] = (CAutoPanel*)element;
+			m_uiBlockPreNum++;
+		}
+
+		// only if using Super precond
+		if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_SUPER) != 0) {
+
+			// if in this branch there is no depth enough, use leaf for preconditioner
+			if(m_iLevel <= (int)m_uiSupPreLevel) {
+				// hi level preconditioner elements array
+				m_clsSupPrecondElements[m_uiSupPreNum].m_pclsHiLevLeaf = element;
+//				m_clsSupPrecondElements[m_uiSupPreNum].m_lLoLevLeavesNum = 1;
+				m_clsSupPrecondElements[m_uiSupPreNum].m_pCond = m_pCurrCond;
+				// leaf pointer to hi level preconditioner element
+				m_puiSupPrecondIndex[m_ulPanelNum] = m_uiSupPreNum;
+				IncrementSupPreNum();
+			}
+			// otherwise, just record pointer from leaf to hi level preconditioner element
+			// and increment count of leaves under that hi level preconditioner element
+			else {
+				m_puiSupPrecondIndex[m_ulPanelNum] = m_ulTmpSupPreIndex;
+				m_ulSupPreNumOfLeaves++;
+			}
+
+			// and copy the area
+			if(g_ucSolverType == SOLVERGLOBAL_3DSOLVER) {
+				m_pfSupPrecondAreae[m_ulPanelNum] = ((CAutoPanel*)element)->GetArea();
+			}
+			else {
+				m_pfSupPrecondAreae[m_ulPanelNum] = ((CAutoSegment*)element)->GetLength();
+			}
+		}
+
+		m_ulPanelNum++;
+	}
+	// else, element is not a leaf
+	else {
+		// only if using Super precond
+		if( (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_SUPER) != 0 ) {
+
+			// if correct depth for super preconditioner
+			if(m_iLevel == (int)m_uiSupPreLevel) {
+				// initialize count of number of subtended leaves
+				m_ulSupPreNumOfLeaves = 0;
+				// and remember what is the hi level preconditioner element
+				m_ulTmpSupPreIndex = m_uiSupPreNum;
+				// hi level preconditioner elements array
+				m_clsSupPrecondElements[m_uiSupPreNum].m_pclsHiLevLeaf = element;
+				m_clsSupPrecondElements[m_uiSupPreNum].m_pCond = m_pCurrCond;
+			}
+		}
+
+		// if not a leaf element, go into left and right sub-trees
+		RecurseComputePrecond(element->m_pLeft);
+		RecurseComputePrecond(element->m_pRight);
+
+		// only if using Super precond or Hier precond and Super precond can be used to accelerate iterations
+		if(m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_SUPER) {
+
+			// if correct depth for super preconditioner
+			if(m_iLevel == (int)m_uiSupPreLevel) {
+				// store number of leaves
+//				m_clsSupPrecondElements[m_uiSupPreNum].m_lLoLevLeavesNum = m_ulSupPreNumOfLeaves;
+				IncrementSupPreNum();
+			}
+		}
+	}
+
+	// only if using Block precond, and if the block started from this element, close it;
+	// the blocks are computed all together, in parallel, by ComputeBlockPrecond()
+	if( (m_clsGlobalVars.m_ucPrecondType & (AUTOREFINE_PRECOND_BLOCK | AUTOREFINE_PRECOND_MG)) != 0 && calculateBlock == true) {
+		m_bIsComputingBlock = false;
+
+		ASSERT(m_uiBlockPreNum <= m_clsGlobalVars.m_uiBlockPreSize);
+
+		// store block position and dimension for preconditioner usage
+		m_pulBlockPrecondBase[m_ulBlockPrecondNum] = m_ulBlockPreBaseNum;
+		m_ulBlockPrecondNum++;
+		m_pucBlockPrecondDim[m_ulBlockPreBaseNum] = (unsigned char) m_uiBlockPreNum;
+		// and position index to next block
+		m_ulBlockPreBaseNum += m_uiBlockPreNum;
+	}
+
+	m_iLevel--;
+}
+
+// safe function to increment m_uiSupPreNum
+void CSolveCap::IncrementSupPreNum()
+{
+	if(m_uiSupPreNum < m_clsGlobalVars.m_uiSuperPreDim) {
+		m_uiSupPreNum++;
+	}
+	else {
+		ErrMsg("Internal error: number of two-levels preconditioner elements greater than %i\nReverting to Jacobi preconditioner\n", m_clsGlobalVars.m_uiSuperPreDim);
+		m_clsGlobalVars.m_ucPrecondType = AUTOREFINE_PRECOND_JACOBI;
+	}
+}
+
+void CSolveCap::ComputeSuperPrecond()
+{
+	long i, j, k, l, size;
+	int isPotValid;
+	double potestim1, potestim2, *col;
+	bool potError, potWarn, symmetric;
+
+	size = (long)m_uiSupPreNum;
+
+	// compute super potential matrix
+	//
+	// self potentials first; SelfPotential() needs the current conductor, which is shared,
+	// so they are computed sequentially (they are only 'size' anyway)
+	for(i = 0; i < size; i++) {
+		m_clsMulthier.SetCurrentConductor(m_clsSupPrecondElements[i].m_pCond);
+		if(g_ucSolverType == SOLVERGLOBAL_3DSOLVER) {
+			m_clsMulthier.SelfPotential((CAutoPanel*)(m_clsSupPrecondElements[i].m_pclsHiLevLeaf), &potestim1, &potestim2);
+		}
+		else {
+			m_clsMulthier.SelfPotential((CAutoSegment*)(m_clsSupPrecondElements[i].m_pclsHiLevLeaf), &potestim1, &potestim2);
+		}
+		// store only the real part; the super preconditioner in case of complex capacitance matrix
+		// will be used to precondition only the real part of the potential matrix, since this is
+		// the one compressed with the hierarchical method
+		m_pdSupPotMtx[i*size+i] = potestim1;
+	}
+
+	// then the mutual potentials, that are the bulk of the work. Each couple of elements
+	// is independent, so the rows are split among the threads (dynamically, as the rows
+	// are shorter and shorter). The problems are signaled by the PotEstimateOpt() return
+	// value, and collected here, since the global warning flags are shared among the threads
+	symmetric = UsePcg();
+	potError = false;
+	potWarn = false;
+#pragma omp parallel for schedule(dynamic) private(j, isPotValid, potestim1, potestim2) reduction(||:potError, potWarn)
+	for(i = 0; i < size; i++) {
+		for(j = i+1; j < size; j++) {
+			if(g_ucSolverType == SOLVERGLOBAL_3DSOLVER) {
+				isPotValid = m_clsMulthier.PotEstimateOpt((CAutoPanel*)(m_clsSupPrecondElements[i].m_pclsHiLevLeaf), (CAutoPanel*)(m_clsSupPrecondElements[j].m_pclsHiLevLeaf), potestim1, potestim2, AUTOREFINE_PRECOND_SUPER);
+			}
+			else {
+				isPotValid = m_clsMulthier.PotEstimateOpt((CAutoSegment*)(m_clsSupPrecondElements[i].m_pclsHiLevLeaf), (CAutoSegment*)(m_clsSupPrecondElements[j].m_pclsHiLevLeaf), potestim1, potestim2, AUTOREFINE_PRECOND_SUPER);
+			}
+
+			if(isPotValid == AUTOREFINE_WARN_PRECOND_DIST) {
+				potWarn = true;
+			}
+			else if(isPotValid != AUTOREFINE_NO_ERROR) {
+				potError = true;
+			}
+
+			// the two estimates of each couple differ slightly; if solving with the conjugate gradient,
+			// the preconditioner must be symmetric, so their average is used for both
+			if(symmetric == true) {
+				potestim1 = 0.5 * (potestim1 + potestim2);
+				potestim2 = potestim1;
+			}
+
+			m_pdSupPotMtx[i*size+j] = potestim1;
+			m_pdSupPotMtx[j*size+i] = potestim2;
+		}
+	}
+
+	// if real error while calculating the precond
+	if(potError == true) {
+		ErrMsg("Error: invalid potential calculation during two-levels preconditioner calculation\n");
+		ErrMsg("       Removing the pre-conditioner and continuing\n");
+		m_clsGlobalVars.m_ucPrecondType &= (~AUTOREFINE_PRECOND_SUPER);
+		// the block preconditioner, if any, has already been computed and is still used
+		DeallocateSuperPrecond();
+		return;
+	}
+
+	// if problems calculating the precond, and in automatic mode, prevent usage of the preconditioner
+	if(potWarn == true && m_clsGlobalVars.m_bAutoPrecond == true) {
+		ErrMsg("Warning: problems found when forming the two-levels preconditioner in automatic preconditioner mode\n");
+		ErrMsg("         Moving to Jacobi pre-conditioner, to avoid possible worst convergence of GMRES, and continuing\n");
+		m_clsGlobalVars.m_ucPrecondType = AUTOREFINE_PRECOND_JACOBI;
+		DeallocatePrecond();
+		return;
+	}
+
+	// then factor it; the inverse is never formed, since the super preconditioner
+	// is applied by forward and backward substitution (see ComputePrecondVectFast())
+	//
+
+	if(FactorMatrixLU(m_pdSupPotMtx, m_plSupPotPivot, size) == false) {
+		ErrMsg("Error: singular matrix during two-levels preconditioner calculation\n");
+		ErrMsg("       Removing the pre-conditioner and continuing\n");
+		m_clsGlobalVars.m_ucPrecondType &= (~AUTOREFINE_PRECOND_SUPER);
+		// the block preconditioner, if any, has already been computed and is still used
+		DeallocateSuperPrecond();
+		return;
+	}
+
+	// only the diagonal of the inverse is needed explicitly (see the distribution step
+	// in ComputePrecondVectFast()); its elements are independent, so each thread solves
+	// for a different column of the identity, in its own work vector
+#pragma omp parallel if(size >= SOLVE_LU_MIN_PARALLEL_SIZE) private(k, l, col)
+	{
+		col = &m_pdSupPrecondVect[(unsigned long)omp_get_thread_num() * size];
+
+#pragma omp for schedule(dynamic)
+		for(k=0; k<size; k++) {
+			for(l=0; l<size; l++) {
+				col[l] = 0.0;
+			}
+			col[k] = 1.0;
+			SolveMatrixLU(m_pdSupPotMtx, m_plSupPotPivot, size, col, false);
+			m_pdSupPrecondDiag[k] = col[k];
+		}
+	}
+}
+
+// Compute the blocks of the block preconditioner, as recorded by RecurseComputePrecond().
+// The blocks are independent, so they are split among the threads, each one forming
+// and factoring the block potential matrix in its own scratch matrix
+void CSolveCap::ComputeBlockPrecond()
+{
+	long b, i, j, n, blockSize;
+	unsigned long base;
+	int isPotValid;
+	double potestim1, potestim2, *potMtx;
+	long *pivot;
+	bool potError, singular;
+
+	blockSize = (long)m_clsGlobalVars.m_uiBlockPreSize;
+
+	potError = false;
+	singular = false;
+#pragma omp parallel for schedule(dynamic) private(i, j, n, base, isPotValid, potestim1, potestim2, potMtx, pivot) reduction(||:potError, singular)
+	for(b=0; b < (long)m_ulBlockPrecondNum; b++) {
+		double col[SOLVE_MAX_BLOCK_PRECOND_NUM], selfPot[SOLVE_MAX_BLOCK_PRECOND_NUM];
+
+		base = m_pulBlockPrecondBase[b];
+		n = (long)m_pucBlockPrecondDim[base];
+
+		ASSERT(n <= blockSize);
+
+		potMtx = &m_pdBlockPotMtx[(unsigned long)omp_get_thread_num() * blockSize * blockSize];
+		pivot = &m_plBlockPotPivot[(unsigned long)omp_get_thread_num() * blockSize];
+
+		for(i=0; i < n; i++) {
+			for(j = i; j < n; j++) {
+				// if self potential
+				if( i == j ) {
+					m_clsMulthier.SelfPotential(m_clsBlockPrecondElements[base + i], &potestim1, &potestim2);
+					// store only the real part; the super preconditioner in case of complex capacitance matrix
+					// will be used to precondition only the real part of the potential matrix, since this is
+					// the one compressed with the hierarchical method
+					potMtx[i*n+i] = potestim1;
+					selfPot[i] = potestim1;
+				}
+				else {
+					isPotValid = m_clsMulthier.PotEstimateOpt(m_clsBlockPrecondElements[base + i], m_clsBlockPrecondElements[base + j], potestim1, potestim2, AUTOREFINE_PRECOND_BLOCK);
+
+					if(isPotValid != AUTOREFINE_NO_ERROR) {
+						potError = true;
+					}
+
+					potMtx[i*n+j] = potestim1;
+					potMtx[j*n+i] = potestim2;
+				}
+			}
+		}
+
+		if(FactorMatrixLU(potMtx, pivot, n) == true) {
+			// the preconditioner block is the inverse matrix (blocks are small); compute it
+			// column by column from the LU factors, directly into the preconditioner block
+			for(j=0; j < n; j++) {
+				for(i=0; i < n; i++) {
+					col[i] = 0.0;
+				}
+				col[j] = 1.0;
+				SolveMatrixLU(potMtx, pivot, n, col, false);
+				for(i=0; i < n; i++) {
+					m_pdBlockPrecond[base + i][j] = col[i];
+				}
+			}
+		}
+		else {
+			// use Jacobi preconditioner for the block
+			singular = true;
+			for(i=0; i < n; i++) {
+				for(j=0; j < n; j++) {
+					m_pdBlockPrecond[base + i][j] = 0.0;
+				}
+				if(selfPot[i] != 0.0) {
+					m_pdBlockPrecond[base + i][i] = 1.0 / selfPot[i];
+				}
+			}
+		}
+	}
+
+	if(potError == true) {
+		ErrMsg("Error: invalid potential calculation during block preconditioner calculation\n");
+		ErrMsg("       Efficiency of the preconditioner may be impacted\n");
+	}
+	if(singular == true) {
+		ErrMsg("Error: singular matrix during block preconditioner calculation\n");
+		ErrMsg("       Using Jacobi preconditioner for the singular blocks, efficiency of the preconditioner may be impacted\n");
+	}
+}
+
+// Compute the sparse approximate inverse preconditioner, from the near-field part of the
+// potential matrix (the leaf to leaf links, see CMultHier::BuildNearFieldMatrix()).
+// The row of each leaf 'i' has a pattern 'S' made of the leaf itself and of the (at most
+// 'm_uiSpaiSize' - 1) leaves with the largest near-field coefficients in its row; the row
+// is the row of 'i' in the inverse of the local matrix A(S,S), that is the solution of
+// A(S,S)' * m = e(i). The rows are independent, so they are split among the threads,
+// each one forming and factoring the local matrix in its own scratch matrix.
+// The preconditioner is applied as a sparse matrix-vector product (see ComputePrecondVectFast()),
+// and does not depend on the number of conductors, as the two-levels one does.
+// Only for in-core links; otherwise, the Jacobi preconditioner is used instead
+void CSolveCap::ComputeSpaiPrecond()
+{
+	long i, a, b, n, lo, hi, mid, diagPos, spaiSize;
+	unsigned long k, leaf, *rowStart, *nearLeaf;
+	double *nearPotCoeff, *potMtx, weight;
+	long *pivot;
+	int ret;
+	bool singular;
+
+	ret = m_clsMulthier.BuildNearFieldMatrix();
+	if(ret != FC_NORMAL_END) {
+		if(ret == FC_OUT_OF_MEMORY) {
+			ErrMsg("Error: not enough memory to compute the sparse approximate inverse preconditioner\n");
+		}
+		else {
+			ErrMsg("Warning: the sparse approximate inverse preconditioner needs the links in-core\n");
+		}
+		ErrMsg("         Moving to Jacobi pre-conditioner and continuing\n");
+		m_clsGlobalVars.m_ucPrecondType &= ~(AUTOREFINE_PRECOND_SPAI);
+		m_clsGlobalVars.m_ucPrecondType |= AUTOREFINE_PRECOND_JACOBI;
+		m_clsMulthier.DeallocateNearFieldMatrix();
+		return;
+	}
+
+	rowStart = m_clsMulthier.m_pulNearRowStart;
+	nearLeaf = m_clsMulthier.m_pulNearLeaf;
+	nearPotCoeff = m_clsMulthier.m_pdNearPotCoeff;
+	spaiSize = (long)m_clsGlobalVars.m_uiSpaiSize;
+
+	singular = false;
+#pragma omp parallel for schedule(dynamic, 64) private(a, b, n, lo, hi, mid, diagPos, k, leaf, weight, potMtx, pivot) reduction(||:singular)
+	for(i=0; i < (long)m_clsMulthier.GetPanelNum(AUTOREFINE_HIER_PRE_0_LEVEL); i++) {
+		unsigned long pattern[SOLVE_MAX_SPAI_NUM];
+		double patternWeight[SOLVE_MAX_SPAI_NUM], col[SOLVE_MAX_SPAI_NUM];
+
+		potMtx = &m_pdSpaiPotMtx[(unsigned long)omp_get_thread_num() * spaiSize * spaiSize];
+		pivot = &m_plSpaiPotPivot[(unsigned long)omp_get_thread_num() * spaiSize];
+
+		// select the pattern: the leaf itself, and the strongest near-field interactions
+		pattern[0] = (unsigned long)i;
+		n = 1;
+		for(k = rowStart[i]; k < rowStart[i+1]; k++) {
+			leaf = nearLeaf[k];
+			weight = fabs(nearPotCoeff[k]);
+			// skip if already in the pattern
+			for(a=0; a < n; a++) {
+				if(pattern[a] == leaf) {
+					break;
+				}
+			}
+			if(a < n) {
+				continue;
+			}
+			if(n < spaiSize) {
+				pattern[n] = leaf;
+				patternWeight[n] = weight;
+				n++;
+			}
+			else {
+				// replace the weakest one, if weaker than this one (the leaf itself, in position 0, stays)
+				b = 1;
+				for(a=2; a < n; a++) {
+					if(patternWeight[a] < patternWeight[b]) {
+						b = a;
+					}
+				}
+				if(patternWeight[b] < weight) {
+					pattern[b] = leaf;
+					patternWeight[b] = weight;
+				}
+			}
+		}
+
+		// sort the pattern by leaf index (insertion sort, the pattern is small),
+		// to find the local position of the columns by bisection
+		for(a=1; a < n; a++) {
+			leaf = pattern[a];
+			for(b=a; b > 0 && pattern[b-1] > leaf; b--) {
+				pattern[b] = pattern[b-1];
+			}
+			pattern[b] = leaf;
+		}
+
+		// form the transpose of the local matrix A(S,S): the diagonal is the self potential,
+		// while the elements without a near-field link (interacting only at higher levels)
+		// are left to zero
+		for(a=0; a < n*n; a++) {
+			potMtx[a] = 0.0;
+		}
+		diagPos = 0;
+		for(a=0; a < n; a++) {
+			if(pattern[a] == (unsigned long)i) {
+				diagPos = a;
+			}
+			// store only the real part, as for the other preconditioners
+			potMtx[a*n+a] = m_clsMulthier.m_clsSelfPotCoeff[pattern[a]];
+			for(k = rowStart[pattern[a]]; k < rowStart[pattern[a]+1]; k++) {
+				leaf = nearLeaf[k];
+				lo = 0;
+				hi = n-1;
+				while(lo < hi) {
+					mid = (lo + hi) / 2;
+					if(pattern[mid] < leaf) {
+						lo = mid + 1;
+					}
+					else {
+						hi = mid;
+					}
+				}
+				if(pattern[lo] == leaf && lo != a) {
+					potMtx[lo*n+a] = nearPotCoeff[k];
+				}
+			}
+		}
+
+		if(FactorMatrixLU(potMtx, pivot, n) == true) {
+			for(a=0; a < n; a++) {
+				col[a] = 0.0;
+			}
+			col[diagPos] = 1.0;
+			SolveMatrixLU(potMtx, pivot, n, col, false);
+			for(a=0; a < n; a++) {
+				m_pdSpaiPrecond[(unsigned long)i*spaiSize + a] = col[a];
+				m_pulSpaiIndex[(unsigned long)i*spaiSize + a] = pattern[a];
+			}
+			m_pucSpaiDim[i] = (unsigned char)n;
+		}
+		else {
+			// use Jacobi preconditioner for the row
+			singular = true;
+			m_pdSpaiPrecond[(unsigned long)i*spaiSize] = 1.0 / m_clsMulthier.m_clsSelfPotCoeff[i];
+			m_pulSpaiIndex[(unsigned long)i*spaiSize] = (unsigned long)i;
+			m_pucSpaiDim[i] = 1;
+		}
+	}
+
+	if(singular == true) {
+		ErrMsg("Error: singular matrix during sparse approximate inverse preconditioner calculation\n");
+		ErrMsg("       Using Jacobi preconditioner for the singular rows, efficiency of the preconditioner may be impacted\n");
+	}
+
+	// the near-field matrix is not needed anymore
+	m_clsMulthier.DeallocateNearFieldMatrix();
+}
+
+// Compute the multigrid preconditioner, on top of the block preconditioner (the smoother of the
+// leaves, see ComputeBlockPrecond()).
+// The levels are built on the panel trees: the elements of level 'l' (the aggregates) are the
+// tree elements with at most 'm_ulMgMaxLeaves[l]' leaves whose parent has more, so each aggregate
+// is contained in exactly one aggregate of the next level. The first level above the leaves has
+// the same aggregates as the blocks, the next ones are SOLVE_MG_COARSENING times larger, and the
+// last one (the coarse level) is the finest one that fits into 'm_uiSuperPreDim' elements.
+// As in the distribution step of the two-levels preconditioner, the charge of an aggregate is
+// prolonged to the leaves in proportion to their areae, and the restriction, its transpose, is the
+// area-weighted average of the potentials. The operator of each level above the leaves is the
+// potential matrix of its aggregates, computed as for the two-levels preconditioner: the coarse
+// one is factored, and the ones of the intermediate levels give the residuals of their smoother,
+// so each V-cycle costs only the two multiplications on the leaves (see ComputeMultigridVect()).
+// Since these matrices are dense, the intermediate levels with more than SOLVE_MG_MAX_LEVEL_DIM
+// aggregates are skipped.
+// If the levels cannot be formed, the block preconditioner alone is used instead
+void CSolveCap::ComputeMultigridPrecond()
+{
+	StlAutoCondDeque::iterator itc;
+	unsigned long panelNum, coarseLeaves, maxLeaves, aggNum, diagBase;
+	unsigned long levelPos[SOLVE_MAX_MG_LEVELS], currAgg[SOLVE_MAX_MG_LEVELS];
+	long i, size;
+	unsigned int l;
+	int ret;
+	double *mtx;
+	bool potError;
+
+	panelNum = m_clsMulthier.GetPanelNum(AUTOREFINE_HIER_PRE_0_LEVEL);
+
+	// find the coarse level, as the finest one that fits into the coarse matrix
+	coarseLeaves = 1;
+	aggNum = CountMgAggregates(coarseLeaves);
+	while(aggNum > m_clsGlobalVars.m_uiSuperPreDim && coarseLeaves < panelNum) {
+		coarseLeaves *= 2;
+		aggNum = CountMgAggregates(coarseLeaves);
+	}
+	if(aggNum > m_clsGlobalVars.m_uiSuperPreDim) {
+		ErrMsg("Warning: number of conductors and dielectric interfaces greater than %d; cannot use the multigrid preconditioner\n", m_clsGlobalVars.m_uiSuperPreDim);
+		ErrMsg("         Moving to block pre-conditioner and continuing\n");
+		m_clsGlobalVars.m_ucPrecondType = AUTOREFINE_PRECOND_BLOCK;
+		DeallocateMultigridPrecond();
+		return;
+	}
+
+	// then the intermediate levels, from the blocks up to the coarse level, skipping
+	// the ones with too many aggregates for their potential matrix
+	m_uiMgLevelsNum = 1;
+	maxLeaves = m_clsGlobalVars.m_uiBlockPreSize;
+	while(maxLeaves < coarseLeaves && m_uiMgLevelsNum < m_clsGlobalVars.m_uiMgLevels - 1) {
+		if(CountMgAggregates(maxLeaves) <= SOLVE_MG_MAX_LEVEL_DIM) {
+			m_ulMgMaxLeaves[m_uiMgLevelsNum] = maxLeaves;
+			m_uiMgLevelsNum++;
+		}
+		maxLeaves *= SOLVE_MG_COARSENING;
+	}
+	m_ulMgMaxLeaves[m_uiMgLevelsNum] = coarseLeaves;
+	m_uiMgLevelsNum++;
+	m_ulMgMaxLeaves[0] = 1;
+
+	m_pulMgLevelStart[0] = 0;
+	m_pulMgLevelStart[1] = panelNum;
+	for(l=1; l<m_uiMgLevelsNum; l++) {
+		m_pulMgLevelStart[l+1] = m_pulMgLevelStart[l] + CountMgAggregates(m_ulMgMaxLeaves[l]);
+	}
+
+	ret = AllocateMultigridPrecond();
+	if(ret != FC_NORMAL_END) {
+		ErrMsg("Error: not enough memory to compute the multigrid preconditioner\n");
+		ErrMsg("       Moving to block pre-conditioner and continuing\n");
+		m_clsGlobalVars.m_ucPrecondType = AUTOREFINE_PRECOND_BLOCK;
+		DeallocateMultigridPrecond();
+		return;
+	}
+
+	// record the aggregates of all the levels, and the links between the levels
+	for(l=0; l<m_uiMgLevelsNum; l++) {
+		levelPos[l] = 0;
+		currAgg[l] = 0;
+	}
+	for(itc = m_clsMulthier.m_stlConductors.begin(); itc != m_clsMulthier.m_stlConductors.end(); itc++) {
+		m_pCurrCond = *itc;
+		RecurseMgAggregates((*itc)->m_uTopElement.m_pTopElement, (unsigned long)-1, levelPos, currAgg);
+	}
+
+	ASSERT(levelPos[0] == panelNum);
+
+	// potential matrices of the intermediate levels, and their Jacobi smoother
+	potError = false;
+	for(l=1; l<m_uiMgLevelsNum-1; l++) {
+		size = (long)(m_pulMgLevelStart[l+1] - m_pulMgLevelStart[l]);
+		diagBase = m_pulMgLevelStart[l] - m_pulMgLevelStart[1];
+		mtx = &m_pdMgLevelMtx[m_pulMgMtxBase[l]];
+		if(ComputeMgLevelMatrix(l, mtx) == false) {
+			potError = true;
+		}
+		for(i = 0; i < size; i++) {
+			if(mtx[i*size+i] != 0.0) {
+				m_pdMgDiag[diagBase+i] = SOLVE_MG_JACOBI_DAMPING / mtx[i*size+i];
+			}
+			else {
+				m_pdMgDiag[diagBase+i] = 0.0;
+			}
+		}
+	}
+
+	// coarse potential matrix
+	size = (long)(m_pulMgLevelStart[m_uiMgLevelsNum] - m_pulMgLevelStart[m_uiMgLevelsNum-1]);
+	if(ComputeMgLevelMatrix(m_uiMgLevelsNum-1, m_pdMgCoarseMtx) == false) {
+		potError = true;
+	}
+
+	if(potError == true) {
+		ErrMsg("Error: invalid potential calculation during multigrid preconditioner calculation\n");
+	}
+	if(potError == true || FactorMatrixLU(m_pdMgCoarseMtx, m_plMgCoarsePivot, size) == false) {
+		if(potError == false) {
+			ErrMsg("Error: singular matrix during multigrid preconditioner calculation\n");
+		}
+		ErrMsg("       Moving to block pre-conditioner and continuing\n");
+		m_clsGlobalVars.m_ucPrecondType = AUTOREFINE_PRECOND_BLOCK;
+		DeallocateMultigridPrecond();
+		return;
+	}
+
+	// the aggregates are not needed anymore
+	delete [] m_clsMgElements;
+	m_clsMgElements = NULL;
+
+	if(m_clsGlobalVars.m_bVerboseOutput == true) {
+		LogMsg("Multigrid preconditioner levels:");
+		for(l=0; l<m_uiMgLevelsNum; l++) {
+			LogMsg(" %lu", m_pulMgLevelStart[l+1] - m_pulMgLevelStart[l]);
+		}
+		LogMsg("\n");
+	}
+}
+
+// Compute the potential matrix of the aggregates of level 'level' in the row-major 'matrix',
+// as for the two-levels preconditioner (see ComputeSuperPrecond()).
+// Returns false if some of the potentials could not be calculated
+bool CSolveCap::ComputeMgLevelMatrix(unsigned int level, double *matrix)
+{
+	long i, j, size;
+	unsigned long base;
+	int isPotValid;
+	double potestim1, potestim2;
+	bool potError;
+
+	base = m_pulMgLevelStart[level] - m_pulMgLevelStart[1];
+	size = (long)(m_pulMgLevelStart[level+1] - m_pulMgLevelStart[level]);
+
+	// SelfPotential() needs the current conductor, which is shared, so the self potentials are computed sequentially
+	for(i = 0; i < size; i++) {
+		m_clsMulthier.SetCurrentConductor(m_clsMgElements[base+i].m_pCond);
+		if(g_ucSolverType == SOLVERGLOBAL_3DSOLVER) {
+			m_clsMulthier.SelfPotential((CAutoPanel*)(m_clsMgElements[base+i].m_pclsHiLevLeaf), &potestim1, &potestim2);
+		}
+		else {
+			m_clsMulthier.SelfPotential((CAutoSegment*)(m_clsMgElements[base+i].m_pclsHiLevLeaf), &potestim1, &potestim2);
+		}
+		// store only the real part, as for the other preconditioners
+		matrix[i*size+i] = potestim1;
+	}
+	potError = false;
+#pragma omp parallel for schedule(dynamic) private(j, isPotValid, potestim1, potestim2) reduction(||:potError)
+	for(i = 0; i < size; i++) {
+		for(j = i+1; j < size; j++) {
+			if(g_ucSolverType == SOLVERGLOBAL_3DSOLVER) {
+				isPotValid = m_clsMulthier.PotEstimateOpt((CAutoPanel*)(m_clsMgElements[base+i].m_pclsHiLevLeaf), (CAutoPanel*)(m_clsMgElements[base+j].m_pclsHiLevLeaf), potestim1, potestim2, AUTOREFINE_PRECOND_SUPER);
+			}
+			else {
+				isPotValid = m_clsMulthier.PotEstimateOpt((CAutoSegment*)(m_clsMgElements[base+i].m_pclsHiLevLeaf), (CAutoSegment*)(m_clsMgElements[base+j].m_pclsHiLevLeaf), potestim1, potestim2, AUTOREFINE_PRECOND_SUPER);
+			}
+
+			if(isPotValid != AUTOREFINE_NO_ERROR && isPotValid != AUTOREFINE_WARN_PRECOND_DIST) {
+				potError = true;
+			}
+
+			matrix[i*size+j] = potestim1;
+			matrix[j*size+i] = potestim2;
+		}
+	}
+
+	return !potError;
+}
+
+// count the aggregates with at most 'maxLeaves' leaves (see ComputeMultigridPrecond())
+unsigned long CSolveCap::CountMgAggregates(unsigned long maxLeaves)
+{
+	StlAutoCondDeque::iterator itc;
+	unsigned long aggNum;
+
+	aggNum = 0;
+	for(itc = m_clsMulthier.m_stlConductors.begin(); itc != m_clsMulthier.m_stlConductors.end(); itc++) {
+		aggNum += RecurseCountMgAggregates((*itc)->m_uTopElement.m_pTopElement, maxLeaves);
+	}
+
+	return aggNum;
+}
+
+unsigned long CSolveCap::RecurseCountMgAggregates(CAutoElement *element, unsigned long maxLeaves)
+{
+	if(element->IsLeaf() == true || element->m_lNumOfChildren <= maxLeaves) {
+		return 1;
+	}
+
+	return RecurseCountMgAggregates(element->m_pLeft, maxLeaves) + RecurseCountMgAggregates(element->m_pRight, maxLeaves);
+}
+
+// Recursively record the aggregates under 'element', whose parent has 'parentLeaves' leaves.
+// 'levelPos[l]' is the next free position in level 'l' (the next leaf for level 0), and
+// 'currAgg[l]' is the position of the aggregate of level 'l' currently containing 'element'
+void CSolveCap::RecurseMgAggregates(CAutoElement *element, unsigned long parentLeaves, unsigned long *levelPos, unsigned long *currAgg)
+{
+	unsigned long pos, parentPos;
+	unsigned int l;
+
+	// from the coarse level down, so that the aggregate containing this one
+	// in the next level is already known
+	for(l=m_uiMgLevelsNum-1; l>0; l--) {
+		if(element->m_lNumOfChildren <= m_ulMgMaxLeaves[l] && m_ulMgMaxLeaves[l] < parentLeaves) {
+			pos = levelPos[l];
+			levelPos[l]++;
+			m_clsMgElements[m_pulMgLevelStart[l] - m_pulMgLevelStart[1] + pos].m_pclsHiLevLeaf = element;
+			m_clsMgElements[m_pulMgLevelStart[l] - m_pulMgLevelStart[1] + pos].m_pCond = m_pCurrCond;
+			if(l < m_uiMgLevelsNum-1) {
+				parentPos = m_pulMgLevelStart[l+1] - m_pulMgLevelStart[1] + currAgg[l+1];
+				m_pulMgParent[m_pulMgLevelStart[l] + pos] = currAgg[l+1];
+				m_pdMgWeight[m_pulMgLevelStart[l] + pos] = element->GetDimension() / m_clsMgElements[parentPos].m_pclsHiLevLeaf->GetDimension();
+			}
+			currAgg[l] = pos;
+		}
+	}
+
+	if(element->IsLeaf() == true) {
+		pos = levelPos[0];
+		levelPos[0]++;
+		m_pulMgParent[pos] = currAgg[1];
+		m_pdMgWeight[pos] = element->GetDimension() / m_clsMgElements[currAgg[1]].m_pclsHiLevLeaf->GetDimension();
+	}
+	else {
+		RecurseMgAggregates(element->m_pLeft, element->m_lNumOfChildren, levelPos, currAgg);
+		RecurseMgAggregates(element->m_pRight, element->m_lNumOfChildren, levelPos, currAgg);
+	}
+}
 
-		if(g_bFCContinue == false) {
-			return FC_USER_BREAK;
+int CSolveCap::AllocateMultigridPrecond()
+{
+	unsigned long aggNum, vectNum, numElems, coarseNum, levelNum, mtxNum;
+	unsigned int l;
+	bool ret;
+
+	DeallocateMultigridPrecond();
+
+	aggNum = m_pulMgLevelStart[m_uiMgLevelsNum] - m_pulMgLevelStart[1];
+	coarseNum = m_pulMgLevelStart[m_uiMgLevelsNum] - m_pulMgLevelStart[m_uiMgLevelsNum-1];
+	// potential matrices of the intermediate levels
+	mtxNum = 0;
+	for(l=1; l<m_uiMgLevelsNum-1; l++) {
+		levelNum = m_pulMgLevelStart[l+1] - m_pulMgLevelStart[l];
+		m_pulMgMtxBase[l] = mtxNum;
+		mtxNum += levelNum * levelNum;
+	}
+	numElems = m_clsMulthier.GetPanelNum(AUTOREFINE_HIER_PRE_0_LEVEL);
+	// if complex permittivity, the residuals and corrections are twice as long
+	if( m_clsGlobalVars.m_ucHasCmplxPerm == AUTOREFINE_REAL_PERM) {
+		vectNum = aggNum;
+	}
+	else {
+		vectNum = 2 * aggNum;
+		numElems *= 2;
+	}
+
+	// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+	SAFENEW_ARRAY_RET(unsigned long, m_pulMgParent, m_pulMgLevelStart[m_uiMgLevelsNum-1], g_clsMemUsage.m_ulPrecondMem)
+	// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+	SAFENEW_ARRAY_RET(double, m_pdMgWeight, m_pulMgLevelStart[m_uiMgLevelsNum-1], g_clsMemUsage.m_ulPrecondMem)
+	// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+	SAFENEW_ARRAY_RET(double, m_pdMgDiag, aggNum, g_clsMemUsage.m_ulPrecondMem)
+	// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+	SAFENEW_ARRAY_RET(double, m_pdMgRes, vectNum, g_clsMemUsage.m_ulPrecondMem)
+	// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+	SAFENEW_ARRAY_RET(double, m_pdMgCorr, vectNum, g_clsMemUsage.m_ulPrecondMem)
+	// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+	SAFENEW_ARRAY_RET(double, m_pdMgWork, vectNum, g_clsMemUsage.m_ulPrecondMem)
+	// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+	SAFENEW_ARRAY_RET(double, m_pdMgLevelMtx, mtxNum, g_clsMemUsage.m_ulPrecondMem)
+	// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+	SAFENEW_ARRAY_RET(CSuperPrecondElement, m_clsMgElements, aggNum, g_clsMemUsage.m_ulPrecondMem)
+	// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+	SAFENEW_ARRAY_RET(double, m_pdMgCoarseMtx, coarseNum * coarseNum, g_clsMemUsage.m_ulPrecondMem)
+	// SAFENEW_ARRAY_RET(TYPE, VAR, LEN, MEM)
+	SAFENEW_ARRAY_RET(long, m_plMgCoarsePivot, coarseNum, g_clsMemUsage.m_ulPrecondMem)
+
+	// work vectors on the leaves
+	ret = m_clsMg_t.newsize(numElems);
+	if(ret == false) {
+		return FC_OUT_OF_MEMORY;
+	}
+	g_clsMemUsage.m_ulPrecondMem += numElems * sizeof(double);
+	ret = m_clsMg_w.newsize(numElems);
+	if(ret == false) {
+		return FC_OUT_OF_MEMORY;
+	}
+	g_clsMemUsage.m_ulPrecondMem += numElems * sizeof(double);
+
+	return FC_NORMAL_END;
+}
+
+void CSolveCap::DeallocateMultigridPrecond()
+{
+	if(m_pulMgParent != NULL) {
+		delete [] m_pulMgParent;
+		m_pulMgParent = NULL;
+	}
+	if(m_pdMgWeight != NULL) {
+		delete [] m_pdMgWeight;
+		m_pdMgWeight = NULL;
+	}
+	if(m_pdMgDiag != NULL) {
+		delete [] m_pdMgDiag;
+		m_pdMgDiag = NULL;
+	}
+	if(m_pdMgRes != NULL) {
+		delete [] m_pdMgRes;
+		m_pdMgRes = NULL;
+	}
+	if(m_pdMgCorr != NULL) {
+		delete [] m_pdMgCorr;
+		m_pdMgCorr = NULL;
+	}
+	if(m_pdMgWork != NULL) {
+		delete [] m_pdMgWork;
+		m_pdMgWork = NULL;
+	}
+	if(m_pdMgLevelMtx != NULL) {
+		delete [] m_pdMgLevelMtx;
+		m_pdMgLevelMtx = NULL;
+	}
+	if(m_clsMgElements != NULL) {
+		delete [] m_clsMgElements;
+		m_clsMgElements = NULL;
+	}
+	if(m_pdMgCoarseMtx != NULL) {
+		delete [] m_pdMgCoarseMtx;
+		m_pdMgCoarseMtx = NULL;
+	}
+	if(m_plMgCoarsePivot != NULL) {
+		delete [] m_plMgCoarsePivot;
+		m_plMgCoarsePivot = NULL;
+	}
+	m_clsMg_t.destroy();
+	m_clsMg_w.destroy();
+}
+
+// Apply the multigrid preconditioner: one V-cycle, with the damped block preconditioner
+// as pre- and post-smoother on the leaves, starting from a zero charge.
+// Remark: if a multiplication fails (e.g. user break), the cycle stops with the correction
+// computed so far; the error is then detected by the caller at its next multiplication
+void CSolveCap::ComputeMultigridVect(CLin_Vector *Pq, CLin_Vector *q)
+{
+	long i, vectNum;
+	int ret;
+
+	vectNum = (long)(*Pq).size();
+
+	// pre-smoothing
+	MgBlockSmooth(Pq, q);
+
+	// residual, restricted to the first level
+	ret = m_clsMulthier.MultiplyMatByVec_fast(&m_clsMg_w, Pq);
+	if(ret != FC_NORMAL_END) {
+		return;
+	}
+	for(i=0; i<vectNum; i++) {
+		m_clsMg_w[i] = (*q)[i] - m_clsMg_w[i];
+	}
+	for(i=0; i<(long)(vectNum / m_pulMgLevelStart[1] * (m_pulMgLevelStart[2] - m_pulMgLevelStart[1])); i++) {
+		m_pdMgRes[i] = 0.0;
+	}
+	MgRestrictFromLeaves(1, &m_clsMg_w, m_pdMgRes, 1.0);
+
+	MultigridCycle(1);
+
+	// coarse correction
+	MgProlongToLeaves(1, m_pdMgCorr, &m_clsMg_t);
+	for(i=0; i<vectNum; i++) {
+		(*Pq)[i] += m_clsMg_t[i];
+	}
+
+	// post-smoothing
+	ret = m_clsMulthier.MultiplyMatByVec_fast(&m_clsMg_w, Pq);
+	if(ret != FC_NORMAL_END) {
+		return;
+	}
+	for(i=0; i<vectNum; i++) {
+		m_clsMg_w[i] = (*q)[i] - m_clsMg_w[i];
+	}
+	MgBlockSmooth(&m_clsMg_t, &m_clsMg_w);
+	for(i=0; i<vectNum; i++) {
+		(*Pq)[i] += m_clsMg_t[i];
+	}
+}
+
+// Recursive step of the V-cycle: computes the correction of level 'level' from its residual.
+// The intermediate levels use the damped Jacobi smoother, whose residuals are computed with
+// the potential matrix of the level
+void CSolveCap::MultigridCycle(unsigned int level)
+{
+	long i, k, levelNum, nextNum, halves;
+	unsigned long base, nextBase, diagBase;
+	double *res, *corr, *nextRes, *nextCorr;
+
+	halves = (long)(m_clsMg_t.size() / m_pulMgLevelStart[1]);
+	levelNum = (long)(m_pulMgLevelStart[level+1] - m_pulMgLevelStart[level]);
+	diagBase = m_pulMgLevelStart[level] - m_pulMgLevelStart[1];
+	base = halves * diagBase;
+	res = &m_pdMgRes[base];
+	corr = &m_pdMgCorr[base];
+
+	// coarse level: direct solution
+	if(level == m_uiMgLevelsNum-1) {
+		for(i=0; i<halves*levelNum; i++) {
+			corr[i] = res[i];
+		}
+		for(k=0; k<halves; k++) {
+			SolveMatrixLU(m_pdMgCoarseMtx, m_plMgCoarsePivot, levelNum, &corr[k*levelNum], true);
+		}
+		return;
+	}
+
+	nextNum = (long)(m_pulMgLevelStart[level+2] - m_pulMgLevelStart[level+1]);
+	nextBase = halves * (m_pulMgLevelStart[level+1] - m_pulMgLevelStart[1]);
+	nextRes = &m_pdMgRes[nextBase];
+	nextCorr = &m_pdMgCorr[nextBase];
+
+	// pre-smoothing
+	for(k=0; k<halves; k++) {
+		for(i=0; i<levelNum; i++) {
+			corr[k*levelNum+i] = m_pdMgDiag[diagBase+i] * res[k*levelNum+i];
+		}
+	}
+
+	// residual, restricted to the next level
+	MgLevelResidual(level, corr, res, m_pdMgWork);
+	for(i=0; i<halves*nextNum; i++) {
+		nextRes[i] = 0.0;
+	}
+	for(k=0; k<halves; k++) {
+		for(i=0; i<levelNum; i++) {
+			nextRes[k*nextNum + m_pulMgParent[m_pulMgLevelStart[level]+i]] += m_pdMgWeight[m_pulMgLevelStart[level]+i] * m_pdMgWork[k*levelNum+i];
+		}
+	}
+
+	MultigridCycle(level+1);
+
+	// coarse correction
+	for(k=0; k<halves; k++) {
+		for(i=0; i<levelNum; i++) {
+			corr[k*levelNum+i] += m_pdMgWeight[m_pulMgLevelStart[level]+i] * nextCorr[k*nextNum + m_pulMgParent[m_pulMgLevelStart[level]+i]];
+		}
+	}
+
+	// post-smoothing
+	MgLevelResidual(level, corr, res, m_pdMgWork);
+	for(k=0; k<halves; k++) {
+		for(i=0; i<levelNum; i++) {
+			corr[k*levelNum+i] += m_pdMgDiag[diagBase+i] * m_pdMgWork[k*levelNum+i];
+		}
+	}
+}
+
+// Residual 'r' = 'y' - M * 'x' of the aggregates of the intermediate level 'level', M being
+// the potential matrix of the level. If complex permittivity, the vectors are twice as long,
+// and as for the preconditioners, must multiply by [M 0; 0 M]
+void CSolveCap::MgLevelResidual(unsigned int level, double *x, double *y, double *r)
+{
+	long i, j, k, levelNum, halves;
+	double sum, *mtx;
+
+	halves = (long)(m_clsMg_t.size() / m_pulMgLevelStart[1]);
+	levelNum = (long)(m_pulMgLevelStart[level+1] - m_pulMgLevelStart[level]);
+	mtx = &m_pdMgLevelMtx[m_pulMgMtxBase[level]];
+
+	for(k=0; k<halves; k++) {
+#pragma omp parallel for if(levelNum >= SOLVE_MG_MIN_PARALLEL_DIM) private(j, sum)
+		for(i=0; i<levelNum; i++) {
+			sum = y[k*levelNum+i];
+			for(j=0; j<levelNum; j++) {
+				sum -= mtx[i*levelNum+j] * x[k*levelNum+j];
+			}
+			r[k*levelNum+i] = sum;
+		}
+	}
+}
+
+// Damped block preconditioner, smoother of the leaves of the multigrid preconditioner.
+// If complex permittivity, the '*q' and '*Pq' vectors are twice as long, and as for Jacobi,
+// must multiply by [B 0; 0 B]
+void CSolveCap::MgBlockSmooth(CLin_Vector *Pq, CLin_Vector *q)
+{
+	long b, i, j, k, n, panelNum;
+	unsigned long base;
+	double sum;
+
+	panelNum = (long)m_clsMulthier.GetPanelNum(AUTOREFINE_HIER_PRE_0_LEVEL);
+
+	for(k=0; k < (long)(*Pq).size(); k += panelNum) {
+#pragma omp parallel for if(panelNum >= SOLVE_MG_MIN_PARALLEL_SIZE) schedule(dynamic, 64) private(i, j, n, base, sum)
+		for(b=0; b < (long)m_ulBlockPrecondNum; b++) {
+			base = m_pulBlockPrecondBase[b];
+			n = (long)m_pucBlockPrecondDim[base];
+			for(i=0; i < n; i++) {
+				sum = 0.0;
+				for(j=0; j < n; j++) {
+					sum += m_pdBlockPrecond[base + i][j] * (*q)[k + base + j];
+				}
+				(*Pq)[k + base + i] = SOLVE_MG_BLOCK_DAMPING * sum;
+			}
+		}
+	}
+}
+
+// Prolong the charges 'x' of the aggregates of level 'level' to the leaves, in '*q',
+// in proportion to the areae of the leaves
+void CSolveCap::MgProlongToLeaves(unsigned int level, double *x, CLin_Vector *q)
+{
+	long i, k, panelNum, levelNum, halves;
+	unsigned long pos;
+	unsigned int l;
+	double weight;
+
+	panelNum = (long)m_pulMgLevelStart[1];
+	levelNum = (long)(m_pulMgLevelStart[level+1] - m_pulMgLevelStart[level]);
+	halves = (long)((*q).size() / panelNum);
+
+#pragma omp parallel for if(panelNum >= SOLVE_MG_MIN_PARALLEL_SIZE) private(k, l, pos, weight)
+	for(i=0; i < panelNum; i++) {
+		pos = (unsigned long)i;
+		weight = 1.0;
+		for(l=0; l<level; l++) {
+			weight *= m_pdMgWeight[m_pulMgLevelStart[l] + pos];
+			pos = m_pulMgParent[m_pulMgLevelStart[l] + pos];
+		}
+		for(k=0; k<halves; k++) {
+			(*q)[k*panelNum + i] = weight * x[k*levelNum + pos];
+		}
+	}
+}
+
+// Restrict the potentials '*v' on the leaves to the aggregates of level 'level', as
+// area-weighted averages, adding them multiplied by 'factor' to 'y'. The leaves scatter
+// into the aggregates, so the restriction is sequential
+void CSolveCap::MgRestrictFromLeaves(unsigned int level, CLin_Vector *v, double *y, double factor)
+{
+	long i, k, panelNum, levelNum, halves;
+	unsigned long pos;
+	unsigned int l;
+	double weight;
+
+	panelNum = (long)m_pulMgLevelStart[1];
+	levelNum = (long)(m_pulMgLevelStart[level+1] - m_pulMgLevelStart[level]);
+	halves = (long)((*v).size() / panelNum);
+
+	for(i=0; i < panelNum; i++) {
+		pos = (unsigned long)i;
+		weight = factor;
+		for(l=0; l<level; l++) {
+			weight *= m_pdMgWeight[m_pulMgLevelStart[l] + pos];
+			pos = m_pulMgParent[m_pulMgLevelStart[l] + pos];
+		}
+		for(k=0; k<halves; k++) {
+			y[k*levelNum + pos] += weight * (*v)[k*panelNum + i];
+		}
+	}
+}
+
+// LU factorization with partial pivoting of the 'size' x 'size' row-major 'matrix', in place:
+// on return the strictly lower part holds the unit lower triangular factor L, the rest the upper
+// triangular factor U, and at step 'j' row 'j' was swapped with row 'pivot[j]'.
+// Returns false if the matrix is singular.
+//
+// Right-looking algorithm, blocked on SOLVE_LU_BLOCK_SIZE columns: each column panel is factored
+// unblocked (pivot search and row swaps need the whole column), then the corresponding block row
+// of U is computed and the trailing submatrix is updated with a single rank-SOLVE_LU_BLOCK_SIZE
+// product, instead of a rank-1 update per column. The update proceeds by square tiles, so that
+// the tile of U stays in cache while the rows are streamed, and is split among the threads
+// by blocks of rows
+bool CSolveCap::FactorMatrixLU(double *matrix, long *pivot, long size)
+{
+	long jb, jend, j, jp, i, ib, iend, cb, cend, k, kk;
+	double t, recp, lik, *rowi, *rowj;
+
+	for(jb=0; jb<size; jb+=SOLVE_LU_BLOCK_SIZE) {
+		jend = jb + SOLVE_LU_BLOCK_SIZE;
+		if(jend > size) {
+			jend = size;
+		}
+
+		// unblocked factorization of the panel of columns jb:jend-1
+		for(j=jb; j<jend; j++) {
+
+			// find pivot in column j and test for singularity
+			jp = j;
+			t = fabs(matrix[j*size+j]);
+			for(i=j+1; i<size; i++) {
+				if( fabs(matrix[i*size+j]) > t) {
+					jp = i;
+					t = fabs(matrix[i*size+j]);
+				}
+			}
+
+			pivot[j] = jp;
+
+			// factorization failed because of zero pivot
+			if(t == 0.0) {
+				return false;
+			}
+
+			// if pivot not already on the diagonal, swap the whole rows j and jp
+			if(jp != j) {
+				rowj = &matrix[j*size];
+				rowi = &matrix[jp*size];
+				for(k=0; k<size; k++) {
+					t = rowj[k];
+					rowj[k] = rowi[k];
+					rowi[k] = t;
+				}
+			}
+
+			// divide the elements of column j below the diagonal by the pivot,
+			// and apply the rank-1 update to the rest of the panel only
+			rowj = &matrix[j*size];
+			recp = 1.0 / rowj[j];
+#pragma omp parallel for if(size - j >= SOLVE_LU_MIN_PARALLEL_SIZE) private(k, lik, rowi)
+			for(i=j+1; i<size; i++) {
+				rowi = &matrix[i*size];
+				rowi[j] *= recp;
+				lik = rowi[j];
+				for(k=j+1; k<jend; k++) {
+					rowi[k] -= lik * rowj[k];
+				}
+			}
+		}
+
+		if(jend < size) {
+
+			// block row of U, solving L11 * U12 = A12 (L11 is unit lower triangular);
+			// the column blocks are independent
+#pragma omp parallel for if(size >= SOLVE_LU_MIN_PARALLEL_SIZE) private(cend, i, k, kk, lik, rowi, rowj)
+			for(cb=jend; cb<size; cb+=SOLVE_LU_BLOCK_SIZE) {
+				cend = cb + SOLVE_LU_BLOCK_SIZE;
+				if(cend > size) {
+					cend = size;
+				}
+				for(i=jb+1; i<jend; i++) {
+					rowi = &matrix[i*size];
+					for(k=jb; k<i; k++) {
+						lik = rowi[k];
+						rowj = &matrix[k*size];
+						for(kk=cb; kk<cend; kk++) {
+							rowi[kk] -= lik * rowj[kk];
+						}
+					}
+				}
+			}
+
+			// update of the trailing submatrix, A22 = A22 - L21 * U12
+#pragma omp parallel for if(size >= SOLVE_LU_MIN_PARALLEL_SIZE) private(iend, cb, cend, i, k, kk, lik, rowi, rowj)
+			for(ib=jend; ib<size; ib+=SOLVE_LU_BLOCK_SIZE) {
+				iend = ib + SOLVE_LU_BLOCK_SIZE;
+				if(iend > size) {
+					iend = size;
+				}
+				for(cb=jend; cb<size; cb+=SOLVE_LU_BLOCK_SIZE) {
+					cend = cb + SOLVE_LU_BLOCK_SIZE;
+					if(cend > size) {
+						cend = size;
+					}
+					for(i=ib; i<iend; i++) {
+						rowi = &matrix[i*size];
+						for(k=jb; k<jend; k++) {
+							lik = rowi[k];
+							rowj = &matrix[k*size];
+							for(kk=cb; kk<cend; kk++) {
+								rowi[kk] -= lik * rowj[kk];
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+// Solve 'matrix' * x = 'b' in place ('b' is overwritten by 'x'), where 'matrix' and 'pivot'
+// are the LU factors returned by FactorMatrixLU(). The leading zeros of the permuted 'b' are
+// skipped in the forward substitution, so solving for the columns of the identity is cheaper.
+// The substitutions proceed by blocks of SOLVE_LU_BLOCK_SIZE unknowns: each diagonal block
+// is solved sequentially, then the remaining elements of 'b' are updated with the unknowns
+// just found, in parallel by rows if 'parallel'
+void CSolveCap::SolveMatrixLU(double *matrix, long *pivot, long size, double *b, bool parallel)
+{
+	long i, j, jb, jend, first;
+	double t, sum, *rowi;
+
+	// not worth for small matrices
+	if(size < SOLVE_LU_MIN_PARALLEL_SIZE) {
+		parallel = false;
+	}
+
+	// apply the rows permutation
+	for(i=0; i<size; i++) {
+		if(pivot[i] != i) {
+			t = b[i];
+			b[i] = b[pivot[i]];
+			b[pivot[i]] = t;
+		}
+	}
+
+	for(first=0; first<size; first++) {
+		if(b[first] != 0.0) {
+			break;
+		}
+	}
+
+	// forward substitution (L is unit lower triangular)
+	for(jb=first; jb<size; jb+=SOLVE_LU_BLOCK_SIZE) {
+		jend = jb + SOLVE_LU_BLOCK_SIZE;
+		if(jend > size) {
+			jend = size;
+		}
+		for(i=jb+1; i<jend; i++) {
+			rowi = &matrix[i*size];
+			sum = b[i];
+			for(j=jb; j<i; j++) {
+				sum -= rowi[j] * b[j];
+			}
+			b[i] = sum;
+		}
+#pragma omp parallel for if(parallel) private(j, sum, rowi)
+		for(i=jend; i<size; i++) {
+			rowi = &matrix[i*size];
+			sum = b[i];
+			for(j=jb; j<jend; j++) {
+				sum -= rowi[j] * b[j];
+			}
+			b[i] = sum;
+		}
+	}
+
+	// backward substitution
+	for(jend=size; jend>0; jend-=SOLVE_LU_BLOCK_SIZE) {
+		jb = jend - SOLVE_LU_BLOCK_SIZE;
+		if(jb < 0) {
+			jb = 0;
+		}
+		for(i=jend-1; i>=jb; i--) {
+			rowi = &matrix[i*size];
+			sum = b[i];
+			for(j=i+1; j<jend; j++) {
+				sum -= rowi[j] * b[j];
+			}
+			b[i] = sum / rowi[i];
+
+			_ASSERT(!isnan(b[i]));
+			_ASSERT(isfinite(b[i]));
+		}
+#pragma omp parallel for if(parallel) private(j, sum, rowi)
+		for(i=0; i<jb; i++) {
+			rowi = &matrix[i*size];
+			sum = b[i];
+			for(j=jb; j<jend; j++) {
+				sum -= rowi[j] * b[j];
+			}
+			b[i] = sum;
+		}
+	}
+}
+
+//   Generalized Minimum Residual Method with preconditioner
+//
+//   x = gmresPrecond(A,b,P) attempt to solve the preconditioned
+//   system A*P*y = b & x = P*y
+//
+//   Enrico Di Lorenzo, 2004/07/06
+//
+//   'fast' refers to the direct vector multiplication loops used
+//   instead of CLin_Vector class operator*, which requires
+//   the creation of a temp object for every assignment operation
+//
+//   the 's' on the other hand refers to the scilab gmres correction,
+//   to make convergence faster, that basically uses as residual
+//   a weighted residual: normr = || b - Ax || / || b ||, that is
+//   normr = fabs(g[i+1]) / normb;
+//   and not
+//   normr = fabs(g[i+1]);
+//   see also the notes inline about this choice
+//
+//   the 'all' refers to the increase of speed not allocating memory
+//   locally every time
+//
+//   This version has been modified to work with a complex potential matrix;
+//   this is not a general-purpose gmres dealing with complex values, but an optimized
+//   version that considers that the only imaginary parts are on the diagonal, and only
+//   for the rows corresponding to the dielectric panels. In this case, b and x have
+//   a length 2x the number of panels n, where the first n elements are the real parts,
+//   while the remaining n elements are the imaginary parts
+//
+//   If 'x0' is not NULL, it is used as initial vector instead of P*b. If a restart
+//   size is set (see GetGmresRestart()), the Krylov basis is restarted every 'restart'
+//   Arnoldi steps from the current solution, so no more than 'restart'+1 Krylov vectors
+//   are kept in memory; the same happens, with a warning, when there is no more memory
+//   to grow the basis
+int CSolveCap::gmresPrecondSFastAll(CLin_Vector *b, CLin_Vector *x, double gmresTol, CLin_Vector *x0)
+{
+	double normr, normb, tmp1, tmp2, length;
+	long i, j, iteration, size, k, ii, recycleNum, restart, totalIter;
+	bool ret, converged, outOfMem;
+	int retInt;
+	CLin_Range bre, xre;
+
+	// get system size
+	size = b->size();
+	// check consistency of size
+	ASSERT(size == (long)(*x).size());
+
+	if(x0 != NULL) {
+		// initial vector provided by the caller (e.g. warm start)
+		ASSERT(size == (long)(*x0).size());
+		for(k=0; k<size; k++) {
+			m_clsGmres_x0[k] = (*x0)[k];
+		}
+	}
+	// if there is a preconditioner
+	else if(m_clsGlobalVars.m_ucPrecondType != AUTOREFINE_PRECOND_NONE) {
+
+		// initial vector: having the approx inverted matrix, it is cheap to calculate the initial vector.
+		//  Simply put, to solve the preconditioned system
+		//  A * P * y = b and x = P * y, the best choice for y0 initial vector is b,
+		//  since a good P should be as similar as possible to inv(A), so A * P ~= I
+		//  So x0 = P * y0 = P * b
+		ComputePrecondVectFast(&m_clsGmres_x0, b, m_clsGlobalVars.m_ucPrecondType);
+	}
+	else {
+		// no preconditioner; initial vector x0 is an all zeros vector
+		for(k=0; k<size; k++) {
+			m_clsGmres_x0[k] = 0.0;
+		}
+	}
+	normb = mod(*b);
+
+	// number of Arnoldi steps before restarting, i.e. max number of Krylov vectors
+	// (after the first one) kept in memory
+	restart = (long)GetGmresRestart();
+
+	recycleNum = (long)m_uiRecycleCur;
+	totalIter = 0;
+	converged = false;
+	outOfMem = false;
+
+	//
+	// restart cycles; at each cycle, m_clsGmres_x0 is the current approximation of the solution
+	//
+	do {
+
+		if(x0 == NULL && m_clsGlobalVars.m_ucPrecondType == AUTOREFINE_PRECOND_NONE && totalIter == 0) {
+			// x0 is an all zeros vector, so r = b
+			for(k=0; k<size; k++) {
+				m_clsGmres_r[k] = (*b)[k];
+			}
+		}
+		else {
+			// r = b - A * x0;
+			// matrix - vector multiplication
+			retInt = m_clsMulthier.MultiplyMatByVec_fast(&m_clsGmres_v, &m_clsGmres_x0);
+			if(retInt != FC_NORMAL_END) {
+				return retInt;
+			}
+			// and get r
+			//m_clsGmres_r = *b - m_clsGmres_v;
+			for(k=0; k<size; k++) {
+				m_clsGmres_r[k] = (*b)[k] - m_clsGmres_v[k];
+			}
+		}
+		normr = mod(m_clsGmres_r);
+
+		// if recycling, project the residual out of the recycled space: being A*P*u(j) = c(j)
+		// with orthonormal 'c' vectors, the correction y = sum(a(j)*u(j)) with a(j) = c(j)'*r
+		// removes from r its components along the 'c' vectors (see UpdateRecycledSpace())
+		if(recycleNum > 0) {
+			for(j=0; j<recycleNum; j++) {
+				m_clsRecycle_a[j] = dot_prod(m_pclsRecycle_c[j], m_clsGmres_r);
+				for(k=0; k<size; k++) {
+					m_clsGmres_r[k] = m_clsGmres_r[k] - m_clsRecycle_a[j] * m_pclsRecycle_c[j][k];
+				}
+			}
+			normr = mod(m_clsGmres_r);
 		}
 
+		// init first column of Q matrix
+		//m_pclsGmres_q[0] = m_clsGmres_r / normr;
+		for(k=0; k<size; k++) {
+			m_pclsGmres_q[0][k] = m_clsGmres_r[k] / normr;
+		}
+
+		// init first element of first row of the
+		// Q matrix of the QR factors of H; this should be 1,
+		// using normr will produce the first row
+		// multiplied by normr, which is used to compute the solution
+		// Remark: this is not the Q matrix whose columns are q(i,j)
+		m_clsGmres_g[0] = normr;
+
 		//
-		// execute the i-th Arnoldi step, thus computing
-		// the i-th column of the H (upper Hessemberg) matrix
+		// if the norm of the residual is small enough,
+		// current vector (plus its correction in the recycled space, if any)
+		// is a good enough solution
 		//
+		if(normr / normb < gmresTol) {
+			converged = true;
+			iteration = -1;
+			break;
+		}
 
-		if(m_clsGlobalVars.m_bDumpResidual == true) {
-			LogMsg("%.3g ", normr);
+		if(totalIter == 0) {
+			LogMsg("GMRES Iteration: ");
 		}
-		LogMsg("%d ", i);
 
-		// allocate only if not already pre-allocated
-		if((long)m_uiGmresPrealloc[AUTOREFINE_HIER_PRE_0_LEVEL] < i) {
+		// start iteration
+		for(i = 0; i < restart && totalIter < SOLVE_GMRES_ITER_MAX && i < (long)size; i++, totalIter++) {
 
-			ASSERT((long)m_uiGmresPrealloc[AUTOREFINE_HIER_PRE_0_LEVEL] == i-1);
+			if(g_bFCContinue == false) {
+				return FC_USER_BREAK;
+			}
 
-			// allocate new column of h
-			// (remark: since vectors are 0-based, must
-			// allocate i+2 entries and not only i+1;
-			// i.e. variable 'i' starts at 0!)
-			ret = m_pclsGmres_h[i].newsize(i+2);
-			if(ret == false) {
-				return FC_OUT_OF_MEMORY;
+			//
+			// execute the i-th Arnoldi step, thus computing
+			// the i-th column of the H (upper Hessemberg) matrix
+			//
+
+			if(m_clsGlobalVars.m_bDumpResidual == true) {
+				LogMsg("%.3g ", normr);
 			}
-			g_clsMemUsage.m_ulGmresMem += (i+2) * sizeof(double);
-			// allocate new column of q
-			ret = m_pclsGmres_q[i+1].newsize(size);
-			if(ret == false) {
-				return FC_OUT_OF_MEMORY;
+			LogMsg("%d ", totalIter);
+
+			// allocate only if not already pre-allocated
+			if((long)m_uiGmresPrealloc[AUTOREFINE_HIER_PRE_0_LEVEL] < i) {
+
+				ASSERT((long)m_uiGmresPrealloc[AUTOREFINE_HIER_PRE_0_LEVEL] == i-1);
+
+				// allocate new column of h
+				// (remark: since vectors are 0-based, must
+				// allocate i+2 entries and not only i+1;
+				// i.e. variable 'i' starts at 0!)
+				ret = m_pclsGmres_h[i].newsize(i+2);
+				// allocate new column of q
+				ret = ret && m_pclsGmres_q[i+1].newsize(size);
+				if(ret == false) {
+					// if some Krylov vectors are already there, restart instead of failing,
+					// and keep restarting with the vectors that fit in memory
+					if(i < SOLVE_GMRES_MIN_RESTART) {
+						return FC_OUT_OF_MEMORY;
+					}
+					m_pclsGmres_h[i].destroy();
+					restart = i;
+					outOfMem = true;
+					break;
+				}
+				g_clsMemUsage.m_ulGmresMem += (i+2) * sizeof(double);
+				g_clsMemUsage.m_ulGmresMem += size * sizeof(double);
+
+				m_uiGmresPrealloc[AUTOREFINE_HIER_PRE_0_LEVEL]++;
 			}
-			g_clsMemUsage.m_ulGmresMem += size * sizeof(double);
 
-			m_uiGmresPrealloc[AUTOREFINE_HIER_PRE_0_LEVEL]++;
+			// compute new vector
+			//
+			if(m_clsGlobalVars.m_ucPrecondType == AUTOREFINE_PRECOND_NONE) {
+				retInt = m_clsMulthier.MultiplyMatByVec_fast(&m_clsGmres_v, &m_pclsGmres_q[i]);
+				if(retInt != FC_NORMAL_END) {
+					return retInt;
+				}
+			}
+			else {
+				// compute preconditioned vector
+				ComputePrecondVectFast(&m_clsGmres_Pq, &m_pclsGmres_q[i], m_clsGlobalVars.m_ucPrecondType);
+				// and use it in matrix - vector multiplication
+				retInt = m_clsMulthier.MultiplyMatByVec_fast(&m_clsGmres_v, &m_clsGmres_Pq);
+				if(retInt != FC_NORMAL_END) {
+					return retInt;
+				}
+			}
+
+			// keep the new vector orthogonal to the recycled space,
+			// storing the projections to compute the solution
+			for(j=0; j<recycleNum; j++) {
+				m_pclsRecycle_B[j][i] = dot_prod(m_pclsRecycle_c[j], m_clsGmres_v);
+				for(ii=0; ii<size; ii++) {
+					m_clsGmres_v[ii] = m_clsGmres_v[ii] - m_pclsRecycle_B[j][i] * m_pclsRecycle_c[j][ii];
+				}
+			}
+
+			// orthogonalize it, and get the new column of Q
+			m_pclsGmres_h[i][i+1] = OrthogonalizeCGS2(&m_clsGmres_v, m_pclsGmres_q, i+1, &m_pclsGmres_h[i], &m_clsGmres_w, true);
+
+			//
+			// rotate new vector (Givens rotations) to compute
+			// the (R;0) matrix of the QR factors of H(j+1);
+			// this is done updating (Q';tmp')*H(j) = (R(j);0)
+			// to produce (Q';tmp')*H(j+1)=(R(j+1);0)
+			// Remark: the first time the loop is executed,
+			// this rotation does not happen
+			//
+
+			// apply all old rotations to new i-th column
+			// of the H matrix to get Q*H from H, but for the
+			// last two elements
+			for(j=0; j<i; j++) {
+				tmp1 = m_pclsGmres_h[i][j];
+				tmp2 = m_pclsGmres_h[i][j+1];
+				m_pclsGmres_h[i][j] = m_clsGmres_c[j] * tmp1 - m_clsGmres_s[j]* tmp2;
+				m_pclsGmres_h[i][j+1] = m_clsGmres_c[j] * tmp2 + m_clsGmres_s[j] * tmp1;
+			}
+
+			// compute the new Givens rotation to annihilate h[i][i+1]
+			tmp1 = m_pclsGmres_h[i][i];
+			tmp2 = m_pclsGmres_h[i][i+1];
+			length = sqrt(tmp1 * tmp1 + tmp2 * tmp2);
+			m_clsGmres_c[i] = tmp1/length;
+			m_clsGmres_s[i] = -tmp2/length;
+
+			// apply new Givens rotation to incomplete
+			// (Q';tmp')*H(j+1) matrix i-th column
+			// to get the complete (R(j+1);0)
+			m_pclsGmres_h[i][i] = m_clsGmres_c[i] * tmp1 - m_clsGmres_s[i] * tmp2;
+			// this should be zero anyway
+			//h(i+1,i) = c(i) * tmp2 + s(i) * tmp1;
+			m_pclsGmres_h[i][i+1] = 0;
+
+			//
+			// Compute recursively the first column of the (Q';tmp')
+			// matrix of the QR factors of H(j+1); this is used to
+			// get implicitly the norm of the residual and to compute
+			// the solution once the norm is small enough
+			//
+
+			tmp1 = m_clsGmres_g[i];
+			m_clsGmres_g[i] = m_clsGmres_c[i] * tmp1;
+			m_clsGmres_g[i+1] = m_clsGmres_s[i] * tmp1;
+
+			// this is the norm of the residual
+			// remark: || b - A*Qj*z || = normb * fabs(g[i+1])
+			// (see "Matrix analysis and applied linear algebra", Meyers)
+			// so fabs(g[i+1]) is already the norm of the residual
+			// weighted by the norm of b (i.e the % difference)
+			// However this is not true here, also verified
+			// explicitly calculating the residual norm, once the solution
+			// is found (see below), so the weighted formula is correct
+			normr = fabs(m_clsGmres_g[i+1]) / normb;
+
+			//
+			// if the norm of the residual is small enough,
+			// exit loop (and return solution)
+			//
+			if(normr < gmresTol) {
+				converged = true;
+				totalIter++;
+				break;
+			}
+		}
+
+		// if not converged, since we ended the 'for' loop, 'i' has been incremented
+		// of one more (or the i-th step could not be allocated); to avoid breaking
+		// the end of the arrays here below, we must decrease 'i'
+		if(converged == false) {
+			i--;
 		}
 
-		// compute new vector
 		//
-		if(m_clsGlobalVars.m_ucPrecondType == AUTOREFINE_PRECOND_NONE) {
-			retInt = m_clsMulthier.MultiplyMatByVec_fast(&m_clsGmres_v, &m_pclsGmres_q[i]);
-			if(retInt != FC_NORMAL_END) {
-				return retInt;
+		// compute the solution, solving H(i)*z = normr * e1 for z using
+		// the first row of the Q matrix and the R matrix of the QR
+		// factorization of H; then the solution is x = Q(i)*z
+		//
+
+		iteration = i;
+
+		if(converged == false) {
+			if(totalIter >= SOLVE_GMRES_ITER_MAX || iteration + 1 >= size) {
+				ErrMsg("\nError: not converging after %d iterations, norm of the residual is %.3f, while targeting %.3f\n", totalIter, normr, gmresTol);
+				break;
 			}
-		}
-		else {
-			// compute preconditioned vector
-			ComputePrecondVectFast(&m_clsGmres_Pq, &m_pclsGmres_q[i], m_clsGlobalVars.m_ucPrecondType);
-			// and use it in matrix - vector multiplication
-			retInt = m_clsMulthier.MultiplyMatByVec_fast(&m_clsGmres_v, &m_clsGmres_Pq);
-			if(retInt != FC_NORMAL_END) {
-				return retInt;
+
+			// restart: update the current approximation of the solution, x0 = x0 + P * y,
+			// and start a new cycle from its residual
+			if(outOfMem == true) {
+				ErrMsg("\nWarning: not enough memory for the GMRES Krylov vectors, restarting every %d iterations\n", restart);
+				outOfMem = false;
+			}
+			ComputeGmresCorrection(iteration);
+			if(m_clsGlobalVars.m_ucPrecondType == AUTOREFINE_PRECOND_NONE) {
+				for(k=0; k<size; k++) {
+					m_clsGmres_x0[k] = m_clsGmres_x0[k] + m_clsGmres_y[k];
+				}
+			}
+			else {
+				ComputePrecondVectFast(&m_clsGmres_Pq, &m_clsGmres_y, m_clsGlobalVars.m_ucPrecondType);
+				for(k=0; k<size; k++) {
+					m_clsGmres_x0[k] = m_clsGmres_x0[k] + m_clsGmres_Pq[k];
+				}
 			}
+			LogMsg("(restart) ");
+		}
+	}
+	while(converged == false);
+
+	if(totalIter > 0) {
+		if(m_clsGlobalVars.m_bDumpResidual == true) {
+			LogMsg("%.3f ", normr);
 		}
+		LogMsg("\n");
+	}
 
-		//m_clsGmres_w = m_clsGmres_v;
+	// get the correction y of the last cycle
+	ComputeGmresCorrection(iteration);
+
+	if(m_clsGlobalVars.m_ucPrecondType == AUTOREFINE_PRECOND_NONE) {
+		//x = x0 + y;
+		for(k=0; k<size; k++) {
+			(*x)[k] = m_clsGmres_x0[k] + m_clsGmres_y[k];
+		}
+	}
+	else {
+		// undo the preconditioner to get x, the final solution,
+		// also considering initial vector in the solution
+		//x = x0 + P * y;
+		ComputePrecondVectFast(x, &m_clsGmres_y, m_clsGlobalVars.m_ucPrecondType);
+		//*x = m_clsGmres_x0 + *x;
 		for(k=0; k<size; k++) {
-			m_clsGmres_w[k] = m_clsGmres_v[k];
+			(*x)[k] = m_clsGmres_x0[k] + (*x)[k];
+		}
+	}
+
+	// recycle the correction for the next conductor solve
+	if(m_uiRecycleNum > 0 && iteration >= 0) {
+		retInt = UpdateRecycledSpace(x);
+		if(retInt != FC_NORMAL_END) {
+			return retInt;
+		}
+	}
+
+	// debug : explicit calculation of residual vector
+	// (is equal to normr*normb in this routine; this proves
+	// that normr here is weighted on normb)
+	//double residual2;
+	//CLin_Vector b_approx(size);
+	//m_clsMulthier.MultiplyMatByVec_fast(x, &b_approx);
+	//residual2 = mod(*b - b_approx);
+
+	return FC_NORMAL_END;
+}
+
+// Compute in 'm_clsGmres_y' the correction of the current gmresPrecondSFastAll() cycle,
+// after the 'iteration'-th Arnoldi step (-1 if none), i.e. y = Q(i)*z solving H(i)*z = normr * e1,
+// plus its component in the recycled space, if any
+void CSolveCap::ComputeGmresCorrection(long iteration)
+{
+	long i, j, k, size;
+	double tmp1;
+
+	size = m_clsGmres_y.size();
+
+	// H(i)*z = normb*e1 gives Q*R*z = normb*e1 -> R*z = Q'*normb*e1
+	// Since g(i) is already the first column of Q' multiplied by normb,
+	// it is the term Q'*normb*e1, so init the solution
+	//m_clsGmres_z = m_clsGmres_g;
+	for(k=0; k<=iteration; k++) {
+		m_clsGmres_z[k] = m_clsGmres_g[k];
+	}
+
+	// then solve R*z = Q'*normr*e1 by back substitution,
+	// knowing that R is upper triangular
+	for(i = iteration; i>=0; i--) {
+		m_clsGmres_z[i]= m_clsGmres_z[i] / m_pclsGmres_h[i][i];
+		for(j = i-1; j>=0; j--) {
+			m_clsGmres_z[j] = m_clsGmres_z[j] - m_pclsGmres_h[i][j] * m_clsGmres_z[i];
+		}
+	}
+
+	// multiply z by Q(i) to get y, the solution
+	// of the (possibly preconditioned) system
+	for(i=0; i<size; i++) {
+		for(j=0, tmp1 = 0; j<=iteration; j++) {
+			tmp1 += m_pclsGmres_q[j][i] * m_clsGmres_z[j];
+		}
+		m_clsGmres_y[i] = tmp1;
+	}
+
+	// add the component of the correction in the recycled space
+	if(m_uiRecycleCur > 0) {
+		ApplyRecycledCorrection(iteration);
+	}
+}
+
+//   Block version of gmresPrecondSFastAll()
+//
+//   Solves the 'vecNum' systems A*P*y(k) = b(k) & x(k) = P*y(k) at the same time,
+//   e.g. for all the conductor excitations. Every right-hand side has its own
+//   Krylov space, Hessemberg matrix and Givens rotations, exactly as in
+//   gmresPrecondSFastAll(), so the solutions are the same; however the matrix - vector
+//   products of all the right-hand sides at each Arnoldi step are computed with a single
+//   CMultHier::MultiplyMatByBlock() call, that fetches the links only once for all the
+//   vectors. Right-hand sides whose residual is small enough are dropped from the block
+//   (deflated), so the following products are computed only on the ones still iterating.
+//
+//   'b' and 'x' are arrays of 'vecNum' vectors; 'vecNum' cannot exceed the block size
+//   passed to AllocateBlockGmres()
+int CSolveCap::gmresPrecondSFastBlock(CLin_Vector *b, CLin_Vector *x, unsigned int vecNum, double gmresTol)
+{
+	double normr, normb, maxnormr, tmp1, tmp2, length;
+	long i, j, iteration, size, k, qbase, hbase;
+	unsigned int col, a, activeNum, newActiveNum;
+	bool ret;
+	int retInt;
+
+	ASSERT(vecNum > 0 && vecNum <= m_uiBGmresVecNum);
+
+	// get system size
+	size = b[0].size();
+	// check consistency of size
+	ASSERT(size == (long)x[0].size());
+
+	// if there is a preconditioner
+	if(m_clsGlobalVars.m_ucPrecondType != AUTOREFINE_PRECOND_NONE) {
+
+		// initial vectors x0 = P * b (see gmresPrecondSFastAll())
+		for(col=0; col<vecNum; col++) {
+			ComputePrecondVectFast(&m_pclsBGmres_x0[col], &b[col], m_clsGlobalVars.m_ucPrecondType);
 		}
 
-		// orthogonalize it
-		for(j=0; j<=i; j++) {
-			m_pclsGmres_h[i][j] = dot_prod(m_pclsGmres_q[j], m_clsGmres_w);
-			for(ii=0; ii<size; ii++) {
-				m_clsGmres_v[ii] = m_clsGmres_v[ii] - m_pclsGmres_h[i][j] * m_pclsGmres_q[j][ii];
+		// r = b - A * x0, matrix - vector multiplication for all the right-hand sides at once
+		retInt = m_clsMulthier.MultiplyMatByBlock(m_pclsBGmres_v, m_pclsBGmres_x0, vecNum);
+		if(retInt != FC_NORMAL_END) {
+			return retInt;
+		}
+	}
+
+	activeNum = 0;
+	for(col=0; col<vecNum; col++) {
+
+		if(m_clsGlobalVars.m_ucPrecondType != AUTOREFINE_PRECOND_NONE) {
+			//m_clsGmres_r = b - m_pclsBGmres_v;
+			for(k=0; k<size; k++) {
+				m_clsGmres_r[k] = b[col][k] - m_pclsBGmres_v[col][k];
 			}
+			normr = mod(m_clsGmres_r);
+			normb = mod(b[col]);
+		}
+		else {
+			// no preconditioner; assumes that initial vector x0 is an all zeros vector
+			//
+			m_clsGmres_r = b[col];
+			normr = mod(m_clsGmres_r);
+			normb = normr;
+		}
+
+		// init first column of Q matrix
+		qbase = col * (SOLVE_GMRES_ITER_MAX+1);
+		for(k=0; k<size; k++) {
+			m_pclsBGmres_q[qbase][k] = m_clsGmres_r[k] / normr;
 		}
 
-		m_pclsGmres_h[i][i+1] = mod(m_clsGmres_v);
+		// init first element of first row of the Q matrix of the QR factors of H
+		m_pclsBGmres_g[col][0] = normr;
 
-		for(ii=0; ii<size; ii++) {
-			m_pclsGmres_q[i+1][ii] = m_clsGmres_v[ii] / (m_pclsGmres_h[i][i+1]);
+		m_clsBGmres_normb[col] = normb;
+		m_clsBGmres_normr[col] = normr / normb;
+		// no Arnoldi step yet
+		m_plBGmresIter[col] = -1;
+
+		// if the norm of the residual is small enough, initial vector is
+		// a good enough solution, otherwise the right-hand side enters the block
+		if(normr / normb >= gmresTol) {
+			m_puiBGmresActive[activeNum] = col;
+			activeNum++;
 		}
+	}
 
-		//
-		// rotate new vector (Givens rotations) to compute
-		// the (R;0) matrix of the QR factors of H(j+1);
-		// this is done updating (Q';tmp')*H(j) = (R(j);0)
-		// to produce (Q';tmp')*H(j+1)=(R(j+1);0)
-		// Remark: the first time the loop is executed,
-		// this rotation does not happen
-		//
+	if(activeNum > 0) {
+		LogMsg("Block GMRES Iteration (%d right-hand sides): ", vecNum);
+	}
 
-		// apply all old rotations to new i-th column
-		// of the H matrix to get Q*H from H, but for the
-		// last two elements
-		for(j=0; j<i; j++) {
-			tmp1 = m_pclsGmres_h[i][j];
-			tmp2 = m_pclsGmres_h[i][j+1];
-			m_pclsGmres_h[i][j] = m_clsGmres_c[j] * tmp1 - m_clsGmres_s[j]* tmp2;
-			m_pclsGmres_h[i][j+1] = m_clsGmres_c[j] * tmp2 + m_clsGmres_s[j] * tmp1;
+	// start iteration
+	for(i = 0; i < SOLVE_GMRES_ITER_MAX && i < (long)size && activeNum > 0; i++) {
+
+		if(g_bFCContinue == false) {
+			return FC_USER_BREAK;
 		}
 
-		// compute the new Givens rotation to annihilate h[i][i+1]
-		tmp1 = m_pclsGmres_h[i][i];
-		tmp2 = m_pclsGmres_h[i][i+1];
-		length = sqrt(tmp1 * tmp1 + tmp2 * tmp2);
-		m_clsGmres_c[i] = tmp1/length;
-		m_clsGmres_s[i] = -tmp2/length;
+		if(m_clsGlobalVars.m_bDumpResidual == true) {
+			// worst residual among the right-hand sides still in the block
+			for(a=0, maxnormr=0.0; a<activeNum; a++) {
+				if(m_clsBGmres_normr[m_puiBGmresActive[a]] > maxnormr) {
+					maxnormr = m_clsBGmres_normr[m_puiBGmresActive[a]];
+				}
+			}
+			LogMsg("%.3g ", maxnormr);
+		}
+		LogMsg("%d(%d) ", i, activeNum);
 
-		// apply new Givens rotation to incomplete
-		// (Q';tmp')*H(j+1) matrix i-th column
-		// to get the complete (R(j+1);0)
-		m_pclsGmres_h[i][i] = m_clsGmres_c[i] * tmp1 - m_clsGmres_s[i] * tmp2;
-		// this should be zero anyway
-		//h(i+1,i) = c(i) * tmp2 + s(i) * tmp1;
-		m_pclsGmres_h[i][i+1] = 0;
+		// prepare the block of vectors for the i-th Arnoldi step of all
+		// the right-hand sides still in the block
+		for(a=0; a<activeNum; a++) {
 
-		//
-		// Compute recursively the first column of the (Q';tmp')
-		// matrix of the QR factors of H(j+1); this is used to
-		// get implicitly the norm of the residual and to compute
-		// the solution once the norm is small enough
-		//
+			col = m_puiBGmresActive[a];
+			qbase = col * (SOLVE_GMRES_ITER_MAX+1);
+			hbase = col * SOLVE_GMRES_ITER_MAX;
 
-		tmp1 = m_clsGmres_g[i];
-		m_clsGmres_g[i] = m_clsGmres_c[i] * tmp1;
-		m_clsGmres_g[i+1] = m_clsGmres_s[i] * tmp1;
+			// allocate only if not already pre-allocated
+			if((long)m_puiBGmresPrealloc[col] < i) {
 
-		// this is the norm of the residual
-		// remark: || b - A*Qj*z || = normb * fabs(g[i+1])
-		// (see "Matrix analysis and applied linear algebra", Meyers)
-		// so fabs(g[i+1]) is already the norm of the residual
-		// weighted by the norm of b (i.e the % difference)
-		// However this is not true here, also verified
-		// explicitly calculating the residual norm, once the solution
-		// is found (see below), so the weighted formula is correct
-		normr = fabs(m_clsGmres_g[i+1]) / normb;
+				ASSERT((long)m_puiBGmresPrealloc[col] == i-1);
 
-		//
-		// if the norm of the residual is small enough,
-		// exit loop (and return solution)
-		//
-		if(normr < gmresTol) {
-			break;
+				// allocate new column of h
+				ret = m_pclsBGmres_h[hbase+i].newsize(i+2);
+				if(ret == false) {
+					return FC_OUT_OF_MEMORY;
+				}
+				g_clsMemUsage.m_ulGmresMem += (i+2) * sizeof(double);
+				// allocate new column of q
+				ret = m_pclsBGmres_q[qbase+i+1].newsize(size);
+				if(ret == false) {
+					return FC_OUT_OF_MEMORY;
+				}
+				g_clsMemUsage.m_ulGmresMem += size * sizeof(double);
+
+				m_puiBGmresPrealloc[col]++;
+			}
+
+			if(m_clsGlobalVars.m_ucPrecondType == AUTOREFINE_PRECOND_NONE) {
+				for(k=0; k<size; k++) {
+					m_pclsBGmres_Pq[a][k] = m_pclsBGmres_q[qbase+i][k];
+				}
+			}
+			else {
+				// compute preconditioned vector
+				ComputePrecondVectFast(&m_pclsBGmres_Pq[a], &m_pclsBGmres_q[qbase+i], m_clsGlobalVars.m_ucPrecondType);
+			}
+		}
+
+		// compute the new vectors of the whole block with a single pass over the links
+		retInt = m_clsMulthier.MultiplyMatByBlock(m_pclsBGmres_v, m_pclsBGmres_Pq, activeNum);
+		if(retInt != FC_NORMAL_END) {
+			return retInt;
+		}
+
+		// complete the Arnoldi step of each right-hand side, as in gmresPrecondSFastAll()
+		newActiveNum = 0;
+		for(a=0; a<activeNum; a++) {
+
+			col = m_puiBGmresActive[a];
+			qbase = col * (SOLVE_GMRES_ITER_MAX+1);
+			hbase = col * SOLVE_GMRES_ITER_MAX;
+
+			// orthogonalize it, and get the new column of Q
+			m_pclsBGmres_h[hbase+i][i+1] = OrthogonalizeCGS2(&m_pclsBGmres_v[a], &m_pclsBGmres_q[qbase], i+1, &m_pclsBGmres_h[hbase+i], &m_clsGmres_w, true);
+
+			// apply all old rotations to new i-th column of the H matrix
+			for(j=0; j<i; j++) {
+				tmp1 = m_pclsBGmres_h[hbase+i][j];
+				tmp2 = m_pclsBGmres_h[hbase+i][j+1];
+				m_pclsBGmres_h[hbase+i][j] = m_pclsBGmres_c[col][j] * tmp1 - m_pclsBGmres_s[col][j]* tmp2;
+				m_pclsBGmres_h[hbase+i][j+1] = m_pclsBGmres_c[col][j] * tmp2 + m_pclsBGmres_s[col][j] * tmp1;
+			}
+
+			// compute the new Givens rotation to annihilate h[i][i+1]
+			tmp1 = m_pclsBGmres_h[hbase+i][i];
+			tmp2 = m_pclsBGmres_h[hbase+i][i+1];
+			length = sqrt(tmp1 * tmp1 + tmp2 * tmp2);
+			m_pclsBGmres_c[col][i] = tmp1/length;
+			m_pclsBGmres_s[col][i] = -tmp2/length;
+
+			// apply new Givens rotation to the i-th column
+			m_pclsBGmres_h[hbase+i][i] = m_pclsBGmres_c[col][i] * tmp1 - m_pclsBGmres_s[col][i] * tmp2;
+			m_pclsBGmres_h[hbase+i][i+1] = 0;
+
+			// update the first column of the (Q';tmp') matrix
+			tmp1 = m_pclsBGmres_g[col][i];
+			m_pclsBGmres_g[col][i] = m_pclsBGmres_c[col][i] * tmp1;
+			m_pclsBGmres_g[col][i+1] = m_pclsBGmres_s[col][i] * tmp1;
+
+			// weighted norm of the residual (see gmresPrecondSFastAll())
+			normr = fabs(m_pclsBGmres_g[col][i+1]) / m_clsBGmres_normb[col];
+			m_clsBGmres_normr[col] = normr;
+			m_plBGmresIter[col] = i;
+
+			// if the norm of the residual is small enough, drop the right-hand side
+			// from the block, otherwise keep it for the next step
+			// (remark: 'newActiveNum' <= 'a', so the list can be compacted in place)
+			if(normr >= gmresTol) {
+				m_puiBGmresActive[newActiveNum] = col;
+				newActiveNum++;
+			}
 		}
+		activeNum = newActiveNum;
 	}
 
-	if(i >= SOLVE_GMRES_ITER_MAX || i >= size) {
-		ErrMsg("\nError: not converging after %d iterations, norm of the residual is %.3f, while targeting %.3f\n", i, normr, gmresTol);
-		// either case, since we ended the 'for' loop, 'i' has been incremented of one more;
-		// to avoid breaking the end of the arrays here below, we must decrease 'i'
-		i--;
+	// right-hand sides still in the block did not converge
+	for(a=0; a<activeNum; a++) {
+		col = m_puiBGmresActive[a];
+		ErrMsg("\nError: right-hand side %d not converging after %d iterations, norm of the residual is %.3f, while targeting %.3f\n", col, i, m_clsBGmres_normr[col], gmresTol);
 	}
 
-	if(m_clsGlobalVars.m_bDumpResidual == true) {
-		LogMsg("%.3f ", normr);
+	// close the iteration line, if any
+	if(i > 0) {
+		if(m_clsGlobalVars.m_bDumpResidual == true) {
+			for(col=0, maxnormr=0.0; col<vecNum; col++) {
+				if(m_clsBGmres_normr[col] > maxnormr) {
+					maxnormr = m_clsBGmres_normr[col];
+				}
+			}
+			LogMsg("%.3f ", maxnormr);
+		}
+		LogMsg("\n");
 	}
-	LogMsg("\n");
 
 	//
-	// compute the solution, solving H(i)*z = normr * e1 for z using
-	// the first row of the Q matrix and the R matrix of the QR
-	// factorization of H; then the solution is x = Q(i)*z
+	// compute the solutions, solving H(i)*z = normr * e1 for z
+	// for each right-hand side (see gmresPrecondSFastAll())
 	//
+	for(col=0; col<vecNum; col++) {
 
-	iteration = i;
+		qbase = col * (SOLVE_GMRES_ITER_MAX+1);
+		hbase = col * SOLVE_GMRES_ITER_MAX;
+		iteration = m_plBGmresIter[col];
 
-	// H(i)*z = normb*e1 gives Q*R*z = normb*e1 -> R*z = Q'*normb*e1
-	// Since g(i) is already the first column of Q' multiplied by normb,
-	// it is the term Q'*normb*e1, so init the solution
-	//m_clsGmres_z = m_clsGmres_g;
-	for(k=0; k<size; k++) {
-		m_clsGmres_z[k] = m_clsGmres_g[k];
-	}
+		// initial vector was already a good enough solution
+		if(iteration < 0) {
+			if(m_clsGlobalVars.m_ucPrecondType == AUTOREFINE_PRECOND_NONE) {
+				x[col] = CLin_Vector(size, 0.0);
+			}
+			else {
+				x[col] = m_pclsBGmres_x0[col];
+			}
+			continue;
+		}
 
-	// then solve R*z = Q'*normr*e1 by back substitution,
-	// knowing that R is upper triangular
-	for(i = iteration; i>=0; i--) {
-		m_clsGmres_z[i]= m_clsGmres_z[i] / m_pclsGmres_h[i][i];
-		for(j = i-1; j>=0; j--) {
-			m_clsGmres_z[j] = m_clsGmres_z[j] - m_pclsGmres_h[i][j] * m_clsGmres_z[i];
+		for(k=0; k<=iteration; k++) {
+			m_clsGmres_z[k] = m_pclsBGmres_g[col][k];
 		}
-	}
 
+		// solve R*z = Q'*normr*e1 by back substitution
+		for(i = iteration; i>=0; i--) {
+			m_clsGmres_z[i]= m_clsGmres_z[i] / m_pclsBGmres_h[hbase+i][i];
+			for(j = i-1; j>=0; j--) {
+				m_clsGmres_z[j] = m_clsGmres_z[j] - m_pclsBGmres_h[hbase+i][j] * m_clsGmres_z[i];
+			}
+		}
 
-	// multiply z by Q(i) to get y, the solution
-	// of the (possibly preconditioned) system
-	for(i=0; i<size; i++) {
-		for(j=0, tmp1 = 0; j<=iteration; j++) {
-			tmp1 += m_pclsGmres_q[j][i] * m_clsGmres_z[j];
+		// multiply z by Q(i) to get y
+		for(i=0; i<size; i++) {
+			for(j=0, tmp1 = 0; j<=iteration; j++) {
+				tmp1 += m_pclsBGmres_q[qbase+j][i] * m_clsGmres_z[j];
+			}
+			m_clsGmres_y[i] = tmp1;
 		}
-		m_clsGmres_y[i] = tmp1;
-	}
 
-	if(m_clsGlobalVars.m_ucPrecondType == AUTOREFINE_PRECOND_NONE) {
-		*x = m_clsGmres_y;
-	}
-	else {
-		// undo the preconditioner to get x, the final solution,
-		// also considering initial vector in the solution
-		//x = x0 + P * y;
-		ComputePrecondVectFast(x, &m_clsGmres_y, m_clsGlobalVars.m_ucPrecondType);
-		//*x = m_clsGmres_x0 + *x;
-		for(k=0; k<size; k++) {
-			(*x)[k] = m_clsGmres_x0[k] + (*x)[k];
+		if(m_clsGlobalVars.m_ucPrecondType == AUTOREFINE_PRECOND_NONE) {
+			x[col] = m_clsGmres_y;
+		}
+		else {
+			// undo the preconditioner, also considering initial vector in the solution
+			//x = x0 + P * y;
+			ComputePrecondVectFast(&x[col], &m_clsGmres_y, m_clsGlobalVars.m_ucPrecondType);
+			for(k=0; k<size; k++) {
+				x[col][k] = m_pclsBGmres_x0[col][k] + x[col][k];
+			}
 		}
 	}
 
-	// debug : explicit calculation of residual vector
-	// (is equal to normr*normb in this routine; this proves
-	// that normr here is weighted on normb)
-	//double residual2;
-	//CLin_Vector b_approx(size);
-	//m_clsMulthier.MultiplyMatByVec_fast(x, &b_approx);
-	//residual2 = mod(*b - b_approx);
-
 	return FC_NORMAL_END;
 }
 
-//   Generalized Minimum Residual Method with preconditioner
-//
-//   x = gmresPrecond(A,b,P) attempt to solve the preconditioned
-//   system A*P*y = b & x = P*y
-//
-//   Enrico Di Lorenzo, 2004/07/06
-//
-//   'fast' refers to the direct vector multiplication loops used
-//   instead of CLin_Vector class operator*, which requires
-//   the creation of a temp object for every assignment operation
-//
-//   the 's' on the other hand refers to the scilab gmres correction,
-//   to make convergence faster, that basically uses as residual
-//   a weighted residual: normr = || b - Ax || / || b ||, that is
-//   normr = fabs(g[i+1]) / normb;
-//   and not
-//   normr = fabs(g[i+1]);
-//   see also the notes inline about this choice
-//
-//   the 'all' refers to the increase of speed not allocating memory
-//   locally every time
+//   Version of gmresPrecondSFastAll() using the vectors of the workspace 'ws',
+//   so that more instances can run concurrently on different right-hand sides
+//   (see SolveConcurrent()). The matrix - vector products use the node arrays
+//   of 'ws' as well, so the workspace must have been prepared by AllocateSolveWorkspaces().
 //
-//   the 'upper' refers to the fact that this function is used in
-//   upper iteration of hierarchical precond, so it is using
-//   other global vars than 'gmresPrecondSFastAll', since it will
-//   be called for each iteration step
-int CSolveCap::gmresPrecondSFastAllUpper(CLin_Vector *b, CLin_Vector *x, double gmresTol, unsigned char precondType)
+//   Remark: nothing is logged from here, since this is called by the worker threads;
+//   the number of iterations and the norm of the residual are returned in 'ws'
+//   ('m_lIterations' is SOLVE_GMRES_ITER_MAX if not converging) and logged by the caller
+int CSolveCap::gmresPrecondSFastAllWs(CLin_Vector *b, CLin_Vector *x, double gmresTol, CSolveWorkspace *ws)
 {
 	double normr, normb, tmp1, tmp2, length;
-	long i, ii, size, j, iteration;
+	long i, j, iteration, size, k;
 	bool ret;
 	int retInt;
 
 	// get system size
 	size = b->size();
 	// check consistency of size
-//	ASSERT(size == *x.size());
+	ASSERT(size == (long)(*x).size());
+
+	ws->m_lIterations = 0;
 
 	// if there is a preconditioner
-	if(precondType != AUTOREFINE_PRECOND_NONE) {
+	if(m_clsGlobalVars.m_ucPrecondType != AUTOREFINE_PRECOND_NONE) {
 
-		// initial vector: having the approx inverted matrix, it is cheap to calculate the initial vector.
-		//  Simply put, to solve the preconditioned system
-		//  A * P * y = b and x = P * y, the best choice for y0 initial vector is b,
-		//  since a good P should be as similar as possible to inv(A), so A * P ~= I
-		//  So x0 = P * y0 = P * b
-		ComputePrecondVectFast(&m_clsGmres1_x0, b, precondType);
+		// initial vector x0 = P * b (see gmresPrecondSFastAll())
+		ComputePrecondVectConc(&ws->m_clsX0, b, m_clsGlobalVars.m_ucPrecondType);
 
 		// r = b - A * x0;
-		// matrix - vector multiplication
-		retInt = m_clsMulthier.MultiplyMatByVec_fast(&m_clsGmres1_v, &m_clsGmres1_x0);
+		retInt = m_clsMulthier.MultiplyMatByVec_fast(&ws->m_clsV, &ws->m_clsX0, &ws->m_clsMultWs);
 		if(retInt != FC_NORMAL_END) {
 			return retInt;
 		}
-
-		// and get r
-		m_clsGmres1_r = *b - m_clsGmres1_v;
-		normr = mod(m_clsGmres1_r);
+		for(k=0; k<size; k++) {
+			ws->m_clsR[k] = (*b)[k] - ws->m_clsV[k];
+		}
+		normr = mod(ws->m_clsR);
 		normb = mod(*b);
 	}
 	else {
 		// no preconditioner; assumes that initial vector x0 is an all zeros vector
-		//
-		m_clsGmres1_r = *b;
-		normr = mod(m_clsGmres1_r);
+		ws->m_clsR = *b;
+		normr = mod(ws->m_clsR);
 		normb = normr;
 	}
 
-	// allocate and init first column of Q matrix
-	m_pclsGmres1_q[0] = CLin_Vector(m_clsGmres1_r / normr);
+	// init first column of Q matrix
+	for(k=0; k<size; k++) {
+		ws->m_pclsQ[0][k] = ws->m_clsR[k] / normr;
+	}
 
-	// init first element of first row of the
-	// Q matrix of the QR factors of H; this should be 1,
-	// using normr will produce the first row
-	// multiplied by normr, which is used to compute the solution
-	// Remark: this is not the Q matrix whose columns are q(i,j)
-	m_clsGmres1_g[0] = normr;
+	// init first element of first row of the Q matrix of the QR factors of H
+	ws->m_clsG[0] = normr;
 
-	LogMsg("\nUpper GMRES Iteration: ");
+	ws->m_dNormr = normr / normb;
 
 	//
 	// if the norm of the residual is small enough,
 	// initial vector is a good enough solution
 	//
 	if(normr / normb < gmresTol) {
-
-		// dump residual and first iteration
-		if(m_clsGlobalVars.m_bDumpResidual == true) {
-			LogMsg("%.3g ", normr / normb);
-		}
-		LogMsg("%d \n", 0);
-
-		if(precondType == AUTOREFINE_PRECOND_NONE) {
+		if(m_clsGlobalVars.m_ucPrecondType == AUTOREFINE_PRECOND_NONE) {
 			*x = CLin_Vector(size, 0.0);
 		}
 		else {
-			*x = m_clsGmres1_x0;
+			*x = ws->m_clsX0;
 		}
-		return 0;
+		return FC_NORMAL_END;
 	}
 
 	// start iteration
-	for(i = 0; i < SOLVE_GMRES_ITER_MAX && i < size; i++) {
+	for(i = 0; i < SOLVE_GMRES_ITER_MAX && i < (long)size; i++) {
 
 		if(g_bFCContinue == false) {
 			return FC_USER_BREAK;
 		}
 
-		//
-		// execute the i-th Arnoldi step, thus computing
-		// the i-th column of the H (upper Hessemberg) matrix
-		//
-
-		if(m_clsGlobalVars.m_bDumpResidual == true) {
-			LogMsg("%.3g ", normr);
-		}
-		LogMsg("%d ", i);
-
 		// allocate only if not already pre-allocated
-		if((long)m_uiGmresPrealloc[AUTOREFINE_HIER_PRE_1_LEVEL] < i) {
+		if((long)ws->m_uiPrealloc < i) {
 
-			ASSERT((long)m_uiGmresPrealloc[AUTOREFINE_HIER_PRE_1_LEVEL] == i-1);
+			ASSERT((long)ws->m_uiPrealloc == i-1);
 
 			// allocate new column of h
-			// (remark: since vectors are 0-based, must
-			// allocate i+2 entries and not only i+1;
-			// i.e. variable 'i' starts at 0!)
-			ret = m_pclsGmres1_h[i].newsize(i+2);
+			ret = ws->m_pclsH[i].newsize(i+2);
 			if(ret == false) {
 				return FC_OUT_OF_MEMORY;
 			}
-			g_clsMemUsage.m_ulGmresMem += (i + 2) * sizeof(double);
 			// allocate new column of q
-			ret = m_pclsGmres1_q[i+1].newsize(size);
+			ret = ws->m_pclsQ[i+1].newsize(size);
 			if(ret == false) {
 				return FC_OUT_OF_MEMORY;
 			}
-			g_clsMemUsage.m_ulGmresMem += size * sizeof(double);
+			#pragma omp atomic
+			g_clsMemUsage.m_ulGmresMem += (i+2+size) * sizeof(double);
 
-			m_uiGmresPrealloc[AUTOREFINE_HIER_PRE_1_LEVEL]++;
+			ws->m_uiPrealloc++;
 		}
 
 		// compute new vector
 		//
-		if(precondType == AUTOREFINE_PRECOND_NONE) {
-			retInt = m_clsMulthier.MultiplyMatByVec_fast(&m_clsGmres1_v, &m_pclsGmres1_q[i]);
-			if(retInt != FC_NORMAL_END) {
-				return retInt;
-			}
+		if(m_clsGlobalVars.m_ucPrecondType == AUTOREFINE_PRECOND_NONE) {
+			retInt = m_clsMulthier.MultiplyMatByVec_fast(&ws->m_clsV, &ws->m_pclsQ[i], &ws->m_clsMultWs);
 		}
 		else {
 			// compute preconditioned vector
-			ComputePrecondVectFast(&m_clsGmres1_Pq, &m_pclsGmres1_q[i], precondType);
+			ComputePrecondVectConc(&ws->m_clsPq, &ws->m_pclsQ[i], m_clsGlobalVars.m_ucPrecondType);
 			// and use it in matrix - vector multiplication
-			retInt = m_clsMulthier.MultiplyMatByVec_fast(&m_clsGmres1_v, &m_clsGmres1_Pq);
-			if(retInt != FC_NORMAL_END) {
-				return retInt;
-			}
-		}
-
-		m_clsGmres1_w = m_clsGmres1_v;
-
-		// orthogonalize it
-		for(j=0; j<=i; j++) {
-			m_pclsGmres1_h[i][j] = dot_prod(m_pclsGmres1_q[j], m_clsGmres1_w);
-			for(ii=0; ii<(long)m_clsGmres1_v.size(); ii++) {
-				m_clsGmres1_v[ii] = m_clsGmres1_v[ii] - m_pclsGmres1_h[i][j] * m_pclsGmres1_q[j][ii];
-			}
+			retInt = m_clsMulthier.MultiplyMatByVec_fast(&ws->m_clsV, &ws->m_clsPq, &ws->m_clsMultWs);
 		}
-
-		m_pclsGmres1_h[i][i+1] = mod(m_clsGmres1_v);
-
-		for(ii=0; ii<(long)m_clsGmres1_v.size(); ii++) {
-			m_pclsGmres1_q[i+1][ii] = m_clsGmres1_v[ii] / (m_pclsGmres1_h[i][i+1]);
+		if(retInt != FC_NORMAL_END) {
+			return retInt;
 		}
 
-		//
-		// rotate new vector (Givens rotations) to compute
-		// the (R;0) matrix of the QR factors of H(j+1);
-		// this is done updating (Q';tmp')*H(j) = (R(j);0)
-		// to produce (Q';tmp')*H(j+1)=(R(j+1);0)
-		// Remark: the first time the loop is executed,
-		// this rotation does not happen
-		//
+		// orthogonalize it, and get the new column of Q
+		// (serially, since the concurrent solves already use all the threads)
+		ws->m_pclsH[i][i+1] = OrthogonalizeCGS2(&ws->m_clsV, ws->m_pclsQ, i+1, &ws->m_pclsH[i], &ws->m_clsW, false);
 
-		// apply all old rotations to new i-th column
-		// of the H matrix to get Q*H from H, but for the
-		// last two elements
+		// apply all old rotations to new i-th column of the H matrix
 		for(j=0; j<i; j++) {
-			tmp1 = m_pclsGmres1_h[i][j];
-			tmp2 = m_pclsGmres1_h[i][j+1];
-			m_pclsGmres1_h[i][j] = m_clsGmres1_c[j] * tmp1 - m_clsGmres1_s[j]* tmp2;
-			m_pclsGmres1_h[i][j+1] = m_clsGmres1_c[j] * tmp2 + m_clsGmres1_s[j] * tmp1;
+			tmp1 = ws->m_pclsH[i][j];
+			tmp2 = ws->m_pclsH[i][j+1];
+			ws->m_pclsH[i][j] = ws->m_clsC[j] * tmp1 - ws->m_clsS[j]* tmp2;
+			ws->m_pclsH[i][j+1] = ws->m_clsC[j] * tmp2 + ws->m_clsS[j] * tmp1;
 		}
 
 		// compute the new Givens rotation to annihilate h[i][i+1]
-		tmp1 = m_pclsGmres1_h[i][i];
-		tmp2 = m_pclsGmres1_h[i][i+1];
+		tmp1 = ws->m_pclsH[i][i];
+		tmp2 = ws->m_pclsH[i][i+1];
 		length = sqrt(tmp1 * tmp1 + tmp2 * tmp2);
-		m_clsGmres1_c[i] = tmp1/length;
-		m_clsGmres1_s[i] = -tmp2/length;
-
-		// apply new Givens rotation to incomplete
-		// (Q';tmp')*H(j+1) matrix i-th column
-		// to get the complete (R(j+1);0)
-		m_pclsGmres1_h[i][i] = m_clsGmres1_c[i] * tmp1 - m_clsGmres1_s[i] * tmp2;
-		// this should be zero anyway
-		//h(i+1,i) = c(i) * tmp2 + s(i) * tmp1;
-		m_pclsGmres1_h[i][i+1] = 0;
+		ws->m_clsC[i] = tmp1/length;
+		ws->m_clsS[i] = -tmp2/length;
 
-		//
-		// Compute recursively the first column of the (Q';tmp')
-		// matrix of the QR factors of H(j+1); this is used to
-		// get implicitly the norm of the residual and to compute
-		// the solution once the norm is small enough
-		//
+		// apply new Givens rotation to the i-th column
+		ws->m_pclsH[i][i] = ws->m_clsC[i] * tmp1 - ws->m_clsS[i] * tmp2;
+		ws->m_pclsH[i][i+1] = 0;
 
-		tmp1 = m_clsGmres1_g[i];
-		m_clsGmres1_g[i] = m_clsGmres1_c[i] * tmp1;
-		m_clsGmres1_g[i+1] = m_clsGmres1_s[i] * tmp1;
+		// update the first column of the (Q';tmp') matrix
+		tmp1 = ws->m_clsG[i];
+		ws->m_clsG[i] = ws->m_clsC[i] * tmp1;
+		ws->m_clsG[i+1] = ws->m_clsS[i] * tmp1;
 
-		// this is the norm of the residual
-		// remark: || b - A*Qj*z || = normb * fabs(g[i+1])
-		// (see "Matrix analysis and applied linear algebra", Meyers)
-		// so fabs(g[i+1]) is already the norm of the residual
-		// weighted by the norm of b (i.e the % difference)
-		// However this is not true here, also verified
-		// explicitly calculating the residual norm, once the solution
-		// is found (see below), so the weighted formula is correct
-		normr = fabs(m_clsGmres1_g[i+1]) / normb;
+		// weighted norm of the residual (see gmresPrecondSFastAll())
+		normr = fabs(ws->m_clsG[i+1]) / normb;
 
 		//
 		// if the norm of the residual is small enough,
@@ -2813,79 +5630,64 @@ int CSolveCap::gmresPrecondSFastAllUpper(CLin_Vector *b, CLin_Vector *x, double
 		}
 	}
 
+	ws->m_dNormr = normr;
+
 	if(i >= SOLVE_GMRES_ITER_MAX || i >= size) {
-		ErrMsg("\nError: not converging after %d iterations, norm of the residual is %.3f, while targeting %.3f\n", i, normr, gmresTol);
-		// either case, since we ended the 'for' loop, 'i' has been incremented of one more;
-		// to avoid breaking the end of the arrays here below, we must decrease 'i'
+		// not converging, the caller reports the error
+		ws->m_lIterations = SOLVE_GMRES_ITER_MAX;
+		// since we ended the 'for' loop, 'i' has been incremented of one more
 		i--;
 	}
-
-	if(m_clsGlobalVars.m_bDumpResidual == true) {
-		LogMsg("%.3f ", normr);
+	else {
+		ws->m_lIterations = i+1;
 	}
-	LogMsg("\n");
 
 	//
-	// compute the solution, solving H(i)*z = normr * e1 for z using
-	// the first row of the Q matrix and the R matrix of the QR
-	// factorization of H; then the solution is x = Q(i)*z
+	// compute the solution, solving H(i)*z = normr * e1 for z
+	// (see gmresPrecondSFastAll())
 	//
 
 	iteration = i;
 
-	// H(i)*z = normb*e1 gives Q*R*z = normb*e1 -> R*z = Q'*normb*e1
-	// Since g(i) is already the first column of Q' multiplied by normb,
-	// it is the term Q'*normb*e1, so init the solution
-	m_clsGmres1_z = m_clsGmres1_g;
+	for(k=0; k<=iteration; k++) {
+		ws->m_clsZ[k] = ws->m_clsG[k];
+	}
 
-	// then solve R*z = Q'*normr*e1 by back substitution,
-	// knowing that R is upper triangular
+	// solve R*z = Q'*normr*e1 by back substitution
 	for(i = iteration; i>=0; i--) {
-		m_clsGmres1_z[i]= m_clsGmres1_z[i] / m_pclsGmres1_h[i][i];
+		ws->m_clsZ[i]= ws->m_clsZ[i] / ws->m_pclsH[i][i];
 		for(j = i-1; j>=0; j--) {
-			m_clsGmres1_z[j] = m_clsGmres1_z[j] - m_pclsGmres1_h[i][j] * m_clsGmres1_z[i];
+			ws->m_clsZ[j] = ws->m_clsZ[j] - ws->m_pclsH[i][j] * ws->m_clsZ[i];
 		}
 	}
 
-
-	// multiply z by Q(i) to get y, the solution
-	// of the (possibly preconditioned) system
+	// multiply z by Q(i) to get y
 	for(i=0; i<size; i++) {
 		for(j=0, tmp1 = 0; j<=iteration; j++) {
-			tmp1 += m_pclsGmres1_q[j][i] * m_clsGmres1_z[j];
+			tmp1 += ws->m_pclsQ[j][i] * ws->m_clsZ[j];
 		}
-		m_clsGmres1_y[i] = tmp1;
+		ws->m_clsY[i] = tmp1;
 	}
 
-	if(precondType == AUTOREFINE_PRECOND_NONE) {
-		*x = m_clsGmres1_y;
+	if(m_clsGlobalVars.m_ucPrecondType == AUTOREFINE_PRECOND_NONE) {
+		*x = ws->m_clsY;
 	}
 	else {
-		// undo the preconditioner to get x, the final solution,
-		// also considering initial vector in the solution
+		// undo the preconditioner, also considering initial vector in the solution
 		//x = x0 + P * y;
-		ComputePrecondVectFast(x, &m_clsGmres1_y, precondType);
-		*x = m_clsGmres1_x0 + *x;
+		ComputePrecondVectConc(x, &ws->m_clsY, m_clsGlobalVars.m_ucPrecondType);
+		for(k=0; k<size; k++) {
+			(*x)[k] = ws->m_clsX0[k] + (*x)[k];
+		}
 	}
 
-	// debug : explicit calculation of residual vector
-	// (is equal to normr*normb in this routine; this proves
-	// that normr here is weighted on normb)
-	//double residual2;
-	//CLin_Vector b_approx(size);
-	//m_clsMulthier.MultiplyMatByVec_fast(x, &b_approx);
-	//residual2 = mod(*b - b_approx);
-
-	LogMsg("\n");
-	return 0;
+	return FC_NORMAL_END;
 }
 
-//   Flexible Generalized Minimum Residual Method with preconditioner
+//   Generalized Minimum Residual Method with preconditioner
 //
 //   x = gmresPrecond(A,b,P) attempt to solve the preconditioned
 //   system A*P*y = b & x = P*y
-//   Flexible means that the preconditioner can change at every iteration
-//   (see "Iterative methods for sparse linear systems", Yousef Saad)
 //
 //   Enrico Di Lorenzo, 2004/07/06
 //
@@ -2904,10 +5706,17 @@ int CSolveCap::gmresPrecondSFastAllUpper(CLin_Vector *b, CLin_Vector *x, double
 //   the 'all' refers to the increase of speed not allocating memory
 //   locally every time
 //
-int CSolveCap::gmresFlexPrecondSFastAll(CLin_Vector *b, CLin_Vector *x, double gmresTol)
+//   the 'upper' refers to the fact that this function is used in
+//   upper iteration of hierarchical precond, so it is using
+//   other global vars than 'gmresPrecondSFastAll', since it will
+//   be called for each iteration step. Being only a preconditioner,
+//   the iteration stops after SOLVE_HIER_INNER_ITER_MAX steps also if
+//   not converged (the outer flexible gmres accepts an approximate
+//   inverse); the number of iterations is left in 'm_lUpperIterations'
+int CSolveCap::gmresPrecondSFastAllUpper(CLin_Vector *b, CLin_Vector *x, double gmresTol, unsigned char precondType)
 {
 	double normr, normb, tmp1, tmp2, length;
-	long size, i, j, iteration, ii;
+	long i, size, j, iteration;
 	bool ret;
 	int retInt;
 
@@ -2917,62 +5726,69 @@ int CSolveCap::gmresFlexPrecondSFastAll(CLin_Vector *b, CLin_Vector *x, double g
 //	ASSERT(size == *x.size());
 
 	// if there is a preconditioner
-	if(m_clsGlobalVars.m_ucPrecondType != AUTOREFINE_PRECOND_NONE) {
+	if(precondType != AUTOREFINE_PRECOND_NONE) {
 
 		// initial vector: having the approx inverted matrix, it is cheap to calculate the initial vector.
 		//  Simply put, to solve the preconditioned system
 		//  A * P * y = b and x = P * y, the best choice for y0 initial vector is b,
 		//  since a good P should be as similar as possible to inv(A), so A * P ~= I
 		//  So x0 = P * y0 = P * b
-		ComputePrecondVectFast(&m_clsGmres_x0, b, m_clsGlobalVars.m_ucPrecondType);
+		ComputePrecondVectFast(&m_clsGmres1_x0, b, precondType);
 
 		// r = b - A * x0;
 		// matrix - vector multiplication
-		retInt = m_clsMulthier.MultiplyMatByVec_fast(&m_clsGmres_v, &m_clsGmres_x0);
+		retInt = m_clsMulthier.MultiplyMatByVec_fast(&m_clsGmres1_v, &m_clsGmres1_x0);
 		if(retInt != FC_NORMAL_END) {
 			return retInt;
 		}
+
 		// and get r
-		m_clsGmres_r = *b - m_clsGmres_v;
-		normr = mod(m_clsGmres_r);
+		m_clsGmres1_r = *b - m_clsGmres1_v;
+		normr = mod(m_clsGmres1_r);
 		normb = mod(*b);
 	}
 	else {
 		// no preconditioner; assumes that initial vector x0 is an all zeros vector
 		//
-		m_clsGmres_r = *b;
-		normr = mod(m_clsGmres_r);
+		m_clsGmres1_r = *b;
+		normr = mod(m_clsGmres1_r);
 		normb = normr;
 	}
 
+	m_lUpperIterations = 0;
+
+	// a null vector is mapped to a null vector
+	if(normb == 0.0) {
+		*x = CLin_Vector(size, 0.0);
+		return FC_NORMAL_END;
+	}
+
 	// allocate and init first column of Q matrix
-	m_pclsGmres_q[0] = CLin_Vector(m_clsGmres_r / normr);
+	m_pclsGmres1_q[0] = CLin_Vector(m_clsGmres1_r / normr);
 
 	// init first element of first row of the
 	// Q matrix of the QR factors of H; this should be 1,
 	// using normr will produce the first row
 	// multiplied by normr, which is used to compute the solution
 	// Remark: this is not the Q matrix whose columns are q(i,j)
-	m_clsGmres_g[0] = normr;
+	m_clsGmres1_g[0] = normr;
 
 	//
 	// if the norm of the residual is small enough,
 	// initial vector is a good enough solution
 	//
 	if(normr / normb < gmresTol) {
-		if(m_clsGlobalVars.m_ucPrecondType == AUTOREFINE_PRECOND_NONE) {
+		if(precondType == AUTOREFINE_PRECOND_NONE) {
 			*x = CLin_Vector(size, 0.0);
 		}
 		else {
-			*x = m_clsGmres_x0;
+			*x = m_clsGmres1_x0;
 		}
 		return FC_NORMAL_END;
 	}
 
-	LogMsg("GMRES Iteration: ");
-
 	// start iteration
-	for(i = 0; i < SOLVE_GMRES_ITER_MAX && i < size; i++) {
+	for(i = 0; i < SOLVE_HIER_INNER_ITER_MAX && i < size; i++) {
 
 		if(g_bFCContinue == false) {
 			return FC_USER_BREAK;
@@ -2983,74 +5799,50 @@ int CSolveCap::gmresFlexPrecondSFastAll(CLin_Vector *b, CLin_Vector *x, double g
 		// the i-th column of the H (upper Hessemberg) matrix
 		//
 
-		if(m_clsGlobalVars.m_bDumpResidual == true) {
-			LogMsg("%.3g ", normr);
-		}
-		LogMsg("%d ", i);
-
 		// allocate only if not already pre-allocated
-		if((long)m_uiGmresPrealloc[AUTOREFINE_HIER_PRE_0_LEVEL] < i) {
+		if((long)m_uiGmresPrealloc[AUTOREFINE_HIER_PRE_1_LEVEL] < i) {
 
-			ASSERT((long)m_uiGmresPrealloc[AUTOREFINE_HIER_PRE_0_LEVEL] == i-1);
+			ASSERT((long)m_uiGmresPrealloc[AUTOREFINE_HIER_PRE_1_LEVEL] == i-1);
 
 			// allocate new column of h
 			// (remark: since vectors are 0-based, must
 			// allocate i+2 entries and not only i+1;
 			// i.e. variable 'i' starts at 0!)
-			ret = m_pclsGmres_h[i].newsize(i+2);
+			ret = m_pclsGmres1_h[i].newsize(i+2);
 			if(ret == false) {
 				return FC_OUT_OF_MEMORY;
 			}
 			g_clsMemUsage.m_ulGmresMem += (i + 2) * sizeof(double);
 			// allocate new column of q
-			ret = m_pclsGmres_q[i+1].newsize(size);
-			if(ret == false) {
-				return FC_OUT_OF_MEMORY;
-			}
-			g_clsMemUsage.m_ulGmresMem += size * sizeof(double);
-			// allocate new column of zf
-			ret = m_pclsGmres_zf[i].newsize(size);
+			ret = m_pclsGmres1_q[i+1].newsize(size);
 			if(ret == false) {
 				return FC_OUT_OF_MEMORY;
 			}
 			g_clsMemUsage.m_ulGmresMem += size * sizeof(double);
 
-			m_uiGmresPrealloc[AUTOREFINE_HIER_PRE_0_LEVEL]++;
+			m_uiGmresPrealloc[AUTOREFINE_HIER_PRE_1_LEVEL]++;
 		}
 
 		// compute new vector
 		//
-		if(m_clsGlobalVars.m_ucPrecondType == AUTOREFINE_PRECOND_NONE) {
-			retInt = m_clsMulthier.MultiplyMatByVec_fast(&m_clsGmres_v, &m_pclsGmres_q[i]);
+		if(precondType == AUTOREFINE_PRECOND_NONE) {
+			retInt = m_clsMulthier.MultiplyMatByVec_fast(&m_clsGmres1_v, &m_pclsGmres1_q[i]);
 			if(retInt != FC_NORMAL_END) {
 				return retInt;
 			}
 		}
 		else {
 			// compute preconditioned vector
-			ComputePrecondVectFast(&m_pclsGmres_zf[i], &m_pclsGmres_q[i], m_clsGlobalVars.m_ucPrecondType);
+			ComputePrecondVectFast(&m_clsGmres1_Pq, &m_pclsGmres1_q[i], precondType);
 			// and use it in matrix - vector multiplication
-			retInt = m_clsMulthier.MultiplyMatByVec_fast(&m_clsGmres_v, &m_pclsGmres_zf[i]);
+			retInt = m_clsMulthier.MultiplyMatByVec_fast(&m_clsGmres1_v, &m_clsGmres1_Pq);
 			if(retInt != FC_NORMAL_END) {
 				return retInt;
 			}
 		}
 
-		m_clsGmres_w = m_clsGmres_v;
-
-		// orthogonalize it
-		for(j=0; j<=i; j++) {
-			m_pclsGmres_h[i][j] = dot_prod(m_pclsGmres_q[j], m_clsGmres_w);
-			for(ii=0; ii<(long)m_clsGmres_v.size(); ii++) {
-				m_clsGmres_v[ii] = m_clsGmres_v[ii] - m_pclsGmres_h[i][j] * m_pclsGmres_q[j][ii];
-			}
-		}
-
-		m_pclsGmres_h[i][i+1] = mod(m_clsGmres_v);
-
-		for(ii=0; ii<(long)m_clsGmres_v.size(); ii++) {
-			m_pclsGmres_q[i+1][ii] = m_clsGmres_v[ii] / (m_pclsGmres_h[i][i+1]);
-		}
+		// orthogonalize it, and get the new column of Q
+		m_pclsGmres1_h[i][i+1] = OrthogonalizeCGS2(&m_clsGmres1_v, m_pclsGmres1_q, i+1, &m_pclsGmres1_h[i], &m_clsGmres1_w, true);
 
 		//
 		// rotate new vector (Givens rotations) to compute
@@ -3065,26 +5857,26 @@ int CSolveCap::gmresFlexPrecondSFastAll(CLin_Vector *b, CLin_Vector *x, double g
 		// of the H matrix to get Q*H from H, but for the
 		// last two elements
 		for(j=0; j<i; j++) {
-			tmp1 = m_pclsGmres_h[i][j];
-			tmp2 = m_pclsGmres_h[i][j+1];
-			m_pclsGmres_h[i][j] = m_clsGmres_c[j] * tmp1 - m_clsGmres_s[j]* tmp2;
-			m_pclsGmres_h[i][j+1] = m_clsGmres_c[j] * tmp2 + m_clsGmres_s[j] * tmp1;
+			tmp1 = m_pclsGmres1_h[i][j];
+			tmp2 = m_pclsGmres1_h[i][j+1];
+			m_pclsGmres1_h[i][j] = m_clsGmres1_c[j] * tmp1 - m_clsGmres1_s[j]* tmp2;
+			m_pclsGmres1_h[i][j+1] = m_clsGmres1_c[j] * tmp2 + m_clsGmres1_s[j] * tmp1;
 		}
 
 		// compute the new Givens rotation to annihilate h[i][i+1]
-		tmp1 = m_pclsGmres_h[i][i];
-		tmp2 = m_pclsGmres_h[i][i+1];
+		tmp1 = m_pclsGmres1_h[i][i];
+		tmp2 = m_pclsGmres1_h[i][i+1];
 		length = sqrt(tmp1 * tmp1 + tmp2 * tmp2);
-		m_clsGmres_c[i] = tmp1/length;
-		m_clsGmres_s[i] = -tmp2/length;
+		m_clsGmres1_c[i] = tmp1/length;
+		m_clsGmres1_s[i] = -tmp2/length;
 
 		// apply new Givens rotation to incomplete
 		// (Q';tmp')*H(j+1) matrix i-th column
 		// to get the complete (R(j+1);0)
-		m_pclsGmres_h[i][i] = m_clsGmres_c[i] * tmp1 - m_clsGmres_s[i] * tmp2;
+		m_pclsGmres1_h[i][i] = m_clsGmres1_c[i] * tmp1 - m_clsGmres1_s[i] * tmp2;
 		// this should be zero anyway
 		//h(i+1,i) = c(i) * tmp2 + s(i) * tmp1;
-		m_pclsGmres_h[i][i+1] = 0;
+		m_pclsGmres1_h[i][i+1] = 0;
 
 		//
 		// Compute recursively the first column of the (Q';tmp')
@@ -3093,9 +5885,9 @@ int CSolveCap::gmresFlexPrecondSFastAll(CLin_Vector *b, CLin_Vector *x, double g
 		// the solution once the norm is small enough
 		//
 
-		tmp1 = m_clsGmres_g[i];
-		m_clsGmres_g[i] = m_clsGmres_c[i] * tmp1;
-		m_clsGmres_g[i+1] = m_clsGmres_s[i] * tmp1;
+		tmp1 = m_clsGmres1_g[i];
+		m_clsGmres1_g[i] = m_clsGmres1_c[i] * tmp1;
+		m_clsGmres1_g[i+1] = m_clsGmres1_s[i] * tmp1;
 
 		// this is the norm of the residual
 		// remark: || b - A*Qj*z || = normb * fabs(g[i+1])
@@ -3105,7 +5897,7 @@ int CSolveCap::gmresFlexPrecondSFastAll(CLin_Vector *b, CLin_Vector *x, double g
 		// However this is not true here, also verified
 		// explicitly calculating the residual norm, once the solution
 		// is found (see below), so the weighted formula is correct
-		normr = fabs(m_clsGmres_g[i+1]) / normb;
+		normr = fabs(m_clsGmres1_g[i+1]) / normb;
 
 		//
 		// if the norm of the residual is small enough,
@@ -3116,18 +5908,13 @@ int CSolveCap::gmresFlexPrecondSFastAll(CLin_Vector *b, CLin_Vector *x, double g
 		}
 	}
 
-	if(i >= SOLVE_GMRES_ITER_MAX || i >= size) {
-		ErrMsg("\nError: not converging after %d iterations, norm of the residual is %.3f, while targeting %.3f\n", i, normr, gmresTol);
+	// not converged: this is not an error, the approximate solution is returned anyway
+	if(i >= SOLVE_HIER_INNER_ITER_MAX || i >= size) {
 		// either case, since we ended the 'for' loop, 'i' has been incremented of one more;
 		// to avoid breaking the end of the arrays here below, we must decrease 'i'
 		i--;
 	}
 
-	if(m_clsGlobalVars.m_bDumpResidual == true) {
-		LogMsg("%.3f ", normr);
-	}
-	LogMsg("\n");
-
 	//
 	// compute the solution, solving H(i)*z = normr * e1 for z using
 	// the first row of the Q matrix and the R matrix of the QR
@@ -3135,47 +5922,41 @@ int CSolveCap::gmresFlexPrecondSFastAll(CLin_Vector *b, CLin_Vector *x, double g
 	//
 
 	iteration = i;
+	m_lUpperIterations = iteration + 1;
 
 	// H(i)*z = normb*e1 gives Q*R*z = normb*e1 -> R*z = Q'*normb*e1
 	// Since g(i) is already the first column of Q' multiplied by normb,
 	// it is the term Q'*normb*e1, so init the solution
-	m_clsGmres_z = m_clsGmres_g;
+	m_clsGmres1_z = m_clsGmres1_g;
 
 	// then solve R*z = Q'*normr*e1 by back substitution,
 	// knowing that R is upper triangular
 	for(i = iteration; i>=0; i--) {
-		m_clsGmres_z[i]= m_clsGmres_z[i] / m_pclsGmres_h[i][i];
+		m_clsGmres1_z[i]= m_clsGmres1_z[i] / m_pclsGmres1_h[i][i];
 		for(j = i-1; j>=0; j--) {
-			m_clsGmres_z[j] = m_clsGmres_z[j] - m_pclsGmres_h[i][j] * m_clsGmres_z[i];
+			m_clsGmres1_z[j] = m_clsGmres1_z[j] - m_pclsGmres1_h[i][j] * m_clsGmres1_z[i];
 		}
 	}
 
 
-	if(m_clsGlobalVars.m_ucPrecondType == AUTOREFINE_PRECOND_NONE) {
-		// multiply z by Q(i) to get y, the solution
-		// of the (possibly preconditioned) system
-		for(i=0; i<size; i++) {
-			for(j=0, tmp1 = 0; j<=iteration; j++) {
-				tmp1 += m_pclsGmres_q[j][i] * m_clsGmres_z[j];
-			}
-			m_clsGmres_y[i] = tmp1;
+	// multiply z by Q(i) to get y, the solution
+	// of the (possibly preconditioned) system
+	for(i=0; i<size; i++) {
+		for(j=0, tmp1 = 0; j<=iteration; j++) {
+			tmp1 += m_pclsGmres1_q[j][i] * m_clsGmres1_z[j];
 		}
+		m_clsGmres1_y[i] = tmp1;
+	}
 
-		*x = m_clsGmres_y;
+	if(precondType == AUTOREFINE_PRECOND_NONE) {
+		*x = m_clsGmres1_y;
 	}
 	else {
-		// multiply by z by zf matrix to undo all preconditioners to get the final solution,
-		// and sum x0 to consider also initial vector
-		//x = x0 + zf * z;
-
-		for(i = 0; i<size; i++) {
-			for(j = 0, tmp1 = 0.0; j<=iteration; j++) {
-				tmp1 += m_pclsGmres_zf[j][i] * m_clsGmres_z[j];
-			}
-			m_clsGmres_y[i] = tmp1;
-		}
-
-		*x = m_clsGmres_x0 + m_clsGmres_y;
+		// undo the preconditioner to get x, the final solution,
+		// also considering initial vector in the solution
+		//x = x0 + P * y;
+		ComputePrecondVectFast(x, &m_clsGmres1_y, precondType);
+		*x = m_clsGmres1_x0 + *x;
 	}
 
 	// debug : explicit calculation of residual vector
@@ -3189,14 +5970,14 @@ int CSolveCap::gmresFlexPrecondSFastAll(CLin_Vector *b, CLin_Vector *x, double g
 	return FC_NORMAL_END;
 }
 
-
-//   Generalized Minimum Residual Method with preconditioner and initial vector
+//   Flexible Generalized Minimum Residual Method with preconditioner
 //
-//   x = gmresPrecond(A,b,P,x0) attempt to solve the preconditioned
+//   x = gmresPrecond(A,b,P) attempt to solve the preconditioned
 //   system A*P*y = b & x = P*y
-//   using x0 as initial vector of the solution iteration
+//   Flexible means that the preconditioner can change at every iteration
+//   (see "Iterative methods for sparse linear systems", Yousef Saad)
 //
-//   Enrico Di Lorenzo, 2009/08/17
+//   Enrico Di Lorenzo, 2004/07/06
 //
 //   'fast' refers to the direct vector multiplication loops used
 //   instead of CLin_Vector class operator*, which requires
@@ -3213,12 +5994,10 @@ int CSolveCap::gmresFlexPrecondSFastAll(CLin_Vector *b, CLin_Vector *x, double g
 //   the 'all' refers to the increase of speed not allocating memory
 //   locally every time
 //
-int CSolveCap::gmresPrecondSFastAllX0(CLin_Vector *b, CLin_Vector *x, CLin_Vector *x0)
+int CSolveCap::gmresFlexPrecondSFastAll(CLin_Vector *b, CLin_Vector *x, double gmresTol)
 {
-	// old, used with no x0 as initial vector
-	//CLin_Vector r(*b);
 	double normr, normb, tmp1, tmp2, length;
-	long size, i, j, iteration, ii;
+	long size, i, j, iteration;
 	bool ret;
 	int retInt;
 
@@ -3227,17 +6006,37 @@ int CSolveCap::gmresPrecondSFastAllX0(CLin_Vector *b, CLin_Vector *x, CLin_Vecto
 	// check consistency of size
 //	ASSERT(size == *x.size());
 
-	// r = b - A * x0;
-	// matrix - vector multiplication
-	retInt = m_clsMulthier.MultiplyMatByVec_fast(&m_clsGmres_v, x0);
-	if(retInt != FC_NORMAL_END) {
-		return retInt;
-	}
-	// and get r
-	m_clsGmres_r = *b - m_clsGmres_v;
-	normr = mod(m_clsGmres_r);
-	normb = mod(*b);
+	// if there is a preconditioner
+	if(m_clsGlobalVars.m_ucPrecondType != AUTOREFINE_PRECOND_NONE) {
+
+		// initial vector: having the approx inverted matrix, it is cheap to calculate the initial vector.
+		//  Simply put, to solve the preconditioned system
+		//  A * P * y = b and x = P * y, the best choice for y0 initial vector is b,
+		//  since a good P should be as similar as possible to inv(A), so A * P ~= I
+		//  So x0 = P * y0 = P * b
+		ComputePrecondVectFast(&m_clsGmres_x0, b, m_clsGlobalVars.m_ucPrecondType);
+		if(m_iUpperGmresRet != FC_NORMAL_END) {
+			return m_iUpperGmresRet;
+		}
 
+		// r = b - A * x0;
+		// matrix - vector multiplication
+		retInt = m_clsMulthier.MultiplyMatByVec_fast(&m_clsGmres_v, &m_clsGmres_x0);
+		if(retInt != FC_NORMAL_END) {
+			return retInt;
+		}
+		// and get r
+		m_clsGmres_r = *b - m_clsGmres_v;
+		normr = mod(m_clsGmres_r);
+		normb = mod(*b);
+	}
+	else {
+		// no preconditioner; assumes that initial vector x0 is an all zeros vector
+		//
+		m_clsGmres_r = *b;
+		normr = mod(m_clsGmres_r);
+		normb = normr;
+	}
 
 	// allocate and init first column of Q matrix
 	m_pclsGmres_q[0] = CLin_Vector(m_clsGmres_r / normr);
@@ -3253,9 +6052,14 @@ int CSolveCap::gmresPrecondSFastAllX0(CLin_Vector *b, CLin_Vector *x, CLin_Vecto
 	// if the norm of the residual is small enough,
 	// initial vector is a good enough solution
 	//
-	if(normr / normb < m_clsGlobalVars.m_dGmresTol) {
-		*x = *x0;
-		return 0;
+	if(normr / normb < gmresTol) {
+		if(m_clsGlobalVars.m_ucPrecondType == AUTOREFINE_PRECOND_NONE) {
+			*x = CLin_Vector(size, 0.0);
+		}
+		else {
+			*x = m_clsGmres_x0;
+		}
+		return FC_NORMAL_END;
 	}
 
 	LogMsg("GMRES Iteration: ");
@@ -3263,6 +6067,10 @@ int CSolveCap::gmresPrecondSFastAllX0(CLin_Vector *b, CLin_Vector *x, CLin_Vecto
 	// start iteration
 	for(i = 0; i < SOLVE_GMRES_ITER_MAX && i < size; i++) {
 
+		if(g_bFCContinue == false) {
+			return FC_USER_BREAK;
+		}
+
 		//
 		// execute the i-th Arnoldi step, thus computing
 		// the i-th column of the H (upper Hessemberg) matrix
@@ -3273,21 +6081,35 @@ int CSolveCap::gmresPrecondSFastAllX0(CLin_Vector *b, CLin_Vector *x, CLin_Vecto
 		}
 		LogMsg("%d ", i);
 
-		// allocate new column of h
-		// (remark: since vectors are 0-based, must
-		// allocate i+2 entries and not only i+1;
-		// i.e. variable 'i' starts at 0!)
-		ret = m_pclsGmres_h[i].newsize(i+2);
-		if(ret == false) {
-			return FC_OUT_OF_MEMORY;
-		}
-		g_clsMemUsage.m_ulGmresMem += (i+2) * sizeof(double);
-		// allocate new column of q
-		ret = m_pclsGmres_q[i+1].newsize(size);
-		if(ret == false) {
-			return FC_OUT_OF_MEMORY;
+		// allocate only if not already pre-allocated
+		if((long)m_uiGmresPrealloc[AUTOREFINE_HIER_PRE_0_LEVEL] < i) {
+
+			ASSERT((long)m_uiGmresPrealloc[AUTOREFINE_HIER_PRE_0_LEVEL] == i-1);
+
+			// allocate new column of h
+			// (remark: since vectors are 0-based, must
+			// allocate i+2 entries and not only i+1;
+			// i.e. variable 'i' starts at 0!)
+			ret = m_pclsGmres_h[i].newsize(i+2);
+			if(ret == false) {
+				return FC_OUT_OF_MEMORY;
+			}
+			g_clsMemUsage.m_ulGmresMem += (i + 2) * sizeof(double);
+			// allocate new column of q
+			ret = m_pclsGmres_q[i+1].newsize(size);
+			if(ret == false) {
+				return FC_OUT_OF_MEMORY;
+			}
+			g_clsMemUsage.m_ulGmresMem += size * sizeof(double);
+			// allocate new column of zf
+			ret = m_pclsGmres_zf[i].newsize(size);
+			if(ret == false) {
+				return FC_OUT_OF_MEMORY;
+			}
+			g_clsMemUsage.m_ulGmresMem += size * sizeof(double);
+
+			m_uiGmresPrealloc[AUTOREFINE_HIER_PRE_0_LEVEL]++;
 		}
-		g_clsMemUsage.m_ulGmresMem += size * sizeof(double);
 
 		// compute new vector
 		//
@@ -3299,29 +6121,23 @@ int CSolveCap::gmresPrecondSFastAllX0(CLin_Vector *b, CLin_Vector *x, CLin_Vecto
 		}
 		else {
 			// compute preconditioned vector
-			ComputePrecondVectFast(&m_clsGmres_Pq, &m_pclsGmres_q[i], m_clsGlobalVars.m_ucPrecondType);
+			ComputePrecondVectFast(&m_pclsGmres_zf[i], &m_pclsGmres_q[i], m_clsGlobalVars.m_ucPrecondType);
+			if(m_iUpperGmresRet != FC_NORMAL_END) {
+				return m_iUpperGmresRet;
+			}
+			// in verbose mode, also report the iterations of the hierarchical preconditioner inner solve
+			if(m_clsGlobalVars.m_bVerboseOutput == true && (m_clsGlobalVars.m_ucPrecondType & AUTOREFINE_PRECOND_HIER) != 0) {
+				LogMsg("(%ld) ", m_lUpperIterations);
+			}
 			// and use it in matrix - vector multiplication
-			retInt = m_clsMulthier.MultiplyMatByVec_fast(&m_clsGmres_Pq, &m_clsGmres_v);
+			retInt = m_clsMulthier.MultiplyMatByVec_fast(&m_clsGmres_v, &m_pclsGmres_zf[i]);
 			if(retInt != FC_NORMAL_END) {
 				return retInt;
 			}
 		}
 
-		m_clsGmres_w = m_clsGmres_v;
-
-		// orthogonalize it
-		for(j=0; j<=i; j++) {
-			m_pclsGmres_h[i][j] = dot_prod(m_pclsGmres_q[j], m_clsGmres_w);
-			for(ii=0; ii<(long)m_clsGmres_v.size(); ii++) {
-				m_clsGmres_v[ii] = m_clsGmres_v[ii] - m_pclsGmres_h[i][j] * m_pclsGmres_q[j][ii];
-			}
-		}
-
-		m_pclsGmres_h[i][i+1] = mod(m_clsGmres_v);
-
-		for(ii=0; ii<(long)m_clsGmres_v.size(); ii++) {
-			m_pclsGmres_q[i+1][ii] = m_clsGmres_v[ii] / (m_pclsGmres_h[i][i+1]);
-		}
+		// orthogonalize it, and get the new column of Q
+		m_pclsGmres_h[i][i+1] = OrthogonalizeCGS2(&m_clsGmres_v, m_pclsGmres_q, i+1, &m_pclsGmres_h[i], &m_clsGmres_w, true);
 
 		//
 		// rotate new vector (Givens rotations) to compute
@@ -3382,13 +6198,13 @@ int CSolveCap::gmresPrecondSFastAllX0(CLin_Vector *b, CLin_Vector *x, CLin_Vecto
 		// if the norm of the residual is small enough,
 		// exit loop (and return solution)
 		//
-		if(normr < m_clsGlobalVars.m_dGmresTol) {
+		if(normr < gmresTol) {
 			break;
 		}
 	}
 
 	if(i >= SOLVE_GMRES_ITER_MAX || i >= size) {
-		ErrMsg("\nError: not converging after %d iterations, norm of the residual is %.3f, while targeting %.3f\n", i, normr, m_clsGlobalVars.m_dGmresTol);
+		ErrMsg("\nError: not converging after %d iterations, norm of the residual is %.3f, while targeting %.3f\n", i, normr, gmresTol);
 		// either case, since we ended the 'for' loop, 'i' has been incremented of one more;
 		// to avoid breaking the end of the arrays here below, we must decrease 'i'
 		i--;
@@ -3422,26 +6238,31 @@ int CSolveCap::gmresPrecondSFastAllX0(CLin_Vector *b, CLin_Vector *x, CLin_Vecto
 	}
 
 
-	// multiply z by Q(i) to get y, the solution
-	// of the (possibly preconditioned) system
-	for(i=0; i<size; i++) {
-		for(j=0, tmp1 = 0; j<=iteration; j++) {
-			tmp1 += m_pclsGmres_q[j][i] * m_clsGmres_z[j];
+	if(m_clsGlobalVars.m_ucPrecondType == AUTOREFINE_PRECOND_NONE) {
+		// multiply z by Q(i) to get y, the solution
+		// of the (possibly preconditioned) system
+		for(i=0; i<size; i++) {
+			for(j=0, tmp1 = 0; j<=iteration; j++) {
+				tmp1 += m_pclsGmres_q[j][i] * m_clsGmres_z[j];
+			}
+			m_clsGmres_y[i] = tmp1;
 		}
-		m_clsGmres_y[i] = tmp1;
-	}
 
-	if(m_clsGlobalVars.m_ucPrecondType != AUTOREFINE_PRECOND_NONE) {
-		// undo the preconditioner to get x, the final solution,
-		// also considering initial vector in the solution
-		//x = x0 + P * y;
-		ComputePrecondVectFast(x, &m_clsGmres_y, m_clsGlobalVars.m_ucPrecondType);
-		*x = *x0 + *x;
+		*x = m_clsGmres_y;
 	}
 	else {
-		// consider initial vector in the solution
-		//x = x0 + y;
-		*x = *x0 + m_clsGmres_y;
+		// multiply by z by zf matrix to undo all preconditioners to get the final solution,
+		// and sum x0 to consider also initial vector
+		//x = x0 + zf * z;
+
+		for(i = 0; i<size; i++) {
+			for(j = 0, tmp1 = 0.0; j<=iteration; j++) {
+				tmp1 += m_pclsGmres_zf[j][i] * m_clsGmres_z[j];
+			}
+			m_clsGmres_y[i] = tmp1;
+		}
+
+		*x = m_clsGmres_x0 + m_clsGmres_y;
 	}
 
 	// debug : explicit calculation of residual vector
@@ -3452,12 +6273,360 @@ int CSolveCap::gmresPrecondSFastAllX0(CLin_Vector *b, CLin_Vector *x, CLin_Vecto
 	//m_clsMulthier.MultiplyMatByVec_fast(x, &b_approx);
 	//residual2 = mod(*b - b_approx);
 
-	return 0;
+	return FC_NORMAL_END;
+}
+
+
+//   Generalized Minimum Residual Method with preconditioner and initial vector
+//
+//   x = gmresPrecond(A,b,P,x0) attempt to solve the preconditioned
+//   system A*P*y = b & x = P*y
+//   using x0 as initial vector of the solution iteration
+//
+//   Enrico Di Lorenzo, 2009/08/17
+//
+//   'fast' refers to the direct vector multiplication loops used
+//   instead of CLin_Vector class operator*, which requires
+//   the creation of a temp object for every assignment operation
+//
+//   the 's' on the other hand refers to the scilab gmres correction,
+//   to make convergence faster, that basically uses as residual
+//   a weighted residual: normr = || b - Ax || / || b ||, that is
+//   normr = fabs(g[i+1]) / normb;
+//   and not
+//   normr = fabs(g[i+1]);
+//   see also the notes inline about this choice
+//
+//   the 'all' refers to the increase of speed not allocating memory
+//   locally every time
+//
+int CSolveCap::gmresPrecondSFastAllX0(CLin_Vector *b, CLin_Vector *x, CLin_Vector *x0)
+{
+	// same iteration as gmresPrecondSFastAll(), only starting from 'x0'
+	// (so also restart and recycling are supported)
+	return gmresPrecondSFastAll(b, x, m_clsGlobalVars.m_dGmresTol, x0);
+}
+
+// Solve the system A*x = b by iterative refinement: the correction of the solution is
+// computed by the usual iterative solver on the single precision copy of the coefficients
+// of potential (see CMultHier::AllocateSinglePrecLinks()), while the residual b - A*x
+// is computed with the double precision coefficients. Most of the multiplications
+// then stream half of the link memory, while the final accuracy is the double
+// precision one. 'x0', if not NULL, is the initial vector
+int CSolveCap::SolveMixedPrecision(CLin_Vector *b, CLin_Vector *x, CLin_Vector *x0)
+{
+	unsigned int outer;
+	long k, size;
+	double normb, normr, innerTol;
+	bool pcgBreakdown;
+	int ret;
+
+	size = b->size();
+	normb = mod(*b);
+
+	// the corrections do not need more than the single precision accuracy
+	innerTol = m_clsGlobalVars.m_dGmresTol;
+	if(innerTol < SOLVE_MIXED_INNER_TOL) {
+		innerTol = SOLVE_MIXED_INNER_TOL;
+	}
+
+	for(k=0; k<size; k++) {
+		if(x0 != NULL) {
+			(*x)[k] = (*x0)[k];
+		}
+		else {
+			(*x)[k] = 0.0;
+		}
+	}
+
+	for(outer=0; outer<SOLVE_MIXED_OUTER_MAX; outer++) {
+
+		// r = b - A*x, in double precision
+		if(outer == 0 && x0 == NULL) {
+			for(k=0; k<size; k++) {
+				m_clsMixed_r[k] = (*b)[k];
+			}
+		}
+		else {
+			ret = m_clsMulthier.MultiplyMatByVec_fast(&m_clsMixed_d, x);
+			if(ret != FC_NORMAL_END) {
+				return ret;
+			}
+			for(k=0; k<size; k++) {
+				m_clsMixed_r[k] = (*b)[k] - m_clsMixed_d[k];
+			}
+		}
+		normr = mod(m_clsMixed_r);
+
+		if(normr / normb < m_clsGlobalVars.m_dGmresTol) {
+			return FC_NORMAL_END;
+		}
+
+		if(outer > 0) {
+			LogMsg("Mixed precision refinement step %d, norm of the residual is %.3g\n", outer, normr / normb);
+		}
+
+		// A*d = r, in single precision
+		m_clsMulthier.SetSinglePrecMult(true);
+		pcgBreakdown = false;
+		if(UsePcg() == true) {
+			ret = pcgPrecondSFastAll(&m_clsMixed_r, &m_clsMixed_d, innerTol, NULL, &pcgBreakdown);
+			if(ret == FC_NORMAL_END && pcgBreakdown == true) {
+				ErrMsg("Warning: conjugate gradient failed, moving to GMRES\n");
+				m_bPcgBreakdown = true;
+			}
+		}
+		else {
+			ret = gmresPrecondSFastAll(&m_clsMixed_r, &m_clsMixed_d, innerTol);
+		}
+		if(ret == FC_NORMAL_END && pcgBreakdown == true) {
+			ret = gmresPrecondSFastAll(&m_clsMixed_r, &m_clsMixed_d, innerTol);
+		}
+		m_clsMulthier.SetSinglePrecMult(false);
+		if(ret != FC_NORMAL_END) {
+			return ret;
+		}
+
+		// x = x + d
+		for(k=0; k<size; k++) {
+			(*x)[k] += m_clsMixed_d[k];
+		}
+	}
+
+	// not converging (the single precision coefficients may be too inaccurate
+	// for the requested tolerance), so complete the solve in double precision
+	ErrMsg("Warning: mixed precision solve not converging after %d refinement steps, moving to double precision\n", SOLVE_MIXED_OUTER_MAX);
+	for(k=0; k<size; k++) {
+		m_clsMixed_d[k] = (*x)[k];
+	}
+	return gmresPrecondSFastAllX0(b, x, &m_clsMixed_d);
+}
+
+// Preconditioned Conjugate Gradient
+//
+//   x = pcgPrecond(A,b,P) attempt to solve the system A*x = b, with A and P
+//   symmetric positive definite (see UsePcg())
+//
+//   Only the current residual, preconditioned residual, search direction and
+//   its product by A are kept, so the memory does not grow with the iterations,
+//   and the work per iteration is O(n) beyond the matrix - vector multiplication
+//   and the preconditioner.
+//   The residual is weighted on the norm of b, as in gmresPrecondSFastAll(), and the
+//   initial vector is 'x0', if not NULL, or P*b (all zeros if no preconditioner).
+//   If A or P turn out not to be positive definite, or the iterations do not converge,
+//   'breakdown' is set to true and the solve must be repeated with gmres
+int CSolveCap::pcgPrecondSFastAll(CLin_Vector *b, CLin_Vector *x, double tol, CLin_Vector *x0, bool *breakdown)
+{
+	double normr, normb, rz, rzOld, pAp, alpha, beta;
+	long i, k, size;
+	bool parallel;
+	int retInt;
+
+	// get system size
+	size = b->size();
+	// check consistency of size
+	ASSERT(size == (long)(*x).size());
+
+	parallel = (size >= SOLVE_ORTHO_MIN_PARALLEL_SIZE);
+	*breakdown = false;
+
+	// initial vector (see gmresPrecondSFastAll())
+	if(x0 != NULL) {
+		ASSERT(size == (long)(*x0).size());
+		for(k=0; k<size; k++) {
+			(*x)[k] = (*x0)[k];
+		}
+	}
+	else if(m_clsGlobalVars.m_ucPrecondType != AUTOREFINE_PRECOND_NONE) {
+		ComputePrecondVectFast(x, b, m_clsGlobalVars.m_ucPrecondType);
+	}
+	else {
+		// no preconditioner; initial vector is an all zeros vector
+		for(k=0; k<size; k++) {
+			(*x)[k] = 0.0;
+		}
+	}
+
+	// r = b - A * x;
+	retInt = m_clsMulthier.MultiplyMatByVec_fast(&m_clsGmres_v, x);
+	if(retInt != FC_NORMAL_END) {
+		return retInt;
+	}
+	for(k=0; k<size; k++) {
+		m_clsGmres_r[k] = (*b)[k] - m_clsGmres_v[k];
+	}
+	normr = mod(m_clsGmres_r);
+	normb = mod(*b);
+
+	// if the norm of the residual is small enough,
+	// initial vector is a good enough solution
+	if(normr / normb < tol) {
+		return FC_NORMAL_END;
+	}
+
+	// z = P * r, p = z
+	ComputePrecondVectFast(&m_clsGmres_Pq, &m_clsGmres_r, m_clsGlobalVars.m_ucPrecondType);
+	for(k=0; k<size; k++) {
+		m_clsGmres_w[k] = m_clsGmres_Pq[k];
+	}
+	rz = dot_prod(m_clsGmres_r, m_clsGmres_Pq);
+
+	LogMsg("PCG Iteration: ");
+
+	for(i = 0; i < SOLVE_GMRES_ITER_MAX; i++) {
+
+		if(g_bFCContinue == false) {
+			return FC_USER_BREAK;
+		}
+
+		if(m_clsGlobalVars.m_bDumpResidual == true) {
+			LogMsg("%.3g ", normr / normb);
+		}
+		LogMsg("%d ", i);
+
+		// Ap = A * p
+		retInt = m_clsMulthier.MultiplyMatByVec_fast(&m_clsGmres_v, &m_clsGmres_w);
+		if(retInt != FC_NORMAL_END) {
+			return retInt;
+		}
+
+		pAp = dot_prod(m_clsGmres_w, m_clsGmres_v);
+		if(pAp <= 0.0 || rz <= 0.0) {
+			LogMsg("\n");
+			*breakdown = true;
+			return FC_NORMAL_END;
+		}
+		alpha = rz / pAp;
+
+		// x = x + alpha * p, r = r - alpha * Ap, and the norm of r, in a single pass
+		normr = 0.0;
+#pragma omp parallel for if(parallel) reduction(+:normr)
+		for(k=0; k<size; k++) {
+			(*x)[k] += alpha * m_clsGmres_w[k];
+			m_clsGmres_r[k] -= alpha * m_clsGmres_v[k];
+			normr += m_clsGmres_r[k] * m_clsGmres_r[k];
+		}
+		normr = sqrt(normr);
+
+		if(normr / normb < tol) {
+			break;
+		}
+
+		// z = P * r
+		ComputePrecondVectFast(&m_clsGmres_Pq, &m_clsGmres_r, m_clsGlobalVars.m_ucPrecondType);
+
+		rzOld = rz;
+		rz = 0.0;
+#pragma omp parallel for if(parallel) reduction(+:rz)
+		for(k=0; k<size; k++) {
+			rz += m_clsGmres_r[k] * m_clsGmres_Pq[k];
+		}
+		beta = rz / rzOld;
+
+		// p = z + beta * p
+#pragma omp parallel for if(parallel)
+		for(k=0; k<size; k++) {
+			m_clsGmres_w[k] = m_clsGmres_Pq[k] + beta * m_clsGmres_w[k];
+		}
+	}
+
+	// stalling (e.g. with a preconditioner that is not exactly symmetric) is treated
+	// as a breakdown, so that the solve is repeated with gmres
+	if(i >= SOLVE_GMRES_ITER_MAX) {
+		LogMsg("\n");
+		ErrMsg("Warning: conjugate gradient not converging after %d iterations, norm of the residual is %.3f, while targeting %.3f\n", i, normr / normb, tol);
+		*breakdown = true;
+		return FC_NORMAL_END;
+	}
+
+	if(m_clsGlobalVars.m_bDumpResidual == true) {
+		LogMsg("%.3f ", normr / normb);
+	}
+	LogMsg("\n");
+
+	return FC_NORMAL_END;
+}
+
+// Orthogonalize 'v' against the 'qNum' orthonormal vectors 'q' (the Krylov basis), storing
+// the projections in 'h' and the normalized result in q[qNum]; returns the norm of 'v'
+// after the orthogonalization, i.e. the subdiagonal element of the Hessemberg matrix.
+// 'w' is a work vector, of at least 'qNum' elements.
+//
+// Uses classical Gram-Schmidt with one re-orthogonalization pass (CGS2): at each pass
+// the projections on all the vectors are computed from the same 'v', so they are
+// independent dot products and the update is a single sweep over the basis, instead
+// of one sweep per vector as in modified Gram-Schmidt. The second pass recovers the
+// orthogonality lost by the first one. If 'parallel', the dot products are split
+// among the threads by vector, and the update by blocks of SOLVE_ORTHO_BLOCK_SIZE
+// elements of 'v', which stay in cache while the basis vectors are streamed
+double CSolveCap::OrthogonalizeCGS2(CLin_Vector *v, CLin_Vector *q, long qNum, CLin_Vector *h, CLin_Vector *w, bool parallel)
+{
+	long j, k, kb, kend, size;
+	int pass;
+	double tmp, norm;
+
+	size = v->size();
+
+	// not worth for small vectors
+	if(size < SOLVE_ORTHO_MIN_PARALLEL_SIZE) {
+		parallel = false;
+	}
+
+	for(j=0; j<qNum; j++) {
+		(*h)[j] = 0.0;
+	}
+
+	for(pass=0; pass<2; pass++) {
+
+		// projections w = Q'*v
+#pragma omp parallel for if(parallel && qNum > 1) private(k, tmp)
+		for(j=0; j<qNum; j++) {
+			tmp = 0.0;
+			for(k=0; k<size; k++) {
+				tmp += q[j][k] * (*v)[k];
+			}
+			(*w)[j] = tmp;
+		}
+
+		// v = v - Q*w
+#pragma omp parallel for if(parallel) private(j, k, kend, tmp)
+		for(kb=0; kb<size; kb+=SOLVE_ORTHO_BLOCK_SIZE) {
+			kend = kb + SOLVE_ORTHO_BLOCK_SIZE;
+			if(kend > size) {
+				kend = size;
+			}
+			for(j=0; j<qNum; j++) {
+				tmp = (*w)[j];
+				for(k=kb; k<kend; k++) {
+					(*v)[k] -= tmp * q[j][k];
+				}
+			}
+		}
+
+		for(j=0; j<qNum; j++) {
+			(*h)[j] += (*w)[j];
+		}
+	}
+
+	norm = 0.0;
+#pragma omp parallel for if(parallel) reduction(+:norm)
+	for(k=0; k<size; k++) {
+		norm += (*v)[k] * (*v)[k];
+	}
+	norm = sqrt(norm);
+
+#pragma omp parallel for if(parallel)
+	for(k=0; k<size; k++) {
+		q[qNum][k] = (*v)[k] / norm;
+	}
+
+	return norm;
 }
 
 void CSolveCap::ComputePrecondVectFast(CLin_Vector *Pq, CLin_Vector *q, unsigned char precondType)
 {
-	long i, j, k;
+	long i, j, k, size, spaiSize;
+	double sum;
 	unsigned long supPreIndex;
 	unsigned int leavesNum;
 
@@ -3542,6 +6711,35 @@ void CSolveCap::ComputePrecondVectFast(CLin_Vector *Pq, CLin_Vector *q, unsigned
 		}
 
 	}
+	else if(precondType == AUTOREFINE_PRECOND_SPAI) {
+
+		//
+		// sparse approximate inverse preconditioner
+		//
+
+		// sparse matrix - vector multiplication; if complex permittivity, the '*q' and '*Pq'
+		// vectors are twice as long, and as for Jacobi, must multiply by [M 0; 0 M]
+		size = (long)m_clsMulthier.GetPanelNum(AUTOREFINE_HIER_PRE_0_LEVEL);
+		spaiSize = (long)m_clsGlobalVars.m_uiSpaiSize;
+		for(k=0; k < (long)(*Pq).size(); k += size) {
+#pragma omp parallel for if(size >= SOLVE_SPAI_MIN_PARALLEL_SIZE) private(j, sum)
+			for(i=0; i < size; i++) {
+				sum = 0.0;
+				for(j=0; j < (long)m_pucSpaiDim[i]; j++) {
+					sum += m_pdSpaiPrecond[(unsigned long)i*spaiSize + j] * (*q)[k + m_pulSpaiIndex[(unsigned long)i*spaiSize + j]];
+				}
+				(*Pq)[k + i] = sum;
+			}
+		}
+	}
+	else if(precondType == AUTOREFINE_PRECOND_MG) {
+
+		//
+		// multigrid preconditioner
+		//
+
+		ComputeMultigridVect(Pq, q);
+	}
 	else if(precondType == AUTOREFINE_PRECOND_SUPER) {
 
 		//
@@ -3564,16 +6762,17 @@ void CSolveCap::ComputePrecondVectFast(CLin_Vector *Pq, CLin_Vector *q, unsigned
 				// This is with correct weighting. Remark: 'm_lLoLevLeavesNum' may not be useful anymore
 				m_clsSupPrecondElements[supPreIndex].m_pclsHiLevLeaf->m_dPotential += (*q)[i] * m_pfSupPrecondAreae[i] / m_clsSupPrecondElements[supPreIndex].m_pclsHiLevLeaf->GetDimension();
 			}
-			// multiplication step, calculates the result of super preconditioner matrix multiplication
+			// multiplication step, calculates the result of super preconditioner matrix multiplication,
+			// by forward and backward substitution with the LU factors of the super potential matrix
 			for(i=0; i<(long)m_uiSupPreNum; i++) {
-				for(k=0; k<(long)m_uiSupPreNum; k++) {
-					// if auto potential, skip: must zero off-diagonal leaves-level elements, which would be positive
-					// instead of negative, when extending the precond hi-lev matrix to lo-lev leaves (are based on
-					// diagonal positive elements of Maxwell capacitance matrix of the super precond)
-					if(i != k) {
-						m_clsSupPrecondElements[i].m_pclsHiLevLeaf->m_dCharge += m_pclsSupPrecondMtx[i][k] * m_clsSupPrecondElements[k].m_pclsHiLevLeaf->m_dPotential;
-					}
-				}
+				m_pdSupPrecondVect[i] = m_clsSupPrecondElements[i].m_pclsHiLevLeaf->m_dPotential;
+			}
+			SolveMatrixLU(m_pdSupPotMtx, m_plSupPotPivot, m_uiSupPreNum, m_pdSupPrecondVect, true);
+			for(i=0; i<(long)m_uiSupPreNum; i++) {
+				// remove the auto potential: must zero off-diagonal leaves-level elements, which would be positive
+				// instead of negative, when extending the precond hi-lev matrix to lo-lev leaves (are based on
+				// diagonal positive elements of Maxwell capacitance matrix of the super precond)
+				m_clsSupPrecondElements[i].m_pclsHiLevLeaf->m_dCharge = m_pdSupPrecondVect[i] - m_pdSupPrecondDiag[i] * m_clsSupPrecondElements[i].m_pclsHiLevLeaf->m_dPotential;
 			}
 			// distribution step, distributes the results obtained at super preconditioner level to the leaves
 			for(i=0; i<(long)m_clsMulthier.GetPanelNum(AUTOREFINE_HIER_PRE_0_LEVEL); i++) {
@@ -3593,8 +6792,8 @@ void CSolveCap::ComputePrecondVectFast(CLin_Vector *Pq, CLin_Vector *q, unsigned
 				// Another way to see the below operation: we divide the auto-capacitance of the super precond matrix
 				// by the number of leaves of the block, then we multiply by q. Seen in this way, there is a straightforward
 				// approach to account for different leave sizes, i.e. weighting on the areae
-				//(*Pq)[i] += m_pclsSupPrecondMtx[supPreIndex][supPreIndex] * (*q)[i] / m_clsSupPrecondElements[supPreIndex].m_lLoLevLeavesNum;
-				(*Pq)[i] += m_pclsSupPrecondMtx[supPreIndex][supPreIndex] * (*q)[i] * m_pfSupPrecondAreae[i] / m_clsSupPrecondElements[supPreIndex].m_pclsHiLevLeaf->GetDimension();
+				//(*Pq)[i] += m_pdSupPrecondDiag[supPreIndex] * (*q)[i] / m_clsSupPrecondElements[supPreIndex].m_lLoLevLeavesNum;
+				(*Pq)[i] += m_pdSupPrecondDiag[supPreIndex] * (*q)[i] * m_pfSupPrecondAreae[i] / m_clsSupPrecondElements[supPreIndex].m_pclsHiLevLeaf->GetDimension();
 			}
 		}
 		else {
@@ -3620,19 +6819,19 @@ void CSolveCap::ComputePrecondVectFast(CLin_Vector *Pq, CLin_Vector *q, unsigned
 			}
 			// multiplication step, calculates the result of super preconditioner matrix multiplication
 			for(i=0; i<(long)m_uiSupPreNum; i++) {
-				for(k=0; k<(long)m_uiSupPreNum; k++) {
-					// if auto potential, skip
-					if(i != k) {
-						m_clsSupPrecondElements[i].m_pclsHiLevLeaf->m_dCharge += m_pclsSupPrecondMtx[i][k] * m_clsSupPrecondElements[k].m_pclsHiLevLeaf->m_dPotential;
-					}
-				}
+				m_pdSupPrecondVect[i] = m_clsSupPrecondElements[i].m_pclsHiLevLeaf->m_dPotential;
+			}
+			SolveMatrixLU(m_pdSupPotMtx, m_plSupPotPivot, m_uiSupPreNum, m_pdSupPrecondVect, true);
+			for(i=0; i<(long)m_uiSupPreNum; i++) {
+				// remove the auto potential
+				m_clsSupPrecondElements[i].m_pclsHiLevLeaf->m_dCharge = m_pdSupPrecondVect[i] - m_pdSupPrecondDiag[i] * m_clsSupPrecondElements[i].m_pclsHiLevLeaf->m_dPotential;
 			}
 			// distribution step, distributes the results obtained at super preconditioner level to the leaves
 			for(i=0; i<(long)m_clsMulthier.GetPanelNum(AUTOREFINE_HIER_PRE_0_LEVEL); i++) {
 				supPreIndex = m_puiSupPrecondIndex[i];
 				(*Pq)[i] = m_clsSupPrecondElements[supPreIndex].m_pclsHiLevLeaf->m_dCharge * m_pfSupPrecondAreae[i] / m_clsSupPrecondElements[supPreIndex].m_pclsHiLevLeaf->GetDimension();
 				// and add diagonal element
-				(*Pq)[i] += m_pclsSupPrecondMtx[supPreIndex][supPreIndex] * (*q)[i] * m_pfSupPrecondAreae[i] / m_clsSupPrecondElements[supPreIndex].m_pclsHiLevLeaf->GetDimension();
+				(*Pq)[i] += m_pdSupPrecondDiag[supPreIndex] * (*q)[i] * m_pfSupPrecondAreae[i] / m_clsSupPrecondElements[supPreIndex].m_pclsHiLevLeaf->GetDimension();
 			}
 
 			// second step for second half of '*q' and '*Pq'
@@ -3651,19 +6850,19 @@ void CSolveCap::ComputePrecondVectFast(CLin_Vector *Pq, CLin_Vector *q, unsigned
 			}
 			// multiplication step, calculates the result of super preconditioner matrix multiplication
 			for(i=0; i<(long)m_uiSupPreNum; i++) {
-				for(k=0; k<(long)m_uiSupPreNum; k++) {
-					// if auto potential, skip
-					if(i != k) {
-						m_clsSupPrecondElements[i].m_pclsHiLevLeaf->m_dCharge += m_pclsSupPrecondMtx[i][k] * m_clsSupPrecondElements[k].m_pclsHiLevLeaf->m_dPotential;
-					}
-				}
+				m_pdSupPrecondVect[i] = m_clsSupPrecondElements[i].m_pclsHiLevLeaf->m_dPotential;
+			}
+			SolveMatrixLU(m_pdSupPotMtx, m_plSupPotPivot, m_uiSupPreNum, m_pdSupPrecondVect, true);
+			for(i=0; i<(long)m_uiSupPreNum; i++) {
+				// remove the auto potential
+				m_clsSupPrecondElements[i].m_pclsHiLevLeaf->m_dCharge = m_pdSupPrecondVect[i] - m_pdSupPrecondDiag[i] * m_clsSupPrecondElements[i].m_pclsHiLevLeaf->m_dPotential;
 			}
 			// distribution step, distributes the results obtained at super preconditioner level to the leaves
 			for(i=0, j=(long)(*Pq).size()/2; i<(long)m_clsMulthier.GetPanelNum(AUTOREFINE_HIER_PRE_0_LEVEL); i++, j++) {
 				supPreIndex = m_puiSupPrecondIndex[i];
 				(*Pq)[j] = m_clsSupPrecondElements[supPreIndex].m_pclsHiLevLeaf->m_dCharge * m_pfSupPrecondAreae[i] / m_clsSupPrecondElements[supPreIndex].m_pclsHiLevLeaf->GetDimension();
 				// and add diagonal element
-				(*Pq)[j] += m_pclsSupPrecondMtx[supPreIndex][supPreIndex] * (*q)[j] * m_pfSupPrecondAreae[i] / m_clsSupPrecondElements[supPreIndex].m_pclsHiLevLeaf->GetDimension();
+				(*Pq)[j] += m_pdSupPrecondDiag[supPreIndex] * (*q)[j] * m_pfSupPrecondAreae[i] / m_clsSupPrecondElements[supPreIndex].m_pclsHiLevLeaf->GetDimension();
 			}
 		}
 
@@ -3679,12 +6878,29 @@ void CSolveCap::ComputePrecondVectFast(CLin_Vector *Pq, CLin_Vector *q, unsigned
 		m_clsMulthier.SetInteractionLevel(AUTOREFINE_HIER_PRE_1_LEVEL);
 		// leave only the lower level precond (if any)
 		precondType &= ~(AUTOREFINE_PRECOND_HIER);
-		gmresPrecondSFastAllUpper(q, Pq, m_clsGlobalVars.m_dHierPreGmresTol, precondType);
+		// errors (user break, out of memory) are checked by the caller
+		m_iUpperGmresRet = gmresPrecondSFastAllUpper(q, Pq, m_clsGlobalVars.m_dHierPreGmresTol, precondType);
 		// reset lower level
 		m_clsMulthier.SetInteractionLevel(AUTOREFINE_HIER_PRE_0_LEVEL);
 	}
 }
 
+// Re-entrant version of ComputePrecondVectFast(), for the concurrent solves:
+// the super preconditioner uses the high level tree elements as scratch storage,
+// so its application is serialized, while the others only read shared data
+void CSolveCap::ComputePrecondVectConc(CLin_Vector *Pq, CLin_Vector *q, unsigned char precondType)
+{
+	if( (precondType & AUTOREFINE_PRECOND_SUPER) != 0) {
+		#pragma omp critical(superprecond)
+		{
+			ComputePrecondVectFast(Pq, q, precondType);
+		}
+	}
+	else {
+		ComputePrecondVectFast(Pq, q, precondType);
+	}
+}
+
 
 #ifdef DEBUG_DUMP_POT
 
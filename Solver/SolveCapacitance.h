@@ -36,20 +36,91 @@
 #include "LinAlgebra/Mtx.h"
 
 // block preconditioner
-// remark: SOLVE_MAX_BLOCK_PRECOND_NUM cannot be bigger than SOLVE_MAX_SUPER_PRECOND_NUM
-// ('m_pclsSupPotMtx' matrix is shared between super and block precond and defined of SOLVE_MAX_SUPER_PRECOND_NUM dimension)
-// and, due to 'unsigned char' limit of 'm_pucBlockPrecondDim' dimension, cannot exceed 255
+// remark: due to 'unsigned char' limit of 'm_pucBlockPrecondDim' dimension, SOLVE_MAX_BLOCK_PRECOND_NUM
+// cannot exceed 255
 #define SOLVE_MAX_BLOCK_PRECOND_NUM		128
 #define SOLVE_MIN_BLOCK_PRECOND_NUM		2
 
+// sparse approximate inverse preconditioner
+// remark: due to 'unsigned char' limit of 'm_pucSpaiDim' dimension, SOLVE_MAX_SPAI_NUM
+// cannot exceed 255
+#define SOLVE_MAX_SPAI_NUM				64
+#define SOLVE_MIN_SPAI_NUM				2
+// min number of elements for which the sparse approximate inverse preconditioner is applied in parallel
+#define SOLVE_SPAI_MIN_PARALLEL_SIZE	4096
+
+// multigrid preconditioner
+// max number of levels of the V-cycle, leaves and coarse level included
+#define SOLVE_MAX_MG_LEVELS				8
+#define SOLVE_MIN_MG_LEVELS				2
+// ratio between the max number of leaves of the aggregates of two consecutive intermediate levels
+#define SOLVE_MG_COARSENING				4
+// damping of the block smoother on the leaves, and of the Jacobi smoother on the intermediate levels
+// (the potential matrix is a first kind operator, so the undamped smoothers amplify the smooth errors)
+#define SOLVE_MG_BLOCK_DAMPING			0.6
+#define SOLVE_MG_JACOBI_DAMPING			0.5
+// min number of leaves for which the smoothing and the prolongation of the multigrid preconditioner run in parallel
+#define SOLVE_MG_MIN_PARALLEL_SIZE		4096
+// max number of aggregates of an intermediate level of the multigrid preconditioner, whose potential matrix is dense
+#define SOLVE_MG_MAX_LEVEL_DIM			4096
+// min number of aggregates for which the potential matrix of an intermediate level is multiplied in parallel
+#define SOLVE_MG_MIN_PARALLEL_DIM		256
+
 // max number of allowed GMRES iterations
 // (must be less than the max number fitting in an unsigned int)
 #define SOLVE_GMRES_ITER_MAX 1000
+// number of GMRES iterations whose Krylov vectors are accounted for
+// when planning the memory budget (see EstimateSolveMemory())
+#define SOLVE_GMRES_PLAN_ITER 64
+// max number of vectors recycled from one conductor solve to the next
+#define SOLVE_GMRES_RECYCLE_MAX 64
+// relative norm below which a new vector is considered already in the recycled space
+#define SOLVE_GMRES_RECYCLE_EPS 1E-10
+// min number of Krylov vectors with which GMRES restarts, instead of failing,
+// when there is no memory to grow the Krylov basis
+#define SOLVE_GMRES_MIN_RESTART 4
+// number of elements of the blocks in which the GMRES orthogonalization splits
+// the vectors (see CSolveCap::OrthogonalizeCGS2())
+#define SOLVE_ORTHO_BLOCK_SIZE 1024
+// min vector size for which the GMRES orthogonalization runs in parallel
+#define SOLVE_ORTHO_MIN_PARALLEL_SIZE 4096
+// max number of double precision refinement steps of the mixed precision solve
+#define SOLVE_MIXED_OUTER_MAX 10
+// min tolerance of the single precision corrections of the mixed precision solve
+#define SOLVE_MIXED_INNER_TOL 1E-4
+// max number of iterations of the inner (upper level) GMRES of the hierarchical preconditioner
+#define SOLVE_HIER_INNER_ITER_MAX 100
+// size of the square blocks in which the LU factorization of the two-levels
+// preconditioner splits the matrix (see CSolveCap::FactorMatrixLU())
+#define SOLVE_LU_BLOCK_SIZE 64
+// min matrix dimension for which the LU factorization and substitutions run in parallel
+#define SOLVE_LU_MIN_PARALLEL_SIZE 256
 
 // test
 #define SOLVE_TEST_ELEM_MAX 1216
 
 
+// GMRES vectors and hierarchical multiplication buffers of a single conductor solve,
+// so that more conductor excitations can be solved concurrently (see CSolveCap::SolveConcurrent())
+class CSolveWorkspace
+{
+public:
+	CSolveWorkspace();
+	~CSolveWorkspace();
+
+	// q and h matrices, g, v, w, z, y, c, s, r, Pq, x0 vectors (see CSolveCap::gmresPrecondSFastAll())
+	CLin_Vector *m_pclsQ, *m_pclsH;
+	CLin_Vector m_clsG, m_clsV, m_clsW, m_clsZ, m_clsY, m_clsC, m_clsS, m_clsR, m_clsPq, m_clsX0;
+	// excitation (potential) and solution (charge) of the current solve
+	CLin_Vector m_clsPotential, m_clsCharge;
+	// up to which iteration the arrays have been pre-allocated
+	unsigned int m_uiPrealloc;
+	// iterations and final relative residual norm of the last solve
+	long m_lIterations;
+	double m_dNormr;
+	CMultHierWorkspace m_clsMultWs;
+};
+
 class CSolveCap
 {
 
@@ -61,6 +132,11 @@ public:
 	void CopyCondNames(StlStringList &stringList);
 	void DeallocateMemory(int command, CAutoRefGlobalVars globalVars);
 	void DeallocatePrecond();
+	void DeallocateSuperPrecond();
+	void DeallocateBlockGmres();
+	void DeallocateSolveWorkspaces();
+	void DeallocateRecycledSpace();
+	void DeallocateWarmStart();
     void PrintRetError(int retErr);
 	    
 	CMultHier m_clsMulthier;
@@ -70,7 +146,7 @@ public:
 
 protected:
 	int InputFile(CAutoRefGlobalVars *globalVars);
-	void AutoSetPrecondType(unsigned long numOfLinks, long condNum, CAutoRefGlobalVars &globalVars);
+	void AutoSetPrecondType(unsigned long numOfLinks, long condNum, bool outOfCore, CAutoRefGlobalVars &globalVars);
 	void OutputSolveParams(CAutoRefGlobalVars globalVars);
 	void OutputMeshParams(CAutoRefGlobalVars globalVars);
 	void OutputSolvePrecondType(CAutoRefGlobalVars globalVars);
@@ -83,20 +159,63 @@ protected:
 	int SolveForCapacitance(CLin_Matrix *cRe, CLin_Matrix *cIm);
 	void MakePreconditioner();
 	int Solve(CLin_Matrix *cRe, CLin_Matrix *cIm);
+	int SolveCondBlock(unsigned int vecNum, unsigned long firstRow, CLin_Matrix *cRe, CLin_Matrix *cIm);
+	int SolveConcurrent(unsigned long excNum, unsigned long *excPotIndex, unsigned long *excPanelNum, CLin_Matrix *cRe, CLin_Matrix *cIm);
+	unsigned int GetConcurrentSolves();
+	unsigned int GetRecycleNum();
+	unsigned int GetGmresRestart();
+	bool UseFlexGmres();
+	bool UsePcg();
+	void StoreCondCharge(CLin_Vector *charge, unsigned long caprow, CLin_Matrix *cRe, CLin_Matrix *cIm);
+	unsigned int GetGmresBlockSize();
 	int AllocateMemory();
+	int AllocateBlockGmres(unsigned int vecNum, unsigned long numElems);
+	int AllocateSolveWorkspaces(unsigned int wsNum, unsigned long numElems);
+	int AllocateRecycledSpace(unsigned int vecNum, unsigned long numElems);
+	int UpdateRecycledSpace(CLin_Vector *x);
+	void ApplyRecycledCorrection(long iteration);
+	int SaveWarmStartTree();
+	void RecordWarmStartTree(CAutoElement *panel);
+	bool ProlongWarmCharge(unsigned long caprow, CLin_Vector *x0);
+	bool ProlongCharges(CAutoElement *panel, CLin_Vector *oldCharge, CLin_Vector *x0);
+	bool SumOldCharges(CLin_Vector *oldCharge, double *chargeRe, double *chargeIm);
+	void DistributeCharge(CAutoElement *panel, double densityRe, double densityIm, CLin_Vector *x0);
+	double EstimateSolveMemory();
 	void RecurseHierSuperPre(CAutoPanel* panel);
 	void IncrementSupPreNum();
 	void RecurseComputePrecond(CAutoElement* element);
 	void ComputePrecond(CAutoPanel* panel);
 	void ComputeSuperPrecond();
 	void ComputeBlockPrecond();
-	void InvertMatrix(double (*matrix)[SOLVE_MAX_SUPER_PRECOND_NUM], double (*invMatrix)[SOLVE_MAX_SUPER_PRECOND_NUM], unsigned long size);
+	void ComputeSpaiPrecond();
+	void ComputeMultigridPrecond();
+	int AllocateMultigridPrecond();
+	void DeallocateMultigridPrecond();
+	unsigned long CountMgAggregates(unsigned long maxLeaves);
+	unsigned long RecurseCountMgAggregates(CAutoElement *element, unsigned long maxLeaves);
+	void RecurseMgAggregates(CAutoElement *element, unsigned long parentLeaves, unsigned long *levelPos, unsigned long *currAgg);
+	void ComputeMultigridVect(CLin_Vector *Pq, CLin_Vector *q);
+	void MultigridCycle(unsigned int level);
+	bool ComputeMgLevelMatrix(unsigned int level, double *matrix);
+	void MgLevelResidual(unsigned int level, double *x, double *y, double *r);
+	void MgBlockSmooth(CLin_Vector *Pq, CLin_Vector *q);
+	void MgProlongToLeaves(unsigned int level, double *x, CLin_Vector *q);
+	void MgRestrictFromLeaves(unsigned int level, CLin_Vector *v, double *y, double factor);
+	bool FactorMatrixLU(double *matrix, long *pivot, long size);
+	void SolveMatrixLU(double *matrix, long *pivot, long size, double *b, bool parallel);
 	int gmresPrecondSFast_test(CLin_Vector *b, CLin_Vector *x, double gmresTol);
-	int gmresPrecondSFastAll(CLin_Vector *b, CLin_Vector *x, double gmresTol);
+	int gmresPrecondSFastAll(CLin_Vector *b, CLin_Vector *x, double gmresTol, CLin_Vector *x0 = NULL);
+	void ComputeGmresCorrection(long iteration);
+	double OrthogonalizeCGS2(CLin_Vector *v, CLin_Vector *q, long qNum, CLin_Vector *h, CLin_Vector *w, bool parallel);
+	int gmresPrecondSFastBlock(CLin_Vector *b, CLin_Vector *x, unsigned int vecNum, double gmresTol);
+	int gmresPrecondSFastAllWs(CLin_Vector *b, CLin_Vector *x, double gmresTol, CSolveWorkspace *ws);
 	int gmresPrecondSFastAllUpper(CLin_Vector *b, CLin_Vector *x, double gmresTol, unsigned char precondType);
 	int gmresFlexPrecondSFastAll(CLin_Vector *b, CLin_Vector *x, double gmresTol);
 	int gmresPrecondSFastAllX0(CLin_Vector *b, CLin_Vector *x, CLin_Vector *x0);
+	int pcgPrecondSFastAll(CLin_Vector *b, CLin_Vector *x, double tol, CLin_Vector *x0, bool *breakdown);
+	int SolveMixedPrecision(CLin_Vector *b, CLin_Vector *x, CLin_Vector *x0);
 	void ComputePrecondVectFast(CLin_Vector *Pq, CLin_Vector *q, unsigned char precondType);
+	void ComputePrecondVectConc(CLin_Vector *Pq, CLin_Vector *q, unsigned char precondType);
 
 #ifdef DEBUG_DUMP_POT
     void DebugDumpPotMtxAndIndex();
@@ -125,9 +244,27 @@ protected:
 	CAutoPanel **m_clsBlockPrecondElements;
 	double (*m_pdBlockPrecond)[SOLVE_MAX_BLOCK_PRECOND_NUM];
 	unsigned char *m_pucBlockPrecondDim;
-	double (*m_pclsTmpCapMtx)[SOLVE_MAX_SUPER_PRECOND_NUM];
-	double (*m_pclsSupPrecondMtx)[SOLVE_MAX_SUPER_PRECOND_NUM];
-	double (*m_pclsSupPotMtx)[SOLVE_MAX_SUPER_PRECOND_NUM];
+	// position of the first element of each block, and number of blocks
+	unsigned long *m_pulBlockPrecondBase;
+	unsigned long m_ulBlockPrecondNum;
+	// scratch block potential matrices and pivot vectors, one per thread (see ComputeBlockPrecond())
+	double *m_pdBlockPotMtx;
+	long *m_plBlockPotPivot;
+	// super potential matrix (row-major, 'm_ulSupPotMtxDim' x 'm_ulSupPotMtxDim' elements allocated),
+	// LU-factored in place, with its pivot vector; the diagonal of its inverse and a work vector
+	// (one per thread) are all what is needed, on top of the factors, to apply the super preconditioner
+	double *m_pdSupPotMtx;
+	long *m_plSupPotPivot;
+	unsigned long m_ulSupPotMtxDim;
+	double *m_pdSupPrecondDiag, *m_pdSupPrecondVect;
+	// sparse approximate inverse preconditioner: for each leaf, 'm_pucSpaiDim' coefficients
+	// and the leaf indexes of their columns, starting at 'leaf * m_clsGlobalVars.m_uiSpaiSize'
+	double *m_pdSpaiPrecond;
+	unsigned long *m_pulSpaiIndex;
+	unsigned char *m_pucSpaiDim;
+	// scratch local potential matrices and pivot vectors, one per thread (see ComputeSpaiPrecond())
+	double *m_pdSpaiPotMtx;
+	long *m_plSpaiPotPivot;
 	unsigned int m_uiBlockPreNum;
 	unsigned long m_ulBlockPreBaseNum;
 	bool m_bIsComputingBlock;
@@ -147,6 +284,31 @@ protected:
 		CAutoConductor *m_pCond;
 	};
 	CSuperPrecondElement *m_clsSupPrecondElements;
+	// multigrid preconditioner (see ComputeMultigridPrecond()): 'm_uiMgLevelsNum' levels, level 0
+	// being the leaves and the last one the coarse level. The elements of level 'l' are the aggregates
+	// (tree elements) with at most 'm_ulMgMaxLeaves[l]' leaves, from 'm_pulMgLevelStart[l]' to
+	// 'm_pulMgLevelStart[l+1]-1' in the arrays below
+	unsigned long m_pulMgLevelStart[SOLVE_MAX_MG_LEVELS+1];
+	unsigned long m_ulMgMaxLeaves[SOLVE_MAX_MG_LEVELS];
+	unsigned int m_uiMgLevelsNum;
+	// for each element but the coarse ones, the position in its level of the aggregate containing it
+	// in the next level, and the ratio between their dimensions (areae, or lengths in 2D)
+	unsigned long *m_pulMgParent;
+	double *m_pdMgWeight;
+	// from level 1 on: damped inverse of the self potentials of the aggregates (Jacobi smoother of
+	// the intermediate levels), and residuals, corrections and work vector of the V-cycle (twice
+	// as long if complex permittivity)
+	double *m_pdMgDiag, *m_pdMgRes, *m_pdMgCorr, *m_pdMgWork;
+	// potential matrices of the intermediate levels, the one of level 'l' starting at 'm_pulMgMtxBase[l]'
+	double *m_pdMgLevelMtx;
+	unsigned long m_pulMgMtxBase[SOLVE_MAX_MG_LEVELS];
+	// from level 1 on, only while forming the preconditioner: the aggregates
+	CSuperPrecondElement *m_clsMgElements;
+	// coarse potential matrix, LU-factored in place, with its pivot vector
+	double *m_pdMgCoarseMtx;
+	long *m_plMgCoarsePivot;
+	// leaf charges and potentials of the hierarchical multiplications of the V-cycle
+	CLin_Vector m_clsMg_t, m_clsMg_w;
 	unsigned int m_uiGmresPrealloc[AUTOPANEL_MAX_NUM_OF_HIERARCHIES];
 	unsigned char m_ucAlternatePrecond;
 	CLin_Vector *m_pCondCharges;
@@ -177,6 +339,65 @@ protected:
 	// x0 vector (initial solution vector): must declare as visible to whole function, even in case is not used
 	// (but does not allocate memory)
 	CLin_Vector m_clsGmres1_x0;
+	// iterations of the last upper level gmres, and its return code
+	// (the hierarchical preconditioner is applied by ComputePrecondVectFast(), which has no return value)
+	long m_lUpperIterations;
+	int m_iUpperGmresRet;
+
+	// block gmres vars (see gmresPrecondSFastBlock()); the Krylov vectors and the columns
+	// of the Hessemberg matrix of the 'k'-th right-hand side start at k*(SOLVE_GMRES_ITER_MAX+1)
+	// and at k*SOLVE_GMRES_ITER_MAX respectively
+	CLin_Vector *m_pclsBGmres_q, *m_pclsBGmres_h;
+	// g, c, s and x0 vectors, one for each right-hand side
+	CLin_Vector *m_pclsBGmres_g, *m_pclsBGmres_c, *m_pclsBGmres_s, *m_pclsBGmres_x0;
+	// block of right-hand sides (potentials) and of solutions (charges)
+	CLin_Vector *m_pclsBGmres_b, *m_pclsBGmres_x;
+	// input and output vectors of the multi-vector matrix - vector multiplication,
+	// packed for the right-hand sides not yet converged
+	CLin_Vector *m_pclsBGmres_Pq, *m_pclsBGmres_v;
+	// relative residual norms and norms of the right-hand sides
+	CLin_Vector m_clsBGmres_normr, m_clsBGmres_normb;
+	// last Arnoldi step of each right-hand side, and list of the right-hand sides not yet converged
+	long *m_plBGmresIter;
+	unsigned int *m_puiBGmresActive;
+	// up to which iteration the arrays have been pre-allocated, for each right-hand side
+	unsigned int *m_puiBGmresPrealloc;
+	unsigned int m_uiBGmresVecNum;
+
+	// workspaces of the concurrent solves, one for each worker thread
+	CSolveWorkspace *m_pclsSolveWs;
+	unsigned int m_uiSolveWsNum;
+
+	// recycled space (see UpdateRecycledSpace()): 'm_uiRecycleCur' vectors 'u' (in the
+	// preconditioned space) and 'c' = A*P*u, the 'c' vectors being orthonormal;
+	// the oldest vector is replaced when all the 'm_uiRecycleNum' slots are used
+	CLin_Vector *m_pclsRecycle_u, *m_pclsRecycle_c;
+	// projections on the 'c' vectors of the new vectors of each Arnoldi step
+	// (one vector of SOLVE_GMRES_ITER_MAX elements for each 'c' vector)
+	CLin_Vector *m_pclsRecycle_B;
+	// projections on the 'c' vectors of the initial residual
+	CLin_Vector m_clsRecycle_a;
+	unsigned int m_uiRecycleNum, m_uiRecycleCur, m_uiRecycleNext;
+
+	// set when the conjugate gradient finds the system not positive definite (see UsePcg())
+	bool m_bPcgBreakdown;
+
+	// double precision residual and single precision correction of the mixed precision solve
+	CLin_Vector m_clsMixed_r, m_clsMixed_d;
+
+	// warm start across the auto-refinement iterations (see ProlongWarmCharge()): charges of
+	// the previous iteration, one vector for each conductor excitation, and pre-order record of
+	// the previous panel trees (leaf flags, plus position in the charge vectors and dimension
+	// of each leaf)
+	CLin_Vector *m_pclsWarmCharges;
+	CLin_Vector m_clsWarmX0;
+	unsigned char *m_pucWarmIsLeaf;
+	unsigned long *m_pulWarmLeafIndex;
+	double *m_pdWarmLeafDim;
+	unsigned long m_ulWarmNodeNum, m_ulWarmLeafNum, m_ulWarmCondNum;
+	// read positions in the record, while walking the new panel trees
+	unsigned long m_ulWarmNodePos, m_ulWarmLeafPos;
+	bool m_bWarmStart, m_bWarmValid;
 
 #ifdef DEBUG_DUMP_UNCOMP_POT
 	// debug vars
@@ -56,12 +56,21 @@ void CAutoRefGlobalVars::Reset()
 	// if not specified, precond type is JACOBI
 	m_ucPrecondType = AUTOREFINE_PRECOND_JACOBI;
 	m_dMaxHierPreDiscSide = 128;
+	// zero means ten times the solution mutual potential epsilon (see CSolveCap::Run())
+	m_dHierPreEps = 0.0;
 	m_uiSuperPreDim = 128;
 	m_uiBlockPreSize = 32;
+	m_uiSpaiSize = 16;
+	m_uiMgLevels = 3;
 	m_bDumpResidual = false;
 	m_bDumpTimeMem = false;
 	m_bVerboseOutput = false;
 	m_dGmresTol = 0.01;
+	m_uiGmresBlockSize = 1;
+	m_uiConcurrentSolves = 1;
+	m_uiGmresRecycleNum = 0;
+	m_uiGmresRestart = 0;
+	m_bMixedPrecision = false;
 	m_dHierPreGmresTol = 0.5;
 	m_bOutputGeo = false;
 	m_bDumpInputGeo = false;
@@ -73,8 +82,16 @@ void CAutoRefGlobalVars::Reset()
 	m_dEpsRatio = 1.0;
 	m_dMeshCurvCoeff = 3.0;
 	m_dOutOfCoreRatio = 5.0;
+	m_dMemBudget = 0.0;
 	m_bOutputCharge = false;
 	m_bOutputCapMtx = false;
+	m_bFloatLinks = false;
+	m_bFarLinks = false;
+	m_bSymLinks = false;
+	m_bMmapLinks = false;
+	m_bCompressLinks = false;
+	m_bLinkCache = false;
+	m_sLinkCacheDir = "";
 	// not used any more in 'Run' dialog, but calculated offline and used globally
 	m_dMaxDiscSide = 0.1;
 	m_dEps = 0.3 * m_dMaxDiscSide;
@@ -91,6 +108,7 @@ void CAutoRefGlobalVars::Reset()
 	m_bWarnGivenSkew = false;
 	m_bWarnGivenSelfPot = false;
 	m_bWarnGivenNaN = false;
+	m_dSolveMemReserve = 0.0;
 }
 
 CMemoryUsage::CMemoryUsage()
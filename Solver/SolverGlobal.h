@@ -68,6 +68,10 @@
 #define AUTOREFINE_PRECOND_HIER				(unsigned char)8
 // value used in discretization pass for signaling to PotEstimateOpt() that should suppress the user warnings
 #define AUTOREFINE_DISCRETIZE				(unsigned char)16
+// sparse approximate inverse preconditioner, from the near-field links
+#define AUTOREFINE_PRECOND_SPAI				(unsigned char)32
+// multigrid V-cycle preconditioner, on the panel trees
+#define AUTOREFINE_PRECOND_MG				(unsigned char)64
 
 #define AUTOREFINE_COLLOCATION				1
 #define AUTOREFINE_GALERKIN					2
@@ -80,8 +84,10 @@
 //
 // super preconditioner
 // remark: SOLVE_MAX_SUPER_PRECOND_NUM due to 'unsigned int' limit
-// of 'm_puiSupPrecondIndex' dimension in SolveCapacitance.cpp, cannot exceed 65535
-#define SOLVE_MAX_SUPER_PRECOND_NUM		4096
+// of 'm_puiSupPrecondIndex' dimension in SolveCapacitance.cpp, cannot exceed 65535;
+// the preconditioner matrix is allocated on the actual dimension (-ps), so this
+// only bounds the memory used (dimension^2 doubles, i.e. 2GB at the maximum)
+#define SOLVE_MAX_SUPER_PRECOND_NUM		16384
 #define SOLVE_MIN_SUPER_PRECOND_NUM		16
 
 using namespace std;
@@ -169,17 +175,38 @@ public:
 	unsigned char m_ucHasCmplxPerm;
 	unsigned char m_ucPrecondType;
 	unsigned int m_uiSuperPreDim, m_uiBlockPreSize;
+	// max number of elements of each row of the sparse approximate inverse preconditioner (see CSolveCap::ComputeSpaiPrecond())
+	unsigned int m_uiSpaiSize;
+	// max number of levels of the multigrid preconditioner, leaves and coarse level included (see CSolveCap::ComputeMultigridPrecond())
+	unsigned int m_uiMgLevels;
+	// number of conductor excitations solved together by the block GMRES (see CSolveCap::gmresPrecondSFastBlock())
+	unsigned int m_uiGmresBlockSize;
+	// number of conductor excitations solved concurrently (see CSolveCap::SolveConcurrent())
+	unsigned int m_uiConcurrentSolves;
+	// max number of vectors recycled from one conductor solve to the next (see CSolveCap::UpdateRecycledSpace())
+	unsigned int m_uiGmresRecycleNum;
+	// number of GMRES iterations after which the Krylov basis is restarted, 0 if never (see CSolveCap::GetGmresRestart())
+	unsigned int m_uiGmresRestart;
+	// solver iterations on single precision coefficients, refined in double precision (see CSolveCap::SolveMixedPrecision())
+	bool m_bMixedPrecision;
 	std::string m_sFileIn;
+	// directory of the link cache, used across runs (see CAutoRefine::LoadLinkCache())
+	std::string m_sLinkCacheDir;
 	double m_dMaxDiscSide, m_dEps, m_dMeshEps, m_dEpsRatio, m_dMeshCurvCoeff, m_dGmresTol;
 	double m_dMaxHierPreDiscSide, m_dHierPreEps, m_dHierPreGmresTol;
 	double m_dAutoMaxErr, m_dOutOfCoreRatio;
+	// memory budget in Mbytes (0 = no budget, use the free memory), see CAutoRefine::AutoRefineLinks()
+	double m_dMemBudget;
 	bool m_bDumpResidual, m_bVerboseOutput, m_bOutputGeo, m_bDumpInputGeo, m_bAuto, m_bAutoPrecond, m_bDumpTimeMem;
 	bool m_bKeepCharge, m_bRefineCharge, m_bKeepMesh, m_bOutputCharge, m_bOutputCapMtx;
+	bool m_bFloatLinks, m_bFarLinks, m_bSymLinks, m_bMmapLinks, m_bCompressLinks, m_bLinkCache;
 	char m_cScheme;
 
 	// variables not linked to user options, but to global statuses
 	bool m_bWarnGivenPre, m_bWarnGivenThin, m_bWarnGivenSkew, m_bWarnGivenSelfPot;
 	bool m_bWarnGivenNaN;
+	// memory (in bytes) that the solver will need after the links (see CSolveCap::EstimateSolveMemory())
+	double m_dSolveMemReserve;
 };
 
 #endif //AFX_GLOBAL_H__E89AAF21_5486_11D5_9282_04F014C10000__INCLUDED_
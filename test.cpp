@@ -28,10 +28,12 @@
 #include "test.h"
 
 #include <math.h>
+#include <stdio.h>
 
 #include "FasterCapGlobal.h"
 
 #include "Solver/Potential.h"
+#include "Solver/SolveCapacitance.h"
 
 void test_pot2D()
 {
@@ -390,3 +392,83 @@ void test_pot2D()
     LogMsg("Result 5.3: %g, res[0]: %g, res[1]: %g\n", result, res[0], res[1]);
 
 }
+
+
+// Hierarchical preconditioner (-ph): two parallel plates are solved with the Jacobi preconditioner,
+// then with the hierarchical one, and finally with an inner GMRES tolerance that cannot be reached,
+// so that every inner solve stops at SOLVE_HIER_INNER_ITER_MAX iterations (the inner iterations are
+// logged in brackets after each outer one). The capacitances must match within the GMRES tolerance
+void test_hierPrecond()
+{
+	CSolveCap solveMain;
+	CAutoRefGlobalVars globalVars;
+	double capJacobi[2][2];
+	FILE *fout;
+	double maxDiff, diff;
+	long i, j;
+	int ret, run;
+
+	LogMsg("Hierarchical preconditioner\n");
+
+	fout = fopen("test_hierprecond.txt", "w");
+	if(fout == NULL) {
+		LogMsg("Cannot write the test input file\n");
+		return;
+	}
+	fprintf(fout, "0 two parallel plates\n");
+	fprintf(fout, "Q 1  0.0 0.0 0.0  1.0 0.0 0.0  1.0 1.0 0.0  0.0 1.0 0.0\n");
+	fprintf(fout, "Q 2  0.0 0.0 0.1  1.0 0.0 0.1  1.0 1.0 0.1  0.0 1.0 0.1\n");
+	fclose(fout);
+
+	globalVars.m_sFileIn = "test_hierprecond.txt";
+	globalVars.m_dMeshEps = 0.01;
+	globalVars.m_bVerboseOutput = true;
+	globalVars.m_ucPrecondType = AUTOREFINE_PRECOND_JACOBI;
+
+	ret = solveMain.Run(globalVars);
+	if(ret != FC_NORMAL_END) {
+		LogMsg("Jacobi preconditioner run failed, return code %d\n", ret);
+		return;
+	}
+	if(g_clsCapMatrixRe.num_rows() != 2 || g_clsCapMatrixRe.num_cols() != 2) {
+		LogMsg("Wrong capacitance matrix dimension\n");
+		return;
+	}
+	for(i=0; i<2; i++) {
+		for(j=0; j<2; j++) {
+			capJacobi[i][j] = g_clsCapMatrixRe[i][j];
+		}
+	}
+
+	for(run=0; run<2; run++) {
+		// same options as '-ph' (Jacobi is the default)
+		globalVars.m_ucPrecondType = AUTOREFINE_PRECOND_JACOBI | AUTOREFINE_PRECOND_HIER;
+		if(run == 0) {
+			globalVars.m_dHierPreGmresTol = 0.5;
+		}
+		else {
+			globalVars.m_dHierPreGmresTol = 1E-15;
+		}
+
+		ret = solveMain.Run(globalVars);
+		if(ret != FC_NORMAL_END) {
+			LogMsg("Hierarchical preconditioner run %d failed, return code %d\n", run+1, ret);
+			continue;
+		}
+
+		maxDiff = 0.0;
+		for(i=0; i<2; i++) {
+			for(j=0; j<2; j++) {
+				diff = fabs(g_clsCapMatrixRe[i][j] - capJacobi[i][j]) / fabs(capJacobi[i][i]);
+				if(diff > maxDiff) {
+					maxDiff = diff;
+				}
+			}
+		}
+
+		LogMsg("Hierarchical preconditioner run %d (-pht%g): max relative difference from Jacobi %g, %s\n", run+1,
+		       globalVars.m_dHierPreGmresTol, maxDiff, (maxDiff < 2.0 * globalVars.m_dGmresTol) ? "OK" : "FAILED");
+	}
+
+	remove("test_hierprecond.txt");
+}
@@ -26,5 +26,6 @@
 #define TEST_INCLUDED_H
 
 void test_pot2D();
+void test_hierPrecond();
 
 #endif //TEST_INCLUDED_H